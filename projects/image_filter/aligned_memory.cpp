@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef _WIN32
+#include <malloc.h>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#include "image_filter/aligned_memory.h"
+
+// Round size up to a multiple of align, align is a power of two.
+static size_t AlignUp(size_t size, size_t align) {
+  return (size + align - 1) & ~(align - 1);
+}
+
+#ifdef _WIN32
+// Map a block with large pages, needs SeLockMemoryPrivilege.
+static void* MapHugePage(size_t* size) {
+  size_t page_size = GetLargePageMinimum();
+  if (0 == page_size) {
+    return nullptr;
+  }
+  *size = AlignUp(*size, page_size);
+  return VirtualAlloc(nullptr, *size,
+    MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+}
+
+static void UnmapHugePage(void* data, size_t) {
+  VirtualFree(data, 0, MEM_RELEASE);
+}
+#else
+// Map a block on a huge page boundary and advise transparent huge pages.
+static void* MapHugePage(size_t* size) {
+  *size = AlignUp(*size, HUGE_PAGE_SIZE);
+  size_t map_size = *size + HUGE_PAGE_SIZE;
+  void* map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == map) {
+    return nullptr;
+  }
+  // Give back the unaligned head and the tail.
+  uintptr_t begin = reinterpret_cast<uintptr_t>(map);
+  uintptr_t aligned = AlignUp(begin, HUGE_PAGE_SIZE);
+  if (aligned > begin) {
+    munmap(map, aligned - begin);
+  }
+  size_t tail = begin + map_size - (aligned + *size);
+  if (tail > 0) {
+    munmap(reinterpret_cast<void*>(aligned + *size), tail);
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(reinterpret_cast<void*>(aligned), *size, MADV_HUGEPAGE);
+#endif
+  return reinterpret_cast<void*>(aligned);
+}
+
+static void UnmapHugePage(void* data, size_t size) {
+  munmap(data, size);
+}
+#endif
+
+bool AllocateAlignedBlock(size_t size, bool huge_page, AlignedBlock* block) {
+  block->data = nullptr;
+  block->size = AlignUp(size, CACHE_LINE_SIZE);
+  block->mapped = false;
+  if (huge_page && block->size >= HUGE_PAGE_SIZE) {
+    size_t map_size = block->size;
+    void* data = MapHugePage(&map_size);
+    if (nullptr != data) {
+      block->data = data;
+      block->size = map_size;
+      block->mapped = true;
+      return true;
+    }
+  }
+#ifdef _WIN32
+  block->data = _aligned_malloc(block->size, CACHE_LINE_SIZE);
+#else
+  if (0 != posix_memalign(&block->data, CACHE_LINE_SIZE, block->size)) {
+    block->data = nullptr;
+  }
+#endif
+  return nullptr != block->data;
+}
+
+void FreeAlignedBlock(AlignedBlock* block) {
+  if (nullptr != block->data) {
+    if (block->mapped) {
+      UnmapHugePage(block->data, block->size);
+    } else {
+#ifdef _WIN32
+      _aligned_free(block->data);
+#else
+      free(block->data);
+#endif
+    }
+  }
+  block->data = nullptr;
+  block->size = 0;
+  block->mapped = false;
+}
+
+void PrefaultMemory(void* data, size_t size) {
+  volatile char* bytes = static_cast<volatile char*>(data);
+  for (size_t i = 0; i < size; i += SMALL_PAGE_SIZE) {
+    bytes[i] = 0;
+  }
+  if (size > 0) {
+    bytes[size - 1] = 0;
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef IMAGE_IMAGE_FILTER_ALIGNED_MEMORY_H_
+#define IMAGE_IMAGE_FILTER_ALIGNED_MEMORY_H_
+#include <stddef.h>
+
+// Cache line size, every block and every workspace buffer starts on a line.
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// Transparent huge page size, only blocks of at least this size are mapped
+// with huge pages.
+#ifndef HUGE_PAGE_SIZE
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#endif
+
+// Small page size, the step used to pre-fault a block.
+#ifndef SMALL_PAGE_SIZE
+#define SMALL_PAGE_SIZE 4096
+#endif
+
+// A block of cache line aligned memory.
+struct AlignedBlock {
+  AlignedBlock() : data(nullptr), size(0), mapped(false) {}
+  void* data;
+  size_t size;
+  // True if the block is mapped from the system instead of the heap.
+  bool mapped;
+};
+
+/**
+* Allocate a cache line aligned block.
+* With huge_page set, a block of at least HUGE_PAGE_SIZE is mapped on a huge
+* page boundary and marked for transparent huge pages (madvise on Linux,
+* large pages on Windows when the privilege is held). Otherwise, or if the
+* mapping fails, the block comes from the aligned heap.
+* Return false if no memory can be allocated.
+*/
+bool AllocateAlignedBlock(size_t size, bool huge_page, AlignedBlock* block);
+
+// Free a block allocated by AllocateAlignedBlock, block is reset.
+void FreeAlignedBlock(AlignedBlock* block);
+
+// Touch every page of the memory, so no page fault is taken later.
+void PrefaultMemory(void* data, size_t size);
+#endif  // !IMAGE_IMAGE_FILTER_ALIGNED_MEMORY_H_
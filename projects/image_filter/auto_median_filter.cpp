@@ -0,0 +1,530 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <process.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "image_filter/auto_median_filter.h"
+#include "image_filter/cpu_dispatch.h"
+#include "image_filter/filter_graph.h"
+
+template class AutoMedianFilter<unsigned char>;
+template class AutoMedianFilter<float>;
+template class AutoMedianFilter<double>;
+
+// Side of the square image the methods are timed on.
+#ifndef AUTO_CALIBRATE_SIZE
+#define AUTO_CALIBRATE_SIZE 96
+#endif
+
+// Smallest tile side a plan tries, doubled up to the image size.
+#ifndef AUTO_TILE_MIN
+#define AUTO_TILE_MIN 64
+#endif
+
+// Seconds to start one more thread of a FilterGraph.
+#ifndef AUTO_THREAD_SECONDS
+#define AUTO_THREAD_SECONDS 2e-5
+#endif
+
+static const char* kDtypeNames[] = {"uchar", "float", "double"};
+static const char* kEngineNames[MEDIAN_ENGINE_NUM] = {
+  "uchar_histogram", "histogram", "local_sort"};
+static const int kCalibrateRadii[] = {1, 3, 6};
+
+static MedianAutoTuner auto_tuner;
+
+MedianAutoTuner* GetMedianAutoTuner() {
+  return &auto_tuner;
+}
+
+static int DtypeIndex(unsigned char) { return 0; }
+static int DtypeIndex(float) { return 1; }
+static int DtypeIndex(double) { return 2; }
+
+// The unsigned char histogram is only for unsigned char.
+static int GetFirstEngine(int dtype) {
+  return 0 == dtype ? MEDIAN_ENGINE_UCHAR_HISTOGRAM : MEDIAN_ENGINE_HISTOGRAM;
+}
+
+// Terms of the time per pixel of a method, see MedianAutoTuner.
+static void GetTerms(int engine, int radius, double unique, double* terms) {
+  double w = radius * 2 + 1;
+  terms[0] = 1;
+  switch (engine) {
+  case MEDIAN_ENGINE_UCHAR_HISTOGRAM:
+    terms[1] = radius;
+    terms[2] = 0;
+    break;
+  case MEDIAN_ENGINE_HISTOGRAM:
+    terms[1] = radius;
+    terms[2] = unique;
+    break;
+  default:
+    terms[1] = w * w;
+    terms[2] = w * w * w;
+    break;
+  }
+}
+
+// Least squares fit of y = sum c[k] * terms[k], with no c[k] below 0: a
+// term fitted negative is dropped and the others fitted again.
+static void FitTerms(const std::vector<double>& terms,
+  const std::vector<double>& y, int term_num, double* c) {
+  bool used[3] = {true, true, true};
+  for (int round = 0; round < term_num; round++) {
+    // Normal equations of the used terms, a column of zeros keeps an unused
+    // term at 0.
+    double a[3][4];
+    for (int i = 0; i < term_num; i++) {
+      for (int j = 0; j < term_num; j++) {
+        double sum = 0;
+        for (size_t s = 0; s < y.size(); s++) {
+          sum += terms[s * term_num + i] * terms[s * term_num + j];
+        }
+        a[i][j] = used[i] && used[j] ? sum : (i == j ? 1 : 0);
+      }
+      double sum = 0;
+      for (size_t s = 0; s < y.size(); s++) {
+        sum += terms[s * term_num + i] * y[s];
+      }
+      a[i][term_num] = used[i] ? sum : 0;
+    }
+    // Gaussian elimination with partial pivoting.
+    for (int k = 0; k < term_num; k++) {
+      int pivot = k;
+      for (int i = k + 1; i < term_num; i++) {
+        if (fabs(a[i][k]) > fabs(a[pivot][k])) {
+          pivot = i;
+        }
+      }
+      for (int j = 0; j <= term_num; j++) {
+        std::swap(a[k][j], a[pivot][j]);
+      }
+      if (0 == a[k][k]) {
+        continue;
+      }
+      for (int i = 0; i < term_num; i++) {
+        if (i != k) {
+          double f = a[i][k] / a[k][k];
+          for (int j = k; j <= term_num; j++) {
+            a[i][j] -= f * a[k][j];
+          }
+        }
+      }
+    }
+    int worst = -1;
+    for (int k = 0; k < term_num; k++) {
+      c[k] = 0 == a[k][k] ? 0 : a[k][term_num] / a[k][k];
+      if (c[k] < 0 && (worst < 0 || c[k] < c[worst])) {
+        worst = k;
+      }
+    }
+    if (worst < 0) {
+      return;
+    }
+    used[worst] = false;
+  }
+  for (int k = 0; k < term_num; k++) {
+    c[k] = c[k] > 0 ? c[k] : 0;
+  }
+}
+
+// Filter with a method, the unsigned char overload adds the unsigned char
+// histogram.
+template<typename Dtype>
+static bool RunEngine(MedianEngine engine, const MedianFilter<Dtype>& filter,
+  const UcharMedianFilter&, const Dtype* host_src, int src_pitch,
+  Dtype* host_dst, int dst_pitch, int width, int height) {
+  ImageRect roi(0, 0, width, height);
+  if (MEDIAN_ENGINE_LOCAL_SORT == engine) {
+    return filter.FilterByLocalSort(host_src, src_pitch, host_dst, dst_pitch,
+      width, height, roi);
+  }
+  return filter.FilterByHistogram(host_src, src_pitch, host_dst, dst_pitch,
+    width, height, roi);
+}
+
+static bool RunEngine(MedianEngine engine,
+  const MedianFilter<unsigned char>& filter,
+  const UcharMedianFilter& uchar_filter, const unsigned char* host_src,
+  int src_pitch, unsigned char* host_dst, int dst_pitch, int width,
+  int height) {
+  if (MEDIAN_ENGINE_UCHAR_HISTOGRAM == engine) {
+    return uchar_filter.FilterByHistogram(host_src, src_pitch, host_dst,
+      dst_pitch, width, height, ImageRect(0, 0, width, height));
+  }
+  return RunEngine<unsigned char>(engine, filter, uchar_filter, host_src,
+    src_pitch, host_dst, dst_pitch, width, height);
+}
+
+template<typename Dtype>
+static void AddEngine(FilterGraph<Dtype>* graph, MedianEngine engine,
+  const MedianFilter<Dtype>* filter, const UcharMedianFilter*) {
+  if (MEDIAN_ENGINE_LOCAL_SORT == engine) {
+    graph->AddMedianByLocalSort(filter);
+  } else {
+    graph->AddMedianByHistogram(filter);
+  }
+}
+
+static void AddEngine(FilterGraph<unsigned char>* graph, MedianEngine engine,
+  const MedianFilter<unsigned char>* filter,
+  const UcharMedianFilter* uchar_filter) {
+  if (MEDIAN_ENGINE_UCHAR_HISTOGRAM == engine) {
+    graph->AddMedianByHistogram(uchar_filter);
+  } else {
+    AddEngine<unsigned char>(graph, engine, filter, uchar_filter);
+  }
+}
+
+// Random image of levels values, 0 for values all different.
+static void GetCalibrateImage(int levels, unsigned char* image, int size) {
+  std::mt19937 random(size);
+  for (int k = 0; k < size; k++) {
+    image[k] = static_cast<unsigned char>(random() % (levels ? levels : 256));
+  }
+}
+
+template<typename Dtype>
+static void GetCalibrateImage(int levels, Dtype* image, int size) {
+  std::mt19937 random(size);
+  for (int k = 0; k < size; k++) {
+    image[k] = levels ? static_cast<Dtype>(random() % levels) :
+      static_cast<Dtype>(random()) / 65536;
+  }
+}
+
+MedianAutoTuner::MedianAutoTuner() : cache_loaded_(false), cpu_target_(-1) {
+  const char* path = getenv(TUNE_CACHE_ENV);
+  cache_path_ = nullptr != path ? path : "";
+  ResetCoefficients();
+}
+
+void MedianAutoTuner::set_cache_path(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cache_path_ = path;
+  cache_loaded_ = false;
+}
+
+void MedianAutoTuner::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ResetCoefficients();
+  cache_loaded_ = false;
+}
+
+void MedianAutoTuner::ResetCoefficients() {
+  for (int d = 0; d < DTYPE_NUM; d++) {
+    calibrated_[d] = false;
+    for (int e = 0; e < MEDIAN_ENGINE_NUM; e++) {
+      for (int k = 0; k < TERM_NUM; k++) {
+        coefficients_[d][e][k] = 0;
+      }
+    }
+  }
+}
+
+double MedianAutoTuner::GetCost(int dtype, int engine, double pixels,
+  int radius, double unique) const {
+  double terms[TERM_NUM];
+  GetTerms(engine, radius, unique, terms);
+  double ns = 0;
+  for (int k = 0; k < TERM_NUM; k++) {
+    ns += coefficients_[dtype][engine][k] * terms[k];
+  }
+  return pixels * ns * 1e-9;
+}
+
+/**
+* Plan filtering an image. The whole image on the calling thread is tried
+* against square tiles of AUTO_TILE_MIN pixels and more, for every method.
+* The cost of a tile is the one of its context, the tile and the halo it
+* reads, the tiles are done in rounds of one per thread.
+* The distinct values of float and double images are taken as all the
+* pixels of the context, as for a camera image.
+*
+* \param width     Image width, in pixels.
+* \param height    Image height, in pixels.
+* \param channels  Interleaved values per pixel.
+* \param radius    Median filter radius.
+*/
+template<typename Dtype>
+MedianPlan MedianAutoTuner::Plan(int width, int height, int channels,
+  int radius) {
+  assert(0 < width);
+  assert(0 < height);
+  std::lock_guard<std::mutex> lock(mutex_);
+  int dtype = DtypeIndex(Dtype());
+  int target = GetCpuTarget();
+  if (target != cpu_target_) {
+    ResetCoefficients();
+    cpu_target_ = target;
+    cache_loaded_ = false;
+  }
+  if (!calibrated_[dtype] && !cache_loaded_) {
+    LoadCache();
+    cache_loaded_ = true;
+  }
+  if (!calibrated_[dtype]) {
+    CalibrateLocked<Dtype>();
+    SaveCache();
+  }
+  int cores = static_cast<int>(std::thread::hardware_concurrency());
+  cores = cores > 0 ? cores : 1;
+  MedianPlan best;
+  best.seconds = -1;
+  int side = width > height ? width : height;
+  for (int e = GetFirstEngine(dtype); e < MEDIAN_ENGINE_NUM; e++) {
+    for (int tile = 0; tile < side;
+      tile = 0 == tile ? AUTO_TILE_MIN : tile * 2) {
+      int context_width = width;
+      int context_height = height;
+      int tile_num = 1;
+      int thread_num = 1;
+      if (0 != tile) {
+        context_width = MIN(tile + 2 * radius, width);
+        context_height = MIN(tile + 2 * radius, height);
+        tile_num = ((width + tile - 1) / tile) * ((height + tile - 1) / tile);
+        thread_num = MIN(cores, tile_num);
+      }
+      double pixels = static_cast<double>(context_width) * context_height;
+      double unique = 0 == dtype ? MIN(pixels, GRAY_LEVEL_MAX) : pixels;
+      int rounds = (tile_num + thread_num - 1) / thread_num;
+      double seconds = rounds *
+        GetCost(dtype, e, pixels * channels, radius, unique) +
+        (thread_num - 1) * AUTO_THREAD_SECONDS;
+      if (best.seconds < 0 || seconds < best.seconds) {
+        best.engine = static_cast<MedianEngine>(e);
+        best.tile_size = tile;
+        best.thread_num = thread_num;
+        best.seconds = seconds;
+      }
+    }
+  }
+  return best;
+}
+
+template<typename Dtype>
+void MedianAutoTuner::Calibrate() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cpu_target_ = GetCpuTarget();
+  CalibrateLocked<Dtype>();
+  SaveCache();
+}
+
+// Time every method at the radii of kCalibrateRadii, the histogram of any
+// type also on an image of few levels to tell its terms apart. The best of
+// two runs is kept.
+template<typename Dtype>
+void MedianAutoTuner::CalibrateLocked() {
+  typedef std::chrono::high_resolution_clock Clock;
+  int dtype = DtypeIndex(Dtype());
+  int size = AUTO_CALIBRATE_SIZE;
+  std::vector<Dtype> src(size * size);
+  std::vector<Dtype> dst(size * size);
+  std::vector<Dtype> sorted(size * size);
+  for (int e = GetFirstEngine(dtype); e < MEDIAN_ENGINE_NUM; e++) {
+    std::vector<double> terms;
+    std::vector<double> ns;
+    for (int l = 0; l < (MEDIAN_ENGINE_HISTOGRAM == e ? 2 : 1); l++) {
+      GetCalibrateImage(0 == l ? 0 : 16, src.data(), size * size);
+      sorted = src;
+      std::sort(sorted.begin(), sorted.end());
+      double unique = static_cast<double>(
+        std::unique(sorted.begin(), sorted.end()) - sorted.begin());
+      for (size_t r = 0; r < sizeof(kCalibrateRadii) / sizeof(int); r++) {
+        int radius = kCalibrateRadii[r];
+        MedianFilter<Dtype> filter(radius);
+        UcharMedianFilter uchar_filter(radius);
+        double seconds = -1;
+        for (int run = 0; run < 2; run++) {
+          Clock::time_point start = Clock::now();
+          RunEngine(static_cast<MedianEngine>(e), filter, uchar_filter,
+            src.data(), size, dst.data(), size, size, size);
+          double time =
+            std::chrono::duration<double>(Clock::now() - start).count();
+          seconds = seconds < 0 || time < seconds ? time : seconds;
+        }
+        double term[TERM_NUM];
+        GetTerms(e, radius, unique, term);
+        terms.insert(terms.end(), term, term + TERM_NUM);
+        ns.push_back(seconds * 1e9 / (size * size));
+      }
+    }
+    FitTerms(terms, ns, TERM_NUM, coefficients_[dtype][e]);
+  }
+  calibrated_[dtype] = true;
+}
+
+// One line per type and method: cpu target, type, method and coefficients.
+bool MedianAutoTuner::LoadCache() {
+  if (cache_path_.empty()) {
+    return false;
+  }
+  std::ifstream file(cache_path_.c_str());
+  if (!file) {
+    return false;
+  }
+  std::string target = GetCpuTargetName(static_cast<CpuTarget>(cpu_target_));
+  int found[DTYPE_NUM] = {0, 0, 0};
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    std::string line_target, dtype_name, engine_name;
+    double c[TERM_NUM];
+    if (!(fields >> line_target >> dtype_name >> engine_name >> c[0] >>
+      c[1] >> c[2]) || line_target != target) {
+      continue;
+    }
+    for (int d = 0; d < DTYPE_NUM; d++) {
+      for (int e = GetFirstEngine(d); e < MEDIAN_ENGINE_NUM; e++) {
+        if (dtype_name == kDtypeNames[d] && engine_name == kEngineNames[e]) {
+          for (int k = 0; k < TERM_NUM; k++) {
+            coefficients_[d][e][k] = c[k];
+          }
+          found[d] |= 1 << e;
+        }
+      }
+    }
+  }
+  for (int d = 0; d < DTYPE_NUM; d++) {
+    int all = ((1 << MEDIAN_ENGINE_NUM) - 1) & ~((1 << GetFirstEngine(d)) - 1);
+    calibrated_[d] = calibrated_[d] || all == found[d];
+  }
+  return true;
+}
+
+// Number of the next temporary cache file of the process.
+static std::atomic<int> temp_cache_count(0);
+
+// Replace path by temp_path in one step, a reader sees the old file or the
+// new one, never none.
+static bool ReplaceCacheFile(const std::string& temp_path,
+  const std::string& path) {
+#ifdef _WIN32
+  return 0 != MoveFileExA(temp_path.c_str(), path.c_str(),
+    MOVEFILE_REPLACE_EXISTING);
+#else
+  return 0 == rename(temp_path.c_str(), path.c_str());
+#endif
+}
+
+// Keep the lines of the other cpu targets and of the types not calibrated,
+// write through a temporary file of the process so a reader never sees half
+// of it and two processes saving at once do not write the same file.
+bool MedianAutoTuner::SaveCache() const {
+  if (cache_path_.empty()) {
+    return false;
+  }
+  std::string target = GetCpuTargetName(static_cast<CpuTarget>(cpu_target_));
+  std::vector<std::string> lines;
+  std::ifstream old_file(cache_path_.c_str());
+  std::string line;
+  while (std::getline(old_file, line)) {
+    std::istringstream fields(line);
+    std::string line_target, dtype_name;
+    if (!(fields >> line_target >> dtype_name)) {
+      continue;
+    }
+    bool replaced = false;
+    for (int d = 0; d < DTYPE_NUM; d++) {
+      replaced = replaced || (line_target == target &&
+        dtype_name == kDtypeNames[d] && calibrated_[d]);
+    }
+    if (!replaced) {
+      lines.push_back(line);
+    }
+  }
+  old_file.close();
+#ifdef _WIN32
+  int pid = _getpid();
+#else
+  int pid = static_cast<int>(getpid());
+#endif
+  std::string temp_path = cache_path_ + ".tmp." + std::to_string(pid) +
+    "." + std::to_string(temp_cache_count++);
+  std::ofstream file(temp_path.c_str());
+  if (!file) {
+    return false;
+  }
+  for (size_t k = 0; k < lines.size(); k++) {
+    file << lines[k] << "\n";
+  }
+  file.precision(9);
+  for (int d = 0; d < DTYPE_NUM; d++) {
+    for (int e = GetFirstEngine(d); e < MEDIAN_ENGINE_NUM && calibrated_[d];
+      e++) {
+      file << target << " " << kDtypeNames[d] << " " << kEngineNames[e];
+      for (int k = 0; k < TERM_NUM; k++) {
+        file << " " << coefficients_[d][e][k];
+      }
+      file << "\n";
+    }
+  }
+  file.close();
+  if (!file || !ReplaceCacheFile(temp_path, cache_path_)) {
+    remove(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+template<typename Dtype>
+AutoMedianFilter<Dtype>::AutoMedianFilter(int radius)
+  : filter_(radius), uchar_filter_(radius), tuner_(GetMedianAutoTuner()) {
+}
+
+template<typename Dtype>
+MedianPlan AutoMedianFilter<Dtype>::GetPlan(int width, int height) const {
+  return tuner_->Plan<Dtype>(width, height, filter_.channel_num(),
+    filter_.radius());
+}
+
+template<typename Dtype>
+bool AutoMedianFilter<Dtype>::Filter(const Dtype* host_src, Dtype* host_dst,
+  int width, int height) const {
+  int pitch = width * filter_.channel_num();
+  return Filter(host_src, pitch, host_dst, pitch, width, height);
+}
+
+// A plan of tiles runs the method as the only stage of a FilterGraph.
+template<typename Dtype>
+bool AutoMedianFilter<Dtype>::Filter(const Dtype* host_src, int src_pitch,
+  Dtype* host_dst, int dst_pitch, int width, int height) const {
+  MedianPlan plan = GetPlan(width, height);
+  if (0 == plan.tile_size) {
+    return RunEngine(plan.engine, filter_, uchar_filter_, host_src,
+      src_pitch, host_dst, dst_pitch, width, height);
+  }
+  FilterGraph<Dtype> graph;
+  graph.set_tile_size(plan.tile_size, plan.tile_size);
+  graph.set_thread_num(plan.thread_num);
+  graph.set_channel_num(filter_.channel_num());
+  AddEngine(&graph, plan.engine, &filter_, &uchar_filter_);
+  return graph.Filter(host_src, src_pitch, host_dst, dst_pitch, width,
+    height);
+}
+
+template MedianPlan MedianAutoTuner::Plan<unsigned char>(int width,
+  int height, int channels, int radius);
+template MedianPlan MedianAutoTuner::Plan<float>(int width, int height,
+  int channels, int radius);
+template MedianPlan MedianAutoTuner::Plan<double>(int width, int height,
+  int channels, int radius);
+template void MedianAutoTuner::Calibrate<unsigned char>();
+template void MedianAutoTuner::Calibrate<float>();
+template void MedianAutoTuner::Calibrate<double>();
@@ -0,0 +1,130 @@
+#ifndef IMAGE_IMAGE_FILTER_AUTO_MEDIAN_FILTER_H_
+#define IMAGE_IMAGE_FILTER_AUTO_MEDIAN_FILTER_H_
+#include <assert.h>
+#include <mutex>
+#include <string>
+#include "image_filter/median_filter.h"
+
+// Environment variable naming the autotuning cache file, overridden by
+// MedianAutoTuner::set_cache_path. When it is not set the coefficients are
+// kept in memory only, no file is written.
+#define TUNE_CACHE_ENV "IMAGE_FILTER_TUNE_CACHE"
+
+// Median filter methods an AutoMedianFilter picks from.
+enum MedianEngine {
+  // UcharMedianFilter::FilterByHistogram, only for unsigned char.
+  MEDIAN_ENGINE_UCHAR_HISTOGRAM = 0,
+  // MedianFilter::FilterByHistogram.
+  MEDIAN_ENGINE_HISTOGRAM = 1,
+  // MedianFilter::FilterByLocalSort.
+  MEDIAN_ENGINE_LOCAL_SORT = 2,
+  MEDIAN_ENGINE_NUM = 3
+};
+
+// How an image is filtered, tile_size 0 for the whole image at once.
+struct MedianPlan {
+  MedianEngine engine;
+  int tile_size;
+  int thread_num;
+  // Time predicted by the cost model, in seconds.
+  double seconds;
+};
+
+/**
+* Cost model of the median filter methods.
+* The time per pixel of each method is a sum of terms following its loops:
+* c0 + c1*r for the unsigned char histogram, c0 + c1*r + c2*u for the
+* histogram of any type, whose rank search walks the u distinct values of
+* the image, and c0 + c1*w^2 + c2*w^3 for the local sort, which shifts up to
+* w^2 values for each of the w = 2*r+1 values entering the window.
+* The coefficients of a type are fitted, none negative, to the times of a
+* small image filtered at a few radii the first time a plan is needed,
+* then saved to the cache file if one is set, so the next processes start
+* tuned. They are kept per cpu target of cpu_dispatch.h, a new target
+* calibrates again.
+* A plan weighs each method on the tiles of a FilterGraph, whose halos cost
+* more as the tiles shrink, against the threads the tiles keep busy.
+*/
+class MedianAutoTuner
+{
+public:
+  MedianAutoTuner();
+  // An empty path keeps the coefficients in memory only.
+  void set_cache_path(const std::string& path);
+  // Best plan for an image, calibrating the type first if needed.
+  template<typename Dtype>
+  MedianPlan Plan(int width, int height, int channels, int radius);
+  // Measure the methods of the type now, then save the cache.
+  template<typename Dtype>
+  void Calibrate();
+  // Forget the coefficients, the next plan loads the cache file again.
+  void Clear();
+private:
+  enum { DTYPE_NUM = 3, TERM_NUM = 3 };
+  // Predicted seconds of a method on pixels values of u distinct ones.
+  double GetCost(int dtype, int engine, double pixels, int radius,
+    double unique) const;
+  void ResetCoefficients();
+  // Calibrate with mutex_ held.
+  template<typename Dtype>
+  void CalibrateLocked();
+  bool LoadCache();
+  bool SaveCache() const;
+  std::mutex mutex_;
+  std::string cache_path_;
+  bool cache_loaded_;
+  // Cpu target the coefficients were measured with.
+  int cpu_target_;
+  bool calibrated_[DTYPE_NUM];
+  double coefficients_[DTYPE_NUM][MEDIAN_ENGINE_NUM][TERM_NUM];
+  DISABLE_COPY_AND_ASSIGN(MedianAutoTuner);
+};
+
+// Tuner of the process, its cache path comes from TUNE_CACHE_ENV.
+MedianAutoTuner* GetMedianAutoTuner();
+
+/**
+* Median filter picking its method, tile size and thread count from the
+* cost model of a MedianAutoTuner for every image size. The output is the
+* same as the one of the method picked run on the whole image.
+*/
+template<typename Dtype>
+class AutoMedianFilter
+{
+public:
+  explicit AutoMedianFilter(int radius);
+  void set_gate(float gate) {
+    filter_.set_gate(gate);
+    uchar_filter_.set_gate(gate);
+  }
+  // Number of interleaved values per pixel, default 1.
+  void set_channel_num(int channel_num) {
+    filter_.set_channel_num(channel_num);
+    uchar_filter_.set_channel_num(channel_num);
+  }
+  // How the pixels outside the image are taken, default BORDER_REFLECT_101.
+  void set_border(BorderType border, Dtype border_value = Dtype()) {
+    filter_.set_border(border, border_value);
+    // Only used when Dtype is unsigned char.
+    uchar_filter_.set_border(border,
+      static_cast<unsigned char>(border_value));
+  }
+  // Default GetMedianAutoTuner().
+  void set_tuner(MedianAutoTuner* tuner) {
+    assert(nullptr != tuner);
+    tuner_ = tuner;
+  }
+  MedianPlan GetPlan(int width, int height) const;
+  // Return false if the memory can not be allocated.
+  bool Filter(const Dtype* host_src, Dtype* host_dst, int width,
+    int height) const;
+  // Pitches in elements, see MedianFilter::FilterByHistogram.
+  bool Filter(const Dtype* host_src, int src_pitch, Dtype* host_dst,
+    int dst_pitch, int width, int height) const;
+private:
+  MedianFilter<Dtype> filter_;
+  UcharMedianFilter uchar_filter_;
+  MedianAutoTuner* tuner_;
+  DISABLE_COPY_AND_ASSIGN(AutoMedianFilter);
+};
+#endif  // !IMAGE_IMAGE_FILTER_AUTO_MEDIAN_FILTER_H_
@@ -0,0 +1,65 @@
+#ifndef IMAGE_IMAGE_FILTER_BORDER_H_
+#define IMAGE_IMAGE_FILTER_BORDER_H_
+#include <stddef.h>
+
+// How the pixels outside the image are taken when the filter window crosses
+// the image edge.
+enum BorderType {
+  // Mirror without repeating the edge pixel, gfedcb|abcdefgh|gfedcba
+  BORDER_REFLECT_101 = 0,
+  // Repeat the edge pixel, aaaaaa|abcdefgh|hhhhhhh
+  BORDER_REPLICATE = 1,
+  // A constant value, iiiiii|abcdefgh|iiiiiii
+  BORDER_CONSTANT = 2
+};
+
+/**
+* Map a coordinate into [0, len).
+* Return p itself if it is inside, -1 if the pixel is a BORDER_CONSTANT one.
+*/
+inline int BorderInterpolate(int p, int len, BorderType border) {
+  if (0 <= p && p < len) {
+    return p;
+  }
+  if (BORDER_REPLICATE == border) {
+    return p < 0 ? 0 : len - 1;
+  }
+  if (BORDER_REFLECT_101 == border) {
+    if (1 == len) {
+      return 0;
+    }
+    do {
+      p = p < 0 ? -p : 2 * (len - 1) - p;
+    } while (p < 0 || p >= len);
+    return p;
+  }
+  return -1;
+}
+
+/**
+* Get the source row y, y may be outside [0, height). pitch is the distance
+* between two rows, in pixels.
+* Return const_row, a row filled with the border value, for BORDER_CONSTANT.
+*/
+template<typename Dtype>
+inline const Dtype* BorderRow(const Dtype* host_src, int pitch, int height,
+  int y, BorderType border, const Dtype* const_row) {
+  int k = BorderInterpolate(y, height, border);
+  return k < 0 ? const_row : host_src + static_cast<ptrdiff_t>(k) * pitch;
+}
+
+/**
+* Get the pixel x of a source row, x may be outside [0, width).
+* The row holds channels interleaved values per pixel, pass row + c to get
+* channel c.
+*/
+template<typename Dtype>
+inline Dtype BorderPixel(const Dtype* row, int x, int width, int channels,
+  BorderType border, Dtype border_value) {
+  if (0 <= x && x < width) {
+    return row[x * channels];
+  }
+  int k = BorderInterpolate(x, width, border);
+  return k < 0 ? border_value : row[k * channels];
+}
+#endif  // !IMAGE_IMAGE_FILTER_BORDER_H_
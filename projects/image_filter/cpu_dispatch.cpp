@@ -0,0 +1,159 @@
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+#include "image_filter/cpu_dispatch.h"
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define CPU_DISPATCH_X86
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define CPU_DISPATCH_X86
+#endif
+
+static const char* kCpuTargetNames[CPU_TARGET_NUM] = {
+  "baseline", "sse41", "avx2", "avx512"};
+
+// -1 until found, the detection may run twice in a race with the same
+// result.
+static std::atomic<int> supported_target(-1);
+static std::atomic<int> current_target(-1);
+
+static const FilterKernels* GetKernelTable(CpuTarget target) {
+  switch (target) {
+  case CPU_TARGET_SSE41:
+    return GetSse41Kernels();
+  case CPU_TARGET_AVX2:
+    return GetAvx2Kernels();
+  case CPU_TARGET_AVX512:
+    return GetAvx512Kernels();
+  default:
+    return GetBaselineKernels();
+  }
+}
+
+#ifdef CPU_DISPATCH_X86
+// regs is eax, ebx, ecx, edx.
+static void Cpuid(int leaf, int sub_leaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+  int values[4];
+  __cpuidex(values, leaf, sub_leaf);
+  for (int k = 0; k < 4; k++) {
+    regs[k] = static_cast<unsigned int>(values[k]);
+  }
+#else
+  __cpuid_count(leaf, sub_leaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register states the OS saves, XCR0.
+static unsigned long long GetEnabledStates() {
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  unsigned int eax = 0;
+  unsigned int edx = 0;
+  __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+}
+
+static CpuTarget DetectCpuTarget() {
+  unsigned int regs[4];
+  Cpuid(0, 0, regs);
+  unsigned int max_leaf = regs[0];
+  Cpuid(1, 0, regs);
+  bool sse41 = 0 != (regs[2] & (1u << 19));
+  bool os_avx = false;
+  // OSXSAVE and AVX, then the xmm and ymm states enabled.
+  if ((regs[2] & (1u << 27)) && (regs[2] & (1u << 28))) {
+    os_avx = 0x6 == (GetEnabledStates() & 0x6);
+  }
+  bool avx2 = false;
+  bool avx512 = false;
+  if (max_leaf >= 7 && os_avx) {
+    Cpuid(7, 0, regs);
+    avx2 = 0 != (regs[1] & (1u << 5));
+    // AVX-512 F, then the opmask and zmm states enabled.
+    avx512 = 0 != (regs[1] & (1u << 16)) &&
+      0xe6 == (GetEnabledStates() & 0xe6);
+  }
+  if (!sse41) {
+    return CPU_TARGET_BASELINE;
+  }
+  if (!avx2) {
+    return CPU_TARGET_SSE41;
+  }
+  return avx512 ? CPU_TARGET_AVX512 : CPU_TARGET_AVX2;
+}
+#else
+static CpuTarget DetectCpuTarget() {
+  return CPU_TARGET_BASELINE;
+}
+#endif
+
+CpuTarget GetSupportedCpuTarget() {
+  int target = supported_target.load();
+  if (target < 0) {
+    // Drop the targets this build has no kernels for.
+    target = DetectCpuTarget();
+    while (target > CPU_TARGET_BASELINE &&
+      nullptr == GetKernelTable(static_cast<CpuTarget>(target))) {
+      target--;
+    }
+    supported_target.store(target);
+  }
+  return static_cast<CpuTarget>(target);
+}
+
+bool IsCpuTargetSupported(CpuTarget target) {
+  return CPU_TARGET_BASELINE <= target && target <= GetSupportedCpuTarget() &&
+    nullptr != GetKernelTable(target);
+}
+
+CpuTarget GetCpuTarget() {
+  int target = current_target.load(std::memory_order_relaxed);
+  if (target < 0) {
+    CpuTarget supported = GetSupportedCpuTarget();
+    CpuTarget wanted = supported;
+    const char* name = getenv(CPU_TARGET_ENV);
+    if (nullptr != name && ParseCpuTarget(name, &wanted)) {
+      while (!IsCpuTargetSupported(wanted)) {
+        wanted = static_cast<CpuTarget>(wanted - 1);
+      }
+    }
+    // Keep a target set by SetCpuTarget meanwhile.
+    int unset = -1;
+    current_target.compare_exchange_strong(unset, wanted);
+    target = current_target.load();
+  }
+  return static_cast<CpuTarget>(target);
+}
+
+bool SetCpuTarget(CpuTarget target) {
+  if (!IsCpuTargetSupported(target)) {
+    return false;
+  }
+  current_target.store(target);
+  return true;
+}
+
+const char* GetCpuTargetName(CpuTarget target) {
+  if (target < CPU_TARGET_BASELINE || target >= CPU_TARGET_NUM) {
+    return "unknown";
+  }
+  return kCpuTargetNames[target];
+}
+
+bool ParseCpuTarget(const char* name, CpuTarget* target) {
+  for (int k = 0; k < CPU_TARGET_NUM; k++) {
+    if (0 == strcmp(name, kCpuTargetNames[k])) {
+      *target = static_cast<CpuTarget>(k);
+      return true;
+    }
+  }
+  return false;
+}
+
+const FilterKernels& GetFilterKernels() {
+  return *GetKernelTable(GetCpuTarget());
+}
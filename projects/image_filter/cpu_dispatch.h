@@ -0,0 +1,56 @@
+#ifndef IMAGE_IMAGE_FILTER_CPU_DISPATCH_H_
+#define IMAGE_IMAGE_FILTER_CPU_DISPATCH_H_
+#include "image_filter/filter_kernels.h"
+
+// Environment variable overriding the target picked at startup, one of
+// "baseline", "sse41", "avx2" and "avx512". A target the cpu lacks falls
+// back to the best one below it.
+#define CPU_TARGET_ENV "IMAGE_FILTER_CPU_TARGET"
+
+// Instruction sets the hot loops are built for, each one includes the ones
+// before it.
+enum CpuTarget {
+  CPU_TARGET_BASELINE = 0,
+  CPU_TARGET_SSE41 = 1,
+  CPU_TARGET_AVX2 = 2,
+  CPU_TARGET_AVX512 = 3,
+  CPU_TARGET_NUM = 4
+};
+
+// Whether the cpu and the OS support target and the build has its kernels.
+bool IsCpuTargetSupported(CpuTarget target);
+// Best target supported, found from CPUID once.
+CpuTarget GetSupportedCpuTarget();
+// Target the filters run with, the best supported one unless overridden by
+// CPU_TARGET_ENV or SetCpuTarget.
+CpuTarget GetCpuTarget();
+// Run the filters with target from now on, for benchmarking. Return false
+// and keep the current target if it is not supported. Filters running in
+// other threads may still use the previous target for a few rows.
+bool SetCpuTarget(CpuTarget target);
+// Name of target, as in CPU_TARGET_ENV.
+const char* GetCpuTargetName(CpuTarget target);
+// Return false if name is not a target name.
+bool ParseCpuTarget(const char* name, CpuTarget* target);
+// Kernel table of the current target.
+const FilterKernels& GetFilterKernels();
+
+/**
+* Update sum when filter core move towards down, with the kernel of the
+* current cpu target.
+*/
+inline void UpdateSum(const unsigned char *row_sub,
+  const unsigned char *row_add, double* sum_cols, int width) {
+  GetFilterKernels().update_sum_uchar(row_sub, row_add, sum_cols, width);
+}
+
+inline void UpdateSum(const float *row_sub, const float *row_add,
+  double* sum_cols, int width) {
+  GetFilterKernels().update_sum_float(row_sub, row_add, sum_cols, width);
+}
+
+inline void UpdateSum(const double *row_sub, const double *row_add,
+  double* sum_cols, int width) {
+  GetFilterKernels().update_sum_double(row_sub, row_add, sum_cols, width);
+}
+#endif  // !IMAGE_IMAGE_FILTER_CPU_DISPATCH_H_
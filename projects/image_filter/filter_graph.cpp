@@ -0,0 +1,236 @@
+#include <thread>
+#include "image_filter/filter_graph.h"
+#include "image_filter/trace_recorder.h"
+
+// Declared before the instantiations, the other types leave it undefined.
+template<>
+void FilterGraph<unsigned char>::AddMedianByHistogram(
+  const UcharMedianFilter* filter) {
+  assert(nullptr != filter);
+  assert(filter->channel_num() == channel_num_);
+  AddStage(filter->radius(),
+    [filter](const unsigned char* src, int src_pitch, unsigned char* dst,
+    int dst_pitch, int width, int height, const ImageRect& roi,
+    FilterWorkspace* workspace) {
+    return filter->FilterByHistogram(src, src_pitch, dst, dst_pitch, width,
+      height, roi, workspace);
+  }, [filter](int width, int height) {
+    return filter->GetWorkspaceSize(width, height);
+  });
+}
+
+template class FilterGraph<unsigned char>;
+template class FilterGraph<float>;
+template class FilterGraph<double>;
+
+template<typename Dtype>
+void FilterGraph<Dtype>::AddMean(const MeanFilter<Dtype>* filter) {
+  assert(nullptr != filter);
+  assert(filter->channel_num() == channel_num_);
+  AddStage(filter->radius(),
+    [filter](const Dtype* src, int src_pitch, Dtype* dst, int dst_pitch,
+    int width, int height, const ImageRect& roi, FilterWorkspace* workspace) {
+    return filter->Filter(src, src_pitch, dst, dst_pitch, width, height, roi,
+      workspace);
+  }, [filter](int width, int height) {
+    return filter->GetWorkspaceSize(width, height);
+  });
+}
+
+template<typename Dtype>
+void FilterGraph<Dtype>::AddMedianByHistogram(
+  const MedianFilter<Dtype>* filter) {
+  assert(nullptr != filter);
+  assert(filter->channel_num() == channel_num_);
+  AddStage(filter->radius(),
+    [filter](const Dtype* src, int src_pitch, Dtype* dst, int dst_pitch,
+    int width, int height, const ImageRect& roi, FilterWorkspace* workspace) {
+    return filter->FilterByHistogram(src, src_pitch, dst, dst_pitch, width,
+      height, roi, workspace);
+  }, [filter](int width, int height) {
+    return filter->GetWorkspaceSize(width, height);
+  });
+}
+
+template<typename Dtype>
+void FilterGraph<Dtype>::AddMedianByLocalSort(
+  const MedianFilter<Dtype>* filter) {
+  assert(nullptr != filter);
+  assert(filter->channel_num() == channel_num_);
+  AddStage(filter->radius(),
+    [filter](const Dtype* src, int src_pitch, Dtype* dst, int dst_pitch,
+    int width, int height, const ImageRect& roi, FilterWorkspace* workspace) {
+    return filter->FilterByLocalSort(src, src_pitch, dst, dst_pitch, width,
+      height, roi, workspace);
+  }, [filter](int width, int height) {
+    return filter->GetWorkspaceSize(width, height);
+  });
+}
+
+/**
+* Append a stage.
+*
+* \param radius          Radius of the square window of the stage.
+* \param filter          Filter the roi of an image with pitches.
+* \param workspace_size  Workspace bytes of the filter for an image size.
+*/
+template<typename Dtype>
+void FilterGraph<Dtype>::AddStage(int radius, const StageFunc& filter,
+  const StageSizeFunc& workspace_size) {
+  assert(0 < radius);
+  Stage stage;
+  stage.radius = radius;
+  stage.filter = filter;
+  stage.workspace_size = workspace_size;
+  stages_.push_back(stage);
+}
+
+template<typename Dtype>
+ImageRect FilterGraph<Dtype>::GetStageRegion(const ImageRect& tile, int k,
+  int width, int height) const {
+  int halo = 0;
+  for (int j = k + 1; j < stage_num(); j++) {
+    halo += stages_[j].radius;
+  }
+  int x_begin = tile.x - halo > 0 ? tile.x - halo : 0;
+  int y_begin = tile.y - halo > 0 ? tile.y - halo : 0;
+  int x_end = MIN(tile.x + tile.width + halo, width);
+  int y_end = MIN(tile.y + tile.height + halo, height);
+  return ImageRect(x_begin, y_begin, x_end - x_begin, y_end - y_begin);
+}
+
+template<typename Dtype>
+bool FilterGraph<Dtype>::Filter(const Dtype* host_src, Dtype* host_dst,
+  int width, int height) const {
+  return Filter(host_src, width * channel_num_, host_dst,
+    width * channel_num_, width, height);
+}
+
+/**
+* Run all the stages tile by tile.
+* The tile buffers and the workspace of a thread are sized for the largest
+* stage region of a full tile, so all the tiles of the image reuse them.
+*
+* \param host_src   Source image data.
+* \param src_pitch  Distance between two source rows, in elements.
+* \param host_dst   Destination image data, must not overlap the source.
+* \param dst_pitch  Distance between two destination rows, in elements.
+* \param width      Image width, in pixels.
+* \param height     Image height, in pixels.
+*/
+template<typename Dtype>
+bool FilterGraph<Dtype>::Filter(const Dtype* host_src, int src_pitch,
+  Dtype* host_dst, int dst_pitch, int width, int height) const {
+  assert(nullptr != host_src);
+  assert(nullptr != host_dst);
+  assert(0 < width);
+  assert(0 < height);
+  assert(width * channel_num_ <= src_pitch);
+  assert(width * channel_num_ <= dst_pitch);
+  assert(0 < stage_num());
+  // Stage k reads the region of stage k - 1 and writes its own, the largest
+  // intermediate one is the region of stage 0 of an inner tile.
+  int halo = 0;
+  for (int k = 1; k < stage_num(); k++) {
+    halo += stages_[k].radius;
+  }
+  size_t buffer_size = static_cast<size_t>(channel_num_) *
+    MIN(tile_width_ + 2 * halo, width) * MIN(tile_height_ + 2 * halo, height);
+  // Every stage reads at most the source region of stage 0.
+  int input_width = MIN(tile_width_ + 2 * (halo + stages_[0].radius), width);
+  int input_height =
+    MIN(tile_height_ + 2 * (halo + stages_[0].radius), height);
+  size_t workspace_size = 0;
+  for (int k = 0; k < stage_num(); k++) {
+    size_t size = stages_[k].workspace_size(input_width, input_height);
+    workspace_size = size > workspace_size ? size : workspace_size;
+  }
+  int tile_num = ((width + tile_width_ - 1) / tile_width_) *
+    ((height + tile_height_ - 1) / tile_height_);
+  int thread_num = MIN(thread_num_, tile_num);
+  FilterWorkspace* buffers = new FilterWorkspace[thread_num];
+  FilterWorkspace* workspaces = new FilterWorkspace[thread_num];
+  bool ok = true;
+  for (int t = 0; t < thread_num && ok; t++) {
+    ok = buffers[t].Reserve(FilterWorkspace::SizeOf<Dtype>(buffer_size) * 2) &&
+      workspaces[t].Reserve(workspace_size);
+  }
+  if (ok) {
+    std::atomic<int> next_tile(0);
+    bool* oks = new bool[thread_num];
+    std::vector<std::thread> workers;
+    for (int t = 1; t < thread_num; t++) {
+      workers.push_back(std::thread(&FilterGraph::FilterTiles, this,
+        host_src, src_pitch, host_dst, dst_pitch, width, height, &next_tile,
+        buffers[t].Acquire<Dtype>(buffer_size * 2), buffer_size,
+        workspaces + t, oks + t));
+    }
+    FilterTiles(host_src, src_pitch, host_dst, dst_pitch, width, height,
+      &next_tile, buffers[0].Acquire<Dtype>(buffer_size * 2), buffer_size,
+      workspaces, oks);
+    for (size_t t = 0; t < workers.size(); t++) {
+      workers[t].join();
+    }
+    for (int t = 0; t < thread_num; t++) {
+      ok = ok && oks[t];
+    }
+    delete[] oks;
+  }
+  delete[] workspaces;
+  delete[] buffers;
+  return ok;
+}
+
+// Every stage but the last writes to one of the two tile buffers in turn,
+// the last one writes the tile of the destination. The tiles and their
+// stages are traced on the ring of the thread.
+template<typename Dtype>
+void FilterGraph<Dtype>::FilterTiles(const Dtype* host_src, int src_pitch,
+  Dtype* host_dst, int dst_pitch, int width, int height,
+  std::atomic<int>* next_tile, Dtype* buffers, size_t buffer_size,
+  FilterWorkspace* workspace, bool* ok) const {
+  *ok = true;
+  int tile_cols = (width + tile_width_ - 1) / tile_width_;
+  int tile_num = tile_cols * ((height + tile_height_ - 1) / tile_height_);
+  int channels = channel_num_;
+  ThreadTraceBuffer thread_trace("filter graph");
+  TraceBuffer* trace = thread_trace.get();
+  for (;;) {
+    int t = next_tile->fetch_add(1);
+    if (t >= tile_num) {
+      return;
+    }
+    TraceScope tile_span(trace, "graph_tile", t);
+    int x = t % tile_cols * tile_width_;
+    int y = t / tile_cols * tile_height_;
+    ImageRect tile(x, y, MIN(tile_width_, width - x),
+      MIN(tile_height_, height - y));
+    ImageRect input = GetStageRegion(tile, -1, width, height);
+    const Dtype* src = host_src + static_cast<ptrdiff_t>(input.y) * src_pitch +
+      input.x * channels;
+    int pitch = src_pitch;
+    for (int k = 0; k < stage_num(); k++) {
+      ImageRect output = GetStageRegion(tile, k, width, height);
+      ImageRect roi(output.x - input.x, output.y - input.y, output.width,
+        output.height);
+      Dtype* dst = nullptr;
+      int out_pitch = 0;
+      if (k == stage_num() - 1) {
+        dst = host_dst + static_cast<ptrdiff_t>(tile.y) * dst_pitch +
+          tile.x * channels;
+        out_pitch = dst_pitch;
+      } else {
+        dst = buffers + (k % 2) * buffer_size;
+        out_pitch = output.width * channels;
+      }
+      TraceScope stage_span(trace, "graph_stage", k);
+      if (!stages_[k].filter(src, pitch, dst, out_pitch, input.width,
+        input.height, roi, workspace)) {
+        *ok = false;
+      }
+      src = dst;
+      pitch = out_pitch;
+      input = output;
+    }
+  }
+}
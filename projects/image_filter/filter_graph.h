@@ -0,0 +1,99 @@
+#ifndef IMAGE_IMAGE_FILTER_FILTER_GRAPH_H_
+#define IMAGE_IMAGE_FILTER_FILTER_GRAPH_H_
+#include <assert.h>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include "image_filter/filter_workspace.h"
+#include "image_filter/image_rect.h"
+#include "image_filter/mean_filter.h"
+#include "image_filter/median_filter.h"
+
+// Default output tile side of a filter graph, in pixels. The intermediate
+// tiles of a few stages fit L2.
+#ifndef FILTER_GRAPH_TILE_SIZE
+#define FILTER_GRAPH_TILE_SIZE 128
+#endif
+
+/**
+* Chain of filters run tile by tile, so the intermediate images never go
+* through DRAM.
+* The output is cut into tiles. For every tile the region each stage has to
+* produce is worked out backward from the last stage, growing by the radius
+* of the next stage and clipped at the image edges. The first stage reads
+* the source image, every next stage reads the tile buffer of the previous
+* one with the roi API, so a halo pixel is read as context and the border
+* mode of each stage only applies at the image edges: the output is the
+* same as running the filters one after the other on the whole image.
+* The tiles are spread over thread_num threads, each one with its own tile
+* buffers and workspace. The filters are shared and must stay alive while
+* the graph is used; the MeanFilter of a stage should keep its own
+* thread_num 1.
+*/
+template<typename Dtype>
+class FilterGraph
+{
+public:
+  // Filter the roi of an image with pitches, see MeanFilter::Filter.
+  typedef std::function<bool(const Dtype*, int, Dtype*, int, int, int,
+    const ImageRect&, FilterWorkspace*)> StageFunc;
+  // Workspace bytes of a stage for an image size.
+  typedef std::function<size_t(int, int)> StageSizeFunc;
+  FilterGraph() : tile_width_(FILTER_GRAPH_TILE_SIZE),
+    tile_height_(FILTER_GRAPH_TILE_SIZE), thread_num_(1), channel_num_(1) {}
+  void set_tile_size(int tile_width, int tile_height) {
+    assert(tile_width > 0);
+    assert(tile_height > 0);
+    tile_width_ = tile_width;
+    tile_height_ = tile_height;
+  }
+  void set_thread_num(int thread_num) {
+    assert(thread_num > 0);
+    thread_num_ = thread_num;
+  }
+  // Interleaved values per pixel, the same for all the stages, default 1.
+  void set_channel_num(int channel_num) {
+    assert(channel_num > 0);
+    assert(channel_num <= CHANNEL_NUM_MAX);
+    channel_num_ = channel_num;
+  }
+  // Append a stage.
+  void AddMean(const MeanFilter<Dtype>* filter);
+  void AddMedianByHistogram(const MedianFilter<Dtype>* filter);
+  void AddMedianByLocalSort(const MedianFilter<Dtype>* filter);
+  // Only for FilterGraph<unsigned char>.
+  void AddMedianByHistogram(const UcharMedianFilter* filter);
+  // Append any filter with a square window of radius.
+  void AddStage(int radius, const StageFunc& filter,
+    const StageSizeFunc& workspace_size);
+  void Clear() { stages_.clear(); }
+  int stage_num() const { return static_cast<int>(stages_.size()); }
+  // Run all the stages, return false if the memory can not be allocated.
+  bool Filter(const Dtype* host_src, Dtype* host_dst, int width,
+    int height) const;
+  // Pitches in elements, see MeanFilter::Filter.
+  bool Filter(const Dtype* host_src, int src_pitch, Dtype* host_dst,
+    int dst_pitch, int width, int height) const;
+private:
+  struct Stage {
+    int radius;
+    StageFunc filter;
+    StageSizeFunc workspace_size;
+  };
+  // Filter the tiles taken from next_tile until there is none left.
+  void FilterTiles(const Dtype* host_src, int src_pitch, Dtype* host_dst,
+    int dst_pitch, int width, int height, std::atomic<int>* next_tile,
+    Dtype* buffers, size_t buffer_size, FilterWorkspace* workspace,
+    bool* ok) const;
+  // Region stage k has to produce for an output tile, clipped to the image.
+  // Stage -1 is the source, the region stage 0 reads.
+  ImageRect GetStageRegion(const ImageRect& tile, int k, int width,
+    int height) const;
+  int tile_width_;
+  int tile_height_;
+  int thread_num_;
+  int channel_num_;
+  std::vector<Stage> stages_;
+  DISABLE_COPY_AND_ASSIGN(FilterGraph);
+};
+#endif  // !IMAGE_IMAGE_FILTER_FILTER_GRAPH_H_
@@ -0,0 +1,44 @@
+#include "image_filter/filter_kernels.h"
+
+// Baseline kernels, plain C++ the compiler may still vectorize for the
+// minimum instruction set of the build.
+
+static void AddHist(int* his, const int* his_add, int size) {
+  for (int i = 0; i < size; i++) {
+    his[i] += his_add[i];
+  }
+}
+
+static void AddSubHist(int* his, const int* his_add, const int* his_sub,
+  int size) {
+  for (int i = 0; i < size; i++) {
+    his[i] += his_add[i];
+    his[i] -= his_sub[i];
+  }
+}
+
+static int FindHistRank(const int* his, int size, int rank) {
+  int sum = 0;
+  for (int i = 0; i < size; i++) {
+    sum += his[i];
+    if (sum > rank) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+template<typename Dtype>
+static void UpdateSum(const Dtype* row_sub, const Dtype* row_add,
+  double* sum_cols, int width) {
+  for (int k = 0; k < width; k++) {
+    sum_cols[k] -= row_sub[k];
+    sum_cols[k] += row_add[k];
+  }
+}
+
+const FilterKernels* GetBaselineKernels() {
+  static const FilterKernels kernels = {AddHist, AddSubHist, FindHistRank,
+    UpdateSum<unsigned char>, UpdateSum<float>, UpdateSum<double>};
+  return &kernels;
+}
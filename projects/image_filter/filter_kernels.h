@@ -0,0 +1,34 @@
+#ifndef IMAGE_IMAGE_FILTER_FILTER_KERNELS_H_
+#define IMAGE_IMAGE_FILTER_FILTER_KERNELS_H_
+
+/**
+* Hot loops of the median and mean filters, built once per instruction set.
+* Every target gives the same results as the baseline one bit for bit, the
+* sums are done in the same order, so switching target never changes an
+* output. Use GetFilterKernels of cpu_dispatch.h to get the table of the
+* active target.
+*/
+struct FilterKernels {
+  // his[i] += his_add[i] for i in [0, size).
+  void (*add_hist)(int* his, const int* his_add, int size);
+  // his[i] += his_add[i] - his_sub[i] for i in [0, size).
+  void (*add_sub_hist)(int* his, const int* his_add, const int* his_sub,
+    int size);
+  // First i whose prefix sum his[0] + ... + his[i] is over rank, -1 if none.
+  int (*find_hist_rank)(const int* his, int size, int rank);
+  // sum_cols[k] = sum_cols[k] - row_sub[k] + row_add[k] for k in
+  // [0, width), the column sums of a mean filter moving down a row.
+  void (*update_sum_uchar)(const unsigned char* row_sub,
+    const unsigned char* row_add, double* sum_cols, int width);
+  void (*update_sum_float)(const float* row_sub, const float* row_add,
+    double* sum_cols, int width);
+  void (*update_sum_double)(const double* row_sub, const double* row_add,
+    double* sum_cols, int width);
+};
+
+// Kernel tables of each target, nullptr if the compiler can not build it.
+const FilterKernels* GetBaselineKernels();
+const FilterKernels* GetSse41Kernels();
+const FilterKernels* GetAvx2Kernels();
+const FilterKernels* GetAvx512Kernels();
+#endif  // !IMAGE_IMAGE_FILTER_FILTER_KERNELS_H_
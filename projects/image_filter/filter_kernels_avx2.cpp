@@ -0,0 +1,130 @@
+#include "image_filter/filter_kernels.h"
+// Built with -mavx2 or /arch:AVX2, see CMakeLists.txt.
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+static void AddHist(int* his, const int* his_add, int size) {
+  int i = 0;
+  for (; i + 8 <= size; i += 8) {
+    __m256i v =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(his + i));
+    __m256i a =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(his_add + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(his + i),
+      _mm256_add_epi32(v, a));
+  }
+  for (; i < size; i++) {
+    his[i] += his_add[i];
+  }
+}
+
+static void AddSubHist(int* his, const int* his_add, const int* his_sub,
+  int size) {
+  int i = 0;
+  for (; i + 8 <= size; i += 8) {
+    __m256i v =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(his + i));
+    __m256i a =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(his_add + i));
+    __m256i s =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(his_sub + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(his + i),
+      _mm256_sub_epi32(_mm256_add_epi32(v, a), s));
+  }
+  for (; i < size; i++) {
+    his[i] += his_add[i];
+    his[i] -= his_sub[i];
+  }
+}
+
+// Skip blocks of 32 bins by their sums, then find the bin in the block.
+static int FindHistRank(const int* his, int size, int rank) {
+  int sum = 0;
+  int i = 0;
+  for (; i + 32 <= size; i += 32) {
+    const __m256i* p = reinterpret_cast<const __m256i*>(his + i);
+    __m256i v = _mm256_add_epi32(
+      _mm256_add_epi32(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1)),
+      _mm256_add_epi32(_mm256_loadu_si256(p + 2), _mm256_loadu_si256(p + 3)));
+    __m128i h = _mm_add_epi32(_mm256_castsi256_si128(v),
+      _mm256_extracti128_si256(v, 1));
+    h = _mm_add_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(1, 0, 3, 2)));
+    h = _mm_add_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(2, 3, 0, 1)));
+    int block = _mm_cvtsi128_si32(h);
+    if (sum + block > rank) {
+      break;
+    }
+    sum += block;
+  }
+  for (; i < size; i++) {
+    sum += his[i];
+    if (sum > rank) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// The column sums are updated as sum - sub + add, like the baseline.
+static inline void UpdateSum4(const __m256d& sub, const __m256d& add,
+  double* sum_cols) {
+  __m256d v = _mm256_loadu_pd(sum_cols);
+  _mm256_storeu_pd(sum_cols, _mm256_add_pd(_mm256_sub_pd(v, sub), add));
+}
+
+static void UpdateSumUchar(const unsigned char* row_sub,
+  const unsigned char* row_add, double* sum_cols, int width) {
+  int k = 0;
+  for (; k + 8 <= width; k += 8) {
+    __m128i sub =
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row_sub + k));
+    __m128i add =
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row_add + k));
+    UpdateSum4(_mm256_cvtepi32_pd(_mm_cvtepu8_epi32(sub)),
+      _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(add)), sum_cols + k);
+    UpdateSum4(_mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_srli_si128(sub, 4))),
+      _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_srli_si128(add, 4))),
+      sum_cols + k + 4);
+  }
+  for (; k < width; k++) {
+    sum_cols[k] -= row_sub[k];
+    sum_cols[k] += row_add[k];
+  }
+}
+
+static void UpdateSumFloat(const float* row_sub, const float* row_add,
+  double* sum_cols, int width) {
+  int k = 0;
+  for (; k + 4 <= width; k += 4) {
+    UpdateSum4(_mm256_cvtps_pd(_mm_loadu_ps(row_sub + k)),
+      _mm256_cvtps_pd(_mm_loadu_ps(row_add + k)), sum_cols + k);
+  }
+  for (; k < width; k++) {
+    sum_cols[k] -= row_sub[k];
+    sum_cols[k] += row_add[k];
+  }
+}
+
+static void UpdateSumDouble(const double* row_sub, const double* row_add,
+  double* sum_cols, int width) {
+  int k = 0;
+  for (; k + 4 <= width; k += 4) {
+    UpdateSum4(_mm256_loadu_pd(row_sub + k), _mm256_loadu_pd(row_add + k),
+      sum_cols + k);
+  }
+  for (; k < width; k++) {
+    sum_cols[k] -= row_sub[k];
+    sum_cols[k] += row_add[k];
+  }
+}
+
+const FilterKernels* GetAvx2Kernels() {
+  static const FilterKernels kernels = {AddHist, AddSubHist, FindHistRank,
+    UpdateSumUchar, UpdateSumFloat, UpdateSumDouble};
+  return &kernels;
+}
+#else
+const FilterKernels* GetAvx2Kernels() {
+  return nullptr;
+}
+#endif
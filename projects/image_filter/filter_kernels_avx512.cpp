@@ -0,0 +1,133 @@
+#include "image_filter/filter_kernels.h"
+// Built with -mavx512f or /arch:AVX512, see CMakeLists.txt.
+#if defined(__AVX512F__)
+#include <immintrin.h>
+// The conversions, shuffles and extractions are the zero-masked ones with all
+// the lanes selected: the plain ones, and the casts to narrower registers,
+// start from _mm512_undefined_*, which GCC 12 reports as maybe-uninitialized
+// with -Wall.
+
+static void AddHist(int* his, const int* his_add, int size) {
+  int i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m512i v = _mm512_loadu_si512(his + i);
+    _mm512_storeu_si512(his + i,
+      _mm512_add_epi32(v, _mm512_loadu_si512(his_add + i)));
+  }
+  for (; i < size; i++) {
+    his[i] += his_add[i];
+  }
+}
+
+static void AddSubHist(int* his, const int* his_add, const int* his_sub,
+  int size) {
+  int i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m512i v = _mm512_add_epi32(_mm512_loadu_si512(his + i),
+      _mm512_loadu_si512(his_add + i));
+    _mm512_storeu_si512(his + i,
+      _mm512_sub_epi32(v, _mm512_loadu_si512(his_sub + i)));
+  }
+  for (; i < size; i++) {
+    his[i] += his_add[i];
+    his[i] -= his_sub[i];
+  }
+}
+
+// Sum of the 16 lanes of v, the upper 128 bits lanes are folded down by
+// shuffles.
+static inline int ReduceAdd(__m512i v) {
+  v = _mm512_add_epi32(v, _mm512_maskz_shuffle_i64x2(0xFF, v, v, 0x4E));
+  v = _mm512_add_epi32(v, _mm512_maskz_shuffle_i64x2(0xFF, v, v, 0xB1));
+  __m128i s = _mm512_maskz_extracti32x4_epi32(0xF, v, 0);
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+  return _mm_cvtsi128_si32(s);
+}
+
+// Skip blocks of 64 bins by their sums, then find the bin in the block.
+static int FindHistRank(const int* his, int size, int rank) {
+  int sum = 0;
+  int i = 0;
+  for (; i + 64 <= size; i += 64) {
+    __m512i v = _mm512_add_epi32(
+      _mm512_add_epi32(_mm512_loadu_si512(his + i),
+      _mm512_loadu_si512(his + i + 16)),
+      _mm512_add_epi32(_mm512_loadu_si512(his + i + 32),
+      _mm512_loadu_si512(his + i + 48)));
+    int block = ReduceAdd(v);
+    if (sum + block > rank) {
+      break;
+    }
+    sum += block;
+  }
+  for (; i < size; i++) {
+    sum += his[i];
+    if (sum > rank) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// The column sums are updated as sum - sub + add, like the baseline.
+static inline void UpdateSum8(const __m512d& sub, const __m512d& add,
+  double* sum_cols) {
+  __m512d v = _mm512_loadu_pd(sum_cols);
+  _mm512_storeu_pd(sum_cols, _mm512_add_pd(_mm512_sub_pd(v, sub), add));
+}
+
+static void UpdateSumUchar(const unsigned char* row_sub,
+  const unsigned char* row_add, double* sum_cols, int width) {
+  int k = 0;
+  for (; k + 8 <= width; k += 8) {
+    __m256i sub = _mm256_cvtepu8_epi32(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row_sub + k)));
+    __m256i add = _mm256_cvtepu8_epi32(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row_add + k)));
+    UpdateSum8(_mm512_maskz_cvtepi32_pd(0xFF, sub),
+      _mm512_maskz_cvtepi32_pd(0xFF, add), sum_cols + k);
+  }
+  for (; k < width; k++) {
+    sum_cols[k] -= row_sub[k];
+    sum_cols[k] += row_add[k];
+  }
+}
+
+static void UpdateSumFloat(const float* row_sub, const float* row_add,
+  double* sum_cols, int width) {
+  int k = 0;
+  for (; k + 8 <= width; k += 8) {
+    UpdateSum8(_mm512_maskz_cvtps_pd(0xFF, _mm256_loadu_ps(row_sub + k)),
+      _mm512_maskz_cvtps_pd(0xFF, _mm256_loadu_ps(row_add + k)),
+      sum_cols + k);
+  }
+  for (; k < width; k++) {
+    sum_cols[k] -= row_sub[k];
+    sum_cols[k] += row_add[k];
+  }
+}
+
+static void UpdateSumDouble(const double* row_sub, const double* row_add,
+  double* sum_cols, int width) {
+  int k = 0;
+  for (; k + 8 <= width; k += 8) {
+    UpdateSum8(_mm512_loadu_pd(row_sub + k), _mm512_loadu_pd(row_add + k),
+      sum_cols + k);
+  }
+  for (; k < width; k++) {
+    sum_cols[k] -= row_sub[k];
+    sum_cols[k] += row_add[k];
+  }
+}
+
+const FilterKernels* GetAvx512Kernels() {
+  static const FilterKernels kernels = {AddHist, AddSubHist, FindHistRank,
+    UpdateSumUchar, UpdateSumFloat, UpdateSumDouble};
+  return &kernels;
+}
+#else
+const FilterKernels* GetAvx512Kernels() {
+  return nullptr;
+}
+#endif
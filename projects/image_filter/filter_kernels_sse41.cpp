@@ -0,0 +1,129 @@
+#include "image_filter/filter_kernels.h"
+// MSVC has the intrinsics of all the targets without any flag.
+#if defined(__SSE4_1__) || defined(_M_X64) || defined(_M_IX86)
+#include <string.h>
+#include <smmintrin.h>
+
+static void AddHist(int* his, const int* his_add, int size) {
+  int i = 0;
+  for (; i + 4 <= size; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(his + i));
+    __m128i a =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(his_add + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(his + i), _mm_add_epi32(v, a));
+  }
+  for (; i < size; i++) {
+    his[i] += his_add[i];
+  }
+}
+
+static void AddSubHist(int* his, const int* his_add, const int* his_sub,
+  int size) {
+  int i = 0;
+  for (; i + 4 <= size; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(his + i));
+    __m128i a =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(his_add + i));
+    __m128i s =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(his_sub + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(his + i),
+      _mm_sub_epi32(_mm_add_epi32(v, a), s));
+  }
+  for (; i < size; i++) {
+    his[i] += his_add[i];
+    his[i] -= his_sub[i];
+  }
+}
+
+// Skip blocks of 16 bins by their sums, then find the bin in the block.
+static int FindHistRank(const int* his, int size, int rank) {
+  int sum = 0;
+  int i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m128i* p = reinterpret_cast<const __m128i*>(his + i);
+    __m128i v = _mm_add_epi32(
+      _mm_add_epi32(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+      _mm_add_epi32(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    int block = _mm_cvtsi128_si32(v);
+    if (sum + block > rank) {
+      break;
+    }
+    sum += block;
+  }
+  for (; i < size; i++) {
+    sum += his[i];
+    if (sum > rank) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// The column sums are updated as sum - sub + add, like the baseline.
+static inline void UpdateSum2(const __m128d& sub, const __m128d& add,
+  double* sum_cols) {
+  __m128d v = _mm_loadu_pd(sum_cols);
+  _mm_storeu_pd(sum_cols, _mm_add_pd(_mm_sub_pd(v, sub), add));
+}
+
+static void UpdateSumUchar(const unsigned char* row_sub,
+  const unsigned char* row_add, double* sum_cols, int width) {
+  int k = 0;
+  for (; k + 4 <= width; k += 4) {
+    int sub_bits = 0;
+    int add_bits = 0;
+    memcpy(&sub_bits, row_sub + k, sizeof(int));
+    memcpy(&add_bits, row_add + k, sizeof(int));
+    __m128i sub = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(sub_bits));
+    __m128i add = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(add_bits));
+    UpdateSum2(_mm_cvtepi32_pd(sub), _mm_cvtepi32_pd(add), sum_cols + k);
+    UpdateSum2(_mm_cvtepi32_pd(_mm_srli_si128(sub, 8)),
+      _mm_cvtepi32_pd(_mm_srli_si128(add, 8)), sum_cols + k + 2);
+  }
+  for (; k < width; k++) {
+    sum_cols[k] -= row_sub[k];
+    sum_cols[k] += row_add[k];
+  }
+}
+
+static void UpdateSumFloat(const float* row_sub, const float* row_add,
+  double* sum_cols, int width) {
+  int k = 0;
+  for (; k + 4 <= width; k += 4) {
+    __m128 sub = _mm_loadu_ps(row_sub + k);
+    __m128 add = _mm_loadu_ps(row_add + k);
+    UpdateSum2(_mm_cvtps_pd(sub), _mm_cvtps_pd(add), sum_cols + k);
+    UpdateSum2(_mm_cvtps_pd(_mm_movehl_ps(sub, sub)),
+      _mm_cvtps_pd(_mm_movehl_ps(add, add)), sum_cols + k + 2);
+  }
+  for (; k < width; k++) {
+    sum_cols[k] -= row_sub[k];
+    sum_cols[k] += row_add[k];
+  }
+}
+
+static void UpdateSumDouble(const double* row_sub, const double* row_add,
+  double* sum_cols, int width) {
+  int k = 0;
+  for (; k + 2 <= width; k += 2) {
+    UpdateSum2(_mm_loadu_pd(row_sub + k), _mm_loadu_pd(row_add + k),
+      sum_cols + k);
+  }
+  for (; k < width; k++) {
+    sum_cols[k] -= row_sub[k];
+    sum_cols[k] += row_add[k];
+  }
+}
+
+const FilterKernels* GetSse41Kernels() {
+  static const FilterKernels kernels = {AddHist, AddSubHist, FindHistRank,
+    UpdateSumUchar, UpdateSumFloat, UpdateSumDouble};
+  return &kernels;
+}
+#else
+const FilterKernels* GetSse41Kernels() {
+  return nullptr;
+}
+#endif
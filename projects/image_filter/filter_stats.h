@@ -0,0 +1,181 @@
+#ifndef IMAGE_IMAGE_FILTER_FILTER_STATS_H_
+#define IMAGE_IMAGE_FILTER_FILTER_STATS_H_
+#include <chrono>
+#include <functional>
+#include <string.h>
+
+// Disable the copy and assignment operator for a class.
+#ifndef DISABLE_COPY_AND_ASSIGN
+#define DISABLE_COPY_AND_ASSIGN(classname) \
+private:\
+  classname(const classname&);\
+  classname& operator=(const classname&)
+#endif
+
+// The filters only time their phases and count their work when the library
+// is built with IMAGE_FILTER_STATS defined, the CMake option of the same
+// name. Otherwise the timers and counters are compiled out, nothing is
+// filled and a call costs what it did without them.
+
+// Phases of a filter call, they do not overlap.
+enum FilterPhase {
+  // Rows and histograms of border value for the pixels outside the image.
+  FILTER_PHASE_BORDER = 0,
+  // Sort and ordinal transform of the types other than unsigned char.
+  FILTER_PHASE_RANK_TRANSFORM = 1,
+  // Histograms, sorted buffers or sums of the first window of a row or
+  // stripe.
+  FILTER_PHASE_WINDOW_INIT = 2,
+  // Move the window and write the outputs.
+  FILTER_PHASE_SLIDE = 3,
+  FILTER_PHASE_NUM = 4
+};
+
+/**
+* Time and work of a filter call. The seconds of the threads of a call are
+* summed, so they may exceed the wall time of the call.
+*/
+struct FilterStats {
+  double phase_seconds[FILTER_PHASE_NUM];
+  // Output pixels.
+  long long pixels;
+  // Histogram bins the rank search went through.
+  long long bins_scanned;
+  // Workspace blocks allocated and their bytes, by the call itself or on the
+  // workspace it got since the previous call with stats on it, see
+  // FilterWorkspace::TakeStatsAllocations.
+  long long allocations;
+  long long allocated_bytes;
+};
+
+typedef std::function<void(const FilterStats&)> FilterStatsCallback;
+
+inline void ClearFilterStats(FilterStats* stats) {
+  memset(stats, 0, sizeof(FilterStats));
+}
+
+// Add the time and work of stats to total.
+inline void AddFilterStats(const FilterStats& stats, FilterStats* total) {
+  for (int k = 0; k < FILTER_PHASE_NUM; k++) {
+    total->phase_seconds[k] += stats.phase_seconds[k];
+  }
+  total->pixels += stats.pixels;
+  total->bins_scanned += stats.bins_scanned;
+  total->allocations += stats.allocations;
+  total->allocated_bytes += stats.allocated_bytes;
+}
+
+inline const char* GetFilterPhaseName(FilterPhase phase) {
+  switch (phase) {
+  case FILTER_PHASE_BORDER: return "border";
+  case FILTER_PHASE_RANK_TRANSFORM: return "rank_transform";
+  case FILTER_PHASE_WINDOW_INIT: return "window_init";
+  case FILTER_PHASE_SLIDE: return "slide";
+  default: return "unknown";
+  }
+}
+
+// True if the library fills the stats, see IMAGE_FILTER_STATS.
+inline bool IsFilterStatsEnabled() {
+#ifdef IMAGE_FILTER_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+#ifdef IMAGE_FILTER_STATS
+/**
+* Add the time from its construction to its destruction to a phase of
+* stats, nothing if stats is null.
+*/
+class ScopedPhaseTimer
+{
+public:
+  ScopedPhaseTimer(FilterStats* stats, FilterPhase phase)
+    : stats_(stats), phase_(phase) {
+    if (nullptr != stats_) {
+      start_ = Clock::now();
+    }
+  }
+  ~ScopedPhaseTimer() {
+    if (nullptr != stats_) {
+      stats_->phase_seconds[phase_] +=
+        std::chrono::duration<double>(Clock::now() - start_).count();
+    }
+  }
+private:
+  typedef std::chrono::high_resolution_clock Clock;
+  FilterStats* stats_;
+  FilterPhase phase_;
+  Clock::time_point start_;
+  DISABLE_COPY_AND_ASSIGN(ScopedPhaseTimer);
+};
+
+/**
+* Stats of the outermost call of a filter. get() is null when no one reads
+* them, then the timers and counters do nothing. At the end of the scope the
+* stats are copied to out and passed to callback.
+*/
+class FilterCallStats
+{
+public:
+  FilterCallStats(FilterStats* out, const FilterStatsCallback& callback)
+    : out_(out), callback_(callback) {
+    ClearFilterStats(&stats_);
+  }
+  ~FilterCallStats() {
+    if (nullptr != out_) {
+      *out_ = stats_;
+    }
+    if (callback_) {
+      callback_(stats_);
+    }
+  }
+  FilterStats* get() {
+    return nullptr != out_ || callback_ ? &stats_ : nullptr;
+  }
+private:
+  FilterStats* out_;
+  const FilterStatsCallback& callback_;
+  FilterStats stats_;
+  DISABLE_COPY_AND_ASSIGN(FilterCallStats);
+};
+
+#define FILTER_STATS_CONCAT_(a, b) a##b
+#define FILTER_STATS_CONCAT(a, b) FILTER_STATS_CONCAT_(a, b)
+// Time the rest of the enclosing scope as phase.
+#define FILTER_STATS_PHASE(stats, phase) \
+  ScopedPhaseTimer FILTER_STATS_CONCAT(phase_timer_, __LINE__)(stats, phase)
+// Add value to a counter of stats.
+#define FILTER_STATS_ADD(stats, counter, value) \
+  do { if (nullptr != (stats)) { (stats)->counter += (value); } } while (0)
+// Add the blocks a FilterWorkspace allocated since the previous call with
+// stats, the count of TakeAllocations is left to the owner.
+#define FILTER_STATS_ADD_ALLOCATIONS(stats, workspace) \
+  do { \
+    if (nullptr != (stats)) { \
+      size_t filter_stats_bytes = 0; \
+      (stats)->allocations += \
+        (workspace)->TakeStatsAllocations(&filter_stats_bytes); \
+      (stats)->allocated_bytes += filter_stats_bytes; \
+    } \
+  } while (0)
+#else
+class FilterCallStats
+{
+public:
+  FilterCallStats(FilterStats*, const FilterStatsCallback&) {}
+  FilterStats* get() { return nullptr; }
+private:
+  DISABLE_COPY_AND_ASSIGN(FilterCallStats);
+};
+
+// stats is still named, so the parameters only passed to the macros are
+// not reported as unused.
+#define FILTER_STATS_PHASE(stats, phase) (void)(stats)
+#define FILTER_STATS_ADD(stats, counter, value) do { (void)(stats); } while (0)
+#define FILTER_STATS_ADD_ALLOCATIONS(stats, workspace) \
+  do { (void)(stats); } while (0)
+#endif
+#endif  // !IMAGE_IMAGE_FILTER_FILTER_STATS_H_
@@ -0,0 +1,32 @@
+#include "image_filter/filter_workspace.h"
+
+FilterWorkspace::~FilterWorkspace() {
+  FreeAlignedBlock(&block_);
+}
+
+/**
+* Reserve the workspace memory.
+* The block is only reallocated when it grows, so a workspace reserved for
+* the largest image serves all the smaller ones.
+*
+* \param size   Workspace size in bytes, see GetWorkspaceSize of the filters.
+*/
+bool FilterWorkspace::Reserve(size_t size) {
+  used_ = 0;
+  if (size <= capacity_) {
+    return true;
+  }
+  AlignedBlock block;
+  if (!AllocateAlignedBlock(size, huge_page_, &block)) {
+    return false;
+  }
+  if (prefault_) {
+    PrefaultMemory(block.data, block.size);
+  }
+  FreeAlignedBlock(&block_);
+  block_ = block;
+  capacity_ = block.size;
+  allocations_++;
+  allocated_bytes_ += block.size;
+  return true;
+}
@@ -0,0 +1,108 @@
+#ifndef IMAGE_IMAGE_FILTER_FILTER_WORKSPACE_H_
+#define IMAGE_IMAGE_FILTER_FILTER_WORKSPACE_H_
+#include <assert.h>
+#include <stddef.h>
+#include "image_filter/aligned_memory.h"
+
+// Disable the copy and assignment operator for a class.
+#ifndef DISABLE_COPY_AND_ASSIGN
+#define DISABLE_COPY_AND_ASSIGN(classname) \
+private:\
+  classname(const classname&);\
+  classname& operator=(const classname&)
+#endif
+
+// Alignment of every buffer taken from a workspace, in bytes.
+#ifndef WORKSPACE_ALIGNMENT
+#define WORKSPACE_ALIGNMENT CACHE_LINE_SIZE
+#endif
+
+/**
+* Preallocated memory arena for the filters.
+* Reserve it once with the GetWorkspaceSize of a filter for an image size,
+* then every call that gets the workspace takes its buffers from it and never
+* touches the heap. Every buffer starts on a cache line. The block can be
+* backed by huge pages and is pre-faulted when reserved, so the first call
+* takes no page fault either.
+* A workspace serves one call at a time, give each thread its own workspace
+* to share one filter object between threads.
+*/
+class FilterWorkspace
+{
+public:
+  FilterWorkspace() : capacity_(0), used_(0), huge_page_(false),
+    prefault_(true), allocations_(0), allocated_bytes_(0),
+    taken_allocations_(0), taken_bytes_(0), stats_allocations_(0),
+    stats_bytes_(0) {}
+  ~FilterWorkspace();
+  // Map blocks of at least HUGE_PAGE_SIZE with huge pages, default false.
+  void set_huge_page(bool huge_page) { huge_page_ = huge_page; }
+  // Touch every page when reserved, default true.
+  void set_prefault(bool prefault) { prefault_ = prefault; }
+  // Make the capacity at least size bytes, the buffers taken are released.
+  // Return false if the memory can not be allocated.
+  bool Reserve(size_t size);
+  // Take an uninitialized buffer of count elements.
+  // Return nullptr if the workspace is too small.
+  template<typename T>
+  T* Acquire(size_t count) {
+    size_t size = SizeOf<T>(count);
+    if (size > capacity_ - used_) {
+      assert(false);
+      return nullptr;
+    }
+    T* ptr = reinterpret_cast<T*>(static_cast<char*>(block_.data) + used_);
+    used_ += size;
+    return ptr;
+  }
+  // Give back all the buffers taken by Acquire.
+  void Release() { used_ = 0; }
+  // Bytes taken from a workspace by Acquire<T>(count).
+  template<typename T>
+  static size_t SizeOf(size_t count) {
+    return (count * sizeof(T) + WORKSPACE_ALIGNMENT - 1) /
+      WORKSPACE_ALIGNMENT * WORKSPACE_ALIGNMENT;
+  }
+  size_t capacity() const { return capacity_; }
+  size_t used() const { return used_; }
+  // True if the block is mapped with huge pages.
+  bool huge_page_mapped() const { return block_.mapped; }
+  // Blocks allocated by Reserve since the workspace was made, and their
+  // bytes.
+  int allocations() const { return allocations_; }
+  size_t allocated_bytes() const { return allocated_bytes_; }
+  // Blocks allocated by Reserve since the previous call, and their bytes,
+  // for the owner of the workspace.
+  int TakeAllocations(size_t* bytes) {
+    return TakeAllocationsSince(&taken_allocations_, &taken_bytes_, bytes);
+  }
+  // TakeAllocations for the stats of the filter calls, with a mark of its
+  // own so the filters never take the count of the owner.
+  int TakeStatsAllocations(size_t* bytes) {
+    return TakeAllocationsSince(&stats_allocations_, &stats_bytes_, bytes);
+  }
+private:
+  // The blocks allocated since a mark, the mark is moved to now.
+  int TakeAllocationsSince(int* mark_allocations, size_t* mark_bytes,
+    size_t* bytes) {
+    int allocations = allocations_ - *mark_allocations;
+    *bytes = allocated_bytes_ - *mark_bytes;
+    *mark_allocations = allocations_;
+    *mark_bytes = allocated_bytes_;
+    return allocations;
+  }
+
+  AlignedBlock block_;
+  size_t capacity_;
+  size_t used_;
+  bool huge_page_;
+  bool prefault_;
+  int allocations_;
+  size_t allocated_bytes_;
+  int taken_allocations_;
+  size_t taken_bytes_;
+  int stats_allocations_;
+  size_t stats_bytes_;
+  DISABLE_COPY_AND_ASSIGN(FilterWorkspace);
+};
+#endif  // !IMAGE_IMAGE_FILTER_FILTER_WORKSPACE_H_
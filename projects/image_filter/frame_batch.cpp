@@ -0,0 +1,234 @@
+#include <new>
+#include "image_filter/frame_batch.h"
+#include "image_filter/trace_recorder.h"
+
+FrameBatchFilter::FrameBatchFilter(int thread_num)
+  : thread_num_(thread_num), workspaces_(nullptr), ranges_(nullptr),
+  generation_(0), busy_num_(0), stop_(false), task_(nullptr),
+  failed_(false) {
+  assert(0 < thread_num);
+  workspaces_ = new FilterWorkspace[thread_num];
+  // new[] only aligns to the alignment of the type, the ranges must start
+  // on a cache line for their padding to keep them on lines of their own.
+  if (AllocateAlignedBlock(sizeof(FrameRange) * thread_num, false,
+    &ranges_block_)) {
+    ranges_ = static_cast<FrameRange*>(ranges_block_.data);
+    for (int t = 0; t < thread_num; t++) {
+      new (ranges_ + t) FrameRange();
+    }
+  }
+  for (int t = 1; t < thread_num; t++) {
+    threads_.push_back(std::thread(&FrameBatchFilter::WorkerLoop, this, t));
+  }
+}
+
+FrameBatchFilter::~FrameBatchFilter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_cond_.notify_all();
+  for (size_t t = 0; t < threads_.size(); t++) {
+    threads_[t].join();
+  }
+  if (nullptr != ranges_) {
+    for (int t = 0; t < thread_num_; t++) {
+      ranges_[t].~FrameRange();
+    }
+    FreeAlignedBlock(&ranges_block_);
+  }
+  delete[] workspaces_;
+}
+
+/**
+* Mean filtering of a batch of frames.
+*
+* \param filter     Filter settings, shared by all the workers.
+* \param host_srcs  Source frames, width by height pixels each.
+* \param host_dsts  Destination frames, must be preallocated.
+* \param frame_num  Number of frames.
+* \param width      Frame width, in pixels.
+* \param height     Frame height, in pixels.
+*/
+template<typename Dtype>
+bool FrameBatchFilter::Filter(const MeanFilter<Dtype>& filter,
+  const Dtype* const* host_srcs, Dtype* const* host_dsts, int frame_num,
+  int width, int height) {
+  assert(0 == frame_num || nullptr != host_srcs);
+  assert(0 == frame_num || nullptr != host_dsts);
+  if (!ReserveWorkspaces(filter.GetWorkspaceSize(width, height))) {
+    return false;
+  }
+  return Run(frame_num, [&](int k, FilterWorkspace* workspace) {
+    return filter.Filter(host_srcs[k], host_dsts[k], width, height,
+      workspace);
+  });
+}
+
+// Median filtering of a batch of frames by histogram, see Filter.
+template<typename Dtype>
+bool FrameBatchFilter::FilterByHistogram(const MedianFilter<Dtype>& filter,
+  const Dtype* const* host_srcs, Dtype* const* host_dsts, int frame_num,
+  int width, int height) {
+  assert(0 == frame_num || nullptr != host_srcs);
+  assert(0 == frame_num || nullptr != host_dsts);
+  if (!ReserveWorkspaces(filter.GetWorkspaceSize(width, height))) {
+    return false;
+  }
+  return Run(frame_num, [&](int k, FilterWorkspace* workspace) {
+    return filter.FilterByHistogram(host_srcs[k], host_dsts[k], width,
+      height, workspace);
+  });
+}
+
+// Median filtering of a batch of frames by local sorting, see Filter.
+template<typename Dtype>
+bool FrameBatchFilter::FilterByLocalSort(const MedianFilter<Dtype>& filter,
+  const Dtype* const* host_srcs, Dtype* const* host_dsts, int frame_num,
+  int width, int height) {
+  assert(0 == frame_num || nullptr != host_srcs);
+  assert(0 == frame_num || nullptr != host_dsts);
+  if (!ReserveWorkspaces(filter.GetWorkspaceSize(width, height))) {
+    return false;
+  }
+  return Run(frame_num, [&](int k, FilterWorkspace* workspace) {
+    return filter.FilterByLocalSort(host_srcs[k], host_dsts[k], width,
+      height, workspace);
+  });
+}
+
+// Median filtering of a batch of unsigned char frames, see Filter.
+bool FrameBatchFilter::FilterByHistogram(const UcharMedianFilter& filter,
+  const unsigned char* const* host_srcs, unsigned char* const* host_dsts,
+  int frame_num, int width, int height) {
+  assert(0 == frame_num || nullptr != host_srcs);
+  assert(0 == frame_num || nullptr != host_dsts);
+  if (!ReserveWorkspaces(filter.GetWorkspaceSize(width, height))) {
+    return false;
+  }
+  return Run(frame_num, [&](int k, FilterWorkspace* workspace) {
+    return filter.FilterByHistogram(host_srcs[k], host_dsts[k], width,
+      height, workspace);
+  });
+}
+
+// Grow the workspace of every worker, they only grow so a pool used for one
+// frame size reserves once.
+bool FrameBatchFilter::ReserveWorkspaces(size_t size) {
+  for (int t = 0; t < thread_num_; t++) {
+    if (!workspaces_[t].Reserve(size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+* Run a task on every frame of a batch and wait for all of them.
+* Worker t first gets the frames [frame_num * t / n, frame_num * (t + 1) / n).
+* Return false if a task failed or the ranges could not be allocated.
+*/
+bool FrameBatchFilter::Run(int frame_num, const FrameTask& task) {
+  assert(0 <= frame_num);
+  if (nullptr == ranges_) {
+    return false;
+  }
+  for (int t = 0; t < thread_num_; t++) {
+    ranges_[t].next = static_cast<int>(
+      static_cast<long long>(frame_num) * t / thread_num_);
+    ranges_[t].end = static_cast<int>(
+      static_cast<long long>(frame_num) * (t + 1) / thread_num_);
+  }
+  failed_ = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = &task;
+    busy_num_ = thread_num_ - 1;
+    generation_++;
+  }
+  start_cond_.notify_all();
+  RunFrames(0);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cond_.wait(lock, [this] { return 0 == busy_num_; });
+    task_ = nullptr;
+  }
+  return !failed_;
+}
+
+void FrameBatchFilter::WorkerLoop(int worker) {
+  int generation = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_cond_.wait(lock, [&] {
+        return stop_ || generation != generation_;
+      });
+      if (stop_) {
+        return;
+      }
+      generation = generation_;
+    }
+    RunFrames(worker);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      busy_num_--;
+      if (0 == busy_num_) {
+        done_cond_.notify_one();
+      }
+    }
+  }
+}
+
+// Take the frames of the own range first, then steal from the ranges of the
+// next workers in turn until every range is empty. Every frame is traced,
+// a stolen one is recorded as batch_steal.
+void FrameBatchFilter::RunFrames(int worker) {
+  FilterWorkspace* workspace = workspaces_ + worker;
+  ThreadTraceBuffer thread_trace("frame batch");
+  TraceBuffer* trace = thread_trace.get();
+  for (int k = 0; k < thread_num_; k++) {
+    FrameRange* range = ranges_ + (worker + k) % thread_num_;
+    for (;;) {
+      int frame = range->next.fetch_add(1);
+      if (frame >= range->end) {
+        break;
+      }
+      TraceScope span(trace, 0 == k ? "batch_frame" : "batch_steal", frame);
+      if (!(*task_)(frame, workspace)) {
+        failed_ = true;
+      }
+    }
+  }
+}
+
+template bool FrameBatchFilter::Filter<unsigned char>(
+  const MeanFilter<unsigned char>& filter,
+  const unsigned char* const* host_srcs, unsigned char* const* host_dsts,
+  int frame_num, int width, int height);
+template bool FrameBatchFilter::Filter<float>(const MeanFilter<float>& filter,
+  const float* const* host_srcs, float* const* host_dsts, int frame_num,
+  int width, int height);
+template bool FrameBatchFilter::Filter<double>(
+  const MeanFilter<double>& filter, const double* const* host_srcs,
+  double* const* host_dsts, int frame_num, int width, int height);
+template bool FrameBatchFilter::FilterByHistogram<unsigned char>(
+  const MedianFilter<unsigned char>& filter,
+  const unsigned char* const* host_srcs, unsigned char* const* host_dsts,
+  int frame_num, int width, int height);
+template bool FrameBatchFilter::FilterByHistogram<float>(
+  const MedianFilter<float>& filter, const float* const* host_srcs,
+  float* const* host_dsts, int frame_num, int width, int height);
+template bool FrameBatchFilter::FilterByHistogram<double>(
+  const MedianFilter<double>& filter, const double* const* host_srcs,
+  double* const* host_dsts, int frame_num, int width, int height);
+template bool FrameBatchFilter::FilterByLocalSort<unsigned char>(
+  const MedianFilter<unsigned char>& filter,
+  const unsigned char* const* host_srcs, unsigned char* const* host_dsts,
+  int frame_num, int width, int height);
+template bool FrameBatchFilter::FilterByLocalSort<float>(
+  const MedianFilter<float>& filter, const float* const* host_srcs,
+  float* const* host_dsts, int frame_num, int width, int height);
+template bool FrameBatchFilter::FilterByLocalSort<double>(
+  const MedianFilter<double>& filter, const double* const* host_srcs,
+  double* const* host_dsts, int frame_num, int width, int height);
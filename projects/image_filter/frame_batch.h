@@ -0,0 +1,80 @@
+#ifndef IMAGE_IMAGE_FILTER_FRAME_BATCH_H_
+#define IMAGE_IMAGE_FILTER_FRAME_BATCH_H_
+#include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "image_filter/filter_workspace.h"
+#include "image_filter/mean_filter.h"
+#include "image_filter/median_filter.h"
+
+/**
+* Pool of worker threads filtering batches of same-sized frames, one frame
+* per worker at a time.
+* The threads live as long as the pool, and every worker keeps its own
+* workspace from batch to batch, so a batch allocates nothing once the
+* workspaces have grown to the frame size. The frames of a batch are split
+* into one range per worker, a worker which has finished its range steals
+* the remaining frames of the others, so uneven frames still keep all the
+* cores busy. The calling thread is worker 0.
+* The filters keep their own settings, a MeanFilter with a thread_num above
+* 1 also splits every frame, set it to 1 to run on the frames only.
+*/
+class FrameBatchFilter
+{
+public:
+  explicit FrameBatchFilter(int thread_num);
+  ~FrameBatchFilter();
+  // Filter frame_num frames, host_srcs[k] is filtered to host_dsts[k].
+  // Return false if a workspace can not be reserved or the pool could not
+  // allocate its ranges.
+  template<typename Dtype>
+  bool Filter(const MeanFilter<Dtype>& filter, const Dtype* const* host_srcs,
+    Dtype* const* host_dsts, int frame_num, int width, int height);
+  template<typename Dtype>
+  bool FilterByHistogram(const MedianFilter<Dtype>& filter,
+    const Dtype* const* host_srcs, Dtype* const* host_dsts, int frame_num,
+    int width, int height);
+  template<typename Dtype>
+  bool FilterByLocalSort(const MedianFilter<Dtype>& filter,
+    const Dtype* const* host_srcs, Dtype* const* host_dsts, int frame_num,
+    int width, int height);
+  bool FilterByHistogram(const UcharMedianFilter& filter,
+    const unsigned char* const* host_srcs, unsigned char* const* host_dsts,
+    int frame_num, int width, int height);
+  int thread_num() const { return thread_num_; }
+private:
+  // Filter one frame with the workspace of the worker running it.
+  typedef std::function<bool(int, FilterWorkspace*)> FrameTask;
+  // Frames [next, end) of a worker, next is taken by the owner and thieves.
+  // Padded to a cache line, the workers hit their own counter all the time.
+  struct FrameRange {
+    std::atomic<int> next;
+    int end;
+    char padding[CACHE_LINE_SIZE - sizeof(std::atomic<int>) - sizeof(int)];
+  };
+  bool ReserveWorkspaces(size_t size);
+  bool Run(int frame_num, const FrameTask& task);
+  void WorkerLoop(int worker);
+  void RunFrames(int worker);
+  int thread_num_;
+  std::vector<std::thread> threads_;
+  FilterWorkspace* workspaces_;
+  // The ranges, in a cache line aligned block.
+  FrameRange* ranges_;
+  AlignedBlock ranges_block_;
+  std::mutex mutex_;
+  std::condition_variable start_cond_;
+  std::condition_variable done_cond_;
+  // Counts the batches, a worker runs a batch when it changes.
+  int generation_;
+  int busy_num_;
+  bool stop_;
+  const FrameTask* task_;
+  std::atomic<bool> failed_;
+  DISABLE_COPY_AND_ASSIGN(FrameBatchFilter);
+};
+#endif  // !IMAGE_IMAGE_FILTER_FRAME_BATCH_H_
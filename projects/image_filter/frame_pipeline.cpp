@@ -0,0 +1,265 @@
+#include <chrono>
+#include "image_filter/frame_pipeline.h"
+
+template class FramePipeline<unsigned char>;
+template class FramePipeline<float>;
+template class FramePipeline<double>;
+
+SlotQueue::SlotQueue(int capacity) : cells_(nullptr), mask_(0) {
+  assert(0 < capacity);
+  // A full cell of one round must not look free for the next one, so there
+  // are at least two cells.
+  size_t size = 2;
+  while (size < static_cast<size_t>(capacity)) {
+    size <<= 1;
+  }
+  cells_ = new Cell[size];
+  mask_ = size - 1;
+  for (size_t i = 0; i < size; i++) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  push_pos_.store(0, std::memory_order_relaxed);
+  pop_pos_.store(0, std::memory_order_relaxed);
+}
+
+SlotQueue::~SlotQueue() {
+  delete[] cells_;
+}
+
+// A cell is free for the push at pos when its sequence is pos, the push
+// makes it pos + 1, which is what the pop at pos waits for.
+bool SlotQueue::TryPush(int value) {
+  size_t pos = push_pos_.load(std::memory_order_relaxed);
+  Cell* cell = nullptr;
+  for (;;) {
+    cell = cells_ + (pos & mask_);
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    ptrdiff_t diff =
+      static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(pos);
+    if (0 == diff) {
+      if (push_pos_.compare_exchange_weak(pos, pos + 1,
+        std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = push_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  cell->value = value;
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+// The pop at pos frees the cell for the push of the next round.
+bool SlotQueue::TryPop(int* value) {
+  size_t pos = pop_pos_.load(std::memory_order_relaxed);
+  Cell* cell = nullptr;
+  for (;;) {
+    cell = cells_ + (pos & mask_);
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    ptrdiff_t diff =
+      static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(pos + 1);
+    if (0 == diff) {
+      if (pop_pos_.compare_exchange_weak(pos, pos + 1,
+        std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = pop_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  *value = cell->value;
+  cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+  return true;
+}
+
+// Wait a little longer every time a queue is found full or empty: spin
+// first, then yield, then sleep, so an idle stage does not burn a core.
+static void Backoff(int* round) {
+  if (*round >= 64) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  } else if (*round >= 16) {
+    std::this_thread::yield();
+  }
+  (*round)++;
+}
+
+/**
+* \param frame_size   Elements of a frame, the same for source and output.
+* \param worker_num   Number of filter threads.
+* \param queue_size   Frames held between two stages.
+*/
+template<typename Dtype>
+FramePipeline<Dtype>::FramePipeline(size_t frame_size, int worker_num,
+  int queue_size)
+  : frame_size_(frame_size), worker_num_(worker_num),
+  slot_num_(queue_size * 2 + worker_num + 2),
+  free_queue_(queue_size * 2 + worker_num + 2), load_queue_(queue_size),
+  filter_queue_(queue_size), store_queue_(queue_size),
+  slots_(queue_size * 2 + worker_num + 2), workspaces_(nullptr),
+  stop_(false), submitted_(0), completed_(0) {
+  assert(0 < frame_size);
+  assert(0 < worker_num);
+  assert(0 < queue_size);
+  workspaces_ = new FilterWorkspace[worker_num];
+}
+
+template<typename Dtype>
+FramePipeline<Dtype>::~FramePipeline() {
+  Finish();
+  delete[] workspaces_;
+}
+
+template<typename Dtype>
+bool FramePipeline<Dtype>::Start(const LoadFunc& load,
+  const FilterFunc& filter, const StoreFunc& store, size_t workspace_size) {
+  assert(threads_.empty());
+  if (!frame_memory_.Reserve(
+    FilterWorkspace::SizeOf<Dtype>(frame_size_) * 2 * slot_num_)) {
+    return false;
+  }
+  for (int k = 0; k < worker_num_; k++) {
+    if (!workspaces_[k].Reserve(workspace_size)) {
+      return false;
+    }
+  }
+  for (int s = 0; s < slot_num_; s++) {
+    slots_[s].host_src = frame_memory_.Acquire<Dtype>(frame_size_);
+    slots_[s].host_dst = frame_memory_.Acquire<Dtype>(frame_size_);
+    Push(&free_queue_, s, nullptr);
+  }
+  load_ = load;
+  filter_ = filter;
+  store_ = store;
+  stop_ = false;
+  threads_.push_back(std::thread(&FramePipeline::LoadLoop, this));
+  for (int k = 0; k < worker_num_; k++) {
+    threads_.push_back(std::thread(&FramePipeline::FilterLoop, this, k));
+  }
+  threads_.push_back(std::thread(&FramePipeline::StoreLoop, this));
+  return true;
+}
+
+template<typename Dtype>
+std::future<bool> FramePipeline<Dtype>::Submit(int index) {
+  assert(!threads_.empty());
+  ThreadTraceBuffer thread_trace("pipeline submit");
+  TraceBuffer* trace = thread_trace.get();
+  int s = 0;
+  Pop(&free_queue_, &s, trace);
+  FrameSlot& slot = slots_[s];
+  slot.index = index;
+  slot.ok = true;
+  slot.done = std::promise<bool>();
+  std::future<bool> done = slot.done.get_future();
+  submitted_++;
+  Push(&load_queue_, s, trace);
+  return done;
+}
+
+template<typename Dtype>
+void FramePipeline<Dtype>::Finish() {
+  if (threads_.empty()) {
+    return;
+  }
+  int round = 0;
+  while (completed_ != submitted_) {
+    Backoff(&round);
+  }
+  stop_ = true;
+  for (size_t t = 0; t < threads_.size(); t++) {
+    threads_[t].join();
+  }
+  threads_.clear();
+  // Take the slots back, a new Start gives them out again
+  int s = 0;
+  while (free_queue_.TryPop(&s)) {}
+  frame_memory_.Release();
+}
+
+// Wait while the queue is full, the backpressure of the next stage. Only
+// a wait is traced, a push which goes through at once is not.
+template<typename Dtype>
+void FramePipeline<Dtype>::Push(SlotQueue* queue, int slot,
+  TraceBuffer* trace) {
+  if (queue->TryPush(slot)) {
+    return;
+  }
+  TraceScope wait(trace, "wait_full_queue", slot);
+  int round = 0;
+  do {
+    Backoff(&round);
+  } while (!queue->TryPush(slot));
+}
+
+// Wait while the queue is empty, return false once the pipeline stops.
+template<typename Dtype>
+bool FramePipeline<Dtype>::Pop(SlotQueue* queue, int* slot,
+  TraceBuffer* trace) {
+  if (queue->TryPop(slot)) {
+    return true;
+  }
+  TraceScope wait(trace, "wait_empty_queue", -1);
+  int round = 0;
+  do {
+    if (stop_) {
+      return false;
+    }
+    Backoff(&round);
+  } while (!queue->TryPop(slot));
+  return true;
+}
+
+template<typename Dtype>
+void FramePipeline<Dtype>::LoadLoop() {
+  ThreadTraceBuffer thread_trace("pipeline load");
+  TraceBuffer* trace = thread_trace.get();
+  int s = 0;
+  while (Pop(&load_queue_, &s, trace)) {
+    FrameSlot& slot = slots_[s];
+    {
+      TraceScope span(trace, "load", slot.index);
+      slot.ok = load_(slot.index, slot.host_src);
+    }
+    Push(&filter_queue_, s, trace);
+  }
+}
+
+template<typename Dtype>
+void FramePipeline<Dtype>::FilterLoop(int worker) {
+  ThreadTraceBuffer thread_trace("pipeline filter");
+  TraceBuffer* trace = thread_trace.get();
+  int s = 0;
+  while (Pop(&filter_queue_, &s, trace)) {
+    FrameSlot& slot = slots_[s];
+    if (slot.ok) {
+      TraceScope span(trace, "filter", slot.index);
+      slot.ok = filter_(slot.host_src, slot.host_dst, workspaces_ + worker);
+    }
+    Push(&store_queue_, s, trace);
+  }
+}
+
+template<typename Dtype>
+void FramePipeline<Dtype>::StoreLoop() {
+  ThreadTraceBuffer thread_trace("pipeline store");
+  TraceBuffer* trace = thread_trace.get();
+  int s = 0;
+  while (Pop(&store_queue_, &s, trace)) {
+    FrameSlot& slot = slots_[s];
+    if (slot.ok) {
+      TraceScope span(trace, "store", slot.index);
+      slot.ok = store_(slot.index, slot.host_dst);
+    }
+    if (done_) {
+      done_(slot.index, slot.ok);
+    }
+    slot.done.set_value(slot.ok);
+    completed_++;
+    Push(&free_queue_, s, trace);
+  }
+}
@@ -0,0 +1,120 @@
+#ifndef IMAGE_IMAGE_FILTER_FRAME_PIPELINE_H_
+#define IMAGE_IMAGE_FILTER_FRAME_PIPELINE_H_
+#include <assert.h>
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <thread>
+#include <vector>
+#include "image_filter/filter_workspace.h"
+#include "image_filter/trace_recorder.h"
+
+/**
+* Bounded lock-free multi-producer multi-consumer queue of ints.
+* Every cell carries a sequence number telling whether it is free for the
+* push of a round or full for the pop of it, so pushes and pops only race
+* on one compare-and-swap of their position.
+*/
+class SlotQueue
+{
+public:
+  // The capacity is rounded up to a power of two, at least 2.
+  explicit SlotQueue(int capacity);
+  ~SlotQueue();
+  // Return false if the queue is full.
+  bool TryPush(int value);
+  // Return false if the queue is empty.
+  bool TryPop(int* value);
+  int capacity() const { return static_cast<int>(mask_ + 1); }
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    int value;
+  };
+  Cell* cells_;
+  size_t mask_;
+  // Positions on their own cache lines, producers and consumers do not
+  // share a line.
+  char padding0_[CACHE_LINE_SIZE];
+  std::atomic<size_t> push_pos_;
+  char padding1_[CACHE_LINE_SIZE];
+  std::atomic<size_t> pop_pos_;
+  char padding2_[CACHE_LINE_SIZE];
+  DISABLE_COPY_AND_ASSIGN(SlotQueue);
+};
+
+/**
+* Load-filter-store pipeline of frames, so the disk and the cores work at
+* the same time.
+* A loader thread reads the frames into slot buffers, worker_num filter
+* threads filter them, each one with its own workspace, and a store thread
+* writes them out. The stages are linked by SlotQueues of queue_size
+* frames. A stage waits when the next queue is full, and Submit waits
+* when all the slots are taken, so a slow stage throttles the ones before
+* it instead of piling up frames. The frames can complete out of order,
+* each one completes its future and calls the done callback.
+* With a TraceRecorder installed, every stage records its frames and its
+* waits on a full or an empty queue.
+*/
+template<typename Dtype>
+class FramePipeline
+{
+public:
+  // Read frame index into host_src, frame_size elements.
+  typedef std::function<bool(int, Dtype*)> LoadFunc;
+  // Filter host_src to host_dst with the workspace of the worker.
+  typedef std::function<bool(const Dtype*, Dtype*, FilterWorkspace*)>
+    FilterFunc;
+  // Write host_dst of frame index.
+  typedef std::function<bool(int, const Dtype*)> StoreFunc;
+  // Called by the store thread when frame index is done.
+  typedef std::function<void(int, bool)> DoneFunc;
+  FramePipeline(size_t frame_size, int worker_num, int queue_size);
+  ~FramePipeline();
+  // Only allowed before Start.
+  void set_done_callback(const DoneFunc& done) { done_ = done; }
+  // Allocate the slots and the workspaces and start the threads.
+  // Return false if the memory can not be allocated.
+  bool Start(const LoadFunc& load, const FilterFunc& filter,
+    const StoreFunc& store, size_t workspace_size);
+  // Queue frame index. The future is true if the frame was loaded, filtered
+  // and stored.
+  std::future<bool> Submit(int index);
+  // Wait for all the frames submitted and stop the threads.
+  void Finish();
+private:
+  // A slot moves from stage to stage, then back to the free queue.
+  struct FrameSlot {
+    int index;
+    bool ok;
+    Dtype* host_src;
+    Dtype* host_dst;
+    std::promise<bool> done;
+  };
+  void Push(SlotQueue* queue, int slot, TraceBuffer* trace);
+  bool Pop(SlotQueue* queue, int* slot, TraceBuffer* trace);
+  void LoadLoop();
+  void FilterLoop(int worker);
+  void StoreLoop();
+  size_t frame_size_;
+  int worker_num_;
+  int slot_num_;
+  SlotQueue free_queue_;
+  SlotQueue load_queue_;
+  SlotQueue filter_queue_;
+  SlotQueue store_queue_;
+  std::vector<FrameSlot> slots_;
+  FilterWorkspace frame_memory_;
+  FilterWorkspace* workspaces_;
+  std::vector<std::thread> threads_;
+  LoadFunc load_;
+  FilterFunc filter_;
+  StoreFunc store_;
+  DoneFunc done_;
+  std::atomic<bool> stop_;
+  std::atomic<int> submitted_;
+  std::atomic<int> completed_;
+  DISABLE_COPY_AND_ASSIGN(FramePipeline);
+};
+#endif  // !IMAGE_IMAGE_FILTER_FRAME_PIPELINE_H_
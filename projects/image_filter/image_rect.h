@@ -0,0 +1,40 @@
+#ifndef IMAGE_IMAGE_FILTER_IMAGE_RECT_H_
+#define IMAGE_IMAGE_FILTER_IMAGE_RECT_H_
+
+// How the pixels of an image are stored.
+enum ImageLayout {
+  // Each row is contiguous, the pitch is the distance between two rows.
+  LAYOUT_ROW_MAJOR = 0,
+  // Each column is contiguous, like A-scans of a B-scan, the pitch is the
+  // distance between two columns.
+  LAYOUT_COLUMN_MAJOR = 1
+};
+
+// A rectangle of an image, in pixels.
+struct ImageRect {
+  ImageRect() : x(0), y(0), width(0), height(0) {}
+  ImageRect(int x, int y, int width, int height)
+    : x(x), y(y), width(width), height(height) {}
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+// True if rect is a non empty rectangle inside a width by height image.
+inline bool IsRectInside(const ImageRect& rect, int width, int height) {
+  return 0 <= rect.x && 0 <= rect.y && 0 < rect.width && 0 < rect.height &&
+    rect.x + rect.width <= width && rect.y + rect.height <= height;
+}
+
+// The same rectangle in the transposed image.
+inline ImageRect TransposeRect(const ImageRect& rect) {
+  return ImageRect(rect.y, rect.x, rect.height, rect.width);
+}
+
+// Pitch of a packed image in elements, a row or a column long.
+inline int GetPackedPitch(int width, int height, int channels,
+  ImageLayout layout) {
+  return (LAYOUT_COLUMN_MAJOR == layout ? height : width) * channels;
+}
+#endif  // !IMAGE_IMAGE_FILTER_IMAGE_RECT_H_
@@ -0,0 +1,341 @@
+#include <ctype.h>
+#include <string.h>
+#include <string>
+#include "image_filter/mapped_image.h"
+
+// Sizes of the headers of the BMP written.
+#define BMP_FILE_HEADER_SIZE 14
+#define BMP_INFO_HEADER_SIZE 40
+// Bytes of the gray palette of an 8 bits BMP.
+#define BMP_PALETTE_SIZE (GRAY_LEVEL_MAX * 4)
+// Largest width, height or max value read from a header.
+#define IMAGE_FILE_VALUE_MAX (1 << 30)
+
+static unsigned int ReadLittleEndian(const unsigned char* data, int bytes) {
+  unsigned int value = 0;
+  for (int k = bytes - 1; k >= 0; k--) {
+    value = (value << 8) | data[k];
+  }
+  return value;
+}
+
+static void WriteLittleEndian(unsigned int value, int bytes,
+  unsigned char* data) {
+  for (int k = 0; k < bytes; k++) {
+    data[k] = static_cast<unsigned char>(value >> (8 * k));
+  }
+}
+
+// Read a number of a PGM header from pos, after whitespace and comments.
+static bool ReadPgmNumber(const unsigned char* data, long long size,
+  long long* pos, int* value) {
+  long long k = *pos;
+  while (k < size && (isspace(data[k]) || '#' == data[k])) {
+    if ('#' == data[k]) {
+      while (k < size && '\n' != data[k] && '\r' != data[k]) {
+        k++;
+      }
+    } else {
+      k++;
+    }
+  }
+  if (k >= size || !isdigit(data[k])) {
+    return false;
+  }
+  long long number = 0;
+  while (k < size && isdigit(data[k])) {
+    number = number * 10 + (data[k] - '0');
+    if (number > IMAGE_FILE_VALUE_MAX) {
+      return false;
+    }
+    k++;
+  }
+  *pos = k;
+  *value = static_cast<int>(number);
+  return true;
+}
+
+MappedImage::MappedImage() : format_(IMAGE_FILE_RAW), data_(nullptr),
+  width_(0), height_(0), channels_(0), value_size_(0), pitch_(0),
+  bottom_up_(false), max_value_(0), writable_(false) {}
+
+void MappedImage::Close() {
+  file_.Close();
+  data_ = nullptr;
+  width_ = 0;
+  height_ = 0;
+  channels_ = 0;
+  value_size_ = 0;
+  pitch_ = 0;
+  bottom_up_ = false;
+  max_value_ = 0;
+  writable_ = false;
+}
+
+unsigned char* MappedImage::MapFile() {
+  long long size = file_.size();
+  if (size <= 0 || static_cast<unsigned long long>(size) >
+    static_cast<size_t>(-1)) {
+    return nullptr;
+  }
+  return reinterpret_cast<unsigned char*>(
+    file_.Map(0, static_cast<size_t>(size)));
+}
+
+unsigned char* MappedImage::MapNewFile(const char* path, long long size) {
+  Close();
+  if (!file_.OpenWrite(path, size)) {
+    return nullptr;
+  }
+  unsigned char* data = MapFile();
+  if (nullptr == data) {
+    Close();
+    return nullptr;
+  }
+  writable_ = true;
+  return data;
+}
+
+bool MappedImage::SetLayout(ImageFileFormat format, unsigned char* data,
+  long long available, int width, int height, int channels, int value_size,
+  int pitch) {
+  if (width <= 0 || height <= 0 || channels <= 0 ||
+    channels > CHANNEL_NUM_MAX || value_size <= 0 ||
+    pitch < static_cast<long long>(width) * channels) {
+    return false;
+  }
+  long long size = (static_cast<long long>(pitch) * (height - 1) +
+    static_cast<long long>(width) * channels) * value_size;
+  if (size > available) {
+    return false;
+  }
+  format_ = format;
+  data_ = data;
+  width_ = width;
+  height_ = height;
+  channels_ = channels;
+  value_size_ = value_size;
+  pitch_ = pitch;
+  return true;
+}
+
+/**
+* Binary PGM: "P5", width, height and max value in ASCII, separated by
+* whitespace or comments, then one whitespace and the rows. Only a max value
+* up to 255, one byte per value, is mapped.
+*/
+bool MappedImage::OpenPgm(const char* path) {
+  Close();
+  if (!file_.OpenRead(path)) {
+    return false;
+  }
+  unsigned char* data = MapFile();
+  long long size = file_.size();
+  if (nullptr == data || size < 2 || 'P' != data[0] || '5' != data[1]) {
+    Close();
+    return false;
+  }
+  long long pos = 2;
+  int values[3] = { 0, 0, 0 };
+  for (int k = 0; k < 3; k++) {
+    if (!ReadPgmNumber(data, size, &pos, values + k)) {
+      Close();
+      return false;
+    }
+  }
+  if (pos >= size || !isspace(data[pos]) || values[2] <= 0 ||
+    values[2] > 255) {
+    Close();
+    return false;
+  }
+  pos++;
+  if (!SetLayout(IMAGE_FILE_PGM, data + pos, size - pos, values[0],
+    values[1], 1, 1, values[0])) {
+    Close();
+    return false;
+  }
+  max_value_ = values[2];
+  return true;
+}
+
+/**
+* Uncompressed BMP of 8 or 24 bits. The rows are padded to 4 bytes and
+* stored bottom-up if the height is positive. The palette of an 8 bits one
+* must be the gray ramp, so its indices are the gray levels.
+*/
+bool MappedImage::OpenBmp(const char* path) {
+  Close();
+  if (!file_.OpenRead(path)) {
+    return false;
+  }
+  unsigned char* data = MapFile();
+  long long size = file_.size();
+  if (nullptr == data ||
+    size < BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE ||
+    'B' != data[0] || 'M' != data[1]) {
+    Close();
+    return false;
+  }
+  long long offset = ReadLittleEndian(data + 10, 4);
+  long long info_size = ReadLittleEndian(data + 14, 4);
+  int width = static_cast<int>(ReadLittleEndian(data + 18, 4));
+  int height = static_cast<int>(ReadLittleEndian(data + 22, 4));
+  int bits = static_cast<int>(ReadLittleEndian(data + 28, 2));
+  unsigned int compression = ReadLittleEndian(data + 30, 4);
+  if (0 != compression || (8 != bits && 24 != bits) || width <= 0 ||
+    width > IMAGE_FILE_VALUE_MAX / 4 || 0 == height ||
+    height < -IMAGE_FILE_VALUE_MAX || height > IMAGE_FILE_VALUE_MAX ||
+    offset >= size) {
+    Close();
+    return false;
+  }
+  if (8 == bits) {
+    long long colors = ReadLittleEndian(data + 46, 4);
+    const unsigned char* palette = data + BMP_FILE_HEADER_SIZE + info_size;
+    if (0 == colors) {
+      colors = GRAY_LEVEL_MAX;
+    }
+    if (colors > GRAY_LEVEL_MAX ||
+      BMP_FILE_HEADER_SIZE + info_size + colors * 4 > offset) {
+      Close();
+      return false;
+    }
+    for (int c = 0; c < colors; c++) {
+      if (c != palette[c * 4] || c != palette[c * 4 + 1] ||
+        c != palette[c * 4 + 2]) {
+        Close();
+        return false;
+      }
+    }
+  }
+  int channels = bits / 8;
+  if (!SetLayout(IMAGE_FILE_BMP, data + offset, size - offset, width,
+    height < 0 ? -height : height, channels,
+    1, (width * channels + 3) / 4 * 4)) {
+    Close();
+    return false;
+  }
+  bottom_up_ = height > 0;
+  return true;
+}
+
+bool MappedImage::OpenRaw(const char* path, int width, int height,
+  int channels, int value_size, long long offset) {
+  Close();
+  // Keep the values aligned, the mapping starts on a page.
+  if (offset < 0 || value_size <= 0 || 0 != offset % value_size ||
+    !file_.OpenRead(path)) {
+    Close();
+    return false;
+  }
+  unsigned char* data = MapFile();
+  if (nullptr == data || offset >= file_.size() ||
+    !SetLayout(IMAGE_FILE_RAW, data + offset, file_.size() - offset, width,
+    height, channels, value_size, width * channels)) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool MappedImage::CreatePgm(const char* path, int width, int height,
+  int max_value) {
+  Close();
+  if (width <= 0 || height <= 0 || max_value <= 0 || max_value > 255) {
+    return false;
+  }
+  std::string header = "P5\n" + std::to_string(width) + " " +
+    std::to_string(height) + "\n" + std::to_string(max_value) + "\n";
+  long long pixel_size = static_cast<long long>(width) * height;
+  unsigned char* data = MapNewFile(path,
+    static_cast<long long>(header.size()) + pixel_size);
+  if (nullptr == data) {
+    return false;
+  }
+  memcpy(data, header.data(), header.size());
+  SetLayout(IMAGE_FILE_PGM, data + header.size(), pixel_size, width, height,
+    1, 1, width);
+  max_value_ = max_value;
+  return true;
+}
+
+bool MappedImage::CreateBmp(const char* path, int width, int height,
+  int channels, bool bottom_up) {
+  Close();
+  if (width <= 0 || height <= 0 || (1 != channels && 3 != channels)) {
+    return false;
+  }
+  int pitch = (width * channels + 3) / 4 * 4;
+  long long offset = BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE +
+    (1 == channels ? BMP_PALETTE_SIZE : 0);
+  long long pixel_size = static_cast<long long>(pitch) * height;
+  if (offset + pixel_size > 0xFFFFFFFFLL) {
+    return false;
+  }
+  unsigned char* data = MapNewFile(path, offset + pixel_size);
+  if (nullptr == data) {
+    return false;
+  }
+  data[0] = 'B';
+  data[1] = 'M';
+  WriteLittleEndian(static_cast<unsigned int>(offset + pixel_size), 4,
+    data + 2);
+  WriteLittleEndian(static_cast<unsigned int>(offset), 4, data + 10);
+  unsigned char* info = data + BMP_FILE_HEADER_SIZE;
+  WriteLittleEndian(BMP_INFO_HEADER_SIZE, 4, info);
+  WriteLittleEndian(width, 4, info + 4);
+  WriteLittleEndian(static_cast<unsigned int>(bottom_up ? height : -height),
+    4, info + 8);
+  WriteLittleEndian(1, 2, info + 12);
+  WriteLittleEndian(channels * 8, 2, info + 14);
+  WriteLittleEndian(static_cast<unsigned int>(pixel_size), 4, info + 20);
+  // 72 dpi.
+  WriteLittleEndian(2835, 4, info + 24);
+  WriteLittleEndian(2835, 4, info + 28);
+  if (1 == channels) {
+    WriteLittleEndian(GRAY_LEVEL_MAX, 4, info + 32);
+    unsigned char* palette = info + BMP_INFO_HEADER_SIZE;
+    for (int c = 0; c < GRAY_LEVEL_MAX; c++) {
+      palette[c * 4] = static_cast<unsigned char>(c);
+      palette[c * 4 + 1] = static_cast<unsigned char>(c);
+      palette[c * 4 + 2] = static_cast<unsigned char>(c);
+    }
+  }
+  SetLayout(IMAGE_FILE_BMP, data + offset, pixel_size, width, height,
+    channels, 1, pitch);
+  bottom_up_ = bottom_up;
+  return true;
+}
+
+bool MappedImage::CreateRaw(const char* path, int width, int height,
+  int channels, int value_size) {
+  Close();
+  if (width <= 0 || height <= 0 || channels <= 0 ||
+    channels > CHANNEL_NUM_MAX || value_size <= 0) {
+    return false;
+  }
+  long long pixel_size =
+    static_cast<long long>(width) * height * channels * value_size;
+  unsigned char* data = MapNewFile(path, pixel_size);
+  if (nullptr == data) {
+    return false;
+  }
+  SetLayout(IMAGE_FILE_RAW, data, pixel_size, width, height, channels,
+    value_size, width * channels);
+  return true;
+}
+
+bool MappedImage::CreateLike(const char* path, const MappedImage& image) {
+  assert(image.is_open());
+  switch (image.format()) {
+  case IMAGE_FILE_PGM:
+    return CreatePgm(path, image.width(), image.height(),
+      image.max_value());
+  case IMAGE_FILE_BMP:
+    return CreateBmp(path, image.width(), image.height(), image.channels(),
+      image.bottom_up());
+  default:
+    return CreateRaw(path, image.width(), image.height(), image.channels(),
+      image.value_size());
+  }
+}
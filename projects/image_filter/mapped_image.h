@@ -0,0 +1,103 @@
+#ifndef IMAGE_IMAGE_FILTER_MAPPED_IMAGE_H_
+#define IMAGE_IMAGE_FILTER_MAPPED_IMAGE_H_
+#include <assert.h>
+#include <stddef.h>
+#include "image_filter/tiled_file_filter.h"
+
+// Layouts of the image files MappedImage maps.
+enum ImageFileFormat {
+  // Pixels only, row by row, channel values interleaved.
+  IMAGE_FILE_RAW = 0,
+  // Binary PGM, P5, of 8 bits.
+  IMAGE_FILE_PGM = 1,
+  // Uncompressed BMP, 8 bits with a gray palette or 24 bits BGR.
+  IMAGE_FILE_BMP = 2
+};
+
+/**
+* An image file mapped in memory. The filters read the source pixels and
+* write the output ones in place in the mappings through pixels, pitch and
+* the roi API, nothing is decoded or copied:
+*   filter.set_channel_num(src.channels());
+*   dst.CreateLike(dst_path, src);
+*   filter.FilterByHistogram(src.pixels<unsigned char>(), src.pitch(),
+*     dst.mutable_pixels<unsigned char>(), dst.pitch(), src.width(),
+*     src.height(), ImageRect(0, 0, src.width(), src.height()));
+* The rows are kept in file order. A bottom-up BMP, the layout of the
+* bundled images, is then filtered upside down, which gives the same output
+* since the windows and the border modes are symmetric, and CreateLike
+* writes it bottom-up too. A 24 bits BMP has 3 channels. A 16 bits PGM is
+* refused: its values are big-endian and may start on an odd byte, and no
+* filter takes 2 bytes values, so they can not be filtered in place.
+* The whole file is mapped, so it must fit the address space.
+*/
+class MappedImage
+{
+public:
+  MappedImage();
+  // Map an existing file for reading. Return false if it can not be mapped
+  // or its layout is not supported.
+  bool OpenPgm(const char* path);
+  bool OpenBmp(const char* path);
+  // The pixels start at offset, value_size bytes per value.
+  bool OpenRaw(const char* path, int width, int height, int channels,
+    int value_size, long long offset = 0);
+  // Create a file, an existing one is truncated, and map it for writing.
+  // The pixels are zero.
+  bool CreatePgm(const char* path, int width, int height, int max_value);
+  bool CreateBmp(const char* path, int width, int height, int channels,
+    bool bottom_up = true);
+  bool CreateRaw(const char* path, int width, int height, int channels,
+    int value_size);
+  // Create a file of the format, size and row order of image.
+  bool CreateLike(const char* path, const MappedImage& image);
+  // Unmap, the pixels written are in the file.
+  void Close();
+  // First row of the file, value_size must be sizeof(T).
+  template<typename T>
+  const T* pixels() const {
+    assert(sizeof(T) == static_cast<size_t>(value_size_));
+    return reinterpret_cast<const T*>(data_);
+  }
+  template<typename T>
+  T* mutable_pixels() {
+    assert(sizeof(T) == static_cast<size_t>(value_size_));
+    assert(writable_);
+    return reinterpret_cast<T*>(data_);
+  }
+  bool is_open() const { return nullptr != data_; }
+  ImageFileFormat format() const { return format_; }
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int channels() const { return channels_; }
+  int value_size() const { return value_size_; }
+  // Distance between two rows, in values.
+  int pitch() const { return pitch_; }
+  // The first row of the file is the bottom row of the image.
+  bool bottom_up() const { return bottom_up_; }
+  // Max value of a PGM, at most 255.
+  int max_value() const { return max_value_; }
+private:
+  // Map the file just opened or created, nullptr on failure.
+  unsigned char* MapFile();
+  // Create path with size bytes and map it.
+  unsigned char* MapNewFile(const char* path, long long size);
+  // Set the layout, return false if the pixels do not fit in available
+  // bytes from data.
+  bool SetLayout(ImageFileFormat format, unsigned char* data,
+    long long available, int width, int height, int channels,
+    int value_size, int pitch);
+  MappedFile file_;
+  ImageFileFormat format_;
+  unsigned char* data_;
+  int width_;
+  int height_;
+  int channels_;
+  int value_size_;
+  int pitch_;
+  bool bottom_up_;
+  int max_value_;
+  bool writable_;
+  DISABLE_COPY_AND_ASSIGN(MappedImage);
+};
+#endif  // !IMAGE_IMAGE_FILTER_MAPPED_IMAGE_H_
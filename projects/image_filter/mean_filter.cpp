@@ -1,175 +1,383 @@
+#include <algorithm>
 #include <new>
 #include <memory>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <string.h>
+#include "image_filter/cpu_dispatch.h"
 #include "image_filter/mean_filter.h"
+#include "image_filter/trace_recorder.h"
 
 template class MeanFilter<unsigned char>;
 template class MeanFilter<float>;
 template class MeanFilter<double>;
+template class MeanRowStream<unsigned char>;
+template class MeanRowStream<float>;
+template class MeanRowStream<double>;
 
 /**
-* Extend image edge by copying adjacent pixel
+* Add a source row to the column sums, used when start from a new stripe.
 */
 template<typename Dtype>
-void ExtendMatrixEdge(const Dtype *host_src, Dtype* host_extend_src,
-  int width, int height, int radius) {
-  int width_extend = width + radius * 2;
-  for (int i = 0; i < height; i++) {
-    memcpy_s(host_extend_src + width_extend * (i + radius) + radius,
-      width* sizeof(Dtype), host_src + width * i, width* sizeof(Dtype));
-    for (int j = 0; j < radius; j++) {
-      host_extend_src[(i + radius) * width_extend + j] =
-        host_src[i * width + radius - j];
-      host_extend_src[(i + radius) * width_extend + width + radius + j] =
-        host_src[(i + 1)*width - j];
-    }
-  }
-  for (int i = 0; i < width + radius * 2; i++) {
-    for (int j = 0; j < radius; j++) {
-      host_extend_src[j * width_extend + i]
-        = host_extend_src[(radius * 2 - j) * width_extend + i];
-      host_extend_src[(height - 1 + 2 * radius - j) * (width + radius * 2) + i]
-        = host_extend_src[(height - 1 + j) * width_extend + i];
-    }
+void GetInitSum(const Dtype *row, double* sum_cols, int width) {
+  for (int k = 0; k < width; k++) {
+    sum_cols[k] += row[k];
   }
 }
 
 /**
-* Get initial sum when start from a new row.
+* Convert the sum of a filter window to the mean value.
 */
+inline unsigned char GetMeanValue(double sum, int wnd_size,
+  unsigned char) {
+  return (unsigned char)(round(sum / wnd_size));
+}
+
 template<typename Dtype>
-void GetInitSum(const Dtype *host_src, double* sum_cols,
-  int radius, int width) {
-  int core_size = radius * 2 + 1;
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < core_size; j++) {
-      sum_cols[i] += host_src[i + width * j];
-    }
-  }
+inline Dtype GetMeanValue(double sum, int wnd_size, Dtype) {
+  return static_cast<Dtype>(sum / wnd_size);
 }
 
 /**
-* Update sum when filter core move towards right.
+* Get the mean values of the columns [x_begin, x_end) of a row from the
+* column sums. The columns outside the image are taken from the border, a
+* BORDER_CONSTANT column sums to border_value * (2*r+1).
+* The sums and the row hold channels interleaved values per pixel, all the
+* channels of a pixel are done together.
 */
 template<typename Dtype>
-void UpdateSum(const Dtype *host_src, double* sum_cols,
-  int radius, int height_pos, int width) {
-  for (int k = 0; k < width; k++) {
-    sum_cols[k] -= host_src[k + width * (height_pos - radius)];
-    sum_cols[k] += host_src[k + width * (height_pos + radius + 1)];
+void GetRowMean(const double* sum_cols, Dtype* dst_row, int x_begin,
+  int x_end, int width, int channels, int radius, BorderType border,
+  Dtype border_value) {
+  int core_size = radius * 2 + 1;
+  double border_sum = static_cast<double>(border_value) * core_size;
+  double sum[CHANNEL_NUM_MAX];
+  for (int j = x_begin; j < x_end; j++) {
+    for (int c = 0; c < channels; c++) {
+      sum[c] = 0;
+    }
+    if (radius <= j && j < width - radius) {
+      const double* sum_col = sum_cols + (j - radius) * channels;
+      for (int m = 0; m < core_size * channels; m += channels) {
+        for (int c = 0; c < channels; c++) {
+          sum[c] += sum_col[m + c];
+        }
+      }
+    } else {
+      for (int m = j - radius; m <= j + radius; m++) {
+        int k = BorderInterpolate(m, width, border);
+        for (int c = 0; c < channels; c++) {
+          sum[c] += k < 0 ? border_sum : sum_cols[k * channels + c];
+        }
+      }
+    }
+    Dtype* dst_pixel = dst_row + (j - x_begin) * channels;
+    for (int c = 0; c < channels; c++) {
+      dst_pixel[c] = GetMeanValue(sum[c], core_size * core_size, Dtype());
+    }
   }
 }
 
 /**
-* Mean filtering helper, o(r) for unsigned char
+* Mean filtering helper, o(r)
+* Filter the rows in [row_begin, row_end) of the roi, the column sums are
+* initialized from the first window of the stripe, then updated row by row.
+* Only the columns under the filter windows of the roi are summed, the rows
+* outside the image are read through BorderRow, nothing is copied.
+* stats, if not null, are the stats of the stripe alone. The stripe is
+* traced on the ring of the thread, by its first row, thread_name is the
+* name of a thread started for the stripe, null on the calling thread.
 */
-void MeanFilterHelper(const unsigned char *host_src, unsigned char *host_dst,
-  int width, int height, int radius) {
-  int core_size = radius * 2 + 1;
-  double* sum_cols = nullptr;
-  try {
-    sum_cols = new double[width];
-    memset(sum_cols, 0, sizeof(double) * width);
-  }
-  catch (std::bad_alloc) {
-    exit(1);
-  }
-  GetInitSum(host_src, sum_cols, radius, width);
-  int i = 0;
-  for (int i = radius; i < height - radius - 1; i++) {
-    for (int j = radius; j < width - radius; j++) {
-      double sum = 0;
-      for (int m = 0; m < core_size; m++) {
-        sum += sum_cols[m + j - radius];
-      }
-      host_dst[j + i*width] =
-        (unsigned char)(round(sum / (core_size * core_size)));
+template<typename Dtype>
+void MeanFilterHelper(const Dtype *host_src, int src_pitch, Dtype *host_dst,
+  int dst_pitch, int width, int height, int channels, ImageRect roi,
+  int radius, BorderType border, Dtype border_value, int row_begin,
+  int row_end, double* sum_cols, const Dtype* const_row,
+  FilterStats* stats, const char* thread_name) {
+  ThreadTraceBuffer thread_trace(thread_name);
+  TraceScope span(thread_trace.get(), "mean_stripe",
+    row_begin);
+  int col_begin = (roi.x - radius > 0 ? roi.x - radius : 0) * channels;
+  int col_end = MIN(roi.x + roi.width + radius, width) * channels;
+  int cols = col_end - col_begin;
+  {
+    FILTER_STATS_PHASE(stats, FILTER_PHASE_WINDOW_INIT);
+    memset(sum_cols + col_begin, 0, sizeof(double) * cols);
+    for (int m = -radius; m <= radius; m++) {
+      GetInitSum(BorderRow(host_src, src_pitch, height, row_begin + m,
+        border, const_row) + col_begin, sum_cols + col_begin, cols);
     }
-    UpdateSum(host_src, sum_cols, radius, i, width);
   }
-  for (int j = radius; j < width - radius; j++) {
-    double sum = 0;
-    for (int m = 0; m < core_size; m++) {
-      sum += sum_cols[m + j - radius];
+  FILTER_STATS_PHASE(stats, FILTER_PHASE_SLIDE);
+  for (int i = row_begin; i < row_end; i++) {
+    if (i != row_begin) {
+      UpdateSum(BorderRow(host_src, src_pitch, height, i - radius - 1, border,
+        const_row) + col_begin,
+        BorderRow(host_src, src_pitch, height, i + radius, border,
+        const_row) + col_begin, sum_cols + col_begin, cols);
     }
-    host_dst[j + i*width] =
-      (unsigned char)(round(sum / (core_size * core_size)));
+    GetRowMean(sum_cols,
+      host_dst + static_cast<ptrdiff_t>(i - roi.y) * dst_pitch, roi.x,
+      roi.x + roi.width, width, channels, radius, border, border_value);
   }
-  delete[] sum_cols;
 }
 
 /**
-* Mean filtering helper, o(r)
+* Mean filtering helper, split the rows of the roi into stripes and filter
+* each stripe in its own thread. The stripe bounds only depend on the roi
+* height and thread_num, so the result is deterministic at a fixed thread
+* count. Each stripe takes its own column sums from the workspace, and its
+* own stats, summed to stats once all the stripes are done.
 */
 template<typename Dtype>
-void MeanFilterHelper(const Dtype *host_src, Dtype *host_dst,
-  int width, int height, int radius) {
-  int core_size = radius * 2 + 1;
-  double* sum_cols = nullptr;
-  try {
-    sum_cols = new double[width];
-    memset(sum_cols, 0, sizeof(double) * width);
-  }
-  catch (std::bad_alloc) {
-    exit(1);
-  }
-  GetInitSum(host_src, sum_cols, radius, width);
-  int i = 0;
-  for (int i = radius; i < height - radius - 1; i++) {
-    for (int j = radius; j < width - radius; j++) {
-      double sum = 0;
-      for (int m = 0; m < core_size; m++) {
-        sum += sum_cols[m + j - radius];
-      }
-      host_dst[j + i*width] = static_cast<Dtype>(sum / (core_size * core_size));
+void ParallelMeanFilterHelper(const Dtype *host_src, int src_pitch,
+  Dtype *host_dst, int dst_pitch, int width, int height, int channels,
+  ImageRect roi, int radius, BorderType border, Dtype border_value,
+  int thread_num, FilterWorkspace* workspace, FilterStats* stats) {
+  thread_num = MIN(thread_num, roi.height);
+  int row_size = width * channels;
+  Dtype* const_row = workspace->Acquire<Dtype>(row_size);
+  {
+    FILTER_STATS_PHASE(stats, FILTER_PHASE_BORDER);
+    for (int k = 0; k < row_size; k++) {
+      const_row[k] = border_value;
     }
-    UpdateSum(host_src, sum_cols, radius, i, width);
   }
-  for (int j = radius; j < width - radius; j++) {
-    double sum = 0;
-    for (int m = 0; m < core_size; m++) {
-      sum += sum_cols[m + j - radius];
+  if (thread_num <= 1) {
+    MeanFilterHelper(host_src, src_pitch, host_dst, dst_pitch, width, height,
+      channels, roi, radius, border, border_value, roi.y,
+      roi.y + roi.height, workspace->Acquire<double>(row_size), const_row,
+      stats, nullptr);
+    return;
+  }
+  std::vector<FilterStats> stripe_stats;
+  if (nullptr != stats) {
+    stripe_stats.resize(thread_num);
+    for (int t = 0; t < thread_num; t++) {
+      ClearFilterStats(&stripe_stats[t]);
     }
-    host_dst[j + i*width] = static_cast<Dtype>(sum / (core_size * core_size));
   }
-  delete[] sum_cols;
+  std::vector<std::thread> workers;
+  for (int t = 1; t < thread_num; t++) {
+    int row_begin = roi.y + static_cast<int>(
+      static_cast<long long>(roi.height) * t / thread_num);
+    int row_end = roi.y + static_cast<int>(
+      static_cast<long long>(roi.height) * (t + 1) / thread_num);
+    workers.push_back(std::thread(MeanFilterHelper<Dtype>, host_src,
+      src_pitch, host_dst, dst_pitch, width, height, channels, roi, radius,
+      border, border_value, row_begin, row_end,
+      workspace->Acquire<double>(row_size), const_row,
+      nullptr != stats ? &stripe_stats[t] : nullptr, "mean stripe"));
+  }
+  // The calling thread takes the first stripe.
+  MeanFilterHelper(host_src, src_pitch, host_dst, dst_pitch, width, height,
+    channels, roi, radius, border, border_value, roi.y,
+    roi.y + roi.height / thread_num, workspace->Acquire<double>(row_size),
+    const_row, nullptr != stats ? &stripe_stats[0] : nullptr, nullptr);
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+  for (size_t t = 0; t < stripe_stats.size(); t++) {
+    AddFilterStats(stripe_stats[t], stats);
+  }
+}
+
+/**
+* Workspace size of the mean filter, the column sums of each stripe and a
+* row of border value. Enough for any roi of the image.
+*/
+template<typename Dtype>
+size_t MeanFilter<Dtype>::GetWorkspaceSize(int width, int height) const {
+  if (LAYOUT_COLUMN_MAJOR == layout_) {
+    std::swap(width, height);
+  }
+  int thread_num = MIN(thread_num_, height);
+  int row_size = width * channel_num_;
+  return FilterWorkspace::SizeOf<double>(row_size) * thread_num +
+    FilterWorkspace::SizeOf<Dtype>(row_size);
 }
 
 /**
 * Mean filtering.
-* Extend image edge by copying adjacent pixel, then execute mean filtering.
+* The pixels outside the image are taken from the border mode, see
+* set_border. The rows are split into thread_num stripes filtered in
+* parallel, the result is identical to the serial one for unsigned char.
 *
-* \param host_src   Source image data.
+* \param host_src   Source image data, channel_num values per pixel.
 * \param host_dst   Destination image data. Must be preallocated.
 * \param width			Source image and destination image width, in pixels.
 * \param height			Source image and destination image height, in pixels.
 * \param radius			Median filter radius. The kernelis a 2*r+1 by 2*r+1 square.
 */
 template<typename Dtype>
-void MeanFilter<Dtype>::Filter(const Dtype* host_src, Dtype* host_dst,
-  int width, int height) {
+bool MeanFilter<Dtype>::Filter(const Dtype* host_src, Dtype* host_dst,
+  int width, int height) const {
+  FilterWorkspace workspace;
+  if (!workspace.Reserve(GetWorkspaceSize(width, height))) {
+    return false;
+  }
+  return Filter(host_src, host_dst, width, height, &workspace);
+}
+
+/**
+* Mean filtering with a preallocated workspace, the serial path does not
+* allocate any memory.
+*
+* \param workspace  Reserved with at least GetWorkspaceSize(width, height).
+*/
+template<typename Dtype>
+bool MeanFilter<Dtype>::Filter(const Dtype* host_src, Dtype* host_dst,
+  int width, int height, FilterWorkspace* workspace) const {
+  int pitch = GetPackedPitch(width, height, channel_num_, layout_);
+  return Filter(host_src, pitch, host_dst, pitch, width, height,
+    ImageRect(0, 0, width, height), workspace);
+}
+
+template<typename Dtype>
+bool MeanFilter<Dtype>::Filter(const Dtype* host_src, int src_pitch,
+  Dtype* host_dst, int dst_pitch, int width, int height,
+  const ImageRect& roi) const {
+  FilterWorkspace workspace;
+  if (!workspace.Reserve(GetWorkspaceSize(width, height))) {
+    return false;
+  }
+  return Filter(host_src, src_pitch, host_dst, dst_pitch, width, height, roi,
+    &workspace);
+}
+
+/**
+* Mean filtering of a roi, in place in a bigger image with row pitches.
+* The image pixels around the roi are read as they are, the border mode only
+* applies at the image edges, so the roi output is the same as the one of
+* the whole image. Nothing is repacked.
+* A LAYOUT_COLUMN_MAJOR image is filtered as its transposed row-major
+* image, the pitches are then the distances between two columns.
+*
+* \param host_src   Source image data, the pixel (0, 0) of the image.
+* \param src_pitch  Distance between two source rows, in elements.
+* \param host_dst   Destination of the roi, the pixel (roi.x, roi.y).
+* \param dst_pitch  Distance between two destination rows, in elements.
+* \param width      Source image width, in pixels.
+* \param height     Source image height, in pixels.
+* \param roi        Rectangle to filter, inside the source image.
+* \param workspace  Reserved with at least GetWorkspaceSize(width, height).
+*/
+template<typename Dtype>
+bool MeanFilter<Dtype>::Filter(const Dtype* host_src, int src_pitch,
+  Dtype* host_dst, int dst_pitch, int width, int height, const ImageRect& roi,
+  FilterWorkspace* workspace) const {
   assert(nullptr != host_src);
   assert(nullptr != host_dst);
+  assert(nullptr != workspace);
   assert(0 < width);
   assert(0 < height);
+  assert(IsRectInside(roi, width, height));
   assert(radius_ < MIN(width, height));
+  workspace->Release();
+  if (workspace->capacity() < GetWorkspaceSize(width, height)) {
+    return false;
+  }
+  // The window is symmetric, the columns are the rows of the transposed image.
+  ImageRect rect = roi;
+  if (LAYOUT_COLUMN_MAJOR == layout_) {
+    std::swap(width, height);
+    rect = TransposeRect(roi);
+  }
+  assert(width * channel_num_ <= src_pitch);
+  assert(rect.width * channel_num_ <= dst_pitch);
+  FilterCallStats call_stats(stats_, stats_callback_);
+  FILTER_STATS_ADD_ALLOCATIONS(call_stats.get(), workspace);
+  FILTER_STATS_ADD(call_stats.get(), pixels,
+    static_cast<long long>(rect.width) * rect.height);
+  ParallelMeanFilterHelper(host_src, src_pitch, host_dst, dst_pitch, width,
+    height, channel_num_, rect, radius_, border_, border_value_, thread_num_,
+    workspace, call_stats.get());
+  return true;
+}
+
+template<typename Dtype>
+MeanRowStream<Dtype>::MeanRowStream(int radius, int width)
+  : radius_(radius), width_(width), rows_out_(0),
+  ring_buffer_(radius, width), sum_cols_(nullptr) {
+  if (!workspace_.Reserve(FilterWorkspace::SizeOf<double>(width))) {
+    return;
+  }
+  sum_cols_ = workspace_.Acquire<double>(width);
+}
 
-  Dtype* host_extend_src = nullptr;
-  Dtype* host_extend_dst = nullptr;
-  try {
-    host_extend_src = new Dtype[(width + radius_ * 2)*(height + radius_ * 2)];
-    host_extend_dst = new Dtype[(width + radius_ * 2)*(height + radius_ * 2)];
-  }
-  catch (std::bad_alloc) {
-    exit(1);
-  }
-  ExtendMatrixEdge(host_src, host_extend_src, width, height, radius_);
-  MeanFilterHelper(host_extend_src, host_extend_dst, width + 2 * radius_,
-    height + 2 * radius_, radius_);
-  for (int i = 0; i < height; i++) {
-    memcpy_s(host_dst + i*width, width*sizeof(Dtype),
-      host_extend_dst + (width + 2 * radius_)*(radius_ + i) + radius_,
-      width * sizeof(Dtype));
-  }
-  delete[] host_extend_src;
-  delete[] host_extend_dst;
-}
\ No newline at end of file
+template<typename Dtype>
+void MeanRowStream<Dtype>::Reset() {
+  ring_buffer_.Reset();
+  rows_out_ = 0;
+}
+
+/**
+* Push a source row into the stream.
+* The column sums are updated by subtracting the row leaving the filter
+* window and adding the row entering it, like UpdateSum.
+*
+* \param host_src_row  Source row, width pixels.
+* \param host_dst_row  Destination row, width pixels. Written only when
+*                      true is returned.
+*/
+template<typename Dtype>
+bool MeanRowStream<Dtype>::PushRow(const Dtype* host_src_row,
+  Dtype* host_dst_row) {
+  assert(nullptr != host_dst_row);
+  if (!ok()) {
+    return false;
+  }
+  ring_buffer_.Push(host_src_row);
+  if (ring_buffer_.rows() <= radius_) {
+    return false;
+  }
+  EmitRow(host_dst_row, -1);
+  return true;
+}
+
+template<typename Dtype>
+bool MeanRowStream<Dtype>::PushPackedRow(const unsigned char* packed_row,
+  PackedFormat format, Dtype* host_dst_row) {
+  assert(nullptr != host_dst_row);
+  if (!ok()) {
+    return false;
+  }
+  ring_buffer_.PushPacked(packed_row, format);
+  if (ring_buffer_.rows() <= radius_) {
+    return false;
+  }
+  EmitRow(host_dst_row, -1);
+  return true;
+}
+
+template<typename Dtype>
+bool MeanRowStream<Dtype>::Flush(Dtype* host_dst_row) {
+  assert(nullptr != host_dst_row);
+  if (!ok()) {
+    return false;
+  }
+  assert(radius_ < ring_buffer_.rows());
+  if (rows_out_ >= ring_buffer_.rows()) {
+    return false;
+  }
+  EmitRow(host_dst_row, ring_buffer_.rows());
+  return true;
+}
+
+template<typename Dtype>
+void MeanRowStream<Dtype>::EmitRow(Dtype* host_dst_row, int height) {
+  int y = rows_out_;
+  if (0 == y) {
+    memset(sum_cols_, 0, sizeof(double) * width_);
+    for (int m = -radius_; m <= radius_; m++) {
+      GetInitSum(ring_buffer_.Row(m, height), sum_cols_, width_);
+    }
+  } else {
+    UpdateSum(ring_buffer_.Row(y - radius_ - 1, height),
+      ring_buffer_.Row(y + radius_, height), sum_cols_, width_);
+  }
+  GetRowMean(sum_cols_, host_dst_row, 0, width_, width_, 1, radius_,
+    ring_buffer_.border(), ring_buffer_.border_value());
+  rows_out_++;
+}
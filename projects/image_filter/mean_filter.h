@@ -3,6 +3,10 @@
 #include <assert.h>
 #include <chrono>
 #include <iostream>
+#include "image_filter/filter_stats.h"
+#include "image_filter/filter_workspace.h"
+#include "image_filter/image_rect.h"
+#include "image_filter/row_buffer.h"
 // Define macro min
 #ifndef MIN
 #define MIN(a, b) ((a) > (b) ? (b) : (a))
@@ -13,6 +17,11 @@
 #define GRAY_LEVEL_MAX 256
 #endif
 
+// Define max number of interleaved channels.
+#ifndef CHANNEL_NUM_MAX
+#define CHANNEL_NUM_MAX 4
+#endif
+
 // Disable the copy and assignment operator for a class.
 #define DISABLE_COPY_AND_ASSIGN(classname) \
 private:\
@@ -23,15 +32,112 @@ template<typename Dtype>
 class MeanFilter
 {
 public:
-  MeanFilter() {}
-  explicit MeanFilter(int radius) : radius_(radius) {}
+  MeanFilter() : thread_num_(1), channel_num_(1), layout_(LAYOUT_ROW_MAJOR),
+    border_(BORDER_REFLECT_101), border_value_(0), stats_(nullptr) {}
+  explicit MeanFilter(int radius) : radius_(radius), thread_num_(1),
+    channel_num_(1), layout_(LAYOUT_ROW_MAJOR), border_(BORDER_REFLECT_101),
+    border_value_(0), stats_(nullptr) {}
   void set_radius(int radius) {
     assert(radius > 0);
     radius_ = radius;
   }
-  void Filter(const Dtype* host_src, Dtype* host_dst, int width, int height);
+  // Number of workers, each one filters a stripe of output rows.
+  void set_thread_num(int thread_num) {
+    assert(thread_num > 0);
+    thread_num_ = thread_num;
+  }
+  // Number of interleaved values per pixel, each channel has its own column
+  // sums, all of them are updated in the same pass, default 1.
+  void set_channel_num(int channel_num) {
+    assert(channel_num > 0);
+    assert(channel_num <= CHANNEL_NUM_MAX);
+    channel_num_ = channel_num;
+  }
+  // How the images are stored, default LAYOUT_ROW_MAJOR. A column-major
+  // image is filtered along its contiguous columns, without transposing.
+  void set_layout(ImageLayout layout) { layout_ = layout; }
+  // How the pixels outside the image are taken, default BORDER_REFLECT_101.
+  void set_border(BorderType border, Dtype border_value = Dtype()) {
+    border_ = border;
+    border_value_ = border_value;
+  }
+  // Filled with the phase times and counts of each call, only when the
+  // library is built with IMAGE_FILTER_STATS, see filter_stats.h. The times
+  // of the stripes are summed. A filter called from several threads at once
+  // must not collect stats.
+  void set_stats(FilterStats* stats) { stats_ = stats; }
+  // Called at the end of each call with its stats, IMAGE_FILTER_STATS too.
+  void set_stats_callback(const FilterStatsCallback& callback) {
+    stats_callback_ = callback;
+  }
+  int radius() const { return radius_; }
+  int channel_num() const { return channel_num_; }
+  // Workspace bytes needed by Filter for an image size.
+  size_t GetWorkspaceSize(int width, int height) const;
+  // Return false if the memory can not be allocated.
+  bool Filter(const Dtype* host_src, Dtype* host_dst, int width,
+    int height) const;
+  // Take all the buffers from workspace, see GetWorkspaceSize.
+  bool Filter(const Dtype* host_src, Dtype* host_dst, int width, int height,
+    FilterWorkspace* workspace) const;
+  // Filter the roi of an image with row pitches, in elements. The pixels
+  // around the roi are read as context, host_dst points to the roi output.
+  bool Filter(const Dtype* host_src, int src_pitch, Dtype* host_dst,
+    int dst_pitch, int width, int height, const ImageRect& roi) const;
+  bool Filter(const Dtype* host_src, int src_pitch, Dtype* host_dst,
+    int dst_pitch, int width, int height, const ImageRect& roi,
+    FilterWorkspace* workspace) const;
 private:
   int radius_;
+  int thread_num_;
+  int channel_num_;
+  ImageLayout layout_;
+  BorderType border_;
+  Dtype border_value_;
+  FilterStats* stats_;
+  FilterStatsCallback stats_callback_;
   DISABLE_COPY_AND_ASSIGN(MeanFilter);
 };
+
+/**
+* Line-buffered mean filter, for images arriving row by row.
+* Only 2*r+2 rows and the column sums are kept in memory, an output row is
+* emitted as soon as the r rows below it have been pushed.
+*/
+template<typename Dtype>
+class MeanRowStream
+{
+public:
+  MeanRowStream(int radius, int width);
+  // False if the buffers could not be allocated, then PushRow, PushPackedRow
+  // and Flush return false without doing anything.
+  bool ok() const { return ring_buffer_.ok() && nullptr != sum_cols_; }
+  // Only allowed before the first row is pushed.
+  void set_border(BorderType border, Dtype border_value = Dtype()) {
+    ring_buffer_.set_border(border, border_value);
+  }
+  // Push the next source row. Return true if output row rows_out() - 1 was
+  // written to host_dst_row.
+  bool PushRow(const Dtype* host_src_row, Dtype* host_dst_row);
+  // Push the next source row packed, see packed_row.h. It is unpacked
+  // straight into the row buffer, never as a whole image.
+  bool PushPackedRow(const unsigned char* packed_row, PackedFormat format,
+    Dtype* host_dst_row);
+  // Call after the last source row, once per remaining output row. Return
+  // false when all the rows have been emitted.
+  bool Flush(Dtype* host_dst_row);
+  // Start a new image with the same radius and width.
+  void Reset();
+  int rows_in() const { return ring_buffer_.rows(); }
+  int rows_out() const { return rows_out_; }
+private:
+  void EmitRow(Dtype* host_dst_row, int height);
+  int radius_;
+  int width_;
+  int rows_out_;
+  RowRingBuffer<Dtype> ring_buffer_;
+  FilterWorkspace workspace_;
+  double* sum_cols_;
+  DISABLE_COPY_AND_ASSIGN(MeanRowStream);
+};
 #endif  // !IMAGE_IMAGE_FILTER_MEAN_FILTER_H_
@@ -1,10 +1,18 @@
+﻿#include <algorithm>
 #include <new>
 #include <memory>
+#include <string.h>
+#include "image_filter/cpu_dispatch.h"
 #include "image_filter/median_filter.h"
+#include "image_filter/median_filter_internal.h"
+#include "image_filter/trace_recorder.h"
 
 template class MedianFilter<unsigned char>;
 template class MedianFilter<float>;
 template class MedianFilter<double>;
+template class MedianRowStream<unsigned char>;
+template class MedianRowStream<float>;
+template class MedianRowStream<double>;
 
 // Quick sort
 template<typename Dtype>
@@ -52,141 +60,254 @@ int RemoveDuplicates(const Dtype* src, int len, Dtype* dst) {
   return j + 1;
 }
 
-// Extend image edge by copying adjacent pixel
+// Get initial histogram array of channel c of the filter window centered on
+// col x when start from a new row, rows points to the 2*r+1 source rows of
+// the window, interleaved with channels values per pixel
 template<typename Dtype>
-void ExtendMatrixEdge(const Dtype *host_src, Dtype* host_extend_src,
-  int width, int height, int radius) {
-  int width_extend = width + radius * 2;
-  for (int i = 0; i < height; i++) {
-    memcpy_s(host_extend_src + width_extend * (i + radius) + radius,
-      width* sizeof(Dtype), host_src + width * i, width* sizeof(Dtype));
-    for (int j = 0; j < radius; j++) {
-      int row_extend = (i + radius) * width_extend;
-      host_extend_src[row_extend + j] = host_src[i * width + radius - j];
-      host_extend_src[row_extend + width + radius + j] =
-        host_src[(i + 1)*width - j];
-    }
-  }
-  for (int i = 0; i < width + radius * 2; i++) {
-    for (int j = 0; j < radius; j++) {
-      host_extend_src[j * width_extend + i]
-        = host_extend_src[(radius * 2 - j) * width_extend + i];
-      host_extend_src[(height - 1 + 2 * radius - j) * (width + radius * 2) + i]
-        = host_extend_src[(height - 1 + j) * width_extend + i];
+void GetInitHist(const Dtype** rows, int *his, int radius, int x, int width,
+  int c, int channels, BorderType border, Dtype border_value) {
+  int core_size = radius * 2 + 1;
+  for (int i = 0; i < core_size; i++) {
+    for (int j = x - radius; j <= x + radius; j++) {
+      his[BorderPixel(rows[i] + c, j, width, channels, border,
+        border_value)]++;
     }
   }
 }
 
-// Get initial histogram array when start from a new row
+// Update histogram array of channel c when filter core move towards right.
 template<typename Dtype>
-void GetInitHist(const Dtype *host_src, int *his, int radius,
-  int height_pos, int width_pos, int width) {
+void UpdateHist(const Dtype** rows, int *his, int radius, int width_pos,
+  int width, int c, int channels, BorderType border, Dtype border_value) {
   int core_size = radius * 2 + 1;
-  for (int i = 0; i < core_size; i++) {
-    for (int j = 0; j < core_size; j++) {
-      his[host_src[(height_pos + i - radius) * width + width_pos + j - radius]]++;
+  int x_sub = width_pos - radius - 1;
+  int x_add = width_pos + radius;
+  if (0 <= x_sub && x_add < width) {
+    int pos_sub = x_sub * channels + c;
+    int pos_add = x_add * channels + c;
+    for (int i = 0; i < core_size; i++) {
+      his[rows[i][pos_sub]]--;
+      his[rows[i][pos_add]]++;
+    }
+  } else {
+    for (int i = 0; i < core_size; i++) {
+      his[BorderPixel(rows[i] + c, x_sub, width, channels, border,
+        border_value)]--;
+      his[BorderPixel(rows[i] + c, x_add, width, channels, border,
+        border_value)]++;
     }
   }
 }
 
-// Update histogram array when filter core move towards right.
+
+// Count the histogram array, and return the value when trigger the gate
+int GetHistMediumValue(const FilterKernels& kernels, int* his, int size,
+  int radius, float gate, int dims) {
+  int wnd_size = 1;
+  for (int k = 0; k < dims; k++) {
+    wnd_size *= radius * 2 + 1;
+  }
+  int stop_point = static_cast<int>(wnd_size * gate);
+  return kernels.find_hist_rank(his, size, stop_point);
+}
+
+// Get the 2*r+1 source rows of the filter window centered on row i,
+// host_src holds the image rows from row_begin on
 template<typename Dtype>
-void UpdateHist(const Dtype *host_src, int *his, int radius,
-  int height_pos, int width_pos, int width) {
-  int core_size = radius * 2 + 1;
-  for (int i = 0; i < core_size; i++) {
-    int some_row = (height_pos + i - radius) * width + width_pos;
-    his[host_src[some_row - radius - 1]]--;
-    his[host_src[some_row + radius]]++;
+void GetWindowRows(const Dtype* host_src, int pitch, int row_begin,
+  const Dtype** rows, int height, int radius, int i, BorderType border,
+  const Dtype* const_row) {
+  for (int m = 0; m < radius * 2 + 1; m++) {
+    int k = BorderInterpolate(i - radius + m, height, border);
+    rows[m] = k < 0 ? const_row :
+      host_src + static_cast<ptrdiff_t>(k - row_begin) * pitch;
   }
 }
 
+// Get the rows and cols of the image under the filter windows of a roi
+inline ImageRect GetRoiContext(const ImageRect& roi, int width, int height,
+  int radius) {
+  int x = roi.x - radius > 0 ? roi.x - radius : 0;
+  int y = roi.y - radius > 0 ? roi.y - radius : 0;
+  return ImageRect(x, y, MIN(roi.x + roi.width + radius, width) - x,
+    MIN(roi.y + roi.height + radius, height) - y);
+}
 
-// Count the histogram array, and return the value when trigger the gate
-int GetHistMediumValue(int* his, int size, int radius, float gate) {
-  int sum = 0, value = -1;
-  int stop_point = static_cast<int>((radius * 2 + 1) * (radius * 2 + 1) * gate);
-  for (int i = 0; i < size; i++) {
-    sum += his[i];
-    if (sum > stop_point) {
-      value = i;
-      break;
-    }
-  }
-  return value;
+// Workspace size of GetMedianByHistogram, unsigned char, the height is not
+// needed
+size_t GetHistogramWorkspaceSize(int width, int, int channels, int radius,
+  unsigned char) {
+  return FilterWorkspace::SizeOf<const unsigned char*>(radius * 2 + 1) +
+    FilterWorkspace::SizeOf<unsigned char>(width * channels);
 }
 
 // Median filtering Helper, unsigned char, o(N)
-void GetMedianByHistogram(const unsigned char *host_src,
-  unsigned char *host_dst, int width, int height, int radius, float gate) {
-  int histogram[GRAY_LEVEL_MAX];
-  for (int i = radius; i < height - radius; i++) {
-    for (int j = radius; j < width - radius; j++) {
-      if (j == radius) {
-        memset(histogram, 0, GRAY_LEVEL_MAX * sizeof(int));
-        GetInitHist(host_src, histogram, radius, i, j, width);
-      } else {
-        UpdateHist(host_src, histogram, radius, i, j, width);
+// Each channel has its own histogram, all of them are moved in one pass.
+void GetMedianByHistogram(const unsigned char *host_src, int src_pitch,
+  unsigned char *host_dst, int dst_pitch, int width, int height,
+  int channels, const ImageRect& roi, int radius, float gate,
+  BorderType border, unsigned char border_value,
+  FilterWorkspace* workspace, FilterStats* stats) {
+  const FilterKernels& kernels = GetFilterKernels();
+  int histogram[GRAY_LEVEL_MAX * CHANNEL_NUM_MAX];
+  const unsigned char** rows =
+    workspace->Acquire<const unsigned char*>(radius * 2 + 1);
+  unsigned char* const_row =
+    workspace->Acquire<unsigned char>(width * channels);
+  {
+    FILTER_STATS_PHASE(stats, FILTER_PHASE_BORDER);
+    memset(const_row, border_value, width * channels);
+  }
+  for (int i = 0; i < roi.height; i++) {
+    GetWindowRows(host_src, src_pitch, 0, rows, height, radius, roi.y + i,
+      border, const_row);
+    unsigned char* dst_row = host_dst + static_cast<ptrdiff_t>(i) * dst_pitch;
+    {
+      FILTER_STATS_PHASE(stats, FILTER_PHASE_WINDOW_INIT);
+      for (int c = 0; c < channels; c++) {
+        int* his = histogram + c * GRAY_LEVEL_MAX;
+        memset(his, 0, GRAY_LEVEL_MAX * sizeof(int));
+        GetInitHist(rows, his, radius, roi.x, width, c, channels, border,
+          border_value);
+      }
+    }
+    FILTER_STATS_PHASE(stats, FILTER_PHASE_SLIDE);
+    for (int j = 0; j < roi.width; j++) {
+      for (int c = 0; c < channels; c++) {
+        int* his = histogram + c * GRAY_LEVEL_MAX;
+        if (j > 0) {
+          UpdateHist(rows, his, radius, roi.x + j, width, c, channels,
+            border, border_value);
+        }
+        int value =
+          GetHistMediumValue(kernels, his, GRAY_LEVEL_MAX, radius, gate);
+        FILTER_STATS_ADD(stats, bins_scanned, value + 1);
+        dst_row[j * channels + c] = value;
       }
-      host_dst[j + i*width] =
-        GetHistMediumValue(histogram, GRAY_LEVEL_MAX, radius, gate);
     }
   }
 }
 
+// Workspace size of GetMedianByHistogram, others
+template<typename Dtype>
+size_t GetHistogramWorkspaceSize(int width, int height, int channels,
+  int radius, Dtype) {
+  size_t size = static_cast<size_t>(width) * height;
+  return FilterWorkspace::SizeOf<Dtype>(size + 1) * (channels + 1) +
+    FilterWorkspace::SizeOf<int>(size * channels) +
+    FilterWorkspace::SizeOf<int>(width * channels) +
+    FilterWorkspace::SizeOf<int>(size + 1) * channels +
+    FilterWorkspace::SizeOf<const int*>(radius * 2 + 1);
+}
+
 // Median filtering Helper, others, o(N)
+// Only the pixels under the filter windows of the roi take part in the
+// ordinal transform, host_ordinal keeps the image row length as pitch so
+// the kernels address it by image col. Each channel is sorted on its own
+// and has its own histogram, all of them are moved in one pass.
 template<typename Dtype>
-void GetMedianByHistogram(const Dtype *host_src, Dtype *host_dst,
-  int width, int height, int radius, float gate) {
-  // init
+void GetMedianByHistogram(const Dtype *host_src, int src_pitch,
+  Dtype *host_dst, int dst_pitch, int width, int height, int channels,
+  const ImageRect& roi, int radius, float gate, BorderType border,
+  Dtype border_value, FilterWorkspace* workspace, FilterStats* stats) {
+  // init, a constant border value takes part in the ordinal transform too
+  ImageRect context = GetRoiContext(roi, width, height, radius);
+  int size = context.width * context.height;
+  int sort_size = BORDER_CONSTANT == border ? size + 1 : size;
+  int row_size = width * channels;
   Dtype* host_sort = nullptr;
   Dtype* host_unique = nullptr;
   int* host_ordinal = nullptr;
+  int his_size[CHANNEL_NUM_MAX];
+  int ordinal_value[CHANNEL_NUM_MAX];
 
-  host_sort = new Dtype[width * height];
-  memcpy_s(host_sort, sizeof(Dtype) * width * height, host_src,
-    sizeof(Dtype) * width * height);
-  host_unique = new Dtype[width * height];
-  memset(host_unique, 0, sizeof(Dtype) * width * height);
-  host_ordinal = new int[width * height];
-  memset(host_ordinal, 0, sizeof(int) * width * height);
-  // sort input image value
-  QuickSort(host_sort, 0, width*height - 1);
-  // remove duplicate pixel
-  int his_size = RemoveDuplicates(host_sort, width*height, host_unique);
-  // ordinal transform
-  for (int i = 0; i < height; i++) {
+  host_sort = workspace->Acquire<Dtype>(size + 1);
+  host_unique = workspace->Acquire<Dtype>((size + 1) * channels);
+  host_ordinal =
+    workspace->Acquire<int>(static_cast<size_t>(row_size) * context.height);
+  int* const_row = workspace->Acquire<int>(row_size);
+  {
+    FILTER_STATS_PHASE(stats, FILTER_PHASE_RANK_TRANSFORM);
+    for (int c = 0; c < channels; c++) {
+      Dtype* unique = host_unique + c * (size + 1);
+      for (int i = 0; i < context.height; i++) {
+        const Dtype* src_row = host_src +
+          static_cast<ptrdiff_t>(context.y + i) * src_pitch + c;
+        for (int j = 0; j < context.width; j++) {
+          host_sort[i * context.width + j] =
+            src_row[(context.x + j) * channels];
+        }
+      }
+      if (BORDER_CONSTANT == border) {
+        host_sort[size] = border_value;
+      }
+      // sort input image value
+      QuickSort(host_sort, 0, sort_size - 1);
+      // remove duplicate pixel
+      his_size[c] = RemoveDuplicates(host_sort, sort_size, unique);
+      // ordinal transform
+      for (int i = 0; i < context.height; i++) {
+        const Dtype* src_row =
+          host_src + static_cast<ptrdiff_t>(context.y + i) * src_pitch;
+        int* ordinal_row =
+          host_ordinal + static_cast<ptrdiff_t>(i) * row_size;
+        for (int j = context.x; j < context.x + context.width; j++) {
+          int pos = j * channels + c;
+          ordinal_row[pos] =
+            BinaryFind(unique, 0, his_size[c] - 1, src_row[pos]);
+        }
+      }
+      ordinal_value[c] = BORDER_CONSTANT == border ?
+        BinaryFind(unique, 0, his_size[c] - 1, border_value) : 0;
+    }
+  }
+  {
+    FILTER_STATS_PHASE(stats, FILTER_PHASE_BORDER);
     for (int j = 0; j < width; j++) {
-      host_ordinal[i*width + j] =
-        BinaryFind(host_unique, 0, his_size - 1, host_src[i*width + j]);
+      for (int c = 0; c < channels; c++) {
+        const_row[j * channels + c] = ordinal_value[c];
+      }
     }
   }
   // get median value by histogram
-  int* extend_his = new int[his_size];
-  for (int i = radius; i < height - radius; i++) {
-    for (int j = radius; j < width - radius; j++) {
-      if (j == radius) {
-        memset(extend_his, 0, his_size * sizeof(int));
-        GetInitHist(host_ordinal, extend_his, radius, i, j, width);
-      } else {
-        UpdateHist(host_ordinal, extend_his, radius, i, j, width);
+  const FilterKernels& kernels = GetFilterKernels();
+  int* extend_his = workspace->Acquire<int>((size + 1) * channels);
+  const int** rows = workspace->Acquire<const int*>(radius * 2 + 1);
+  for (int i = 0; i < roi.height; i++) {
+    GetWindowRows<int>(host_ordinal, row_size, context.y, rows, height,
+      radius, roi.y + i, border, const_row);
+    Dtype* dst_row = host_dst + static_cast<ptrdiff_t>(i) * dst_pitch;
+    {
+      FILTER_STATS_PHASE(stats, FILTER_PHASE_WINDOW_INIT);
+      for (int c = 0; c < channels; c++) {
+        int* his = extend_his + c * (size + 1);
+        memset(his, 0, his_size[c] * sizeof(int));
+        GetInitHist(rows, his, radius, roi.x, width, c, channels, border,
+          ordinal_value[c]);
+      }
+    }
+    FILTER_STATS_PHASE(stats, FILTER_PHASE_SLIDE);
+    for (int j = 0; j < roi.width; j++) {
+      for (int c = 0; c < channels; c++) {
+        int* his = extend_his + c * (size + 1);
+        if (j > 0) {
+          UpdateHist(rows, his, radius, roi.x + j, width, c, channels,
+            border, ordinal_value[c]);
+        }
+        int value = GetHistMediumValue(kernels, his, his_size[c], radius,
+          gate);
+        FILTER_STATS_ADD(stats, bins_scanned, value + 1);
+        dst_row[j * channels + c] = host_unique[c * (size + 1) + value];
       }
-      host_dst[j + i*width] =
-        host_unique[GetHistMediumValue(extend_his, his_size, radius, gate)];
     }
   }
-  // source recovery
-  delete[] host_sort;
-  delete[] host_unique;
-  delete[] host_ordinal;
-  delete[] extend_his;
 }
 
-
 /**
 * Median filtering for all types, specification template for unsigned char.
-* Extend image edge by copying adjacent pixel, then execute median filtering.
-* \param host_src   Source image data.
+* The pixels outside the image are taken from the border mode, see
+* set_border, the kernel reads the source image directly.
+* \param host_src   Source image data, channel_num values per pixel.
 * \param host_dst   Destination image data. Must be preallocated.
 * \param width			Image width, in pixels.
 * \param height			Image height, in pixels.
@@ -194,49 +315,102 @@ void GetMedianByHistogram(const Dtype *host_src, Dtype *host_dst,
 * \param gate				Filter gate, default value is 0.5.
 */
 template<typename Dtype>
-void MedianFilter<Dtype>::FilterByHistogram(const Dtype* host_src, Dtype* host_dst,
-  int width, int height) {
+bool MedianFilter<Dtype>::FilterByHistogram(const Dtype* host_src, Dtype* host_dst,
+  int width, int height) const {
+  FilterWorkspace workspace;
+  int line_width = LAYOUT_COLUMN_MAJOR == layout_ ? height : width;
+  if (!workspace.Reserve(
+    GetHistogramWorkspaceSize(line_width, width * height / line_width,
+    channel_num_, radius_, Dtype()))) {
+    return false;
+  }
+  return FilterByHistogram(host_src, host_dst, width, height, &workspace);
+}
+
+/**
+* Median filtering by histogram with a preallocated workspace, no memory is
+* allocated.
+* \param workspace  Reserved with at least GetWorkspaceSize(width, height).
+*/
+template<typename Dtype>
+bool MedianFilter<Dtype>::FilterByHistogram(const Dtype* host_src,
+  Dtype* host_dst, int width, int height, FilterWorkspace* workspace) const {
+  int pitch = GetPackedPitch(width, height, channel_num_, layout_);
+  return FilterByHistogram(host_src, pitch, host_dst, pitch, width, height,
+    ImageRect(0, 0, width, height), workspace);
+}
+
+template<typename Dtype>
+bool MedianFilter<Dtype>::FilterByHistogram(const Dtype* host_src,
+  int src_pitch, Dtype* host_dst, int dst_pitch, int width, int height,
+  const ImageRect& roi) const {
+  FilterWorkspace workspace;
+  int line_width = LAYOUT_COLUMN_MAJOR == layout_ ? height : width;
+  if (!workspace.Reserve(
+    GetHistogramWorkspaceSize(line_width, width * height / line_width,
+    channel_num_, radius_, Dtype()))) {
+    return false;
+  }
+  return FilterByHistogram(host_src, src_pitch, host_dst, dst_pitch, width,
+    height, roi, &workspace);
+}
+
+/**
+* Median filtering by histogram of a roi, in place in a bigger image with
+* row pitches. The image pixels around the roi are read as they are, the
+* border mode only applies at the image edges.
+* A LAYOUT_COLUMN_MAJOR image is filtered as its transposed row-major
+* image, the pitches are then the distances between two columns.
+*
+* \param host_src   Source image data, the pixel (0, 0) of the image.
+* \param src_pitch  Distance between two source rows, in elements.
+* \param host_dst   Destination of the roi, the pixel (roi.x, roi.y).
+* \param dst_pitch  Distance between two destination rows, in elements.
+* \param width      Source image width, in pixels.
+* \param height     Source image height, in pixels.
+* \param roi        Rectangle to filter, inside the source image.
+* \param workspace  Reserved with at least GetWorkspaceSize(width, height).
+*/
+template<typename Dtype>
+bool MedianFilter<Dtype>::FilterByHistogram(const Dtype* host_src,
+  int src_pitch, Dtype* host_dst, int dst_pitch, int width, int height,
+  const ImageRect& roi, FilterWorkspace* workspace) const {
   // Input check
   assert(nullptr != host_src);
   assert(nullptr != host_dst);
+  assert(nullptr != workspace);
   assert(0 < width);
   assert(0 < height);
+  assert(IsRectInside(roi, width, height));
   assert(radius_ < MIN(width, height));
-  Dtype* host_extend_src = nullptr;
-  Dtype* host_extend_dst = nullptr;
-  // Get memory
-  int width_extend = width + radius_ * 2;
-  int height_extend = height + radius_ * 2;
-  host_extend_src = new Dtype[width_extend * height_extend];
-  host_extend_dst = new Dtype[width_extend * height_extend];
-  // Filter
-  ExtendMatrixEdge(host_src, host_extend_src, width, height, radius_);
-  GetMedianByHistogram(host_extend_src, host_extend_dst, width_extend,
-    height_extend, radius_, gate_);
-  for (int i = 0; i < height; i++) {
-    memcpy_s(host_dst + i*width, width*sizeof(Dtype),
-      host_extend_dst + width_extend * (radius_ + i) + radius_,
-      width * sizeof(Dtype));
-  }
-  // Resource recovery
-  delete[] host_extend_src;
-  delete[] host_extend_dst;
-}
-
-
-// Add source data to buffer
-template<typename Dtype>
-void SaveBuffer(const Dtype *host_src, Dtype *buffer, int radius,
-  int height_pos, int width_pos, int width) {
-  int core_size = radius * 2 + 1;
-  for (int i = 0; i < core_size; i++) {
-    int some_row = (height_pos + i - radius) * width + width_pos;
-    for (int j = 0; j < core_size; j++) {
-      buffer[i * core_size + j] = host_src[some_row + j - radius];
-    }
+  // The window is symmetric, the columns are the rows of the transposed image.
+  ImageRect rect = roi;
+  if (LAYOUT_COLUMN_MAJOR == layout_) {
+    std::swap(width, height);
+    rect = TransposeRect(roi);
+  }
+  assert(width * channel_num_ <= src_pitch);
+  assert(rect.width * channel_num_ <= dst_pitch);
+  workspace->Release();
+  if (workspace->capacity() < GetHistogramWorkspaceSize(width, height,
+    channel_num_, radius_, Dtype())) {
+    return false;
   }
+  // Filter, traced by the first row of the roi
+  ThreadTraceBuffer thread_trace(nullptr);
+  TraceScope span(thread_trace.get(), "median_histogram",
+    rect.y);
+  FilterCallStats call_stats(stats_, stats_callback_);
+  FILTER_STATS_ADD_ALLOCATIONS(call_stats.get(), workspace);
+  FILTER_STATS_ADD(call_stats.get(), pixels,
+    static_cast<long long>(rect.width) * rect.height);
+  GetMedianByHistogram(host_src, src_pitch, host_dst, dst_pitch, width,
+    height, channel_num_, rect, radius_, gate_, border_, border_value_,
+    workspace, call_stats.get());
+  return true;
 }
 
+
 // Replace a data in a sorted array to a new value, and then resort it
 template<typename Dtype>
 void ReplaceSortedBuffer(Dtype* buffer, int pos, int radius, Dtype new_val)
@@ -261,38 +435,96 @@ void ReplaceSortedBuffer(Dtype* buffer, int pos, int radius, Dtype new_val)
   }
 }
 
-// Get median value by sort the local buffer
+// Get median value of the cols [x_begin, x_end) of a row by sort the local
+// buffer, rows points to the 2*r+1 source rows of the filter window. Each
+// channel has its own sorted buffer of (2*r+1)^2 values.
 template<typename Dtype>
-void GetMedianByLocalSort(const Dtype*host_src, Dtype *host_dst,
-  int width, int height, int radius, float gate) {
+void GetRowMedianByLocalSort(const Dtype** rows, Dtype *dst_row,
+  int x_begin, int x_end, int width, int channels, int radius, float gate,
+  BorderType border, Dtype border_value, Dtype* buffer, FilterStats* stats) {
   int core_size = radius * 2 + 1;
   int wnd_size = core_size * core_size;
   int get_size = static_cast<int>(wnd_size * gate);
-  Dtype* buffer = new Dtype[core_size * core_size];
-  for (int i = radius; i < height - radius; i++) {
-    for (int j = radius; j < width - radius; j++) {
-      if (j == radius) {
-        memset(buffer, 0, sizeof(Dtype)*wnd_size);
-        SaveBuffer(host_src, buffer, radius, i, j, width);
-        QuickSort(buffer, 0, wnd_size - 1);
-      } else {
-        for (int m = 0; m < core_size; m++) {
-          int pos = BinaryFind(buffer, 0, wnd_size,
-            host_src[(i - radius + m) * width + j - radius - 1]);
-          ReplaceSortedBuffer(buffer, pos, radius,
-            host_src[(i - radius + m) * width + j + radius]);
+  {
+    FILTER_STATS_PHASE(stats, FILTER_PHASE_WINDOW_INIT);
+    for (int c = 0; c < channels; c++) {
+      Dtype* channel_buffer = buffer + c * wnd_size;
+      for (int m = 0; m < core_size; m++) {
+        for (int k = 0; k < core_size; k++) {
+          channel_buffer[m * core_size + k] = BorderPixel(rows[m] + c,
+            x_begin + k - radius, width, channels, border, border_value);
+        }
+      }
+      QuickSort(channel_buffer, 0, wnd_size - 1);
+      dst_row[c] = channel_buffer[get_size];
+    }
+  }
+  FILTER_STATS_PHASE(stats, FILTER_PHASE_SLIDE);
+  for (int j = x_begin + 1; j < x_end; j++) {
+    int x_sub = j - radius - 1;
+    int x_add = j + radius;
+    for (int c = 0; c < channels; c++) {
+      Dtype* channel_buffer = buffer + c * wnd_size;
+      for (int m = 0; m < core_size; m++) {
+        Dtype val_sub, val_add;
+        if (0 <= x_sub && x_add < width) {
+          val_sub = rows[m][x_sub * channels + c];
+          val_add = rows[m][x_add * channels + c];
+        } else {
+          val_sub = BorderPixel(rows[m] + c, x_sub, width, channels, border,
+            border_value);
+          val_add = BorderPixel(rows[m] + c, x_add, width, channels, border,
+            border_value);
         }
+        int pos = BinaryFind(channel_buffer, 0, wnd_size, val_sub);
+        ReplaceSortedBuffer(channel_buffer, pos, radius, val_add);
       }
-      host_dst[j + i*width] = buffer[get_size];
+      dst_row[(j - x_begin) * channels + c] = channel_buffer[get_size];
     }
   }
-  delete[] buffer;
+}
+
+// Workspace size of GetMedianByLocalSort
+template<typename Dtype>
+size_t GetLocalSortWorkspaceSize(int width, int channels, int radius, Dtype) {
+  int core_size = radius * 2 + 1;
+  return FilterWorkspace::SizeOf<Dtype>(core_size * core_size * channels) +
+    FilterWorkspace::SizeOf<const Dtype*>(core_size) +
+    FilterWorkspace::SizeOf<Dtype>(width * channels);
+}
+
+// Get median value by sort the local buffer
+template<typename Dtype>
+void GetMedianByLocalSort(const Dtype*host_src, int src_pitch,
+  Dtype *host_dst, int dst_pitch, int width, int height, int channels,
+  const ImageRect& roi, int radius, float gate, BorderType border,
+  Dtype border_value, FilterWorkspace* workspace, FilterStats* stats) {
+  int core_size = radius * 2 + 1;
+  Dtype* buffer =
+    workspace->Acquire<Dtype>(core_size * core_size * channels);
+  const Dtype** rows = workspace->Acquire<const Dtype*>(core_size);
+  Dtype* const_row = workspace->Acquire<Dtype>(width * channels);
+  {
+    FILTER_STATS_PHASE(stats, FILTER_PHASE_BORDER);
+    for (int j = 0; j < width * channels; j++) {
+      const_row[j] = border_value;
+    }
+  }
+  for (int i = 0; i < roi.height; i++) {
+    GetWindowRows(host_src, src_pitch, 0, rows, height, radius, roi.y + i,
+      border, const_row);
+    GetRowMedianByLocalSort(rows,
+      host_dst + static_cast<ptrdiff_t>(i) * dst_pitch, roi.x,
+      roi.x + roi.width, width, channels, radius, gate, border, border_value,
+      buffer, stats);
+  }
 }
 
 /**
 * Median filtering for all types.
-* Extend image edge by copying adjacent pixel, then execute median filtering.
-* \param host_src   Source image data.
+* The pixels outside the image are taken from the border mode, see
+* set_border, the kernel reads the source image directly.
+* \param host_src   Source image data, channel_num values per pixel.
 * \param host_dst   Destination image data. Must be preallocated.
 * \param width			Image width, in pixels.
 * \param height			Image height, in pixels.
@@ -300,169 +532,551 @@ void GetMedianByLocalSort(const Dtype*host_src, Dtype *host_dst,
 * \param gate				Filter gate, default value is 0.5.
 */
 template<typename Dtype>
-void MedianFilter<Dtype>::FilterByLocalSort(const Dtype* host_src, Dtype* host_dst,
-  int width, int height) {
+bool MedianFilter<Dtype>::FilterByLocalSort(const Dtype* host_src, Dtype* host_dst,
+  int width, int height) const {
+  FilterWorkspace workspace;
+  int line_width = LAYOUT_COLUMN_MAJOR == layout_ ? height : width;
+  if (!workspace.Reserve(
+    GetLocalSortWorkspaceSize(line_width, channel_num_, radius_, Dtype()))) {
+    return false;
+  }
+  return FilterByLocalSort(host_src, host_dst, width, height, &workspace);
+}
+
+/**
+* Median filtering by local sorting with a preallocated workspace, no memory
+* is allocated.
+* \param workspace  Reserved with at least GetWorkspaceSize(width, height).
+*/
+template<typename Dtype>
+bool MedianFilter<Dtype>::FilterByLocalSort(const Dtype* host_src,
+  Dtype* host_dst, int width, int height, FilterWorkspace* workspace) const {
+  int pitch = GetPackedPitch(width, height, channel_num_, layout_);
+  return FilterByLocalSort(host_src, pitch, host_dst, pitch, width, height,
+    ImageRect(0, 0, width, height), workspace);
+}
+
+template<typename Dtype>
+bool MedianFilter<Dtype>::FilterByLocalSort(const Dtype* host_src,
+  int src_pitch, Dtype* host_dst, int dst_pitch, int width, int height,
+  const ImageRect& roi) const {
+  FilterWorkspace workspace;
+  int line_width = LAYOUT_COLUMN_MAJOR == layout_ ? height : width;
+  if (!workspace.Reserve(
+    GetLocalSortWorkspaceSize(line_width, channel_num_, radius_, Dtype()))) {
+    return false;
+  }
+  return FilterByLocalSort(host_src, src_pitch, host_dst, dst_pitch, width,
+    height, roi, &workspace);
+}
+
+/**
+* Median filtering by local sorting of a roi, see FilterByHistogram for the
+* roi and pitch parameters.
+*/
+template<typename Dtype>
+bool MedianFilter<Dtype>::FilterByLocalSort(const Dtype* host_src,
+  int src_pitch, Dtype* host_dst, int dst_pitch, int width, int height,
+  const ImageRect& roi, FilterWorkspace* workspace) const {
   // Input check
   assert(nullptr != host_src);
   assert(nullptr != host_dst);
+  assert(nullptr != workspace);
   assert(0 < width);
   assert(0 < height);
+  assert(IsRectInside(roi, width, height));
   assert(radius_ < MIN(width, height));
-  Dtype* host_extend_src = nullptr;
-  Dtype* host_extend_dst = nullptr;
-  // Get memory
-  int width_extend = width + radius_ * 2;
-  int height_extend = height + radius_ * 2;
-  host_extend_src = new Dtype[width_extend * height_extend];
-  host_extend_dst = new Dtype[width_extend * height_extend];
-  // Filter
-  ExtendMatrixEdge(host_src, host_extend_src, width, height, radius_);
-  GetMedianByLocalSort(host_extend_src, host_extend_dst, width + 2 * radius_,
-    height + 2 * radius_, radius_, gate_);
-  for (int i = 0; i < height; i++) {
-    memcpy_s(host_dst + i*width, width*sizeof(Dtype),
-      host_extend_dst + width_extend * (radius_ + i) + radius_,
-      width * sizeof(Dtype));
-  }
-  // Resource recovery
-  delete[] host_extend_src;
-  delete[] host_extend_dst;
+  // The window is symmetric, the columns are the rows of the transposed image.
+  ImageRect rect = roi;
+  if (LAYOUT_COLUMN_MAJOR == layout_) {
+    std::swap(width, height);
+    rect = TransposeRect(roi);
+  }
+  assert(width * channel_num_ <= src_pitch);
+  assert(rect.width * channel_num_ <= dst_pitch);
+  workspace->Release();
+  if (workspace->capacity() <
+    GetLocalSortWorkspaceSize(width, channel_num_, radius_, Dtype())) {
+    return false;
+  }
+  // Filter, traced by the first row of the roi
+  ThreadTraceBuffer thread_trace(nullptr);
+  TraceScope span(thread_trace.get(), "median_local_sort",
+    rect.y);
+  FilterCallStats call_stats(stats_, stats_callback_);
+  FILTER_STATS_ADD_ALLOCATIONS(call_stats.get(), workspace);
+  FILTER_STATS_ADD(call_stats.get(), pixels,
+    static_cast<long long>(rect.width) * rect.height);
+  GetMedianByLocalSort(host_src, src_pitch, host_dst, dst_pitch, width,
+    height, channel_num_, rect, radius_, gate_, border_, border_value_,
+    workspace, call_stats.get());
+  return true;
 }
 
-// Calculate the sum of the histograms
-void GetSumsOfHist(int* his, int** his_col,
-  int start, int nums) {
-  for (int i = 0; i < 256; i++) {
-    for (int j = 0; j < nums; j++) {
-      his[i] += his_col[start + j][i];
-    }
+/**
+* Workspace size of the median filter, enough for both FilterByHistogram
+* and FilterByLocalSort.
+*/
+template<typename Dtype>
+size_t MedianFilter<Dtype>::GetWorkspaceSize(int width, int height) const {
+  if (LAYOUT_COLUMN_MAJOR == layout_) {
+    std::swap(width, height);
   }
+  size_t histogram_size =
+    GetHistogramWorkspaceSize(width, height, channel_num_, radius_, Dtype());
+  size_t local_sort_size =
+    GetLocalSortWorkspaceSize(width, channel_num_, radius_, Dtype());
+  return histogram_size > local_sort_size ? histogram_size : local_sort_size;
 }
 
-// Add a histogram, then sub another
-void AddSubHist(int* his, int* his_add, int* his_sub) {
-  for (int i = 0; i < 256; i++) {
-    his[i] += his_add[i];
-    his[i] -= his_sub[i];
+// Calculate the sum of the histograms
+void GetSumsOfHist(const FilterKernels& kernels, int* his, int** his_col,
+  int start, int nums) {
+  for (int j = 0; j < nums; j++) {
+    kernels.add_hist(his, his_col[start + j], GRAY_LEVEL_MAX);
   }
 }
 
 // Update some histogram in array with the movement of filter window
-void UpdateHistInArray(int** his_col, const unsigned char* host_src,
-  int width, int new_width, int new_height, int radius) {
-  unsigned char delpoint =
-    host_src[(new_height - radius - 1) * width + new_width + radius];
-  unsigned char addpoint =
-    host_src[(new_height + radius) * width + new_width + radius];
-  his_col[new_width + radius][delpoint]--;
-  his_col[new_width + radius][addpoint]++;
+void UpdateHistInArray(int** his_col, const unsigned char* row_sub,
+  const unsigned char* row_add, int width_pos) {
+  his_col[width_pos][row_sub[width_pos]]--;
+  his_col[width_pos][row_add[width_pos]]++;
 }
 
-// Update some histograms in array from 0, the size is the size of filter window
-void UpdateHistFromZeroToCoreSize(int** his_col,
-  const unsigned char* host_src, int width,
-  int new_height_pos, int radius) {
-  for (int i = 0; i < radius * 2 + 1; i++) {
-    his_col[i][host_src[(new_height_pos - radius - 1) * width + i]]--;
-    his_col[i][host_src[(new_height_pos + radius) * width + i]]++;
-  }
+// Get the histograms of the channels of col x in array, x may be outside
+// [0, width), const_cols are the histograms of a BORDER_CONSTANT col
+inline int** GetColHist(int** his_col, int** const_cols, int x, int width,
+  int channels, BorderType border) {
+  int k = BorderInterpolate(x, width, border);
+  return k < 0 ? const_cols : his_col + k * channels;
 }
 
-// Median filter helper for unsigned char, o(1)
-void GetUcharMedianByHistogram(const unsigned char *host_src,
-  unsigned char *host_dst, int width, int height,
-  int radius, float gate) {
-  // Init a histogram and a histogram array
+// Median filter helper for unsigned char, o(1), filter the cols
+// [x_begin, x_end) of a row.
+// If row_sub and row_add are not null, the histograms in array are moved
+// down one row on the fly, by subtracting row_sub and adding row_add. Only
+// the cols under the filter windows are moved.
+// The array holds a histogram per channel of each col, the channels of a
+// pixel are moved together.
+void GetRowUcharMedianByHistogram(int** his_cols, int* const_his,
+  const unsigned char* row_sub, const unsigned char* row_add,
+  unsigned char *dst_row, int x_begin, int x_end, int width, int channels,
+  int radius, float gate, BorderType border, int** wnd_cols,
+  FilterStats* stats) {
+  const FilterKernels& kernels = GetFilterKernels();
   int core_size = radius * 2 + 1;
-  int histogram[GRAY_LEVEL_MAX];
-  memset(histogram, 0, sizeof(int) * GRAY_LEVEL_MAX);
-  int** his_cols = nullptr;
-  his_cols = new int*[width];
-  for (int i = 0; i < width; i++) {
-    his_cols[i] = new int[GRAY_LEVEL_MAX];
-    memset(his_cols[i], 0, sizeof(int) * GRAY_LEVEL_MAX);
+  int histogram[GRAY_LEVEL_MAX * CHANNEL_NUM_MAX];
+  int* const_cols[CHANNEL_NUM_MAX];
+  {
+    FILTER_STATS_PHASE(stats, FILTER_PHASE_WINDOW_INIT);
+    memset(histogram, 0, sizeof(int) * GRAY_LEVEL_MAX * channels);
+    for (int c = 0; c < channels; c++) {
+      const_cols[c] = const_his;
+    }
+    // Update the cols of the first filter window in histogram array
+    if (nullptr != row_sub) {
+      int col_end = MIN(x_begin + radius, width - 1);
+      for (int i = (x_begin - radius > 0 ? x_begin - radius : 0) * channels;
+        i < (col_end + 1) * channels; i++) {
+        UpdateHistInArray(his_cols, row_sub, row_add, i);
+      }
+    }
+    // Calculate the histogram of first pixel in row,
+    // then calculate medium value
+    for (int i = 0; i < core_size; i++) {
+      int** cols = GetColHist(his_cols, const_cols, x_begin + i - radius,
+        width, channels, border);
+      for (int c = 0; c < channels; c++) {
+        wnd_cols[c * core_size + i] = cols[c];
+      }
+    }
+    for (int c = 0; c < channels; c++) {
+      GetSumsOfHist(kernels, histogram + c * GRAY_LEVEL_MAX, wnd_cols,
+        c * core_size, core_size);
+      dst_row[c] = GetHistMediumValue(kernels,
+        histogram + c * GRAY_LEVEL_MAX, GRAY_LEVEL_MAX, radius, gate);
+      FILTER_STATS_ADD(stats, bins_scanned, dst_row[c] + 1);
+    }
   }
-  // Histogram array assignment
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < core_size; j++) {
-      his_cols[i][host_src[i + j*width]]++;
+  // Calculate the histogram of the other pixel in row
+  FILTER_STATS_PHASE(stats, FILTER_PHASE_SLIDE);
+  for (int i = x_begin + 1; i < x_end; i++) {
+    // Update col in histogram array
+    // then calculate the histogram with the movement of the filter window
+    int x_add = i + radius;
+    if (nullptr != row_sub && x_add < width) {
+      for (int c = 0; c < channels; c++) {
+        UpdateHistInArray(his_cols, row_sub, row_add, x_add * channels + c);
+      }
+    }
+    int** cols_add =
+      GetColHist(his_cols, const_cols, x_add, width, channels, border);
+    int** cols_sub = GetColHist(his_cols, const_cols, i - radius - 1, width,
+      channels, border);
+    for (int c = 0; c < channels; c++) {
+      int* his = histogram + c * GRAY_LEVEL_MAX;
+      kernels.add_sub_hist(his, cols_add[c], cols_sub[c], GRAY_LEVEL_MAX);
+      int value = GetHistMediumValue(kernels, his, GRAY_LEVEL_MAX, radius,
+        gate);
+      FILTER_STATS_ADD(stats, bins_scanned, value + 1);
+      dst_row[(i - x_begin) * channels + c] = value;
     }
   }
-  // Calculate the histogram of first pixel in first row,
-  // then calculate medium value
-  GetSumsOfHist(histogram, his_cols, 0, core_size);
-  host_dst[radius + radius*width] =
-    GetHistMediumValue(histogram, GRAY_LEVEL_MAX, radius, gate);
-  // Calculate the histogram of the other pixel in first row,
-  // then calculate medium value
-  for (int i = radius + 1; i < width - radius; i++) {
-    AddSubHist(histogram, his_cols[i + radius], his_cols[i - radius - 1]);
-    host_dst[i + radius*width] =
-      GetHistMediumValue(histogram, GRAY_LEVEL_MAX, radius, gate);
+}
+
+// Workspace size of GetUcharMedianByHistogram
+size_t GetUcharHistogramWorkspaceSize(int width, int channels, int radius) {
+  return FilterWorkspace::SizeOf<int*>(width * channels) +
+    FilterWorkspace::SizeOf<int>(
+    static_cast<size_t>(width * channels) * GRAY_LEVEL_MAX) +
+    FilterWorkspace::SizeOf<int*>((radius * 2 + 1) * channels) +
+    FilterWorkspace::SizeOf<unsigned char>(width * channels);
+}
+
+// Median filter helper for unsigned char, o(1)
+// The histogram array is indexed by image col and channel, only the cols
+// under the filter windows of the roi are filled.
+void GetUcharMedianByHistogram(const unsigned char *host_src, int src_pitch,
+  unsigned char *host_dst, int dst_pitch, int width, int height,
+  int channels, const ImageRect& roi, int radius, float gate,
+  BorderType border, unsigned char border_value,
+  FilterWorkspace* workspace, FilterStats* stats) {
+  // Init a histogram array, and the histogram of a constant col
+  int core_size = radius * 2 + 1;
+  int row_size = width * channels;
+  int const_his[GRAY_LEVEL_MAX];
+  int** his_cols = workspace->Acquire<int*>(row_size);
+  int* his_data =
+    workspace->Acquire<int>(static_cast<size_t>(row_size) * GRAY_LEVEL_MAX);
+  int** wnd_cols = workspace->Acquire<int*>(core_size * channels);
+  unsigned char* const_row = workspace->Acquire<unsigned char>(row_size);
+  {
+    FILTER_STATS_PHASE(stats, FILTER_PHASE_BORDER);
+    memset(const_his, 0, sizeof(int) * GRAY_LEVEL_MAX);
+    const_his[border_value] = core_size;
+    memset(const_row, border_value, row_size);
   }
-  // Calculate medium value in other row
-  for (int j = radius + 1; j < height - radius; j++) {
-    // Update the first filter core size cols in histogram array
-    UpdateHistFromZeroToCoreSize(his_cols, host_src, width, j, radius);
-    // Calculate the histogram of first pixel in row,
-    // then calculate medium value
-    memset(histogram, 0, sizeof(int) * GRAY_LEVEL_MAX);
-    GetSumsOfHist(histogram, his_cols, 0, core_size);
-    host_dst[radius + j * width] =
-      GetHistMediumValue(histogram, GRAY_LEVEL_MAX, radius, gate);
-    // Calculate the histogram of the other pixel in row
-    for (int i = radius + 1; i < width - radius; i++) {
-      // Update col in histogram array
-      // then calculate the histogram with the movement of the filter window
-      UpdateHistInArray(his_cols, host_src, width, i, j, radius);
-      AddSubHist(histogram, his_cols[i + radius], his_cols[i - radius - 1]);
-      host_dst[i + j * width] =
-        GetHistMediumValue(histogram, GRAY_LEVEL_MAX, radius, gate);
+  ImageRect context = GetRoiContext(roi, width, height, radius);
+  int pos_begin = context.x * channels;
+  int pos_end = (context.x + context.width) * channels;
+  int x_end = roi.x + roi.width;
+  {
+    FILTER_STATS_PHASE(stats, FILTER_PHASE_WINDOW_INIT);
+    memset(his_data + static_cast<ptrdiff_t>(pos_begin) * GRAY_LEVEL_MAX, 0,
+      sizeof(int) * (pos_end - pos_begin) * GRAY_LEVEL_MAX);
+    for (int i = 0; i < row_size; i++) {
+      his_cols[i] = his_data + static_cast<ptrdiff_t>(i) * GRAY_LEVEL_MAX;
+    }
+    // Histogram array assignment
+    for (int j = roi.y - radius; j <= roi.y + radius; j++) {
+      const unsigned char* row =
+        BorderRow(host_src, src_pitch, height, j, border, const_row);
+      for (int i = pos_begin; i < pos_end; i++) {
+        his_cols[i][row[i]]++;
+      }
     }
   }
-  // Resource recovery
-  for (int i = 0; i < width; i++) {
-    delete[] his_cols[i];
+  // Calculate medium value in first row
+  GetRowUcharMedianByHistogram(his_cols, const_his, nullptr, nullptr,
+    host_dst, roi.x, x_end, width, channels, radius, gate, border, wnd_cols,
+    stats);
+  // Calculate medium value in other row
+  for (int j = roi.y + 1; j < roi.y + roi.height; j++) {
+    GetRowUcharMedianByHistogram(his_cols, const_his,
+      BorderRow(host_src, src_pitch, height, j - radius - 1, border,
+      const_row),
+      BorderRow(host_src, src_pitch, height, j + radius, border, const_row),
+      host_dst + static_cast<ptrdiff_t>(j - roi.y) * dst_pitch, roi.x, x_end,
+      width, channels, radius, gate, border, wnd_cols, stats);
   }
-  delete[] his_cols;
 }
 
 /**
 * Median filtering.
-* Extend image edge by copying adjacent pixel, then execute median filtering.
+* The pixels outside the image are taken from the border mode, see
+* set_border, the kernel reads the source image directly.
 *
-* \param host_src   Source image data.
+* \param host_src   Source image data, channel_num values per pixel.
 * \param host_dst   Destination image data. Must be preallocated.
 * \param width			Image width, in pixels.
 * \param height			Image height, in pixels.
 * \param radius			Median filter radius. The kernel is a 2*r+1 by 2*r+1 square.
 * \param gate				Filter gate, default value is 0.5.
 */
-void UcharMedianFilter::FilterByHistogram(const unsigned char* host_src,
-  unsigned char* host_dst, int width, int height) {
+bool UcharMedianFilter::FilterByHistogram(const unsigned char* host_src,
+  unsigned char* host_dst, int width, int height) const {
+  FilterWorkspace workspace;
+  if (!workspace.Reserve(GetWorkspaceSize(width, height))) {
+    return false;
+  }
+  return FilterByHistogram(host_src, host_dst, width, height, &workspace);
+}
+
+/**
+* Median filtering with a preallocated workspace, no memory is allocated.
+* \param workspace  Reserved with at least GetWorkspaceSize(width, height).
+*/
+bool UcharMedianFilter::FilterByHistogram(const unsigned char* host_src,
+  unsigned char* host_dst, int width, int height,
+  FilterWorkspace* workspace) const {
+  int pitch = GetPackedPitch(width, height, channel_num_, layout_);
+  return FilterByHistogram(host_src, pitch, host_dst, pitch, width, height,
+    ImageRect(0, 0, width, height), workspace);
+}
+
+bool UcharMedianFilter::FilterByHistogram(const unsigned char* host_src,
+  int src_pitch, unsigned char* host_dst, int dst_pitch, int width,
+  int height, const ImageRect& roi) const {
+  FilterWorkspace workspace;
+  if (!workspace.Reserve(GetWorkspaceSize(width, height))) {
+    return false;
+  }
+  return FilterByHistogram(host_src, src_pitch, host_dst, dst_pitch, width,
+    height, roi, &workspace);
+}
+
+/**
+* Median filtering of a roi, in place in a bigger image with row pitches.
+* The image pixels around the roi are read as they are, the border mode only
+* applies at the image edges. Only the column histograms under the roi
+* windows are kept up to date. A LAYOUT_COLUMN_MAJOR image is filtered as
+* its transposed row-major image, see MedianFilter::FilterByHistogram.
+*
+* \param host_src   Source image data, the pixel (0, 0) of the image.
+* \param src_pitch  Distance between two source rows, in elements.
+* \param host_dst   Destination of the roi, the pixel (roi.x, roi.y).
+* \param dst_pitch  Distance between two destination rows, in elements.
+* \param width      Source image width, in pixels.
+* \param height     Source image height, in pixels.
+* \param roi        Rectangle to filter, inside the source image.
+* \param workspace  Reserved with at least GetWorkspaceSize(width, height).
+*/
+bool UcharMedianFilter::FilterByHistogram(const unsigned char* host_src,
+  int src_pitch, unsigned char* host_dst, int dst_pitch, int width,
+  int height, const ImageRect& roi, FilterWorkspace* workspace) const {
   // Input check
   assert(nullptr != host_src);
   assert(nullptr != host_dst);
+  assert(nullptr != workspace);
   assert(0 < width);
   assert(0 < height);
+  assert(IsRectInside(roi, width, height));
   assert(radius_ < MIN(width, height));
-  unsigned char* host_extend_src = nullptr;
-  unsigned char* host_extend_dst = nullptr;
-  // Get memory
-  int width_extend = width + radius_ * 2;
-  int height_extend = height + radius_ * 2;
-  host_extend_src = new unsigned char[width_extend * height_extend];
-  host_extend_dst = new unsigned char[width_extend * height_extend];
-  // Filter
-  ExtendMatrixEdge(host_src, host_extend_src, width, height, radius_);
-  GetUcharMedianByHistogram(host_extend_src, host_extend_dst, width_extend,
-    height_extend, radius_, gate_);
-  for (int i = 0; i < height; i++) {
-    memcpy_s(host_dst + i*width, width*sizeof(unsigned char),
-      host_extend_dst + width_extend * (radius_ + i) + radius_,
-      width * sizeof(unsigned char));
-  }
-  // Resource recovery
-  delete[] host_extend_src;
-  delete[] host_extend_dst;
-}
\ No newline at end of file
+  workspace->Release();
+  if (workspace->capacity() < GetWorkspaceSize(width, height)) {
+    return false;
+  }
+  // The window is symmetric, the columns are the rows of the transposed image.
+  ImageRect rect = roi;
+  if (LAYOUT_COLUMN_MAJOR == layout_) {
+    std::swap(width, height);
+    rect = TransposeRect(roi);
+  }
+  assert(width * channel_num_ <= src_pitch);
+  assert(rect.width * channel_num_ <= dst_pitch);
+  // Filter, traced by the first row of the roi
+  ThreadTraceBuffer thread_trace(nullptr);
+  TraceScope span(thread_trace.get(), "uchar_median_histogram",
+    rect.y);
+  FilterCallStats call_stats(stats_, stats_callback_);
+  FILTER_STATS_ADD_ALLOCATIONS(call_stats.get(), workspace);
+  FILTER_STATS_ADD(call_stats.get(), pixels,
+    static_cast<long long>(rect.width) * rect.height);
+  GetUcharMedianByHistogram(host_src, src_pitch, host_dst, dst_pitch, width,
+    height, channel_num_, rect, radius_, gate_, border_, border_value_,
+    workspace, call_stats.get());
+  return true;
+}
+
+// Workspace size of the median filter, the histogram of each col.
+size_t UcharMedianFilter::GetWorkspaceSize(int width, int height) const {
+  int line_width = LAYOUT_COLUMN_MAJOR == layout_ ? height : width;
+  return GetUcharHistogramWorkspaceSize(line_width, channel_num_, radius_);
+}
+
+template<typename Dtype>
+MedianRowStream<Dtype>::MedianRowStream(int radius, int width)
+  : radius_(radius), width_(width), gate_(0.5), rows_out_(0),
+  ring_buffer_(radius, width), buffer_(nullptr), rows_(nullptr) {
+  int core_size = radius * 2 + 1;
+  if (!workspace_.Reserve(
+    FilterWorkspace::SizeOf<Dtype>(core_size * core_size) +
+    FilterWorkspace::SizeOf<const Dtype*>(core_size))) {
+    return;
+  }
+  buffer_ = workspace_.Acquire<Dtype>(core_size * core_size);
+  rows_ = workspace_.Acquire<const Dtype*>(core_size);
+}
+
+template<typename Dtype>
+void MedianRowStream<Dtype>::Reset() {
+  ring_buffer_.Reset();
+  rows_out_ = 0;
+}
+
+/**
+* Push a source row into the stream.
+*
+* \param host_src_row  Source row, width pixels.
+* \param host_dst_row  Destination row, width pixels. Written only when
+*                      true is returned.
+*/
+template<typename Dtype>
+bool MedianRowStream<Dtype>::PushRow(const Dtype* host_src_row,
+  Dtype* host_dst_row) {
+  assert(nullptr != host_dst_row);
+  if (!ok()) {
+    return false;
+  }
+  ring_buffer_.Push(host_src_row);
+  if (ring_buffer_.rows() <= radius_) {
+    return false;
+  }
+  EmitRow(host_dst_row, -1);
+  return true;
+}
+
+template<typename Dtype>
+bool MedianRowStream<Dtype>::PushPackedRow(const unsigned char* packed_row,
+  PackedFormat format, Dtype* host_dst_row) {
+  assert(nullptr != host_dst_row);
+  if (!ok()) {
+    return false;
+  }
+  ring_buffer_.PushPacked(packed_row, format);
+  if (ring_buffer_.rows() <= radius_) {
+    return false;
+  }
+  EmitRow(host_dst_row, -1);
+  return true;
+}
+
+template<typename Dtype>
+bool MedianRowStream<Dtype>::Flush(Dtype* host_dst_row) {
+  assert(nullptr != host_dst_row);
+  if (!ok()) {
+    return false;
+  }
+  assert(radius_ < ring_buffer_.rows());
+  if (rows_out_ >= ring_buffer_.rows()) {
+    return false;
+  }
+  EmitRow(host_dst_row, ring_buffer_.rows());
+  return true;
+}
+
+template<typename Dtype>
+void MedianRowStream<Dtype>::EmitRow(Dtype* host_dst_row, int height) {
+  for (int m = 0; m < radius_ * 2 + 1; m++) {
+    rows_[m] = ring_buffer_.Row(rows_out_ - radius_ + m, height);
+  }
+  GetRowMedianByLocalSort(rows_, host_dst_row, 0, width_, width_, 1,
+    radius_, gate_, ring_buffer_.border(), ring_buffer_.border_value(),
+    buffer_, nullptr);
+  rows_out_++;
+}
+
+UcharMedianRowStream::UcharMedianRowStream(int radius, int width)
+  : radius_(radius), width_(width), gate_(0.5), rows_out_(0),
+  ring_buffer_(radius, width), his_data_(nullptr), his_cols_(nullptr),
+  wnd_cols_(nullptr) {
+  if (!workspace_.Reserve(
+    FilterWorkspace::SizeOf<int>(width * GRAY_LEVEL_MAX) +
+    FilterWorkspace::SizeOf<int*>(width) +
+    FilterWorkspace::SizeOf<int*>(radius * 2 + 1))) {
+    return;
+  }
+  his_data_ = workspace_.Acquire<int>(width * GRAY_LEVEL_MAX);
+  his_cols_ = workspace_.Acquire<int*>(width);
+  wnd_cols_ = workspace_.Acquire<int*>(radius * 2 + 1);
+  for (int i = 0; i < width; i++) {
+    his_cols_[i] = his_data_ + i * GRAY_LEVEL_MAX;
+  }
+}
+
+void UcharMedianRowStream::Reset() {
+  ring_buffer_.Reset();
+  rows_out_ = 0;
+}
+
+bool UcharMedianRowStream::PushRow(const unsigned char* host_src_row,
+  unsigned char* host_dst_row) {
+  assert(nullptr != host_dst_row);
+  if (!ok()) {
+    return false;
+  }
+  ring_buffer_.Push(host_src_row);
+  if (ring_buffer_.rows() <= radius_) {
+    return false;
+  }
+  EmitRow(host_dst_row, -1);
+  return true;
+}
+
+bool UcharMedianRowStream::PushPackedRow(const unsigned char* packed_row,
+  PackedFormat format, unsigned char* host_dst_row) {
+  assert(nullptr != host_dst_row);
+  if (!ok()) {
+    return false;
+  }
+  ring_buffer_.PushPacked(packed_row, format);
+  if (ring_buffer_.rows() <= radius_) {
+    return false;
+  }
+  EmitRow(host_dst_row, -1);
+  return true;
+}
+
+bool UcharMedianRowStream::Flush(unsigned char* host_dst_row) {
+  assert(nullptr != host_dst_row);
+  if (!ok()) {
+    return false;
+  }
+  assert(radius_ < ring_buffer_.rows());
+  if (rows_out_ >= ring_buffer_.rows()) {
+    return false;
+  }
+  EmitRow(host_dst_row, ring_buffer_.rows());
+  return true;
+}
+
+// Update the column histograms with the movement of the filter window,
+// then slide the window toward right like GetUcharMedianByHistogram
+void UcharMedianRowStream::EmitRow(unsigned char* host_dst_row, int height) {
+  int y = rows_out_;
+  if (0 == y) {
+    memset(his_data_, 0, sizeof(int) * width_ * GRAY_LEVEL_MAX);
+    for (int m = -radius_; m <= radius_; m++) {
+      const unsigned char* row = ring_buffer_.Row(m, height);
+      for (int k = 0; k < width_; k++) {
+        his_cols_[k][row[k]]++;
+      }
+    }
+    memset(const_his_, 0, sizeof(int) * GRAY_LEVEL_MAX);
+    const_his_[ring_buffer_.border_value()] = radius_ * 2 + 1;
+    GetRowUcharMedianByHistogram(his_cols_, const_his_, nullptr, nullptr,
+      host_dst_row, 0, width_, width_, 1, radius_, gate_,
+      ring_buffer_.border(), wnd_cols_, nullptr);
+  } else {
+    GetRowUcharMedianByHistogram(his_cols_, const_his_,
+      ring_buffer_.Row(y - radius_ - 1, height),
+      ring_buffer_.Row(y + radius_, height), host_dst_row, 0, width_, width_,
+      1, radius_, gate_, ring_buffer_.border(), wnd_cols_, nullptr);
+  }
+  rows_out_++;
+}
+
+template void QuickSort<unsigned char>(unsigned char*, int, int);
+template void QuickSort<float>(float*, int, int);
+template void QuickSort<double>(double*, int, int);
+template int BinaryFind<unsigned char>(unsigned char*, int, int,
+  unsigned char);
+template int BinaryFind<float>(float*, int, int, float);
+template int BinaryFind<double>(double*, int, int, double);
+template void UpdateHist<int>(const int**, int*, int, int, int, int, int,
+  BorderType, int);
+template void ReplaceSortedBuffer<unsigned char>(unsigned char*, int, int,
+  unsigned char);
+template void ReplaceSortedBuffer<float>(float*, int, int, float);
+template void ReplaceSortedBuffer<double>(double*, int, int, double);
@@ -1,7 +1,9 @@
 ﻿#ifndef IMAGE_IMAGE_FILTER_MEDIAN_FILTER_H_
 #define IMAGE_IMAGE_FILTER_MEDIAN_FILTER_H_
 
-#ifdef IMAGE_IMAGE_FILTER_MEDIAN_FILTER_H_
+#ifndef _WIN32
+#define DLL_IMAGE_FILTER_MEDIAN_FILTER_API
+#elif defined(IMAGE_IMAGE_FILTER_MEDIAN_FILTER_H_)
 #define DLL_IMAGE_FILTER_MEDIAN_FILTER_API __declspec(dllexport)
 #else
 #define DLL_IMAGE_FILTER_MEDIAN_FILTER_API __declspec(dllimport)
@@ -9,6 +11,10 @@
 
 #include <assert.h>
 #include <chrono>
+#include "image_filter/filter_stats.h"
+#include "image_filter/filter_workspace.h"
+#include "image_filter/image_rect.h"
+#include "image_filter/row_buffer.h"
 
 // Define macro min
 #ifndef MIN
@@ -20,6 +26,11 @@
 #define GRAY_LEVEL_MAX 256
 #endif
 
+// Define max number of interleaved channels.
+#ifndef CHANNEL_NUM_MAX
+#define CHANNEL_NUM_MAX 4
+#endif
+
 // Disable the copy and assignment operator for a class.
 #define DISABLE_COPY_AND_ASSIGN(classname) \
 private:\
@@ -31,8 +42,11 @@ template<typename Dtype>
 class DLL_IMAGE_FILTER_MEDIAN_FILTER_API MedianFilter
 {
 public:
-  MedianFilter() : gate_(0.5) {}
-  explicit MedianFilter(int radius) : radius_(radius), gate_(0.5) {}
+  MedianFilter() : gate_(0.5), channel_num_(1), layout_(LAYOUT_ROW_MAJOR),
+    border_(BORDER_REFLECT_101), border_value_(0), stats_(nullptr) {}
+  explicit MedianFilter(int radius) : radius_(radius), gate_(0.5),
+    channel_num_(1), layout_(LAYOUT_ROW_MAJOR), border_(BORDER_REFLECT_101),
+    border_value_(0), stats_(nullptr) {}
   void set_radius(int radius) {
     assert(radius > 0);
     radius_ = radius;
@@ -42,19 +56,76 @@ public:
     assert(gate < 1);
     gate_ = gate;
   }
-  void FilterByHistogram(const Dtype* host_src, Dtype* host_dst, int width, int height);
-  void FilterByLocalSort(const Dtype* host_src, Dtype* host_dst, int width, int height);
+  // Number of interleaved values per pixel, each channel is filtered on its
+  // own in the same pass, default 1.
+  void set_channel_num(int channel_num) {
+    assert(channel_num > 0);
+    assert(channel_num <= CHANNEL_NUM_MAX);
+    channel_num_ = channel_num;
+  }
+  // How the images are stored, default LAYOUT_ROW_MAJOR. A column-major
+  // image is filtered along its contiguous columns, without transposing.
+  void set_layout(ImageLayout layout) { layout_ = layout; }
+  // How the pixels outside the image are taken, default BORDER_REFLECT_101.
+  void set_border(BorderType border, Dtype border_value = Dtype()) {
+    border_ = border;
+    border_value_ = border_value;
+  }
+  // Filled with the phase times and counts of each call, only when the
+  // library is built with IMAGE_FILTER_STATS, see filter_stats.h. A filter
+  // called from several threads at once must not collect stats.
+  void set_stats(FilterStats* stats) { stats_ = stats; }
+  // Called at the end of each call with its stats, IMAGE_FILTER_STATS too.
+  void set_stats_callback(const FilterStatsCallback& callback) {
+    stats_callback_ = callback;
+  }
+  int radius() const { return radius_; }
+  int channel_num() const { return channel_num_; }
+  // Workspace bytes needed by both methods for an image size.
+  size_t GetWorkspaceSize(int width, int height) const;
+  // Return false if the memory can not be allocated.
+  bool FilterByHistogram(const Dtype* host_src, Dtype* host_dst, int width, int height) const;
+  bool FilterByLocalSort(const Dtype* host_src, Dtype* host_dst, int width, int height) const;
+  // Take all the buffers from workspace, see GetWorkspaceSize.
+  bool FilterByHistogram(const Dtype* host_src, Dtype* host_dst, int width,
+    int height, FilterWorkspace* workspace) const;
+  bool FilterByLocalSort(const Dtype* host_src, Dtype* host_dst, int width,
+    int height, FilterWorkspace* workspace) const;
+  // Filter the roi of an image with row pitches, in elements. The pixels
+  // around the roi are read as context, host_dst points to the roi output.
+  bool FilterByHistogram(const Dtype* host_src, int src_pitch,
+    Dtype* host_dst, int dst_pitch, int width, int height,
+    const ImageRect& roi) const;
+  bool FilterByLocalSort(const Dtype* host_src, int src_pitch,
+    Dtype* host_dst, int dst_pitch, int width, int height,
+    const ImageRect& roi) const;
+  bool FilterByHistogram(const Dtype* host_src, int src_pitch,
+    Dtype* host_dst, int dst_pitch, int width, int height,
+    const ImageRect& roi, FilterWorkspace* workspace) const;
+  bool FilterByLocalSort(const Dtype* host_src, int src_pitch,
+    Dtype* host_dst, int dst_pitch, int width, int height,
+    const ImageRect& roi, FilterWorkspace* workspace) const;
 private:
   int radius_;
   float gate_;
+  int channel_num_;
+  ImageLayout layout_;
+  BorderType border_;
+  Dtype border_value_;
+  FilterStats* stats_;
+  FilterStatsCallback stats_callback_;
   DISABLE_COPY_AND_ASSIGN(MedianFilter);
 };
 
 class DLL_IMAGE_FILTER_MEDIAN_FILTER_API UcharMedianFilter
 {
 public:
-  UcharMedianFilter() : gate_(0.5) {}
-  explicit UcharMedianFilter(int radius) : radius_(radius), gate_(0.5) {}
+  UcharMedianFilter() : gate_(0.5), channel_num_(1),
+    layout_(LAYOUT_ROW_MAJOR), border_(BORDER_REFLECT_101), border_value_(0),
+    stats_(nullptr) {}
+  explicit UcharMedianFilter(int radius) : radius_(radius), gate_(0.5),
+    channel_num_(1), layout_(LAYOUT_ROW_MAJOR), border_(BORDER_REFLECT_101),
+    border_value_(0), stats_(nullptr) {}
   void set_radius(int radius) {
     assert(radius > 0);
     radius_ = radius;
@@ -64,10 +135,215 @@ public:
     assert(gate < 1);
     gate_ = gate;
   }
-  void FilterByHistogram(const unsigned char* host_src, unsigned char* host_dst, int width, int height);
+  // Number of interleaved values per pixel, each channel is filtered on its
+  // own in the same pass, default 1.
+  void set_channel_num(int channel_num) {
+    assert(channel_num > 0);
+    assert(channel_num <= CHANNEL_NUM_MAX);
+    channel_num_ = channel_num;
+  }
+  // How the images are stored, default LAYOUT_ROW_MAJOR. A column-major
+  // image is filtered along its contiguous columns, without transposing.
+  void set_layout(ImageLayout layout) { layout_ = layout; }
+  // How the pixels outside the image are taken, default BORDER_REFLECT_101.
+  void set_border(BorderType border, unsigned char border_value = 0) {
+    border_ = border;
+    border_value_ = border_value;
+  }
+  // Filled with the phase times and counts of each call, only when the
+  // library is built with IMAGE_FILTER_STATS, see filter_stats.h. A filter
+  // called from several threads at once must not collect stats.
+  void set_stats(FilterStats* stats) { stats_ = stats; }
+  // Called at the end of each call with its stats, IMAGE_FILTER_STATS too.
+  void set_stats_callback(const FilterStatsCallback& callback) {
+    stats_callback_ = callback;
+  }
+  int radius() const { return radius_; }
+  int channel_num() const { return channel_num_; }
+  // Workspace bytes needed for an image size.
+  size_t GetWorkspaceSize(int width, int height) const;
+  // Return false if the memory can not be allocated.
+  bool FilterByHistogram(const unsigned char* host_src, unsigned char* host_dst, int width, int height) const;
+  // Take all the buffers from workspace, see GetWorkspaceSize.
+  bool FilterByHistogram(const unsigned char* host_src,
+    unsigned char* host_dst, int width, int height,
+    FilterWorkspace* workspace) const;
+  // Filter the roi of an image with row pitches, in elements. The pixels
+  // around the roi are read as context, host_dst points to the roi output.
+  bool FilterByHistogram(const unsigned char* host_src, int src_pitch,
+    unsigned char* host_dst, int dst_pitch, int width, int height,
+    const ImageRect& roi) const;
+  bool FilterByHistogram(const unsigned char* host_src, int src_pitch,
+    unsigned char* host_dst, int dst_pitch, int width, int height,
+    const ImageRect& roi, FilterWorkspace* workspace) const;
 private:
   int radius_;
   float gate_;
+  int channel_num_;
+  ImageLayout layout_;
+  BorderType border_;
+  unsigned char border_value_;
+  FilterStats* stats_;
+  FilterStatsCallback stats_callback_;
   DISABLE_COPY_AND_ASSIGN(UcharMedianFilter);
 };
+
+/**
+* Line-buffered median filter by local sorting, for images arriving row by
+* row. Only 2*r+2 rows are kept in memory, an output row is emitted as soon
+* as the r rows below it have been pushed.
+*/
+template<typename Dtype>
+class DLL_IMAGE_FILTER_MEDIAN_FILTER_API MedianRowStream
+{
+public:
+  MedianRowStream(int radius, int width);
+  // False if the buffers could not be allocated, then PushRow, PushPackedRow
+  // and Flush return false without doing anything.
+  bool ok() const { return ring_buffer_.ok() && nullptr != buffer_; }
+  // Only allowed before the first row is pushed.
+  void set_border(BorderType border, Dtype border_value = Dtype()) {
+    ring_buffer_.set_border(border, border_value);
+  }
+  void set_gate(float gate) {
+    assert(gate > 0);
+    assert(gate < 1);
+    gate_ = gate;
+  }
+  // Push the next source row. Return true if output row rows_out() - 1 was
+  // written to host_dst_row.
+  bool PushRow(const Dtype* host_src_row, Dtype* host_dst_row);
+  // Push the next source row packed, see packed_row.h. It is unpacked
+  // straight into the row buffer, never as a whole image.
+  bool PushPackedRow(const unsigned char* packed_row, PackedFormat format,
+    Dtype* host_dst_row);
+  // Call after the last source row, once per remaining output row. Return
+  // false when all the rows have been emitted.
+  bool Flush(Dtype* host_dst_row);
+  // Start a new image with the same radius and width.
+  void Reset();
+  int rows_in() const { return ring_buffer_.rows(); }
+  int rows_out() const { return rows_out_; }
+private:
+  void EmitRow(Dtype* host_dst_row, int height);
+  int radius_;
+  int width_;
+  float gate_;
+  int rows_out_;
+  RowRingBuffer<Dtype> ring_buffer_;
+  FilterWorkspace workspace_;
+  Dtype* buffer_;
+  const Dtype** rows_;
+  DISABLE_COPY_AND_ASSIGN(MedianRowStream);
+};
+
+/**
+* Line-buffered O(1) median filter for unsigned char, the column histograms
+* of GetUcharMedianByHistogram are updated once per pushed row.
+*/
+class DLL_IMAGE_FILTER_MEDIAN_FILTER_API UcharMedianRowStream
+{
+public:
+  UcharMedianRowStream(int radius, int width);
+  bool ok() const { return ring_buffer_.ok() && nullptr != his_data_; }
+  // Only allowed before the first row is pushed.
+  void set_border(BorderType border, unsigned char border_value = 0) {
+    ring_buffer_.set_border(border, border_value);
+  }
+  void set_gate(float gate) {
+    assert(gate > 0);
+    assert(gate < 1);
+    gate_ = gate;
+  }
+  bool PushRow(const unsigned char* host_src_row,
+    unsigned char* host_dst_row);
+  // The 8 most significant bits of the packed pixels are filtered.
+  bool PushPackedRow(const unsigned char* packed_row, PackedFormat format,
+    unsigned char* host_dst_row);
+  bool Flush(unsigned char* host_dst_row);
+  void Reset();
+  int rows_in() const { return ring_buffer_.rows(); }
+  int rows_out() const { return rows_out_; }
+private:
+  void EmitRow(unsigned char* host_dst_row, int height);
+  int radius_;
+  int width_;
+  float gate_;
+  int rows_out_;
+  RowRingBuffer<unsigned char> ring_buffer_;
+  FilterWorkspace workspace_;
+  int* his_data_;
+  int** his_cols_;
+  int** wnd_cols_;
+  int const_his_[GRAY_LEVEL_MAX];
+  DISABLE_COPY_AND_ASSIGN(UcharMedianRowStream);
+};
+/**
+* Column-streamed median filter, for images arriving A-scan by A-scan.
+* A column of height pixels is contiguous, so the columns are the rows of
+* the transposed image. The filter window is symmetric, the stream is a
+* MedianRowStream over that image: output column x - r is emitted when
+* column x + r is pushed, only 2*r+2 columns are kept and the number of
+* columns is unbounded.
+*/
+template<typename Dtype>
+class DLL_IMAGE_FILTER_MEDIAN_FILTER_API MedianColumnStream
+{
+public:
+  MedianColumnStream(int radius, int height) : row_stream_(radius, height) {}
+  // False if the buffers could not be allocated, see MedianRowStream.
+  bool ok() const { return row_stream_.ok(); }
+  // Only allowed before the first column is pushed.
+  void set_border(BorderType border, Dtype border_value = Dtype()) {
+    row_stream_.set_border(border, border_value);
+  }
+  void set_gate(float gate) { row_stream_.set_gate(gate); }
+  // Push the next source column. Return true if output column
+  // columns_out() - 1 was written to host_dst_col.
+  bool PushColumn(const Dtype* host_src_col, Dtype* host_dst_col) {
+    return row_stream_.PushRow(host_src_col, host_dst_col);
+  }
+  // Call after the last source column, once per remaining output column.
+  // Return false when all the columns have been emitted.
+  bool Flush(Dtype* host_dst_col) { return row_stream_.Flush(host_dst_col); }
+  // Start a new scan with the same radius and height.
+  void Reset() { row_stream_.Reset(); }
+  int columns_in() const { return row_stream_.rows_in(); }
+  int columns_out() const { return row_stream_.rows_out(); }
+private:
+  MedianRowStream<Dtype> row_stream_;
+  DISABLE_COPY_AND_ASSIGN(MedianColumnStream);
+};
+
+/**
+* Column-streamed O(1) median filter for unsigned char. It is a
+* UcharMedianRowStream over the transposed image: a histogram per pixel of
+* the column covers the 2*r+1 columns of the window, and the window
+* histogram slides along the column.
+*/
+class DLL_IMAGE_FILTER_MEDIAN_FILTER_API UcharMedianColumnStream
+{
+public:
+  UcharMedianColumnStream(int radius, int height)
+    : row_stream_(radius, height) {}
+  bool ok() const { return row_stream_.ok(); }
+  // Only allowed before the first column is pushed.
+  void set_border(BorderType border, unsigned char border_value = 0) {
+    row_stream_.set_border(border, border_value);
+  }
+  void set_gate(float gate) { row_stream_.set_gate(gate); }
+  bool PushColumn(const unsigned char* host_src_col,
+    unsigned char* host_dst_col) {
+    return row_stream_.PushRow(host_src_col, host_dst_col);
+  }
+  bool Flush(unsigned char* host_dst_col) {
+    return row_stream_.Flush(host_dst_col);
+  }
+  void Reset() { row_stream_.Reset(); }
+  int columns_in() const { return row_stream_.rows_in(); }
+  int columns_out() const { return row_stream_.rows_out(); }
+private:
+  UcharMedianRowStream row_stream_;
+  DISABLE_COPY_AND_ASSIGN(UcharMedianColumnStream);
+};
 #endif  // !IMAGE_IMAGE_FILTER_MEDIAN_FILTER_H_
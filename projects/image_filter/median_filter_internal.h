@@ -0,0 +1,32 @@
+#ifndef IMAGE_IMAGE_FILTER_MEDIAN_FILTER_INTERNAL_H_
+#define IMAGE_IMAGE_FILTER_MEDIAN_FILTER_INTERNAL_H_
+#include "image_filter/border.h"
+#include "image_filter/filter_kernels.h"
+
+// Inner loops of median_filter.cpp, declared for volume_filter.cpp and the
+// micro benchmarks of image_filter_bench. Not part of the library
+// interface, they change with the filters. The templates are instantiated
+// for unsigned char, float and double, UpdateHist for the int ordinal
+// images.
+
+// Sort src[l, r] in place.
+template<typename Dtype>
+void QuickSort(Dtype* src, int l, int r);
+// Position of v in the sorted src[l, r], which holds it.
+template<typename Dtype>
+int BinaryFind(Dtype* src, int l, int r, Dtype v);
+// Move the histogram of a window of the ordinal image one col toward right.
+template<typename Dtype>
+void UpdateHist(const Dtype** rows, int *his, int radius, int width_pos,
+  int width, int c, int channels, BorderType border, Dtype border_value);
+// Value at which the histogram count reaches gate of the window size, the
+// window has 2*radius+1 values along each of its dims.
+int GetHistMediumValue(const FilterKernels& kernels, int* his, int size,
+  int radius, float gate, int dims = 2);
+// Set buffer[pos] of the sorted window buffer to new_val and keep it sorted.
+template<typename Dtype>
+void ReplaceSortedBuffer(Dtype* buffer, int pos, int radius, Dtype new_val);
+// Add the nums col histograms of his_col from start to his.
+void GetSumsOfHist(const FilterKernels& kernels, int* his, int** his_col,
+  int start, int nums);
+#endif  // !IMAGE_IMAGE_FILTER_MEDIAN_FILTER_INTERNAL_H_
@@ -0,0 +1,118 @@
+#include <assert.h>
+#include "image_filter/packed_row.h"
+
+size_t GetPackedRowSize(PackedFormat format, int width) {
+  assert(0 <= width);
+  switch (format) {
+  case PACKED_10BIT_MIPI:
+    return (static_cast<size_t>(width) + 3) / 4 * 5;
+  case PACKED_12BIT_MIPI:
+    return (static_cast<size_t>(width) + 1) / 2 * 3;
+  default:
+    return (static_cast<size_t>(width) * GetPackedBits(format) + 7) / 8;
+  }
+}
+
+/**
+* A packed value as Dtype, the second parameter is the number of bits of
+* value, only unsigned char needs it.
+*/
+template<typename Dtype>
+inline Dtype GetUnpackedValue(int value, int) {
+  return static_cast<Dtype>(value);
+}
+
+template<>
+inline unsigned char GetUnpackedValue<unsigned char>(int value, int bits) {
+  return static_cast<unsigned char>(value >> (bits - 8));
+}
+
+/**
+* Pixel x of a packed row, one at a time, for the pixels after the last whole
+* group. A pixel of a bit stream spans 2 bytes at most, the second one is
+* only read if the pixel reaches it.
+*/
+static int GetPackedValue(const unsigned char* packed_row,
+  PackedFormat format, int x) {
+  if (PACKED_10BIT_MIPI == format) {
+    const unsigned char* group = packed_row + x / 4 * 5;
+    return (group[x % 4] << 2) | ((group[4] >> (x % 4 * 2)) & 0x03);
+  }
+  if (PACKED_12BIT_MIPI == format) {
+    const unsigned char* group = packed_row + x / 2 * 3;
+    return (group[x % 2] << 4) | ((group[2] >> (x % 2 * 4)) & 0x0F);
+  }
+  int bits = GetPackedBits(format);
+  size_t pos = static_cast<size_t>(x) * bits;
+  const unsigned char* bytes = packed_row + pos / 8;
+  int shift = static_cast<int>(pos % 8);
+  int value = bytes[0] >> shift;
+  if (shift + bits > 8) {
+    value |= bytes[1] << (8 - shift);
+  }
+  return value & ((1 << bits) - 1);
+}
+
+/**
+* Unpack the whole groups of bytes at once, 4 pixels of 5 bytes or 2 pixels
+* of 3 bytes, and the pixels left one at a time.
+*
+* \param packed_row  Packed row, GetPackedRowSize(format, width) bytes.
+* \param format      Layout of the packed row.
+* \param width       Pixels of the row.
+* \param row         Unpacked row, width pixels.
+*/
+template<typename Dtype>
+void UnpackRow(const unsigned char* packed_row, PackedFormat format,
+  int width, Dtype* row) {
+  assert(nullptr != packed_row);
+  assert(nullptr != row);
+  int bits = GetPackedBits(format);
+  int x = 0;
+  const unsigned char* b = packed_row;
+  switch (format) {
+  case PACKED_10BIT:
+    for (; x + 4 <= width; x += 4, b += 5) {
+      row[x] = GetUnpackedValue<Dtype>(b[0] | ((b[1] & 0x03) << 8), bits);
+      row[x + 1] = GetUnpackedValue<Dtype>(
+        (b[1] >> 2) | ((b[2] & 0x0F) << 6), bits);
+      row[x + 2] = GetUnpackedValue<Dtype>(
+        (b[2] >> 4) | ((b[3] & 0x3F) << 4), bits);
+      row[x + 3] = GetUnpackedValue<Dtype>((b[3] >> 6) | (b[4] << 2), bits);
+    }
+    break;
+  case PACKED_12BIT:
+    for (; x + 2 <= width; x += 2, b += 3) {
+      row[x] = GetUnpackedValue<Dtype>(b[0] | ((b[1] & 0x0F) << 8), bits);
+      row[x + 1] = GetUnpackedValue<Dtype>((b[1] >> 4) | (b[2] << 4), bits);
+    }
+    break;
+  case PACKED_10BIT_MIPI:
+    for (; x + 4 <= width; x += 4, b += 5) {
+      row[x] = GetUnpackedValue<Dtype>((b[0] << 2) | (b[4] & 0x03), bits);
+      row[x + 1] = GetUnpackedValue<Dtype>(
+        (b[1] << 2) | ((b[4] >> 2) & 0x03), bits);
+      row[x + 2] = GetUnpackedValue<Dtype>(
+        (b[2] << 2) | ((b[4] >> 4) & 0x03), bits);
+      row[x + 3] = GetUnpackedValue<Dtype>((b[3] << 2) | (b[4] >> 6), bits);
+    }
+    break;
+  case PACKED_12BIT_MIPI:
+    for (; x + 2 <= width; x += 2, b += 3) {
+      row[x] = GetUnpackedValue<Dtype>((b[0] << 4) | (b[2] & 0x0F), bits);
+      row[x + 1] = GetUnpackedValue<Dtype>((b[1] << 4) | (b[2] >> 4), bits);
+    }
+    break;
+  }
+  for (; x < width; x++) {
+    row[x] = GetUnpackedValue<Dtype>(
+      GetPackedValue(packed_row, format, x), bits);
+  }
+}
+
+template void UnpackRow<unsigned char>(const unsigned char* packed_row,
+  PackedFormat format, int width, unsigned char* row);
+template void UnpackRow<float>(const unsigned char* packed_row,
+  PackedFormat format, int width, float* row);
+template void UnpackRow<double>(const unsigned char* packed_row,
+  PackedFormat format, int width, double* row);
@@ -0,0 +1,36 @@
+#ifndef IMAGE_IMAGE_FILTER_PACKED_ROW_H_
+#define IMAGE_IMAGE_FILTER_PACKED_ROW_H_
+#include <stddef.h>
+
+// Layouts of the rows of packed sensor pixels. Every row starts on a byte.
+enum PackedFormat {
+  // 10 bits, 4 pixels in 5 bytes, the row is one stream of bits, least
+  // significant first, as GenICam Mono10p.
+  PACKED_10BIT = 0,
+  // 12 bits, 2 pixels in 3 bytes, the row is one stream of bits, least
+  // significant first, as GenICam Mono12p.
+  PACKED_12BIT = 1,
+  // 10 bits, 4 pixels in 5 bytes, the 8 high bits of each pixel then a byte
+  // of their 2 low bits, as MIPI CSI-2 RAW10. A last group is padded.
+  PACKED_10BIT_MIPI = 2,
+  // 12 bits, 2 pixels in 3 bytes, the 8 high bits of each pixel then a byte
+  // of their 4 low bits, as MIPI CSI-2 RAW12. A last group is padded.
+  PACKED_12BIT_MIPI = 3
+};
+
+// Bits per pixel of a packed format.
+inline int GetPackedBits(PackedFormat format) {
+  return PACKED_10BIT == format || PACKED_10BIT_MIPI == format ? 10 : 12;
+}
+
+// Bytes of a packed row of width pixels.
+size_t GetPackedRowSize(PackedFormat format, int width);
+
+/**
+* Unpack a row of width pixels. The values are kept as they are, except for
+* unsigned char which keeps their 8 most significant bits.
+*/
+template<typename Dtype>
+void UnpackRow(const unsigned char* packed_row, PackedFormat format,
+  int width, Dtype* row);
+#endif  // !IMAGE_IMAGE_FILTER_PACKED_ROW_H_
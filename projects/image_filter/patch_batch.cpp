@@ -0,0 +1,201 @@
+#include <math.h>
+#include <string.h>
+#include "image_filter/patch_batch.h"
+
+template class PatchBatchFilter<unsigned char>;
+template class PatchBatchFilter<float>;
+template class PatchBatchFilter<double>;
+
+template<typename Dtype>
+void PackPatches(const Dtype* const* host_srcs, int patch_num, int width,
+  int height, Dtype* host_packed) {
+  assert(nullptr != host_srcs);
+  assert(nullptr != host_packed);
+  int size = width * height;
+  for (int k = 0; k < patch_num; k++) {
+    const Dtype* src = host_srcs[k];
+    for (int p = 0; p < size; p++) {
+      host_packed[static_cast<ptrdiff_t>(p) * patch_num + k] = src[p];
+    }
+  }
+}
+
+template<typename Dtype>
+void UnpackPatches(const Dtype* host_packed, int patch_num, int width,
+  int height, Dtype* const* host_dsts) {
+  assert(nullptr != host_packed);
+  assert(nullptr != host_dsts);
+  int size = width * height;
+  for (int k = 0; k < patch_num; k++) {
+    Dtype* dst = host_dsts[k];
+    for (int p = 0; p < size; p++) {
+      dst[p] = host_packed[static_cast<ptrdiff_t>(p) * patch_num + k];
+    }
+  }
+}
+
+template void PackPatches<unsigned char>(
+  const unsigned char* const* host_srcs, int patch_num, int width,
+  int height, unsigned char* host_packed);
+template void PackPatches<float>(const float* const* host_srcs,
+  int patch_num, int width, int height, float* host_packed);
+template void PackPatches<double>(const double* const* host_srcs,
+  int patch_num, int width, int height, double* host_packed);
+template void UnpackPatches<unsigned char>(const unsigned char* host_packed,
+  int patch_num, int width, int height, unsigned char* const* host_dsts);
+template void UnpackPatches<float>(const float* host_packed, int patch_num,
+  int width, int height, float* const* host_dsts);
+template void UnpackPatches<double>(const double* host_packed, int patch_num,
+  int width, int height, double* const* host_dsts);
+
+// Convert the sum of a window to the mean value, like MeanFilter.
+static inline unsigned char GetPatchMeanValue(double sum, int wnd_size,
+  unsigned char) {
+  return (unsigned char)(round(sum / wnd_size));
+}
+
+template<typename Dtype>
+static inline Dtype GetPatchMeanValue(double sum, int wnd_size, Dtype) {
+  return static_cast<Dtype>(sum / wnd_size);
+}
+
+// Batcher's odd-even merge sort network of n inputs, as compare-exchange
+// pairs (a, b) with a < b.
+static void GetSortingNetwork(int n, std::vector<int>* network) {
+  network->clear();
+  for (int p = 1; p < n; p <<= 1) {
+    for (int k = p; k >= 1; k >>= 1) {
+      for (int j = k % p; j + k < n; j += 2 * k) {
+        for (int i = 0; i < k && i + j + k < n; i++) {
+          if ((i + j) / (p * 2) == (i + j + k) / (p * 2)) {
+            network->push_back(i + j);
+            network->push_back(i + j + k);
+          }
+        }
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+PatchBatchFilter<Dtype>::PatchBatchFilter(int radius)
+  : radius_(radius), gate_(0.5), border_(BORDER_REFLECT_101),
+  border_value_(0) {
+  assert(0 < radius);
+  assert(radius <= PATCH_RADIUS_MAX);
+  int core_size = radius * 2 + 1;
+  GetSortingNetwork(core_size * core_size, &network_);
+}
+
+template<typename Dtype>
+void PatchBatchFilter<Dtype>::GetWindow(const Dtype* host_packed_src,
+  int patch_num, int width, int height, int x, int y, int lane, int lanes,
+  Dtype* wnd) const {
+  for (int m = -radius_; m <= radius_; m++) {
+    int row = BorderInterpolate(y + m, height, border_);
+    for (int n = -radius_; n <= radius_; n++) {
+      int col = BorderInterpolate(x + n, width, border_);
+      if (row < 0 || col < 0) {
+        for (int k = 0; k < lanes; k++) {
+          wnd[k] = border_value_;
+        }
+      } else {
+        memcpy(wnd, host_packed_src + (static_cast<ptrdiff_t>(row) * width +
+          col) * patch_num + lane, sizeof(Dtype) * lanes);
+      }
+      wnd += PATCH_LANE_NUM;
+    }
+  }
+}
+
+/**
+* Mean filtering of packed patches.
+*
+* \param host_packed_src  Source patches, packed by PackPatches.
+* \param host_packed_dst  Destination patches, packed the same way.
+* \param patch_num        Number of patches.
+* \param width            Patch width, in pixels.
+* \param height           Patch height, in pixels.
+*/
+template<typename Dtype>
+bool PatchBatchFilter<Dtype>::Mean(const Dtype* host_packed_src,
+  Dtype* host_packed_dst, int patch_num, int width, int height) const {
+  assert(nullptr != host_packed_src);
+  assert(nullptr != host_packed_dst);
+  assert(0 < width);
+  assert(0 < height);
+  int core_size = radius_ * 2 + 1;
+  int wnd_size = core_size * core_size;
+  Dtype wnd[(PATCH_RADIUS_MAX * 2 + 1) * (PATCH_RADIUS_MAX * 2 + 1) *
+    PATCH_LANE_NUM];
+  double sum[PATCH_LANE_NUM];
+  memset(wnd, 0, sizeof(wnd));
+  for (int lane = 0; lane < patch_num; lane += PATCH_LANE_NUM) {
+    int lanes = MIN(PATCH_LANE_NUM, patch_num - lane);
+    for (int i = 0; i < height; i++) {
+      for (int j = 0; j < width; j++) {
+        GetWindow(host_packed_src, patch_num, width, height, j, i, lane,
+          lanes, wnd);
+        for (int k = 0; k < PATCH_LANE_NUM; k++) {
+          sum[k] = 0;
+        }
+        for (int m = 0; m < wnd_size; m++) {
+          const Dtype* values = wnd + m * PATCH_LANE_NUM;
+          for (int k = 0; k < PATCH_LANE_NUM; k++) {
+            sum[k] += values[k];
+          }
+        }
+        Dtype* dst = host_packed_dst +
+          (static_cast<ptrdiff_t>(i) * width + j) * patch_num + lane;
+        for (int k = 0; k < lanes; k++) {
+          dst[k] = GetPatchMeanValue(sum[k], wnd_size, Dtype());
+        }
+      }
+    }
+  }
+  return true;
+}
+
+/**
+* Median filtering of packed patches, see Mean for the parameters.
+* The whole window is sorted lane-wise, the value picked is the one
+* GetHistMediumValue would return for the gate.
+*/
+template<typename Dtype>
+bool PatchBatchFilter<Dtype>::Median(const Dtype* host_packed_src,
+  Dtype* host_packed_dst, int patch_num, int width, int height) const {
+  assert(nullptr != host_packed_src);
+  assert(nullptr != host_packed_dst);
+  assert(0 < width);
+  assert(0 < height);
+  int core_size = radius_ * 2 + 1;
+  int stop_point = static_cast<int>(core_size * core_size * gate_);
+  int pair_num = static_cast<int>(network_.size()) / 2;
+  Dtype wnd[(PATCH_RADIUS_MAX * 2 + 1) * (PATCH_RADIUS_MAX * 2 + 1) *
+    PATCH_LANE_NUM];
+  memset(wnd, 0, sizeof(wnd));
+  for (int lane = 0; lane < patch_num; lane += PATCH_LANE_NUM) {
+    int lanes = MIN(PATCH_LANE_NUM, patch_num - lane);
+    for (int i = 0; i < height; i++) {
+      for (int j = 0; j < width; j++) {
+        GetWindow(host_packed_src, patch_num, width, height, j, i, lane,
+          lanes, wnd);
+        // All the lanes take the same compare-exchange, no branch
+        for (int p = 0; p < pair_num; p++) {
+          Dtype* a = wnd + network_[p * 2] * PATCH_LANE_NUM;
+          Dtype* b = wnd + network_[p * 2 + 1] * PATCH_LANE_NUM;
+          for (int k = 0; k < PATCH_LANE_NUM; k++) {
+            Dtype lo = a[k] < b[k] ? a[k] : b[k];
+            Dtype hi = a[k] < b[k] ? b[k] : a[k];
+            a[k] = lo;
+            b[k] = hi;
+          }
+        }
+        memcpy(host_packed_dst +
+          (static_cast<ptrdiff_t>(i) * width + j) * patch_num + lane,
+          wnd + stop_point * PATCH_LANE_NUM, sizeof(Dtype) * lanes);
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,85 @@
+#ifndef IMAGE_IMAGE_FILTER_PATCH_BATCH_H_
+#define IMAGE_IMAGE_FILTER_PATCH_BATCH_H_
+#include <assert.h>
+#include <vector>
+#include "image_filter/border.h"
+// Define macro min
+#ifndef MIN
+#define MIN(a, b) ((a) > (b) ? (b) : (a))
+#endif
+
+// Max radius of the patch batch filters, the window is sorted as a whole.
+#ifndef PATCH_RADIUS_MAX
+#define PATCH_RADIUS_MAX 3
+#endif
+
+// Patches filtered together, the lanes of a block of the window buffer.
+#ifndef PATCH_LANE_NUM
+#define PATCH_LANE_NUM 32
+#endif
+
+// Disable the copy and assignment operator for a class.
+#ifndef DISABLE_COPY_AND_ASSIGN
+#define DISABLE_COPY_AND_ASSIGN(classname) \
+private:\
+  classname(const classname&);\
+  classname& operator=(const classname&)
+#endif
+
+/**
+* Interleave patch_num patches of width by height pixels lane-wise, the
+* pixel (x, y) of patch k goes to host_packed[(y * width + x) * patch_num + k].
+*/
+template<typename Dtype>
+void PackPatches(const Dtype* const* host_srcs, int patch_num, int width,
+  int height, Dtype* host_packed);
+
+// Split lane-wise interleaved patches back, see PackPatches.
+template<typename Dtype>
+void UnpackPatches(const Dtype* host_packed, int patch_num, int width,
+  int height, Dtype* const* host_dsts);
+
+/**
+* Small kernel mean and median filters of many same-sized small patches.
+* The patches are interleaved lane-wise by PackPatches, so every step of the
+* kernels runs the same operation on PATCH_LANE_NUM patches at once over
+* contiguous memory, which the compiler vectorizes with one patch per SIMD
+* lane. The median sorts the window with a branchless min/max sorting
+* network instead of a histogram, so there is no per-patch setup at all.
+* Each patch is filtered as its own image, with the border mode at its
+* edges, and gives the same result as MeanFilter and MedianFilter.
+*/
+template<typename Dtype>
+class PatchBatchFilter
+{
+public:
+  explicit PatchBatchFilter(int radius);
+  void set_gate(float gate) {
+    assert(gate > 0);
+    assert(gate < 1);
+    gate_ = gate;
+  }
+  // How the pixels outside the patches are taken, default BORDER_REFLECT_101.
+  void set_border(BorderType border, Dtype border_value = Dtype()) {
+    border_ = border;
+    border_value_ = border_value;
+  }
+  // Filter patch_num packed patches of width by height pixels.
+  bool Mean(const Dtype* host_packed_src, Dtype* host_packed_dst,
+    int patch_num, int width, int height) const;
+  bool Median(const Dtype* host_packed_src, Dtype* host_packed_dst,
+    int patch_num, int width, int height) const;
+private:
+  // Copy the window of pixel (x, y) for lanes [lane, lane + lanes) to wnd,
+  // one row of PATCH_LANE_NUM values per window pixel.
+  void GetWindow(const Dtype* host_packed_src, int patch_num, int width,
+    int height, int x, int y, int lane, int lanes, Dtype* wnd) const;
+  int radius_;
+  float gate_;
+  BorderType border_;
+  Dtype border_value_;
+  // Compare-exchange pairs of a sorting network of the window size.
+  std::vector<int> network_;
+  DISABLE_COPY_AND_ASSIGN(PatchBatchFilter);
+};
+#endif  // !IMAGE_IMAGE_FILTER_PATCH_BATCH_H_
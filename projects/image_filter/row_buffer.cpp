@@ -0,0 +1,70 @@
+#include <limits.h>
+#include <string.h>
+#include "image_filter/row_buffer.h"
+
+template class RowRingBuffer<unsigned char>;
+template class RowRingBuffer<float>;
+template class RowRingBuffer<double>;
+
+template<typename Dtype>
+RowRingBuffer<Dtype>::RowRingBuffer(int radius, int width)
+  : radius_(radius), width_(width), capacity_(radius * 2 + 2), rows_(0),
+  border_(BORDER_REFLECT_101), border_value_(0), buffer_(nullptr) {
+  assert(0 < radius);
+  assert(radius < width);
+  int line = CACHE_LINE_SIZE / sizeof(Dtype);
+  pitch_ = (width + line - 1) / line * line;
+  if (AllocateAlignedBlock((capacity_ + 1) * pitch_ * sizeof(Dtype), false,
+    &block_)) {
+    buffer_ = static_cast<Dtype*>(block_.data);
+  }
+}
+
+template<typename Dtype>
+RowRingBuffer<Dtype>::~RowRingBuffer() {
+  FreeAlignedBlock(&block_);
+}
+
+template<typename Dtype>
+void RowRingBuffer<Dtype>::set_border(BorderType border, Dtype border_value) {
+  assert(0 == rows_);
+  border_ = border;
+  border_value_ = border_value;
+  if (nullptr == buffer_) {
+    return;
+  }
+  Dtype* const_row = buffer_ + capacity_ * pitch_;
+  for (int k = 0; k < width_; k++) {
+    const_row[k] = border_value;
+  }
+}
+
+template<typename Dtype>
+void RowRingBuffer<Dtype>::Push(const Dtype* host_src_row) {
+  assert(nullptr != host_src_row);
+  assert(ok());
+  memcpy(buffer_ + (rows_ % capacity_) * pitch_, host_src_row,
+    width_ * sizeof(Dtype));
+  rows_++;
+}
+
+template<typename Dtype>
+void RowRingBuffer<Dtype>::PushPacked(const unsigned char* packed_row,
+  PackedFormat format) {
+  assert(nullptr != packed_row);
+  assert(ok());
+  UnpackRow(packed_row, format, width_,
+    buffer_ + (rows_ % capacity_) * pitch_);
+  rows_++;
+}
+
+template<typename Dtype>
+const Dtype* RowRingBuffer<Dtype>::Row(int y, int height) const {
+  y = BorderInterpolate(y, height < 0 ? INT_MAX : height, border_);
+  if (y < 0) {
+    return buffer_ + capacity_ * pitch_;
+  }
+  assert(y < rows_);
+  assert(rows_ - y <= capacity_);
+  return buffer_ + (y % capacity_) * pitch_;
+}
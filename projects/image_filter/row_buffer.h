@@ -0,0 +1,61 @@
+#ifndef IMAGE_IMAGE_FILTER_ROW_BUFFER_H_
+#define IMAGE_IMAGE_FILTER_ROW_BUFFER_H_
+#include <assert.h>
+#include "image_filter/aligned_memory.h"
+#include "image_filter/border.h"
+#include "image_filter/packed_row.h"
+
+// Disable the copy and assignment operator for a class.
+#ifndef DISABLE_COPY_AND_ASSIGN
+#define DISABLE_COPY_AND_ASSIGN(classname) \
+private:\
+  classname(const classname&);\
+  classname& operator=(const classname&)
+#endif
+
+/**
+* Ring buffer keeping the last 2*r+2 rows of a row stream.
+* Rows outside the image are taken from the border mode, the columns outside
+* the image are left to the filter kernels.
+* The rows are allocated by the constructor, check ok() before pushing.
+*/
+template<typename Dtype>
+class RowRingBuffer
+{
+public:
+  RowRingBuffer(int radius, int width);
+  ~RowRingBuffer();
+  // False if the rows could not be allocated.
+  bool ok() const { return nullptr != buffer_; }
+  // Only allowed before the first row is pushed.
+  void set_border(BorderType border, Dtype border_value = Dtype());
+  // Copy the next source row into the buffer.
+  void Push(const Dtype* host_src_row);
+  // Unpack the next source row into the buffer, in place of the copy, so a
+  // packed image is never unpacked whole.
+  void PushPacked(const unsigned char* packed_row, PackedFormat format);
+  // Get the source row y, y may be outside the image.
+  // height is the image height, or -1 if the last row is not pushed yet.
+  const Dtype* Row(int y, int height) const;
+  // Forget all rows, start a new image.
+  void Reset() { rows_ = 0; }
+  int rows() const { return rows_; }
+  int radius() const { return radius_; }
+  int width() const { return width_; }
+  BorderType border() const { return border_; }
+  Dtype border_value() const { return border_value_; }
+private:
+  int radius_;
+  int width_;
+  int capacity_;
+  int rows_;
+  BorderType border_;
+  Dtype border_value_;
+  // capacity_ rows, then a row filled with border_value_, every row starts
+  // on a cache line.
+  int pitch_;
+  AlignedBlock block_;
+  Dtype* buffer_;
+  DISABLE_COPY_AND_ASSIGN(RowRingBuffer);
+};
+#endif  // !IMAGE_IMAGE_FILTER_ROW_BUFFER_H_
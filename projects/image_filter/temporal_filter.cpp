@@ -0,0 +1,151 @@
+#include <math.h>
+#include <string.h>
+#include "image_filter/cpu_dispatch.h"
+#include "image_filter/temporal_filter.h"
+
+template class TemporalMeanFilter<unsigned char>;
+template class TemporalMeanFilter<float>;
+template class TemporalMeanFilter<double>;
+
+// Convert the sum of a window to the mean value.
+static inline unsigned char GetFrameMeanValue(double sum, int frame_num,
+  unsigned char) {
+  return (unsigned char)(round(sum / frame_num));
+}
+
+template<typename Dtype>
+static inline Dtype GetFrameMeanValue(double sum, int frame_num, Dtype) {
+  return static_cast<Dtype>(sum / frame_num);
+}
+
+template<typename Dtype>
+TemporalMeanFilter<Dtype>::TemporalMeanFilter(int frame_num, int width,
+  int height)
+  : frame_num_(frame_num), size_(width * height), frames_in_(0),
+  frames_(nullptr), sums_(nullptr) {
+  assert(0 < frame_num);
+  assert(0 < width);
+  assert(0 < height);
+  if (!workspace_.Reserve(
+    FilterWorkspace::SizeOf<Dtype>(static_cast<size_t>(size_) * frame_num) +
+    FilterWorkspace::SizeOf<double>(size_))) {
+    return;
+  }
+  frames_ = workspace_.Acquire<Dtype>(static_cast<size_t>(size_) * frame_num);
+  sums_ = workspace_.Acquire<double>(size_);
+}
+
+/**
+* Push a frame into the window.
+* The frame leaving the window is subtracted from the sums and the new one
+* is added, with the kernel of the cpu target, then its slot in the frame
+* ring is overwritten.
+*
+* \param host_src   Source frame, width by height pixels.
+* \param host_dst   Average of the window, width by height pixels.
+*/
+template<typename Dtype>
+bool TemporalMeanFilter<Dtype>::PushFrame(const Dtype* host_src,
+  Dtype* host_dst) {
+  assert(nullptr != host_src);
+  assert(nullptr != host_dst);
+  if (!ok()) {
+    return false;
+  }
+  Dtype* slot = frames_ +
+    static_cast<size_t>(frames_in_ % frame_num_) * size_;
+  if (0 == frames_in_) {
+    memset(sums_, 0, sizeof(double) * size_);
+  }
+  if (frames_in_ >= frame_num_) {
+    UpdateSum(slot, host_src, sums_, size_);
+  } else {
+    for (int k = 0; k < size_; k++) {
+      sums_[k] += host_src[k];
+    }
+  }
+  memcpy(slot, host_src, sizeof(Dtype) * size_);
+  frames_in_++;
+  int wnd_size = frames_in_ < frame_num_ ? frames_in_ : frame_num_;
+  for (int k = 0; k < size_; k++) {
+    host_dst[k] = GetFrameMeanValue(sums_[k], wnd_size, Dtype());
+  }
+  return true;
+}
+
+UcharTemporalMedianFilter::UcharTemporalMedianFilter(int frame_num,
+  int width, int height)
+  : frame_num_(frame_num), size_(width * height), gate_(0.5),
+  frames_in_(0), frames_(nullptr), his_(nullptr), medians_(nullptr),
+  belows_(nullptr) {
+  assert(0 < frame_num);
+  assert(frame_num <= TEMPORAL_FRAME_NUM_MAX);
+  assert(0 < width);
+  assert(0 < height);
+  size_t his_size = static_cast<size_t>(size_) * GRAY_LEVEL_MAX;
+  if (!workspace_.Reserve(FilterWorkspace::SizeOf<unsigned char>(
+    static_cast<size_t>(size_) * frame_num) +
+    FilterWorkspace::SizeOf<unsigned char>(his_size) +
+    FilterWorkspace::SizeOf<unsigned char>(size_) * 2)) {
+    return;
+  }
+  frames_ = workspace_.Acquire<unsigned char>(
+    static_cast<size_t>(size_) * frame_num);
+  his_ = workspace_.Acquire<unsigned char>(his_size);
+  medians_ = workspace_.Acquire<unsigned char>(size_);
+  belows_ = workspace_.Acquire<unsigned char>(size_);
+}
+
+/**
+* Push a frame into the window.
+* For every pixel, the value leaving the window and the new one update the
+* histogram and the count below the median, then the median is moved until
+* it is the first gray level whose cumulative count passes the gate, the
+* value GetHistMediumValue would return.
+*
+* \param host_src   Source frame, width by height pixels.
+* \param host_dst   Median of the window, width by height pixels.
+*/
+bool UcharTemporalMedianFilter::PushFrame(const unsigned char* host_src,
+  unsigned char* host_dst) {
+  assert(nullptr != host_src);
+  assert(nullptr != host_dst);
+  if (!ok()) {
+    return false;
+  }
+  unsigned char* slot = frames_ +
+    static_cast<size_t>(frames_in_ % frame_num_) * size_;
+  if (0 == frames_in_) {
+    memset(his_, 0, static_cast<size_t>(size_) * GRAY_LEVEL_MAX);
+    memset(medians_, 0, size_);
+    memset(belows_, 0, size_);
+  }
+  bool full = frames_in_ >= frame_num_;
+  int wnd_size = full ? frame_num_ : frames_in_ + 1;
+  int stop_point = static_cast<int>(wnd_size * gate_);
+  for (int k = 0; k < size_; k++) {
+    unsigned char* his = his_ + static_cast<size_t>(k) * GRAY_LEVEL_MAX;
+    int median = medians_[k];
+    int below = belows_[k];
+    if (full) {
+      his[slot[k]]--;
+      below -= slot[k] < median ? 1 : 0;
+    }
+    his[host_src[k]]++;
+    below += host_src[k] < median ? 1 : 0;
+    while (below > stop_point) {
+      median--;
+      below -= his[median];
+    }
+    while (below + his[median] <= stop_point) {
+      below += his[median];
+      median++;
+    }
+    medians_[k] = static_cast<unsigned char>(median);
+    belows_[k] = static_cast<unsigned char>(below);
+    host_dst[k] = static_cast<unsigned char>(median);
+  }
+  memcpy(slot, host_src, size_);
+  frames_in_++;
+  return true;
+}
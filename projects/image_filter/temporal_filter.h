@@ -0,0 +1,92 @@
+#ifndef IMAGE_IMAGE_FILTER_TEMPORAL_FILTER_H_
+#define IMAGE_IMAGE_FILTER_TEMPORAL_FILTER_H_
+#include <assert.h>
+#include "image_filter/filter_workspace.h"
+
+// Define max gray level.
+#ifndef GRAY_LEVEL_MAX
+#define GRAY_LEVEL_MAX 256
+#endif
+
+// Max number of frames of a temporal median, the histogram counts are
+// unsigned char.
+#ifndef TEMPORAL_FRAME_NUM_MAX
+#define TEMPORAL_FRAME_NUM_MAX 255
+#endif
+
+// Disable the copy and assignment operator for a class.
+#ifndef DISABLE_COPY_AND_ASSIGN
+#define DISABLE_COPY_AND_ASSIGN(classname) \
+private:\
+  classname(const classname&);\
+  classname& operator=(const classname&)
+#endif
+
+/**
+* Per-pixel running average of the last frame_num frames.
+* Frames are pushed one at a time, every pixel keeps the sum of its window,
+* so a frame costs one add and one subtract per pixel. Until frame_num
+* frames have been pushed the average is over the frames pushed so far.
+*/
+template<typename Dtype>
+class TemporalMeanFilter
+{
+public:
+  TemporalMeanFilter(int frame_num, int width, int height);
+  // False if the frames could not be allocated, then PushFrame returns
+  // false without doing anything.
+  bool ok() const { return nullptr != frames_; }
+  // Push the next frame and write the average of the window to host_dst.
+  bool PushFrame(const Dtype* host_src, Dtype* host_dst);
+  // Forget all frames.
+  void Reset() { frames_in_ = 0; }
+  int frames_in() const { return frames_in_; }
+private:
+  int frame_num_;
+  int size_;
+  int frames_in_;
+  FilterWorkspace workspace_;
+  // The last frame_num frames, the oldest one leaves the window next.
+  Dtype* frames_;
+  double* sums_;
+  DISABLE_COPY_AND_ASSIGN(TemporalMeanFilter);
+};
+
+/**
+* Per-pixel median of the last frame_num unsigned char frames.
+* Every pixel keeps a histogram of its window with unsigned char counts and
+* tracks its median: a frame adds one count, removes one, and moves the
+* median by the few bins it crossed, instead of sorting the window.
+* Until frame_num frames have been pushed the median is over the frames
+* pushed so far. The gate has the meaning of MedianFilter::set_gate.
+*/
+class UcharTemporalMedianFilter
+{
+public:
+  UcharTemporalMedianFilter(int frame_num, int width, int height);
+  bool ok() const { return nullptr != frames_; }
+  void set_gate(float gate) {
+    assert(gate > 0);
+    assert(gate < 1);
+    gate_ = gate;
+  }
+  // Push the next frame and write the median of the window to host_dst.
+  bool PushFrame(const unsigned char* host_src, unsigned char* host_dst);
+  // Forget all frames.
+  void Reset() { frames_in_ = 0; }
+  int frames_in() const { return frames_in_; }
+private:
+  int frame_num_;
+  int size_;
+  float gate_;
+  int frames_in_;
+  FilterWorkspace workspace_;
+  unsigned char* frames_;
+  // GRAY_LEVEL_MAX counts per pixel.
+  unsigned char* his_;
+  // Median of each pixel, and the number of values below it.
+  unsigned char* medians_;
+  unsigned char* belows_;
+  DISABLE_COPY_AND_ASSIGN(UcharTemporalMedianFilter);
+};
+#endif  // !IMAGE_IMAGE_FILTER_TEMPORAL_FILTER_H_
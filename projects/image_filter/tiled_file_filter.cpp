@@ -0,0 +1,340 @@
+#include <limits.h>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "image_filter/tiled_file_filter.h"
+
+// Granularity of the view offsets.
+static long long GetMapAlignment() {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwAllocationGranularity;
+#else
+  return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+#ifdef _WIN32
+MappedFile::MappedFile() : writable_(false), size_(0), view_(nullptr),
+  view_size_(0), file_(INVALID_HANDLE_VALUE), mapping_(nullptr) {}
+#else
+MappedFile::MappedFile() : writable_(false), size_(0), view_(nullptr),
+  view_size_(0), file_(-1) {}
+#endif
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+#ifdef _WIN32
+bool MappedFile::OpenRead(const char* path) {
+  Close();
+  file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  LARGE_INTEGER size;
+  if (INVALID_HANDLE_VALUE == file_ || !GetFileSizeEx(file_, &size)) {
+    Close();
+    return false;
+  }
+  size_ = size.QuadPart;
+  writable_ = false;
+  mapping_ = size_ > 0 ?
+    CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr) :
+    nullptr;
+  return size_ == 0 || nullptr != mapping_;
+}
+
+bool MappedFile::OpenWrite(const char* path, long long size) {
+  Close();
+  file_ = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+    CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (INVALID_HANDLE_VALUE == file_) {
+    Close();
+    return false;
+  }
+  size_ = size;
+  writable_ = true;
+  if (0 == size) {
+    return true;
+  }
+  mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE,
+    static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+  if (nullptr == mapping_) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::Close() {
+  Unmap();
+  if (nullptr != mapping_) {
+    CloseHandle(mapping_);
+    mapping_ = nullptr;
+  }
+  if (INVALID_HANDLE_VALUE != file_) {
+    CloseHandle(file_);
+    file_ = INVALID_HANDLE_VALUE;
+  }
+  size_ = 0;
+}
+#else
+bool MappedFile::OpenRead(const char* path) {
+  Close();
+  file_ = open(path, O_RDONLY);
+  struct stat info;
+  if (file_ < 0 || 0 != fstat(file_, &info)) {
+    Close();
+    return false;
+  }
+  size_ = info.st_size;
+  writable_ = false;
+  return true;
+}
+
+bool MappedFile::OpenWrite(const char* path, long long size) {
+  Close();
+  file_ = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (file_ < 0 || 0 != ftruncate(file_, size)) {
+    Close();
+    return false;
+  }
+  size_ = size;
+  writable_ = true;
+  return true;
+}
+
+void MappedFile::Close() {
+  Unmap();
+  if (file_ >= 0) {
+    close(file_);
+    file_ = -1;
+  }
+  size_ = 0;
+}
+#endif
+
+/**
+* Map a view of the file.
+* The view starts on the map alignment at or before offset, so up to one
+* page more than size is mapped.
+*
+* \param offset   First byte of the view, 64-bit.
+* \param size     Bytes of the view, offset + size must be inside the file.
+*/
+char* MappedFile::Map(long long offset, size_t size) {
+  assert(0 <= offset);
+  assert(offset + static_cast<long long>(size) <= size_);
+  Unmap();
+  if (0 == size) {
+    return nullptr;
+  }
+  long long begin = offset / GetMapAlignment() * GetMapAlignment();
+  size_t view_size = static_cast<size_t>(offset - begin) + size;
+#ifdef _WIN32
+  void* view = MapViewOfFile(mapping_,
+    writable_ ? FILE_MAP_WRITE : FILE_MAP_READ,
+    static_cast<DWORD>(begin >> 32), static_cast<DWORD>(begin), view_size);
+  if (nullptr == view) {
+    return nullptr;
+  }
+#else
+  void* view = mmap(nullptr, view_size,
+    writable_ ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file_,
+    static_cast<off_t>(begin));
+  if (MAP_FAILED == view) {
+    return nullptr;
+  }
+#endif
+  view_ = view;
+  view_size_ = view_size;
+  return static_cast<char*>(view) + (offset - begin);
+}
+
+void MappedFile::Unmap() {
+  if (nullptr == view_) {
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(view_);
+#else
+  munmap(view_, view_size_);
+#endif
+  view_ = nullptr;
+  view_size_ = 0;
+}
+
+/**
+* Mean filtering of an image file.
+*
+* \param filter     Filter settings, LAYOUT_ROW_MAJOR.
+* \param src_path   Raw source image, width by height pixels.
+* \param dst_path   Raw destination image, created or truncated.
+* \param width      Image width, in pixels.
+* \param height     Image height, in pixels, 64-bit.
+*/
+template<typename Dtype>
+bool TiledFileFilter::Filter(const MeanFilter<Dtype>& filter,
+  const char* src_path, const char* dst_path, int width, long long height) {
+  int radius = filter.radius();
+  size_t workspace_size = filter.GetWorkspaceSize(
+    MIN(tile_width_, width) + radius * 2,
+    static_cast<int>(MIN(static_cast<long long>(tile_height_), height)) +
+    radius * 2);
+  return FilterTiles<Dtype>(src_path, dst_path, width, height,
+    filter.channel_num(), radius, workspace_size,
+    [&](const Dtype* src, int src_pitch, Dtype* dst, int dst_pitch, int w,
+    int h, const ImageRect& roi, FilterWorkspace* workspace) {
+    return filter.Filter(src, src_pitch, dst, dst_pitch, w, h, roi,
+      workspace);
+  });
+}
+
+// Median filtering of an image file by histogram, see Filter.
+template<typename Dtype>
+bool TiledFileFilter::FilterByHistogram(const MedianFilter<Dtype>& filter,
+  const char* src_path, const char* dst_path, int width, long long height) {
+  int radius = filter.radius();
+  size_t workspace_size = filter.GetWorkspaceSize(
+    MIN(tile_width_, width) + radius * 2,
+    static_cast<int>(MIN(static_cast<long long>(tile_height_), height)) +
+    radius * 2);
+  return FilterTiles<Dtype>(src_path, dst_path, width, height,
+    filter.channel_num(), radius, workspace_size,
+    [&](const Dtype* src, int src_pitch, Dtype* dst, int dst_pitch, int w,
+    int h, const ImageRect& roi, FilterWorkspace* workspace) {
+    return filter.FilterByHistogram(src, src_pitch, dst, dst_pitch, w, h,
+      roi, workspace);
+  });
+}
+
+// Median filtering of an image file by local sorting, see Filter.
+template<typename Dtype>
+bool TiledFileFilter::FilterByLocalSort(const MedianFilter<Dtype>& filter,
+  const char* src_path, const char* dst_path, int width, long long height) {
+  int radius = filter.radius();
+  size_t workspace_size = filter.GetWorkspaceSize(
+    MIN(tile_width_, width) + radius * 2,
+    static_cast<int>(MIN(static_cast<long long>(tile_height_), height)) +
+    radius * 2);
+  return FilterTiles<Dtype>(src_path, dst_path, width, height,
+    filter.channel_num(), radius, workspace_size,
+    [&](const Dtype* src, int src_pitch, Dtype* dst, int dst_pitch, int w,
+    int h, const ImageRect& roi, FilterWorkspace* workspace) {
+    return filter.FilterByLocalSort(src, src_pitch, dst, dst_pitch, w, h,
+      roi, workspace);
+  });
+}
+
+// Median filtering of an unsigned char image file, see Filter.
+bool TiledFileFilter::FilterByHistogram(const UcharMedianFilter& filter,
+  const char* src_path, const char* dst_path, int width, long long height) {
+  int radius = filter.radius();
+  size_t workspace_size = filter.GetWorkspaceSize(
+    MIN(tile_width_, width) + radius * 2,
+    static_cast<int>(MIN(static_cast<long long>(tile_height_), height)) +
+    radius * 2);
+  return FilterTiles<unsigned char>(src_path, dst_path, width, height,
+    filter.channel_num(), radius, workspace_size,
+    [&](const unsigned char* src, int src_pitch, unsigned char* dst,
+    int dst_pitch, int w, int h, const ImageRect& roi,
+    FilterWorkspace* workspace) {
+    return filter.FilterByHistogram(src, src_pitch, dst, dst_pitch, w, h,
+      roi, workspace);
+  });
+}
+
+/**
+* Walk the image strip by strip and tile by tile.
+* A strip maps the tile rows of the destination and the same rows plus r
+* halo rows above and below of the source. A tile is given to the task as
+* an image made of the tile and its halo cols, clipped at the image edges,
+* with the tile as roi.
+*/
+template<typename Dtype>
+bool TiledFileFilter::FilterTiles(const char* src_path, const char* dst_path,
+  int width, long long height, int channels, int radius,
+  size_t workspace_size, const typename TileTask<Dtype>::Type& task) {
+  assert(nullptr != src_path);
+  assert(nullptr != dst_path);
+  assert(0 < width);
+  assert(0 < height);
+  assert(static_cast<long long>(width) * channels <= INT_MAX);
+  int row_size = width * channels;
+  long long row_bytes = static_cast<long long>(row_size) * sizeof(Dtype);
+  MappedFile src_file;
+  MappedFile dst_file;
+  if (!src_file.OpenRead(src_path) || src_file.size() < row_bytes * height) {
+    return false;
+  }
+  if (!dst_file.OpenWrite(dst_path, row_bytes * height)) {
+    return false;
+  }
+  FilterWorkspace workspace;
+  if (!workspace.Reserve(workspace_size)) {
+    return false;
+  }
+  for (long long y = 0; y < height; y += tile_height_) {
+    int rows = static_cast<int>(MIN(static_cast<long long>(tile_height_),
+      height - y));
+    long long row_begin = y - radius > 0 ? y - radius : 0;
+    long long row_end = MIN(y + rows + radius, height);
+    const Dtype* src = reinterpret_cast<const Dtype*>(src_file.Map(
+      row_begin * row_bytes,
+      static_cast<size_t>((row_end - row_begin) * row_bytes)));
+    Dtype* dst = reinterpret_cast<Dtype*>(dst_file.Map(y * row_bytes,
+      static_cast<size_t>(rows * row_bytes)));
+    if (nullptr == src || nullptr == dst) {
+      return false;
+    }
+    for (int x = 0; x < width; x += tile_width_) {
+      int cols = MIN(tile_width_, width - x);
+      int col_begin = x - radius > 0 ? x - radius : 0;
+      int col_end = MIN(x + cols + radius, width);
+      ImageRect roi(x - col_begin, static_cast<int>(y - row_begin), cols,
+        rows);
+      if (!task(src + col_begin * channels, row_size, dst + x * channels,
+        row_size, col_end - col_begin, static_cast<int>(row_end - row_begin),
+        roi, &workspace)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+template bool TiledFileFilter::Filter<unsigned char>(
+  const MeanFilter<unsigned char>& filter, const char* src_path,
+  const char* dst_path, int width, long long height);
+template bool TiledFileFilter::Filter<float>(const MeanFilter<float>& filter,
+  const char* src_path, const char* dst_path, int width, long long height);
+template bool TiledFileFilter::Filter<double>(
+  const MeanFilter<double>& filter, const char* src_path,
+  const char* dst_path, int width, long long height);
+template bool TiledFileFilter::FilterByHistogram<unsigned char>(
+  const MedianFilter<unsigned char>& filter, const char* src_path,
+  const char* dst_path, int width, long long height);
+template bool TiledFileFilter::FilterByHistogram<float>(
+  const MedianFilter<float>& filter, const char* src_path,
+  const char* dst_path, int width, long long height);
+template bool TiledFileFilter::FilterByHistogram<double>(
+  const MedianFilter<double>& filter, const char* src_path,
+  const char* dst_path, int width, long long height);
+template bool TiledFileFilter::FilterByLocalSort<unsigned char>(
+  const MedianFilter<unsigned char>& filter, const char* src_path,
+  const char* dst_path, int width, long long height);
+template bool TiledFileFilter::FilterByLocalSort<float>(
+  const MedianFilter<float>& filter, const char* src_path,
+  const char* dst_path, int width, long long height);
+template bool TiledFileFilter::FilterByLocalSort<double>(
+  const MedianFilter<double>& filter, const char* src_path,
+  const char* dst_path, int width, long long height);
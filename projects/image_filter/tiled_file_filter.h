@@ -0,0 +1,106 @@
+#ifndef IMAGE_IMAGE_FILTER_TILED_FILE_FILTER_H_
+#define IMAGE_IMAGE_FILTER_TILED_FILE_FILTER_H_
+#include <assert.h>
+#include <stddef.h>
+#include <functional>
+#include "image_filter/filter_workspace.h"
+#include "image_filter/image_rect.h"
+#include "image_filter/mean_filter.h"
+#include "image_filter/median_filter.h"
+
+// Default tile side of the out-of-core filters, in pixels.
+#ifndef TILE_SIZE_DEFAULT
+#define TILE_SIZE_DEFAULT 1024
+#endif
+
+/**
+* A file mapped one view at a time.
+* The view offsets are 64-bit, so files far beyond 4GB can be walked through
+* with a view of bounded size, the system keeps only the pages touched.
+*/
+class MappedFile
+{
+public:
+  MappedFile();
+  ~MappedFile();
+  // Open an existing file for reading.
+  bool OpenRead(const char* path);
+  // Create a file of size bytes for writing, an existing one is truncated.
+  bool OpenWrite(const char* path, long long size);
+  void Close();
+  // Map bytes [offset, offset + size) and return the address of offset,
+  // the previous view is unmapped. Return nullptr if it can not be mapped.
+  char* Map(long long offset, size_t size);
+  void Unmap();
+  long long size() const { return size_; }
+private:
+  bool writable_;
+  long long size_;
+  // The mapped view starts on a page boundary at or before the offset.
+  void* view_;
+  size_t view_size_;
+#ifdef _WIN32
+  void* file_;
+  void* mapping_;
+#else
+  int file_;
+#endif
+  DISABLE_COPY_AND_ASSIGN(MappedFile);
+};
+
+/**
+* Out-of-core filtering of raw images stored in files.
+* The image is cut into tiles, every tile is filtered in place in a mapped
+* view of the source file with the roi API: the r pixels of halo around the
+* tile are read as context, and the border mode only applies at the image
+* edges. The medians and the unsigned char means are then identical to the
+* ones of the whole image, the float and double means only equal up to
+* rounding, since their running sums start again at each tile. The output
+* tile is written to a mapped view of the destination file.
+* Only a strip of tile height rows is mapped at a time and one workspace of
+* the tile size is kept, so the memory is bounded by the tile size instead
+* of the image size. The file offsets and pixel counts are 64-bit, only a
+* row has to fit an int.
+* The files hold the pixels row by row with channel_num interleaved values
+* each, with no header, the filters must be LAYOUT_ROW_MAJOR.
+*/
+class TiledFileFilter
+{
+public:
+  TiledFileFilter() : tile_width_(TILE_SIZE_DEFAULT),
+    tile_height_(TILE_SIZE_DEFAULT) {}
+  void set_tile_size(int tile_width, int tile_height) {
+    assert(tile_width > 0);
+    assert(tile_height > 0);
+    tile_width_ = tile_width;
+    tile_height_ = tile_height;
+  }
+  // Filter the width by height image of src_path to dst_path.
+  // Return false if a file can not be opened or mapped, or the workspace can
+  // not be allocated.
+  template<typename Dtype>
+  bool Filter(const MeanFilter<Dtype>& filter, const char* src_path,
+    const char* dst_path, int width, long long height);
+  template<typename Dtype>
+  bool FilterByHistogram(const MedianFilter<Dtype>& filter,
+    const char* src_path, const char* dst_path, int width, long long height);
+  template<typename Dtype>
+  bool FilterByLocalSort(const MedianFilter<Dtype>& filter,
+    const char* src_path, const char* dst_path, int width, long long height);
+  bool FilterByHistogram(const UcharMedianFilter& filter,
+    const char* src_path, const char* dst_path, int width, long long height);
+private:
+  // Filter the roi of a tile view, see the roi overloads of the filters.
+  template<typename Dtype>
+  struct TileTask {
+    typedef std::function<bool(const Dtype*, int, Dtype*, int, int, int,
+      const ImageRect&, FilterWorkspace*)> Type;
+  };
+  template<typename Dtype>
+  bool FilterTiles(const char* src_path, const char* dst_path, int width,
+    long long height, int channels, int radius, size_t workspace_size,
+    const typename TileTask<Dtype>::Type& task);
+  int tile_width_;
+  int tile_height_;
+};
+#endif  // !IMAGE_IMAGE_FILTER_TILED_FILE_FILTER_H_
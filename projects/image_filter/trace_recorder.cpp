@@ -0,0 +1,171 @@
+#include <assert.h>
+#include <fstream>
+#include <iomanip>
+#include "image_filter/trace_recorder.h"
+
+static std::atomic<TraceRecorder*> installed_recorder(nullptr);
+
+TraceBuffer::TraceBuffer(int tid, int capacity,
+  std::chrono::high_resolution_clock::time_point origin)
+  : tid_(tid), events_(capacity), mask_(capacity - 1), origin_(origin),
+  written_(0) {
+  assert(0 == (capacity & (capacity - 1)));
+}
+
+void TraceBuffer::AddThreadName(const char* name) {
+  std::string names = ", " + thread_name_ + ", ";
+  if (std::string::npos != names.find(", " + std::string(name) + ", ")) {
+    return;
+  }
+  thread_name_ += thread_name_.empty() ? name : ", " + std::string(name);
+}
+
+std::vector<TraceEvent> TraceBuffer::GetEvents() const {
+  size_t written = written_.load(std::memory_order_acquire);
+  size_t first = written > events_.size() ? written - events_.size() : 0;
+  std::vector<TraceEvent> events;
+  events.reserve(written - first);
+  for (size_t k = first; k < written; k++) {
+    events.push_back(events_[k & mask_]);
+  }
+  return events;
+}
+
+long long TraceBuffer::dropped() const {
+  size_t written = written_.load(std::memory_order_acquire);
+  return written > events_.size() ?
+    static_cast<long long>(written - events_.size()) : 0;
+}
+
+TraceRecorder::TraceRecorder(int events_per_thread)
+  : capacity_(1), origin_(std::chrono::high_resolution_clock::now()) {
+  assert(0 < events_per_thread);
+  while (capacity_ < events_per_thread) {
+    capacity_ <<= 1;
+  }
+}
+
+TraceRecorder::~TraceRecorder() {
+  assert(this != GetTraceRecorder());
+  assert(leases_.empty());
+  for (size_t k = 0; k < buffers_.size(); k++) {
+    delete buffers_[k];
+  }
+}
+
+TraceBuffer* TraceRecorder::AcquireThreadBuffer(const char* thread_name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::map<std::thread::id, Lease>::iterator it =
+    leases_.find(std::this_thread::get_id());
+  if (leases_.end() == it) {
+    Lease lease = { nullptr, 0 };
+    if (!free_buffers_.empty()) {
+      lease.buffer = free_buffers_.back();
+      free_buffers_.pop_back();
+    } else {
+      lease.buffer = new TraceBuffer(static_cast<int>(buffers_.size()) + 1,
+        capacity_, origin_);
+      buffers_.push_back(lease.buffer);
+    }
+    it = leases_.insert(std::make_pair(std::this_thread::get_id(),
+      lease)).first;
+  }
+  it->second.depth++;
+  if (nullptr != thread_name) {
+    it->second.buffer->AddThreadName(thread_name);
+  }
+  return it->second.buffer;
+}
+
+void TraceRecorder::ReleaseThreadBuffer() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::map<std::thread::id, Lease>::iterator it =
+    leases_.find(std::this_thread::get_id());
+  assert(leases_.end() != it);
+  if (0 == --it->second.depth) {
+    free_buffers_.push_back(it->second.buffer);
+    leases_.erase(it);
+  }
+}
+
+// Quote a thread name for JSON.
+static std::string QuoteJson(const std::string& text) {
+  std::string quoted = "\"";
+  for (size_t k = 0; k < text.size(); k++) {
+    if ('"' == text[k] || '\\' == text[k]) {
+      quoted += '\\';
+    }
+    quoted += static_cast<unsigned char>(text[k]) < 0x20 ? ' ' : text[k];
+  }
+  return quoted + "\"";
+}
+
+/**
+* Write the spans as complete events, ph "X", one track per ring named by a
+* thread_name metadata event if it has names. The times are in us with ns
+* digits, the index of a span is its args.
+*/
+bool TraceRecorder::WriteChromeTrace(const std::string& path) const {
+  std::ofstream file(path.c_str());
+  if (!file) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  long long dropped = 0;
+  for (size_t k = 0; k < buffers_.size(); k++) {
+    dropped += buffers_[k]->dropped();
+  }
+  file << "{\"displayTimeUnit\": \"ns\", \"otherData\": {\"dropped\": "
+    << dropped << "},\n\"traceEvents\": [";
+  file << std::fixed << std::setprecision(3);
+  const char* separator = "\n";
+  for (size_t b = 0; b < buffers_.size(); b++) {
+    const TraceBuffer* buffer = buffers_[b];
+    if (!buffer->thread_name().empty()) {
+      file << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", "
+        << "\"pid\": 1, \"tid\": " << buffer->tid() << ", \"args\": "
+        << "{\"name\": " << QuoteJson(buffer->thread_name()) << "}}";
+      separator = ",\n";
+    }
+    std::vector<TraceEvent> events = buffer->GetEvents();
+    for (size_t k = 0; k < events.size(); k++) {
+      const TraceEvent& event = events[k];
+      file << separator << "{\"name\": \"" << event.name
+        << "\", \"cat\": \"image_filter\", \"ph\": \"X\", \"pid\": 1, "
+        << "\"tid\": " << buffer->tid() << ", \"ts\": "
+        << event.begin_ns / 1000.0 << ", \"dur\": "
+        << (event.end_ns - event.begin_ns) / 1000.0;
+      if (0 <= event.index) {
+        file << ", \"args\": {\"index\": " << event.index << "}";
+      }
+      file << "}";
+      separator = ",\n";
+    }
+  }
+  file << "\n]}\n";
+  return static_cast<bool>(file);
+}
+
+void TraceRecorder::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t k = 0; k < buffers_.size(); k++) {
+    buffers_[k]->Clear();
+  }
+}
+
+long long TraceRecorder::dropped() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  long long dropped = 0;
+  for (size_t k = 0; k < buffers_.size(); k++) {
+    dropped += buffers_[k]->dropped();
+  }
+  return dropped;
+}
+
+void SetTraceRecorder(TraceRecorder* recorder) {
+  installed_recorder.store(recorder, std::memory_order_release);
+}
+
+TraceRecorder* GetTraceRecorder() {
+  return installed_recorder.load(std::memory_order_acquire);
+}
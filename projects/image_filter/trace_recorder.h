@@ -0,0 +1,188 @@
+#ifndef IMAGE_IMAGE_FILTER_TRACE_RECORDER_H_
+#define IMAGE_IMAGE_FILTER_TRACE_RECORDER_H_
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Disable the copy and assignment operator for a class.
+#ifndef DISABLE_COPY_AND_ASSIGN
+#define DISABLE_COPY_AND_ASSIGN(classname) \
+private:\
+  classname(const classname&);\
+  classname& operator=(const classname&)
+#endif
+
+// Default number of spans kept per thread, the oldest ones are overwritten.
+#ifndef TRACE_EVENTS_PER_THREAD
+#define TRACE_EVENTS_PER_THREAD 65536
+#endif
+
+// A span of work of a thread, from begin to end in ns since the recorder
+// started. name must be a string literal.
+struct TraceEvent {
+  const char* name;
+  long long begin_ns;
+  long long end_ns;
+  // Tile, stripe row, frame or slot index, -1 for none.
+  long long index;
+};
+
+/**
+* Ring of the spans of the thread leasing it. Only that thread records, with
+* no lock: it writes the event, then publishes it by moving the write count.
+* When the ring is full the oldest spans are overwritten.
+*/
+class TraceBuffer
+{
+public:
+  TraceBuffer(int tid, int capacity,
+    std::chrono::high_resolution_clock::time_point origin);
+  // Time since the recorder started, in ns.
+  long long Now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::high_resolution_clock::now() - origin_).count();
+  }
+  void Record(const char* name, long long begin_ns, long long end_ns,
+    long long index) {
+    size_t k = written_.load(std::memory_order_relaxed);
+    TraceEvent& event = events_[k & mask_];
+    event.name = name;
+    event.begin_ns = begin_ns;
+    event.end_ns = end_ns;
+    event.index = index;
+    written_.store(k + 1, std::memory_order_release);
+  }
+  int tid() const { return tid_; }
+  // Roles the thread took, comma separated. Only changed and read under
+  // the lock of the recorder.
+  const std::string& thread_name() const { return thread_name_; }
+  void AddThreadName(const char* name);
+  // Spans kept, oldest first. Only exact while the thread does not record.
+  std::vector<TraceEvent> GetEvents() const;
+  // Spans overwritten before they were read.
+  long long dropped() const;
+  void Clear() { written_.store(0, std::memory_order_release); }
+private:
+  int tid_;
+  std::string thread_name_;
+  std::vector<TraceEvent> events_;
+  size_t mask_;
+  std::chrono::high_resolution_clock::time_point origin_;
+  std::atomic<size_t> written_;
+  DISABLE_COPY_AND_ASSIGN(TraceBuffer);
+};
+
+/**
+* Timeline of the threads of the filters, exported as Chrome trace events
+* to see the idle time, the stragglers and the queue stalls in
+* chrome://tracing or Perfetto.
+* Install it with SetTraceRecorder, then FilterGraph records its tiles,
+* MeanFilter its stripes, the median filters their calls, FrameBatchFilter
+* its frames and FramePipeline its stages and waits on full or empty
+* queues, each on the ring of the thread running them. A thread leases its
+* ring under a lock once per run, recording a span takes none.
+*/
+class TraceRecorder
+{
+public:
+  // events_per_thread is rounded up to a power of two.
+  explicit TraceRecorder(int events_per_thread = TRACE_EVENTS_PER_THREAD);
+  ~TraceRecorder();
+  // Lease a ring to the calling thread, see ThreadTraceBuffer. A thread
+  // holding a lease gets its ring again, others get a ring given back or a
+  // new one. thread_name, if not null, is added to the names of the ring:
+  // the role of the thread when it runs a loop of the filters. The names
+  // list the roles of all the threads which used the ring.
+  TraceBuffer* AcquireThreadBuffer(const char* thread_name);
+  // End a lease of the calling thread, its ring is given back with the
+  // spans once its last lease ends.
+  void ReleaseThreadBuffer();
+  // Write the spans kept as Chrome trace event JSON. Call it, and Clear,
+  // when no filter runs. Return false if the file can not be written.
+  bool WriteChromeTrace(const std::string& path) const;
+  // Forget the spans, the rings are kept.
+  void Clear();
+  // Spans overwritten in all the rings.
+  long long dropped() const;
+private:
+  int capacity_;
+  std::chrono::high_resolution_clock::time_point origin_;
+  struct Lease {
+    TraceBuffer* buffer;
+    int depth;
+  };
+  mutable std::mutex mutex_;
+  // All the rings, the leased ones and the free ones.
+  std::vector<TraceBuffer*> buffers_;
+  std::vector<TraceBuffer*> free_buffers_;
+  std::map<std::thread::id, Lease> leases_;
+  DISABLE_COPY_AND_ASSIGN(TraceRecorder);
+};
+
+// Recorder the filters record to, nullptr by default, then nothing is
+// recorded. It must stay alive until it is replaced and the filters which
+// leased a ring from it have returned.
+void SetTraceRecorder(TraceRecorder* recorder);
+TraceRecorder* GetTraceRecorder();
+
+/**
+* Lease of a ring of the installed recorder to the calling thread, for the
+* scope of the object. get() is nullptr if no recorder is installed.
+* Nested leases of a thread share its ring, the last one to end gives the
+* ring back and the next thread to record reuses it, so there are as many
+* rings as threads recording at the same time, not one per thread ever
+* started. Declare it before the spans recorded on it.
+* thread_name is null for a span nested in the work of any thread.
+*/
+class ThreadTraceBuffer
+{
+public:
+  explicit ThreadTraceBuffer(const char* thread_name)
+    : recorder_(GetTraceRecorder()), buffer_(nullptr) {
+    if (nullptr != recorder_) {
+      buffer_ = recorder_->AcquireThreadBuffer(thread_name);
+    }
+  }
+  ~ThreadTraceBuffer() {
+    if (nullptr != recorder_) {
+      recorder_->ReleaseThreadBuffer();
+    }
+  }
+  TraceBuffer* get() const { return buffer_; }
+private:
+  TraceRecorder* recorder_;
+  TraceBuffer* buffer_;
+  DISABLE_COPY_AND_ASSIGN(ThreadTraceBuffer);
+};
+
+/**
+* Record the span from its construction to its destruction, nothing if
+* buffer is null.
+*/
+class TraceScope
+{
+public:
+  TraceScope(TraceBuffer* buffer, const char* name, long long index)
+    : buffer_(buffer), name_(name), index_(index), begin_ns_(0) {
+    if (nullptr != buffer_) {
+      begin_ns_ = buffer_->Now();
+    }
+  }
+  ~TraceScope() {
+    if (nullptr != buffer_) {
+      buffer_->Record(name_, begin_ns_, buffer_->Now(), index_);
+    }
+  }
+private:
+  TraceBuffer* buffer_;
+  const char* name_;
+  long long index_;
+  long long begin_ns_;
+  DISABLE_COPY_AND_ASSIGN(TraceScope);
+};
+#endif  // !IMAGE_IMAGE_FILTER_TRACE_RECORDER_H_
@@ -0,0 +1,185 @@
+#include <assert.h>
+#include <stddef.h>
+#include "image_filter/transpose.h"
+#if defined(__SSE2__) || defined(_M_X64) || \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSPOSE_USE_SSE2
+#endif
+
+// Transpose a block pixel by pixel, src and dst point to its first pixel.
+template<typename Dtype>
+static void TransposeBlockScalar(const Dtype* src, int src_pitch, Dtype* dst,
+  int dst_pitch, int width, int height, int channels) {
+  // One channel without the channel loop, which the compiler keeps.
+  if (1 == channels) {
+    for (int i = 0; i < width; i++) {
+      Dtype* dst_row = dst + static_cast<ptrdiff_t>(i) * dst_pitch;
+      for (int j = 0; j < height; j++) {
+        dst_row[j] = src[static_cast<ptrdiff_t>(j) * src_pitch + i];
+      }
+    }
+    return;
+  }
+  for (int i = 0; i < width; i++) {
+    Dtype* dst_row = dst + static_cast<ptrdiff_t>(i) * dst_pitch;
+    const Dtype* src_col = src + i * channels;
+    for (int j = 0; j < height; j++) {
+      const Dtype* pixel = src_col + static_cast<ptrdiff_t>(j) * src_pitch;
+      for (int c = 0; c < channels; c++) {
+        dst_row[j * channels + c] = pixel[c];
+      }
+    }
+  }
+}
+
+#ifdef TRANSPOSE_USE_SSE2
+// Transpose an 8x8 block of unsigned char by three rounds of unpacking.
+static inline void Transpose8x8(const unsigned char* src, int src_pitch,
+  unsigned char* dst, int dst_pitch) {
+  __m128i r[8];
+  for (int k = 0; k < 8; k++) {
+    r[k] = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(
+      src + static_cast<ptrdiff_t>(k) * src_pitch));
+  }
+  // 2x2 blocks of bytes, then 4x4 blocks of 16 bits
+  __m128i a0 = _mm_unpacklo_epi8(r[0], r[1]);
+  __m128i a1 = _mm_unpacklo_epi8(r[2], r[3]);
+  __m128i a2 = _mm_unpacklo_epi8(r[4], r[5]);
+  __m128i a3 = _mm_unpacklo_epi8(r[6], r[7]);
+  __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+  __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+  __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+  __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+  // Each register holds two destination rows
+  __m128i c[4];
+  c[0] = _mm_unpacklo_epi32(b0, b2);
+  c[1] = _mm_unpackhi_epi32(b0, b2);
+  c[2] = _mm_unpacklo_epi32(b1, b3);
+  c[3] = _mm_unpackhi_epi32(b1, b3);
+  for (int k = 0; k < 4; k++) {
+    unsigned char* dst_row = dst + static_cast<ptrdiff_t>(k * 2) * dst_pitch;
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst_row), c[k]);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst_row + dst_pitch),
+      _mm_unpackhi_epi64(c[k], c[k]));
+  }
+}
+
+// Transpose a 4x4 block of float.
+static inline void Transpose4x4(const float* src, int src_pitch, float* dst,
+  int dst_pitch) {
+  __m128 r0 = _mm_loadu_ps(src);
+  __m128 r1 = _mm_loadu_ps(src + src_pitch);
+  __m128 r2 = _mm_loadu_ps(src + static_cast<ptrdiff_t>(src_pitch) * 2);
+  __m128 r3 = _mm_loadu_ps(src + static_cast<ptrdiff_t>(src_pitch) * 3);
+  _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+  _mm_storeu_ps(dst, r0);
+  _mm_storeu_ps(dst + dst_pitch, r1);
+  _mm_storeu_ps(dst + static_cast<ptrdiff_t>(dst_pitch) * 2, r2);
+  _mm_storeu_ps(dst + static_cast<ptrdiff_t>(dst_pitch) * 3, r3);
+}
+#endif
+
+// Transpose a leaf block, others
+template<typename Dtype>
+static void TransposeBlock(const Dtype* src, int src_pitch, Dtype* dst,
+  int dst_pitch, int width, int height, int channels) {
+  TransposeBlockScalar(src, src_pitch, dst, dst_pitch, width, height,
+    channels);
+}
+
+#ifdef TRANSPOSE_USE_SSE2
+// Transpose a leaf block by kernels of side n, the remaining right cols and
+// bottom rows are transposed pixel by pixel.
+template<typename Dtype, int n, typename Kernel>
+static void TransposeBlockByKernel(const Dtype* src, int src_pitch,
+  Dtype* dst, int dst_pitch, int width, int height, Kernel kernel) {
+  int kernel_width = width - width % n;
+  int kernel_height = height - height % n;
+  for (int j = 0; j < kernel_height; j += n) {
+    for (int i = 0; i < kernel_width; i += n) {
+      kernel(src + static_cast<ptrdiff_t>(j) * src_pitch + i, src_pitch,
+        dst + static_cast<ptrdiff_t>(i) * dst_pitch + j, dst_pitch);
+    }
+  }
+  TransposeBlockScalar(src + kernel_width, src_pitch,
+    dst + static_cast<ptrdiff_t>(kernel_width) * dst_pitch, dst_pitch,
+    width - kernel_width, height, 1);
+  const Dtype* src_bottom =
+    src + static_cast<ptrdiff_t>(kernel_height) * src_pitch;
+  TransposeBlockScalar(src_bottom, src_pitch, dst + kernel_height, dst_pitch,
+    kernel_width, height - kernel_height, 1);
+}
+
+// Transpose a leaf block, unsigned char
+static void TransposeBlock(const unsigned char* src, int src_pitch,
+  unsigned char* dst, int dst_pitch, int width, int height, int channels) {
+  if (1 != channels) {
+    TransposeBlockScalar(src, src_pitch, dst, dst_pitch, width, height,
+      channels);
+    return;
+  }
+  TransposeBlockByKernel<unsigned char, 8>(src, src_pitch, dst, dst_pitch,
+    width, height, Transpose8x8);
+}
+
+// Transpose a leaf block, float
+static void TransposeBlock(const float* src, int src_pitch, float* dst,
+  int dst_pitch, int width, int height, int channels) {
+  if (1 != channels) {
+    TransposeBlockScalar(src, src_pitch, dst, dst_pitch, width, height,
+      channels);
+    return;
+  }
+  TransposeBlockByKernel<float, 4>(src, src_pitch, dst, dst_pitch, width,
+    height, Transpose4x4);
+}
+#endif
+
+// Split the longer side in two until the block fits TRANSPOSE_BLOCK_SIZE,
+// the halves are cut on a multiple of 8 pixels to keep the kernels full.
+template<typename Dtype>
+static void TransposeRecursive(const Dtype* src, int src_pitch, Dtype* dst,
+  int dst_pitch, int width, int height, int channels) {
+  if (width <= TRANSPOSE_BLOCK_SIZE && height <= TRANSPOSE_BLOCK_SIZE) {
+    TransposeBlock(src, src_pitch, dst, dst_pitch, width, height, channels);
+    return;
+  }
+  if (width >= height) {
+    int half = (width / 2 + 7) & ~7;
+    TransposeRecursive(src, src_pitch, dst, dst_pitch, half, height,
+      channels);
+    TransposeRecursive(src + half * channels, src_pitch,
+      dst + static_cast<ptrdiff_t>(half) * dst_pitch, dst_pitch,
+      width - half, height, channels);
+  } else {
+    int half = (height / 2 + 7) & ~7;
+    TransposeRecursive(src, src_pitch, dst, dst_pitch, width, half,
+      channels);
+    TransposeRecursive(src + static_cast<ptrdiff_t>(half) * src_pitch,
+      src_pitch, dst + half * channels, dst_pitch, width, height - half,
+      channels);
+  }
+}
+
+template<typename Dtype>
+void TransposeImage(const Dtype* host_src, int src_pitch, Dtype* host_dst,
+  int dst_pitch, int width, int height, int channels) {
+  assert(nullptr != host_src);
+  assert(nullptr != host_dst);
+  assert(host_src != host_dst);
+  assert(0 < width);
+  assert(0 < height);
+  assert(width * channels <= src_pitch);
+  assert(height * channels <= dst_pitch);
+  TransposeRecursive(host_src, src_pitch, host_dst, dst_pitch, width, height,
+    channels);
+}
+
+template void TransposeImage<unsigned char>(const unsigned char* host_src,
+  int src_pitch, unsigned char* host_dst, int dst_pitch, int width,
+  int height, int channels);
+template void TransposeImage<float>(const float* host_src, int src_pitch,
+  float* host_dst, int dst_pitch, int width, int height, int channels);
+template void TransposeImage<double>(const double* host_src, int src_pitch,
+  double* host_dst, int dst_pitch, int width, int height, int channels);
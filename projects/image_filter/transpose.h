@@ -0,0 +1,28 @@
+#ifndef IMAGE_IMAGE_FILTER_TRANSPOSE_H_
+#define IMAGE_IMAGE_FILTER_TRANSPOSE_H_
+
+// Side of the blocks the recursive transpose stops splitting at, a block of
+// source rows and destination rows stays in L1.
+#ifndef TRANSPOSE_BLOCK_SIZE
+#define TRANSPOSE_BLOCK_SIZE 32
+#endif
+
+/**
+* Transpose an image, the pixel (x, y) of the source becomes the pixel
+* (y, x) of the destination. The image is split recursively along its longer
+* side until the blocks are small, so it is cache-oblivious. Single channel
+* unsigned char and float blocks are transposed with SSE2 8x8 and 4x4
+* kernels when available.
+*
+* \param host_src   Source image data, width by height pixels.
+* \param src_pitch  Distance between two source rows, in elements.
+* \param host_dst   Destination image data, height by width pixels.
+* \param dst_pitch  Distance between two destination rows, in elements.
+* \param width      Source image width, in pixels.
+* \param height     Source image height, in pixels.
+* \param channels   Interleaved channels of a pixel, moved together.
+*/
+template<typename Dtype>
+void TransposeImage(const Dtype* host_src, int src_pitch, Dtype* host_dst,
+  int dst_pitch, int width, int height, int channels);
+#endif  // !IMAGE_IMAGE_FILTER_TRANSPOSE_H_
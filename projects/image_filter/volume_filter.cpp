@@ -0,0 +1,298 @@
+#include <math.h>
+#include <string.h>
+#include "image_filter/cpu_dispatch.h"
+#include "image_filter/median_filter_internal.h"
+#include "image_filter/volume_filter.h"
+
+template class MeanSliceStream<unsigned char>;
+template class MeanSliceStream<float>;
+template class MeanSliceStream<double>;
+
+// Convert the sum of a filter cube to the mean value.
+static inline unsigned char GetCubeMeanValue(double sum, int wnd_size,
+  unsigned char) {
+  return (unsigned char)(round(sum / wnd_size));
+}
+
+template<typename Dtype>
+static inline Dtype GetCubeMeanValue(double sum, int wnd_size, Dtype) {
+  return static_cast<Dtype>(sum / wnd_size);
+}
+
+template<typename Dtype>
+MeanSliceStream<Dtype>::MeanSliceStream(int radius, int width, int height)
+  : radius_(radius), width_(width), height_(height), slices_out_(0),
+  ring_buffer_(radius, width * height), sum_z_(nullptr), sum_cols_(nullptr),
+  const_row_(nullptr) {
+  assert(radius < width);
+  assert(radius < height);
+  if (!workspace_.Reserve(FilterWorkspace::SizeOf<double>(width * height) +
+    FilterWorkspace::SizeOf<double>(width) * 2)) {
+    return;
+  }
+  sum_z_ = workspace_.Acquire<double>(width * height);
+  sum_cols_ = workspace_.Acquire<double>(width);
+  const_row_ = workspace_.Acquire<double>(width);
+}
+
+template<typename Dtype>
+void MeanSliceStream<Dtype>::Reset() {
+  ring_buffer_.Reset();
+  slices_out_ = 0;
+}
+
+/**
+* Push a source slice into the stream.
+*
+* \param host_src_slice  Source slice, width by height pixels.
+* \param host_dst_slice  Destination slice, width by height pixels. Written
+*                        only when true is returned.
+*/
+template<typename Dtype>
+bool MeanSliceStream<Dtype>::PushSlice(const Dtype* host_src_slice,
+  Dtype* host_dst_slice) {
+  assert(nullptr != host_dst_slice);
+  if (!ok()) {
+    return false;
+  }
+  ring_buffer_.Push(host_src_slice);
+  if (ring_buffer_.rows() <= radius_) {
+    return false;
+  }
+  EmitSlice(host_dst_slice, -1);
+  return true;
+}
+
+template<typename Dtype>
+bool MeanSliceStream<Dtype>::Flush(Dtype* host_dst_slice) {
+  assert(nullptr != host_dst_slice);
+  if (!ok()) {
+    return false;
+  }
+  assert(radius_ < ring_buffer_.rows());
+  if (slices_out_ >= ring_buffer_.rows()) {
+    return false;
+  }
+  EmitSlice(host_dst_slice, ring_buffer_.rows());
+  return true;
+}
+
+template<typename Dtype>
+bool MeanSliceStream<Dtype>::FilterVolume(const Dtype* host_src,
+  Dtype* host_dst, int depth) {
+  assert(radius_ < depth);
+  if (!ok()) {
+    return false;
+  }
+  size_t slice_size = static_cast<size_t>(width_) * height_;
+  Reset();
+  for (int z = 0; z < depth; z++) {
+    if (PushSlice(host_src + z * slice_size, host_dst)) {
+      host_dst += slice_size;
+    }
+  }
+  while (Flush(host_dst)) {
+    host_dst += slice_size;
+  }
+  return true;
+}
+
+// Move the z sums to the next slice, then box filter them in the slice
+// plane with col sums, like MeanFilterHelper.
+template<typename Dtype>
+void MeanSliceStream<Dtype>::EmitSlice(Dtype* host_dst_slice, int depth) {
+  int z = slices_out_;
+  int size = width_ * height_;
+  int core_size = radius_ * 2 + 1;
+  BorderType border = ring_buffer_.border();
+  double border_value = static_cast<double>(ring_buffer_.border_value());
+  if (0 == z) {
+    memset(sum_z_, 0, sizeof(double) * size);
+    for (int m = -radius_; m <= radius_; m++) {
+      const Dtype* slice = ring_buffer_.Row(m, depth);
+      for (int k = 0; k < size; k++) {
+        sum_z_[k] += slice[k];
+      }
+    }
+    for (int k = 0; k < width_; k++) {
+      const_row_[k] = border_value * core_size;
+    }
+  } else {
+    UpdateSum(ring_buffer_.Row(z - radius_ - 1, depth),
+      ring_buffer_.Row(z + radius_, depth), sum_z_, size);
+  }
+  double border_sum = border_value * core_size * core_size;
+  int wnd_size = core_size * core_size * core_size;
+  for (int i = 0; i < height_; i++) {
+    if (0 == i) {
+      memset(sum_cols_, 0, sizeof(double) * width_);
+      for (int m = -radius_; m <= radius_; m++) {
+        const double* row =
+          BorderRow(sum_z_, width_, height_, m, border, const_row_);
+        for (int k = 0; k < width_; k++) {
+          sum_cols_[k] += row[k];
+        }
+      }
+    } else {
+      UpdateSum(BorderRow(sum_z_, width_, height_, i - radius_ - 1, border,
+        const_row_),
+        BorderRow(sum_z_, width_, height_, i + radius_, border, const_row_),
+        sum_cols_, width_);
+    }
+    Dtype* dst_row = host_dst_slice + i * width_;
+    for (int j = 0; j < width_; j++) {
+      double sum = 0;
+      if (radius_ <= j && j < width_ - radius_) {
+        for (int m = j - radius_; m <= j + radius_; m++) {
+          sum += sum_cols_[m];
+        }
+      } else {
+        for (int m = j - radius_; m <= j + radius_; m++) {
+          int k = BorderInterpolate(m, width_, border);
+          sum += k < 0 ? border_sum : sum_cols_[k];
+        }
+      }
+      dst_row[j] = GetCubeMeanValue(sum, wnd_size, Dtype());
+    }
+  }
+  slices_out_++;
+}
+
+UcharMedianSliceStream::UcharMedianSliceStream(int radius, int width,
+  int height)
+  : radius_(radius), width_(width), height_(height), gate_(0.5),
+  slices_out_(0), ring_buffer_(radius, width * height), his_data_(nullptr),
+  his_cols_(nullptr), slices_(nullptr), const_row_(nullptr) {
+  assert(radius < width);
+  assert(radius < height);
+  if (!workspace_.Reserve(
+    FilterWorkspace::SizeOf<int>(width * GRAY_LEVEL_MAX) +
+    FilterWorkspace::SizeOf<int*>(width) +
+    FilterWorkspace::SizeOf<const unsigned char*>(radius * 2 + 1) +
+    FilterWorkspace::SizeOf<unsigned char>(width))) {
+    return;
+  }
+  his_data_ = workspace_.Acquire<int>(width * GRAY_LEVEL_MAX);
+  his_cols_ = workspace_.Acquire<int*>(width);
+  slices_ = workspace_.Acquire<const unsigned char*>(radius * 2 + 1);
+  const_row_ = workspace_.Acquire<unsigned char>(width);
+  for (int i = 0; i < width; i++) {
+    his_cols_[i] = his_data_ + i * GRAY_LEVEL_MAX;
+  }
+}
+
+void UcharMedianSliceStream::Reset() {
+  ring_buffer_.Reset();
+  slices_out_ = 0;
+}
+
+bool UcharMedianSliceStream::PushSlice(const unsigned char* host_src_slice,
+  unsigned char* host_dst_slice) {
+  assert(nullptr != host_dst_slice);
+  if (!ok()) {
+    return false;
+  }
+  ring_buffer_.Push(host_src_slice);
+  if (ring_buffer_.rows() <= radius_) {
+    return false;
+  }
+  EmitSlice(host_dst_slice, -1);
+  return true;
+}
+
+bool UcharMedianSliceStream::Flush(unsigned char* host_dst_slice) {
+  assert(nullptr != host_dst_slice);
+  if (!ok()) {
+    return false;
+  }
+  assert(radius_ < ring_buffer_.rows());
+  if (slices_out_ >= ring_buffer_.rows()) {
+    return false;
+  }
+  EmitSlice(host_dst_slice, ring_buffer_.rows());
+  return true;
+}
+
+bool UcharMedianSliceStream::FilterVolume(const unsigned char* host_src,
+  unsigned char* host_dst, int depth) {
+  assert(radius_ < depth);
+  if (!ok()) {
+    return false;
+  }
+  size_t slice_size = static_cast<size_t>(width_) * height_;
+  Reset();
+  for (int z = 0; z < depth; z++) {
+    if (PushSlice(host_src + z * slice_size, host_dst)) {
+      host_dst += slice_size;
+    }
+  }
+  while (Flush(host_dst)) {
+    host_dst += slice_size;
+  }
+  return true;
+}
+
+// The col histograms are rebuilt from the 2*r+1 slices at the first row,
+// then moved down row by row. The window histogram slides toward right
+// like GetRowUcharMedianByHistogram, with the kernels of the cpu target.
+void UcharMedianSliceStream::EmitSlice(unsigned char* host_dst_slice,
+  int depth) {
+  int z = slices_out_;
+  int core_size = radius_ * 2 + 1;
+  BorderType border = ring_buffer_.border();
+  unsigned char border_value = ring_buffer_.border_value();
+  if (0 == z) {
+    memset(const_his_, 0, sizeof(int) * GRAY_LEVEL_MAX);
+    const_his_[border_value] = core_size * core_size;
+    memset(const_row_, border_value, width_);
+  }
+  for (int k = 0; k < core_size; k++) {
+    slices_[k] = ring_buffer_.Row(z - radius_ + k, depth);
+  }
+  const FilterKernels& kernels = GetFilterKernels();
+  int histogram[GRAY_LEVEL_MAX];
+  for (int i = 0; i < height_; i++) {
+    if (0 == i) {
+      memset(his_data_, 0, sizeof(int) * width_ * GRAY_LEVEL_MAX);
+      for (int k = 0; k < core_size; k++) {
+        for (int m = -radius_; m <= radius_; m++) {
+          const unsigned char* row =
+            BorderRow(slices_[k], width_, height_, m, border, const_row_);
+          for (int j = 0; j < width_; j++) {
+            his_cols_[j][row[j]]++;
+          }
+        }
+      }
+    } else {
+      for (int k = 0; k < core_size; k++) {
+        const unsigned char* row_sub = BorderRow(slices_[k], width_,
+          height_, i - radius_ - 1, border, const_row_);
+        const unsigned char* row_add = BorderRow(slices_[k], width_,
+          height_, i + radius_, border, const_row_);
+        for (int j = 0; j < width_; j++) {
+          his_cols_[j][row_sub[j]]--;
+          his_cols_[j][row_add[j]]++;
+        }
+      }
+    }
+    unsigned char* dst_row = host_dst_slice + i * width_;
+    memset(histogram, 0, sizeof(int) * GRAY_LEVEL_MAX);
+    for (int m = -radius_; m <= radius_; m++) {
+      int k = BorderInterpolate(m, width_, border);
+      kernels.add_hist(histogram, k < 0 ? const_his_ : his_cols_[k],
+        GRAY_LEVEL_MAX);
+    }
+    dst_row[0] = GetHistMediumValue(kernels, histogram, GRAY_LEVEL_MAX,
+      radius_, gate_, 3);
+    for (int j = 1; j < width_; j++) {
+      int k_add = BorderInterpolate(j + radius_, width_, border);
+      int k_sub = BorderInterpolate(j - radius_ - 1, width_, border);
+      kernels.add_sub_hist(histogram,
+        k_add < 0 ? const_his_ : his_cols_[k_add],
+        k_sub < 0 ? const_his_ : his_cols_[k_sub], GRAY_LEVEL_MAX);
+      dst_row[j] = GetHistMediumValue(kernels, histogram, GRAY_LEVEL_MAX,
+        radius_, gate_, 3);
+    }
+  }
+  slices_out_++;
+}
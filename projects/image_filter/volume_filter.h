@@ -0,0 +1,112 @@
+#ifndef IMAGE_IMAGE_FILTER_VOLUME_FILTER_H_
+#define IMAGE_IMAGE_FILTER_VOLUME_FILTER_H_
+#include <assert.h>
+#include "image_filter/filter_workspace.h"
+#include "image_filter/row_buffer.h"
+
+// Define max gray level.
+#ifndef GRAY_LEVEL_MAX
+#define GRAY_LEVEL_MAX 256
+#endif
+
+// Disable the copy and assignment operator for a class.
+#ifndef DISABLE_COPY_AND_ASSIGN
+#define DISABLE_COPY_AND_ASSIGN(classname) \
+private:\
+  classname(const classname&);\
+  classname& operator=(const classname&)
+#endif
+
+/**
+* Slice-buffered 3D mean filter, the kernel is a 2*r+1 cube.
+* A volume of width by height slices is pushed slice by slice, only 2*r+2
+* slices are kept. Every pixel keeps the running sum of its 2*r+1 slices
+* along z, updated in O(1) per pushed slice, then the sums are box filtered
+* in the slice plane like MeanFilter.
+*/
+template<typename Dtype>
+class MeanSliceStream
+{
+public:
+  MeanSliceStream(int radius, int width, int height);
+  // False if the buffers could not be allocated, then PushSlice, Flush and
+  // FilterVolume return false without doing anything.
+  bool ok() const { return ring_buffer_.ok() && nullptr != sum_z_; }
+  // Only allowed before the first slice is pushed.
+  void set_border(BorderType border, Dtype border_value = Dtype()) {
+    ring_buffer_.set_border(border, border_value);
+  }
+  // Push the next source slice. Return true if output slice slices_out() - 1
+  // was written to host_dst_slice.
+  bool PushSlice(const Dtype* host_src_slice, Dtype* host_dst_slice);
+  // Call after the last source slice, once per remaining output slice.
+  // Return false when all the slices have been emitted.
+  bool Flush(Dtype* host_dst_slice);
+  // Filter a whole volume of depth slices, the stream is reset first.
+  bool FilterVolume(const Dtype* host_src, Dtype* host_dst, int depth);
+  // Start a new volume with the same radius and slice size.
+  void Reset();
+  int slices_in() const { return ring_buffer_.rows(); }
+  int slices_out() const { return slices_out_; }
+private:
+  void EmitSlice(Dtype* host_dst_slice, int depth);
+  int radius_;
+  int width_;
+  int height_;
+  int slices_out_;
+  RowRingBuffer<Dtype> ring_buffer_;
+  FilterWorkspace workspace_;
+  // Sum of the 2*r+1 slices of the window, for every pixel of a slice.
+  double* sum_z_;
+  double* sum_cols_;
+  double* const_row_;
+  DISABLE_COPY_AND_ASSIGN(MeanSliceStream);
+};
+
+/**
+* Slice-buffered 3D median filter for unsigned char, the kernel is a 2*r+1
+* cube. Like GetUcharMedianByHistogram, each col of a slice keeps a
+* histogram, which covers the 2*r+1 rows by 2*r+1 slices under the window.
+* It is moved down a row by 2*(2*r+1) pixel updates, and the window
+* histogram is moved right by adding and subtracting col histograms.
+* Only 2*r+2 slices and width histograms are kept.
+*/
+class UcharMedianSliceStream
+{
+public:
+  UcharMedianSliceStream(int radius, int width, int height);
+  bool ok() const { return ring_buffer_.ok() && nullptr != his_data_; }
+  // Only allowed before the first slice is pushed.
+  void set_border(BorderType border, unsigned char border_value = 0) {
+    ring_buffer_.set_border(border, border_value);
+  }
+  void set_gate(float gate) {
+    assert(gate > 0);
+    assert(gate < 1);
+    gate_ = gate;
+  }
+  bool PushSlice(const unsigned char* host_src_slice,
+    unsigned char* host_dst_slice);
+  bool Flush(unsigned char* host_dst_slice);
+  bool FilterVolume(const unsigned char* host_src, unsigned char* host_dst,
+    int depth);
+  void Reset();
+  int slices_in() const { return ring_buffer_.rows(); }
+  int slices_out() const { return slices_out_; }
+private:
+  void EmitSlice(unsigned char* host_dst_slice, int depth);
+  int radius_;
+  int width_;
+  int height_;
+  float gate_;
+  int slices_out_;
+  RowRingBuffer<unsigned char> ring_buffer_;
+  FilterWorkspace workspace_;
+  int* his_data_;
+  int** his_cols_;
+  const unsigned char** slices_;
+  unsigned char* const_row_;
+  int const_his_[GRAY_LEVEL_MAX];
+  DISABLE_COPY_AND_ASSIGN(UcharMedianSliceStream);
+};
+#endif  // !IMAGE_IMAGE_FILTER_VOLUME_FILTER_H_
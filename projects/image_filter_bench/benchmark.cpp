@@ -0,0 +1,490 @@
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include "image_filter/aligned_memory.h"
+#include "image_filter/mapped_image.h"
+#include "image_filter_bench/benchmark.h"
+
+#ifndef BENCH_DATA_DIR
+#define BENCH_DATA_DIR "data"
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Read a mapped 8 or 24 bits bmp or an 8 bits pgm as gray.
+static bool ReadImage(const std::string& path, BenchImage* image) {
+  MappedImage file;
+  if ((!file.OpenBmp(path.c_str()) && !file.OpenPgm(path.c_str())) ||
+    1 != file.value_size()) {
+    return false;
+  }
+  int width = file.width();
+  int height = file.height();
+  image->width = width;
+  image->height = height;
+  image->pixels.resize(static_cast<size_t>(width) * height);
+  for (int i = 0; i < height; i++) {
+    const unsigned char* row = file.pixels<unsigned char>() +
+      static_cast<size_t>(file.pitch()) *
+      (file.bottom_up() ? height - 1 - i : i);
+    unsigned char* gray = &image->pixels[static_cast<size_t>(i) * width];
+    if (1 == file.channels()) {
+      memcpy(gray, row, width);
+      continue;
+    }
+    for (int j = 0; j < width; j++) {
+      const unsigned char* bgr = row + 3 * j;
+      gray[j] = static_cast<unsigned char>(
+        (29 * bgr[0] + 150 * bgr[1] + 77 * bgr[2] + 128) >> 8);
+    }
+  }
+  return true;
+}
+
+bool LoadBenchImage(const std::string& path, BenchImage* image) {
+  if (!ReadImage(path, image) &&
+    !ReadImage(std::string(BENCH_DATA_DIR) + "/" + path, image)) {
+    return false;
+  }
+  size_t slash = path.find_last_of("/\\");
+  image->name = std::string::npos == slash ? path : path.substr(slash + 1);
+  return true;
+}
+
+std::vector<std::string> SplitList(const std::string& list) {
+  std::vector<std::string> items;
+  size_t begin = 0;
+  while (begin <= list.size()) {
+    size_t end = list.find(',', begin);
+    if (std::string::npos == end) {
+      end = list.size();
+    }
+    if (end > begin) {
+      items.push_back(list.substr(begin, end - begin));
+    }
+    begin = end + 1;
+  }
+  return items;
+}
+
+std::vector<int> SplitIntList(const std::string& list) {
+  std::vector<std::string> items = SplitList(list);
+  std::vector<int> values;
+  for (size_t k = 0; k < items.size(); k++) {
+    values.push_back(atoi(items[k].c_str()));
+  }
+  return values;
+}
+
+double GetMonotonicSeconds() {
+#ifdef _WIN32
+  // The steady_clock of VS2013 is not steady, ask the counter directly.
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return static_cast<double>(counter.QuadPart) / frequency.QuadPart;
+#else
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+// Median of sorted values.
+static double GetSortedMedian(const std::vector<double>& sorted) {
+  size_t n = sorted.size();
+  if (0 == n) {
+    return 0;
+  }
+  return n % 2 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+}
+
+BenchStats GetBenchStats(std::vector<double> seconds) {
+  BenchStats stats;
+  memset(&stats, 0, sizeof(stats));
+  stats.runs = static_cast<int>(seconds.size());
+  if (seconds.empty()) {
+    return stats;
+  }
+  std::sort(seconds.begin(), seconds.end());
+  stats.median = GetSortedMedian(seconds);
+  int rank = static_cast<int>(ceil(0.95 * seconds.size())) - 1;
+  stats.p95 = seconds[std::max(rank, 0)];
+  stats.min = seconds.front();
+  stats.max = seconds.back();
+  std::vector<double> deviations(seconds.size());
+  for (size_t k = 0; k < seconds.size(); k++) {
+    deviations[k] = fabs(seconds[k] - stats.median);
+  }
+  std::sort(deviations.begin(), deviations.end());
+  stats.mad = GetSortedMedian(deviations);
+  return stats;
+}
+
+void CacheFlusher::Flush() {
+  // Writing makes the lines dirty, so the image lines are evicted too and
+  // not only shared with the buffer.
+  unsigned int sum = 0;
+  for (size_t k = 0; k < buffer_.size(); k += 64) {
+    buffer_[k] = static_cast<unsigned char>(buffer_[k] + 1);
+  }
+  for (size_t k = 0; k < buffer_.size(); k += 64) {
+    sum += buffer_[k];
+  }
+  sink_ = sum;
+}
+
+static const char* kPerfEventNames[PERF_EVENT_NUM] = {
+  "cycles", "instructions", "l1d_misses", "l2_misses", "llc_misses",
+  "branch_misses"};
+
+void ClearPerfCounts(PerfCounts* counts) {
+  for (int k = 0; k < PERF_EVENT_NUM; k++) {
+    counts->values[k] = -1;
+  }
+}
+
+PerfCounters::PerfCounters() : stops_(0) {
+  for (int k = 0; k < PERF_EVENT_NUM; k++) {
+    fds_[k] = -1;
+    totals_[k] = 0;
+  }
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+  for (int k = 0; k < PERF_EVENT_NUM; k++) {
+    if (fds_[k] >= 0) {
+      close(fds_[k]);
+    }
+  }
+#endif
+}
+
+#ifdef __linux__
+// The generic events, the L1 data cache misses are the read ones.
+static void GetPerfEventConfig(int event, perf_event_attr* attr) {
+  attr->type = PERF_TYPE_HARDWARE;
+  switch (event) {
+  case PERF_EVENT_CYCLES:
+    attr->config = PERF_COUNT_HW_CPU_CYCLES;
+    break;
+  case PERF_EVENT_INSTRUCTIONS:
+    attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+    break;
+  case PERF_EVENT_L1D_MISSES:
+    attr->type = PERF_TYPE_HW_CACHE;
+    attr->config = PERF_COUNT_HW_CACHE_L1D |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    break;
+  case PERF_EVENT_L2_MISSES:
+    attr->config = PERF_COUNT_HW_CACHE_REFERENCES;
+    break;
+  case PERF_EVENT_LLC_MISSES:
+    attr->config = PERF_COUNT_HW_CACHE_MISSES;
+    break;
+  default:
+    attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+    break;
+  }
+}
+#endif
+
+bool PerfCounters::Open() {
+#ifdef __linux__
+  for (int k = 0; k < PERF_EVENT_NUM; k++) {
+    if (fds_[k] >= 0) {
+      continue;
+    }
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    GetPerfEventConfig(k, &attr);
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+      PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fds_[k] = static_cast<int>(
+      syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+#endif
+  return IsOpen();
+}
+
+bool PerfCounters::IsOpen() const {
+  for (int k = 0; k < PERF_EVENT_NUM; k++) {
+    if (fds_[k] >= 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PerfCounters::Start() {
+#ifdef __linux__
+  for (int k = 0; k < PERF_EVENT_NUM; k++) {
+    if (fds_[k] >= 0) {
+      ioctl(fds_[k], PERF_EVENT_IOC_RESET, 0);
+      ioctl(fds_[k], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#endif
+}
+
+void PerfCounters::Stop() {
+#ifdef __linux__
+  for (int k = 0; k < PERF_EVENT_NUM; k++) {
+    if (fds_[k] >= 0) {
+      ioctl(fds_[k], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+  for (int k = 0; k < PERF_EVENT_NUM; k++) {
+    // value, time enabled and time running.
+    unsigned long long data[3];
+    if (fds_[k] < 0 || sizeof(data) != read(fds_[k], data, sizeof(data))) {
+      continue;
+    }
+    if (data[2] > 0) {
+      totals_[k] += static_cast<double>(data[0]) * data[1] / data[2];
+    }
+  }
+  stops_++;
+#endif
+}
+
+void PerfCounters::ClearTotals() {
+  for (int k = 0; k < PERF_EVENT_NUM; k++) {
+    totals_[k] = 0;
+  }
+  stops_ = 0;
+}
+
+PerfCounts PerfCounters::GetMeanCounts() const {
+  PerfCounts counts;
+  ClearPerfCounts(&counts);
+  for (int k = 0; k < PERF_EVENT_NUM; k++) {
+    if (fds_[k] >= 0 && stops_ > 0) {
+      counts.values[k] = totals_[k] / stops_;
+    }
+  }
+  return counts;
+}
+
+const char* PerfCounters::GetEventName(PerfEvent event) {
+  return kPerfEventNames[event];
+}
+
+std::string FormatPerfCounts(const PerfCounts& counts, double units,
+  const char* unit, double seconds) {
+  const double* values = counts.values;
+  std::string text;
+  char item[96];
+  if (values[PERF_EVENT_CYCLES] > 0) {
+    sprintf(item, "  %.3g cycles/%s", values[PERF_EVENT_CYCLES] / units,
+      unit);
+    text += item;
+    if (values[PERF_EVENT_INSTRUCTIONS] >= 0) {
+      sprintf(item, "  ipc %.2f", values[PERF_EVENT_INSTRUCTIONS] /
+        values[PERF_EVENT_CYCLES]);
+      text += item;
+    }
+  }
+  for (int k = PERF_EVENT_L1D_MISSES; k < PERF_EVENT_NUM; k++) {
+    if (values[k] >= 0) {
+      sprintf(item, "  %s/%s %.3g", kPerfEventNames[k], unit,
+        values[k] / units);
+      text += item;
+    }
+  }
+  if (values[PERF_EVENT_LLC_MISSES] >= 0 && seconds > 0) {
+    sprintf(item, "  llc %.3g GB/s",
+      values[PERF_EVENT_LLC_MISSES] * CACHE_LINE_SIZE / seconds * 1e-9);
+    text += item;
+  }
+  return text;
+}
+
+BenchStats MeasureRuns(const std::function<void()>& run,
+  const std::function<void()>& prepare, int warmup, int runs,
+  double max_seconds, PerfCounters* counters) {
+  for (int k = 0; k < warmup; k++) {
+    run();
+  }
+  if (nullptr != counters && !counters->IsOpen()) {
+    counters = nullptr;
+  }
+  if (nullptr != counters) {
+    counters->ClearTotals();
+  }
+  std::vector<double> seconds;
+  double total = 0;
+  for (int k = 0; k < runs; k++) {
+    if (prepare) {
+      prepare();
+    }
+    if (nullptr != counters) {
+      counters->Start();
+    }
+    double start = GetMonotonicSeconds();
+    run();
+    double elapsed = GetMonotonicSeconds() - start;
+    if (nullptr != counters) {
+      counters->Stop();
+    }
+    seconds.push_back(elapsed);
+    total += elapsed;
+    if (seconds.size() >= 3 && total > max_seconds) {
+      break;
+    }
+  }
+  return GetBenchStats(seconds);
+}
+
+// The names are made of letters, digits and "/._x", nothing to escape.
+static void WriteResultJson(std::ofstream& file, const BenchResult& result) {
+  const BenchStats& stats = result.stats;
+  double pixels = static_cast<double>(result.width) * result.height;
+  double nanoseconds = stats.median * 1e9;
+  char numbers[512];
+  sprintf(numbers, "\"radius\": %d, \"width\": %d, \"height\": %d, "
+    "\"runs\": %d, \"median_s\": %.9g, \"p95_s\": %.9g, \"mad_s\": %.9g, "
+    "\"min_s\": %.9g, \"max_s\": %.9g, \"mpix_per_s\": %.6g",
+    result.radius, result.width, result.height, stats.runs, stats.median,
+    stats.p95, stats.mad, stats.min, stats.max,
+    stats.median > 0 ? pixels / stats.median * 1e-6 : 0.0);
+  file << "    {\"name\": \"" << result.name << "\", \"algorithm\": \"" <<
+    result.algorithm << "\", \"type\": \"" << result.type <<
+    "\", \"image\": \"" << result.image << "\", \"cache\": \"" <<
+    result.cache << "\", \"target\": \"" << result.target << "\", " <<
+    numbers;
+  for (int k = 0; k < PERF_EVENT_NUM; k++) {
+    if (result.counts.values[k] >= 0) {
+      sprintf(numbers, ", \"%s\": %.9g", kPerfEventNames[k],
+        result.counts.values[k]);
+      file << numbers;
+    }
+  }
+  if (result.counts.values[PERF_EVENT_LLC_MISSES] >= 0 && stats.median > 0) {
+    sprintf(numbers, ", \"llc_gb_per_s\": %.6g",
+      result.counts.values[PERF_EVENT_LLC_MISSES] * CACHE_LINE_SIZE /
+      stats.median * 1e-9);
+    file << numbers;
+  }
+  if (result.elements > 0 && nanoseconds > 0) {
+    sprintf(numbers, ", \"elements_per_ns\": %.6g, \"bytes_per_ns\": %.6g",
+      result.elements / nanoseconds, result.bytes / nanoseconds);
+    file << numbers;
+  }
+  file << "}";
+}
+
+bool WriteBenchJson(const std::string& path,
+  const std::map<std::string, std::string>& host,
+  const std::vector<BenchResult>& results) {
+  std::ofstream file(path.c_str());
+  if (!file) {
+    return false;
+  }
+  file << "{\n  \"schema\": \"image_filter_bench/1\",\n  \"host\": {";
+  std::map<std::string, std::string>::const_iterator it = host.begin();
+  for (; it != host.end(); ++it) {
+    file << (it == host.begin() ? "" : ", ") << "\"" << it->first <<
+      "\": \"" << it->second << "\"";
+  }
+  file << "},\n  \"results\": [\n";
+  for (size_t k = 0; k < results.size(); k++) {
+    WriteResultJson(file, results[k]);
+    file << (k + 1 < results.size() ? ",\n" : "\n");
+  }
+  file << "  ]\n}\n";
+  return static_cast<bool>(file);
+}
+
+// Number following "key": in line, false if missing.
+static bool FindJsonNumber(const std::string& line, const char* key,
+  double* value) {
+  std::string pattern = std::string("\"") + key + "\": ";
+  size_t pos = line.find(pattern);
+  if (std::string::npos == pos) {
+    return false;
+  }
+  return 1 == sscanf(line.c_str() + pos + pattern.size(), "%lf", value);
+}
+
+bool LoadBenchBaseline(const std::string& path,
+  std::map<std::string, BenchStats>* baseline) {
+  std::ifstream file(path.c_str());
+  if (!file) {
+    return false;
+  }
+  const std::string name_key = "\"name\": \"";
+  std::string line;
+  while (std::getline(file, line)) {
+    size_t begin = line.find(name_key);
+    if (std::string::npos == begin) {
+      continue;
+    }
+    begin += name_key.size();
+    size_t end = line.find('"', begin);
+    if (std::string::npos == end) {
+      continue;
+    }
+    BenchStats stats;
+    memset(&stats, 0, sizeof(stats));
+    double runs = 0;
+    if (!FindJsonNumber(line, "median_s", &stats.median)) {
+      continue;
+    }
+    FindJsonNumber(line, "runs", &runs);
+    FindJsonNumber(line, "p95_s", &stats.p95);
+    FindJsonNumber(line, "mad_s", &stats.mad);
+    FindJsonNumber(line, "min_s", &stats.min);
+    FindJsonNumber(line, "max_s", &stats.max);
+    stats.runs = static_cast<int>(runs);
+    (*baseline)[line.substr(begin, end - begin)] = stats;
+  }
+  return true;
+}
+
+int CompareWithBaseline(const std::vector<BenchResult>& results,
+  const std::map<std::string, BenchStats>& baseline, double threshold) {
+  int regressions = 0;
+  for (size_t k = 0; k < results.size(); k++) {
+    std::map<std::string, BenchStats>::const_iterator it =
+      baseline.find(results[k].name);
+    if (baseline.end() == it || it->second.median <= 0) {
+      continue;
+    }
+    const BenchStats& current = results[k].stats;
+    const BenchStats& base = it->second;
+    double change = current.median / base.median - 1;
+    double noise = 3 * (current.mad + base.mad);
+    const char* verdict = "";
+    if (change > threshold && current.median - base.median > noise) {
+      verdict = "  REGRESSION";
+      regressions++;
+    } else if (change < -threshold && base.median - current.median > noise) {
+      verdict = "  improved";
+    }
+    printf("%-56s %10.4f ms -> %10.4f ms %+7.1f%%%s\n",
+      results[k].name.c_str(), base.median * 1e3, current.median * 1e3,
+      change * 100, verdict);
+  }
+  return regressions;
+}
@@ -0,0 +1,167 @@
+#ifndef IMAGE_IMAGE_FILTER_BENCH_BENCHMARK_H_
+#define IMAGE_IMAGE_FILTER_BENCH_BENCHMARK_H_
+#include <stddef.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// Disable the copy and assignment operator for a class.
+#ifndef DISABLE_COPY_AND_ASSIGN
+#define DISABLE_COPY_AND_ASSIGN(classname) \
+private:\
+  classname(const classname&);\
+  classname& operator=(const classname&)
+#endif
+
+// Gray image of 8 bits, the input of every type.
+struct BenchImage {
+  std::string name;
+  int width;
+  int height;
+  std::vector<unsigned char> pixels;
+};
+
+// Read an uncompressed 8 or 24 bits bmp or an 8 bits pgm as gray, from path
+// or else from path in the bundled data directory.
+bool LoadBenchImage(const std::string& path, BenchImage* image);
+
+// Comma separated items of a command line list.
+std::vector<std::string> SplitList(const std::string& list);
+std::vector<int> SplitIntList(const std::string& list);
+
+// Monotonic time, in seconds from an arbitrary origin.
+double GetMonotonicSeconds();
+
+// Order statistics of the times of a case, in seconds.
+struct BenchStats {
+  int runs;
+  double median;
+  // 95th percentile, nearest rank.
+  double p95;
+  // Median absolute deviation from the median.
+  double mad;
+  double min;
+  double max;
+};
+
+BenchStats GetBenchStats(std::vector<double> seconds);
+
+/**
+* Evicts the caches by writing then reading a buffer larger than the last
+* level cache, for the cold runs.
+*/
+class CacheFlusher
+{
+public:
+  explicit CacheFlusher(size_t bytes) : buffer_(bytes), sink_(0) {}
+  void Flush();
+private:
+  std::vector<unsigned char> buffer_;
+  volatile unsigned int sink_;
+};
+
+// Hardware events counted around the timed runs.
+enum PerfEvent {
+  PERF_EVENT_CYCLES = 0,
+  PERF_EVENT_INSTRUCTIONS = 1,
+  PERF_EVENT_L1D_MISSES = 2,
+  // Requests reaching the last level cache, the L2 misses on x86.
+  PERF_EVENT_L2_MISSES = 3,
+  PERF_EVENT_LLC_MISSES = 4,
+  PERF_EVENT_BRANCH_MISSES = 5,
+  PERF_EVENT_NUM = 6
+};
+
+// Counts of one run, -1 for an event the host can not count.
+struct PerfCounts {
+  double values[PERF_EVENT_NUM];
+};
+
+/**
+* Hardware counters of the process and the threads it starts, by the Linux
+* perf_event_open, user space only so perf_event_paranoid 2 is enough.
+* Each event is counted on its own and scaled when the kernel multiplexes
+* them. Elsewhere, or on a host without a PMU, nothing opens.
+*/
+class PerfCounters
+{
+public:
+  PerfCounters();
+  ~PerfCounters();
+  // Return false if no event can be counted.
+  bool Open();
+  bool IsOpen() const;
+  // Count from zero until Stop, which adds the counts to the totals.
+  void Start();
+  void Stop();
+  void ClearTotals();
+  // Counts per Start and Stop since ClearTotals.
+  PerfCounts GetMeanCounts() const;
+  static const char* GetEventName(PerfEvent event);
+private:
+  int fds_[PERF_EVENT_NUM];
+  double totals_[PERF_EVENT_NUM];
+  int stops_;
+  DISABLE_COPY_AND_ASSIGN(PerfCounters);
+};
+
+/**
+* Counts per unit of work, units of them in a run of seconds, and the LLC
+* bandwidth of the misses, for the text output.
+*/
+std::string FormatPerfCounts(const PerfCounts& counts, double units,
+  const char* unit, double seconds);
+
+/**
+* Time warmup untimed runs, then up to runs timed ones. prepare, if set,
+* is called before each timed run, outside the timing. The timed runs stop
+* early once they took more than max_seconds, after 3 of them at least.
+* counters, if set and open, count the timed runs, cleared first.
+*/
+BenchStats MeasureRuns(const std::function<void()>& run,
+  const std::function<void()>& prepare, int warmup, int runs,
+  double max_seconds, PerfCounters* counters = nullptr);
+
+struct BenchResult {
+  // algorithm/type/r<radius>/<image>/<cache> for a filter, the key of a
+  // baseline.
+  std::string name;
+  // Filter method or kernel.
+  std::string algorithm;
+  std::string type;
+  std::string image;
+  std::string cache;
+  // Cpu target of the dispatched kernels.
+  std::string target;
+  int radius;
+  int width;
+  int height;
+  // Elements and bytes a run processes, 0 to report the pixels only.
+  double elements;
+  double bytes;
+  BenchStats stats;
+  // Mean counts of a timed run, all -1 when not counted.
+  PerfCounts counts;
+};
+
+// Mark all the counts of a result as not counted.
+void ClearPerfCounts(PerfCounts* counts);
+
+// Write the results and the host they ran on, one result per line.
+bool WriteBenchJson(const std::string& path,
+  const std::map<std::string, std::string>& host,
+  const std::vector<BenchResult>& results);
+
+// Load the stats by name of a file written by WriteBenchJson.
+bool LoadBenchBaseline(const std::string& path,
+  std::map<std::string, BenchStats>* baseline);
+
+/**
+* Print the change of every result found in the baseline and return the
+* number of regressions: a median slower by more than threshold, relative,
+* and by more than 3 MAD of both runs, so noise is not flagged.
+*/
+int CompareWithBaseline(const std::vector<BenchResult>& results,
+  const std::map<std::string, BenchStats>& baseline, double threshold);
+#endif  // !IMAGE_IMAGE_FILTER_BENCH_BENCHMARK_H_
@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "image_filter/auto_median_filter.h"
+#include "image_filter/cpu_dispatch.h"
+#include "image_filter/filter_workspace.h"
+#include "image_filter/mean_filter.h"
+#include "image_filter/median_filter.h"
+#include "image_filter_bench/benchmark.h"
+
+static const char* kUsage =
+  "Usage: image_filter_bench [options]\n"
+  "  --types LIST           uchar,float,double\n"
+  "  --algorithms LIST      median_uchar_histogram,median_histogram,\n"
+  "                         median_local_sort,median_auto,mean\n"
+  "  --radii LIST           1,2,4,8,16\n"
+  "  --images LIST          bmp or pgm files, also looked up in the data\n"
+  "                         directory, default all of them, or none\n"
+  "  --sizes LIST           sides of synthetic square images, 512,2048\n"
+  "  --cache LIST           warm,cold\n"
+  "  --warmup N             untimed runs of a case, 2\n"
+  "  --runs N               timed runs of a case, 15\n"
+  "  --flush-mb N           buffer written before each cold run, 64\n"
+  "  --max-case-seconds S   stop a case after S seconds of runs and skip\n"
+  "                         the larger sizes predicted to take longer, 10\n"
+  "  --cpu-target NAME      baseline, sse41, avx2 or avx512\n"
+  "  --perf                 count cycles, instructions, cache and branch\n"
+  "                         misses of the timed runs, Linux only\n"
+  "  --json PATH            results, image_filter_bench.json\n"
+  "  --baseline PATH        results to compare with, exit 2 on regression\n"
+  "  --threshold F          relative slow down of a regression, 0.05\n";
+
+static const char* kBundledImages[] = {
+  "test_image.bmp", "test_image1.bmp", "test_image2.bmp", "test_image3.bmp",
+  "test_image4.bmp", "test_image5.bmp"};
+
+struct BenchOptions {
+  std::vector<std::string> types;
+  std::vector<std::string> algorithms;
+  std::vector<int> radii;
+  std::vector<std::string> images;
+  std::vector<int> sizes;
+  std::vector<std::string> caches;
+  int warmup;
+  int runs;
+  int flush_mb;
+  double max_case_seconds;
+  std::string cpu_target;
+  bool perf;
+  std::string json;
+  std::string baseline;
+  double threshold;
+};
+
+// Return false on an unknown option, printing the usage.
+static bool ParseOptions(int argc, char** argv, BenchOptions* options) {
+  options->types = SplitList("uchar,float,double");
+  options->algorithms = SplitList("median_uchar_histogram,median_histogram,"
+    "median_local_sort,median_auto,mean");
+  options->radii = SplitIntList("1,2,4,8,16");
+  options->images.assign(kBundledImages, kBundledImages +
+    sizeof(kBundledImages) / sizeof(kBundledImages[0]));
+  options->sizes = SplitIntList("512,2048");
+  options->caches = SplitList("warm,cold");
+  options->warmup = 2;
+  options->runs = 15;
+  options->flush_mb = 64;
+  options->max_case_seconds = 10;
+  options->perf = false;
+  options->json = "image_filter_bench.json";
+  options->threshold = 0.05;
+  for (int k = 1; k < argc; k++) {
+    std::string key = argv[k];
+    if ("--perf" == key) {
+      options->perf = true;
+      continue;
+    }
+    if ("--help" == key || "-h" == key || k + 1 >= argc) {
+      fputs(kUsage, "--help" == key || "-h" == key ? stdout : stderr);
+      return false;
+    }
+    std::string value = argv[++k];
+    if ("--types" == key) {
+      options->types = SplitList(value);
+    } else if ("--algorithms" == key) {
+      options->algorithms = SplitList(value);
+    } else if ("--radii" == key) {
+      options->radii = SplitIntList(value);
+    } else if ("--images" == key) {
+      options->images = "none" == value ? std::vector<std::string>() :
+        SplitList(value);
+    } else if ("--sizes" == key) {
+      options->sizes = SplitIntList(value);
+    } else if ("--cache" == key) {
+      options->caches = SplitList(value);
+    } else if ("--warmup" == key) {
+      options->warmup = atoi(value.c_str());
+    } else if ("--runs" == key) {
+      options->runs = atoi(value.c_str());
+    } else if ("--flush-mb" == key) {
+      options->flush_mb = atoi(value.c_str());
+    } else if ("--max-case-seconds" == key) {
+      options->max_case_seconds = atof(value.c_str());
+    } else if ("--cpu-target" == key) {
+      options->cpu_target = value;
+    } else if ("--json" == key) {
+      options->json = value;
+    } else if ("--baseline" == key) {
+      options->baseline = value;
+    } else if ("--threshold" == key) {
+      options->threshold = atof(value.c_str());
+    } else {
+      fprintf(stderr, "Unknown option %s\n%s", key.c_str(), kUsage);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Smooth ramps with noise, the same for every run.
+static void MakeSyntheticImage(int size, BenchImage* image) {
+  char name[64];
+  sprintf(name, "synthetic_%dx%d", size, size);
+  image->name = name;
+  image->width = size;
+  image->height = size;
+  image->pixels.resize(static_cast<size_t>(size) * size);
+  unsigned int seed = 12345;
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      seed = seed * 1664525u + 1013904223u;
+      int value = (i + 2 * j) * 160 / (3 * size) + 48 +
+        static_cast<int>(seed >> 27) - 16;
+      image->pixels[static_cast<size_t>(i) * size + j] =
+        static_cast<unsigned char>(std::min(std::max(value, 0), 255));
+    }
+  }
+}
+
+/**
+* One algorithm of the sweep for a type, with its workspace reserved once
+* so the timed runs measure the filter and not the allocator.
+*/
+template<typename Dtype>
+class BenchFilter
+{
+public:
+  BenchFilter(const std::string& algorithm, int radius) :
+    algorithm_(algorithm), median_(radius), uchar_median_(radius),
+    auto_median_(radius), mean_(radius) {}
+  bool IsSupported() const {
+    return "median_histogram" == algorithm_ ||
+      "median_local_sort" == algorithm_ || "median_auto" == algorithm_ ||
+      "mean" == algorithm_ || ("median_uchar_histogram" == algorithm_ &&
+      std::is_same<Dtype, unsigned char>::value);
+  }
+  bool Reserve(int width, int height) {
+    size_t size = 0;
+    if ("mean" == algorithm_) {
+      size = mean_.GetWorkspaceSize(width, height);
+    } else if ("median_uchar_histogram" == algorithm_) {
+      size = uchar_median_.GetWorkspaceSize(width, height);
+    } else if ("median_auto" != algorithm_) {
+      size = median_.GetWorkspaceSize(width, height);
+    }
+    return workspace_.Reserve(size);
+  }
+  bool Run(const Dtype* src, Dtype* dst, int width, int height) const {
+    if ("mean" == algorithm_) {
+      return mean_.Filter(src, dst, width, height, &workspace_);
+    } else if ("median_histogram" == algorithm_) {
+      return median_.FilterByHistogram(src, dst, width, height, &workspace_);
+    } else if ("median_local_sort" == algorithm_) {
+      return median_.FilterByLocalSort(src, dst, width, height, &workspace_);
+    } else if ("median_auto" == algorithm_) {
+      return auto_median_.Filter(src, dst, width, height);
+    }
+    // Only reached for unsigned char, see IsSupported.
+    return uchar_median_.FilterByHistogram(
+      reinterpret_cast<const unsigned char*>(src),
+      reinterpret_cast<unsigned char*>(dst), width, height, &workspace_);
+  }
+private:
+  std::string algorithm_;
+  MedianFilter<Dtype> median_;
+  UcharMedianFilter uchar_median_;
+  AutoMedianFilter<Dtype> auto_median_;
+  MeanFilter<Dtype> mean_;
+  mutable FilterWorkspace workspace_;
+  DISABLE_COPY_AND_ASSIGN(BenchFilter);
+};
+
+// Median time of the last size run for each case name without the image,
+// to predict the time of a larger size.
+struct CaseHistory {
+  double pixels;
+  double seconds;
+};
+
+// Run every case of an image for one type, return false if a filter failed.
+template<typename Dtype>
+static bool RunImageCases(const BenchImage& image, const char* type,
+  const BenchOptions& options, CacheFlusher* flusher,
+  PerfCounters* counters, std::map<std::string, CaseHistory>* history,
+  std::vector<BenchResult>* results) {
+  int width = image.width;
+  int height = image.height;
+  double pixels = static_cast<double>(width) * height;
+  std::vector<Dtype> src(image.pixels.begin(), image.pixels.end());
+  std::vector<Dtype> dst(src.size());
+  for (size_t a = 0; a < options.algorithms.size(); a++) {
+    for (size_t r = 0; r < options.radii.size(); r++) {
+      int radius = options.radii[r];
+      BenchFilter<Dtype> filter(options.algorithms[a], radius);
+      if (!filter.IsSupported() || radius < 1 ||
+        radius >= std::min(width, height)) {
+        continue;
+      }
+      for (size_t c = 0; c < options.caches.size(); c++) {
+        BenchResult result;
+        result.algorithm = options.algorithms[a];
+        result.type = type;
+        result.image = image.name;
+        result.cache = options.caches[c];
+        result.target = GetCpuTargetName(GetCpuTarget());
+        result.radius = radius;
+        result.width = width;
+        result.height = height;
+        result.elements = 0;
+        result.bytes = 0;
+        char radius_name[16];
+        sprintf(radius_name, "r%d", radius);
+        std::string key = result.algorithm + "/" + type + "/" + radius_name;
+        result.name = key + "/" + image.name + "/" + result.cache;
+        key += "/" + result.cache;
+        std::map<std::string, CaseHistory>::const_iterator last =
+          history->find(key);
+        if (history->end() != last && last->second.seconds * pixels /
+          last->second.pixels > options.max_case_seconds) {
+          printf("%-56s skipped, predicted over %g s\n", result.name.c_str(),
+            options.max_case_seconds);
+          continue;
+        }
+        if (!filter.Reserve(width, height)) {
+          fprintf(stderr, "%s: out of memory\n", result.name.c_str());
+          return false;
+        }
+        bool ok = true;
+        std::function<void()> run = [&]() {
+          ok = filter.Run(&src[0], &dst[0], width, height) && ok;
+        };
+        std::function<void()> prepare;
+        if ("cold" == result.cache) {
+          prepare = [flusher]() { flusher->Flush(); };
+        }
+        result.stats = MeasureRuns(run, prepare, options.warmup,
+          options.runs, options.max_case_seconds, counters);
+        ClearPerfCounts(&result.counts);
+        if (nullptr != counters) {
+          result.counts = counters->GetMeanCounts();
+        }
+        if (!ok) {
+          fprintf(stderr, "%s: filter failed\n", result.name.c_str());
+          return false;
+        }
+        CaseHistory& case_history = (*history)[key];
+        if (case_history.pixels <= pixels) {
+          case_history.pixels = pixels;
+          case_history.seconds = result.stats.median;
+        }
+        printf("%-56s median %10.4f ms  p95 %10.4f ms  mad %8.4f ms  "
+          "%4d runs  %9.2f Mpix/s\n", result.name.c_str(),
+          result.stats.median * 1e3, result.stats.p95 * 1e3,
+          result.stats.mad * 1e3, result.stats.runs,
+          pixels / result.stats.median * 1e-6);
+        if (nullptr != counters) {
+          printf("%-56s%s\n", "", FormatPerfCounts(result.counts, pixels,
+            "pixel", result.stats.median).c_str());
+        }
+        fflush(stdout);
+        results->push_back(result);
+      }
+    }
+  }
+  return true;
+}
+
+static bool ImagePixelsLess(const BenchImage& a, const BenchImage& b) {
+  return static_cast<double>(a.width) * a.height <
+    static_cast<double>(b.width) * b.height;
+}
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  if (!ParseOptions(argc, argv, &options)) {
+    return argc > 1 && (0 == strcmp(argv[1], "--help") ||
+      0 == strcmp(argv[1], "-h")) ? 0 : 1;
+  }
+  if (!options.cpu_target.empty()) {
+    CpuTarget target;
+    if (!ParseCpuTarget(options.cpu_target.c_str(), &target) ||
+      !SetCpuTarget(target)) {
+      fprintf(stderr, "Cpu target %s not supported\n",
+        options.cpu_target.c_str());
+      return 1;
+    }
+  }
+  std::vector<BenchImage> images;
+  for (size_t k = 0; k < options.images.size(); k++) {
+    BenchImage image;
+    if (!LoadBenchImage(options.images[k], &image)) {
+      fprintf(stderr, "Can not read %s\n", options.images[k].c_str());
+      return 1;
+    }
+    images.push_back(image);
+  }
+  for (size_t k = 0; k < options.sizes.size(); k++) {
+    BenchImage image;
+    MakeSyntheticImage(options.sizes[k], &image);
+    images.push_back(image);
+  }
+  // Smallest first, their times predict the cases too slow to run.
+  std::stable_sort(images.begin(), images.end(), ImagePixelsLess);
+
+  CacheFlusher flusher(static_cast<size_t>(options.flush_mb) << 20);
+  PerfCounters perf_counters;
+  PerfCounters* counters = nullptr;
+  if (options.perf) {
+    if (perf_counters.Open()) {
+      counters = &perf_counters;
+    } else {
+      fprintf(stderr, "No hardware counter can be opened, see "
+        "/proc/sys/kernel/perf_event_paranoid, timing only\n");
+    }
+  }
+  std::map<std::string, CaseHistory> history;
+  std::vector<BenchResult> results;
+  for (size_t i = 0; i < images.size(); i++) {
+    for (size_t t = 0; t < options.types.size(); t++) {
+      const std::string& type = options.types[t];
+      bool ok = true;
+      if ("uchar" == type) {
+        ok = RunImageCases<unsigned char>(images[i], "uchar", options,
+          &flusher, counters, &history, &results);
+      } else if ("float" == type) {
+        ok = RunImageCases<float>(images[i], "float", options, &flusher,
+          counters, &history, &results);
+      } else if ("double" == type) {
+        ok = RunImageCases<double>(images[i], "double", options, &flusher,
+          counters, &history, &results);
+      } else {
+        fprintf(stderr, "Unknown type %s\n", type.c_str());
+        return 1;
+      }
+      if (!ok) {
+        return 1;
+      }
+    }
+  }
+
+  std::map<std::string, std::string> host;
+  char number[32];
+  host["cpu_target"] = GetCpuTargetName(GetCpuTarget());
+  sprintf(number, "%u", std::thread::hardware_concurrency());
+  host["hardware_threads"] = number;
+#if defined(_MSC_VER)
+  sprintf(number, "msvc %d", _MSC_VER);
+  host["compiler"] = number;
+#elif defined(__clang__)
+  host["compiler"] = "clang " __clang_version__;
+#elif defined(__GNUC__)
+  host["compiler"] = "gcc " __VERSION__;
+#endif
+  sprintf(number, "%lld", static_cast<long long>(time(nullptr)));
+  host["timestamp"] = number;
+  if (!options.json.empty() &&
+    !WriteBenchJson(options.json, host, results)) {
+    fprintf(stderr, "Can not write %s\n", options.json.c_str());
+    return 1;
+  }
+  if (!options.baseline.empty()) {
+    std::map<std::string, BenchStats> baseline;
+    if (!LoadBenchBaseline(options.baseline, &baseline)) {
+      fprintf(stderr, "Can not read %s\n", options.baseline.c_str());
+      return 1;
+    }
+    int regressions = CompareWithBaseline(results, baseline,
+      options.threshold);
+    printf("%d regressions over %g%%\n", regressions,
+      options.threshold * 100);
+    if (regressions > 0) {
+      return 2;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,634 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "image_filter/border.h"
+#include "image_filter/cpu_dispatch.h"
+#include "image_filter/median_filter.h"
+#include "image_filter/median_filter_internal.h"
+#include "image_filter/transpose.h"
+#include "image_filter_bench/benchmark.h"
+
+static const char* kUsage =
+  "Usage: image_filter_micro_bench [options]\n"
+  "Times the inner loops of the filters on the windows of a real image.\n"
+  "  --image PATH           bmp or pgm file, also looked up in the data\n"
+  "                         directory, test_image1.bmp\n"
+  "  --kernels LIST         add_sub_hist,get_sums_of_hist,\n"
+  "                         get_hist_medium_value,update_hist,quick_sort,\n"
+  "                         binary_find,replace_sorted_buffer,update_sum,\n"
+  "                         border_pixel,transpose\n"
+  "  --types LIST           uchar,float,double, of the sort, sum, border\n"
+  "                         and transpose kernels\n"
+  "  --radii LIST           1,4,16\n"
+  "  --targets LIST         cpu targets of the dispatched kernels, default\n"
+  "                         all the supported ones\n"
+  "  --warmup N             untimed runs of a case, 3\n"
+  "  --runs N               timed runs of a case, 21\n"
+  "  --min-run-seconds S    a run repeats the kernel for at least S, 0.002\n"
+  "  --perf                 count cycles, instructions, cache and branch\n"
+  "                         misses of the timed runs, Linux only\n"
+  "  --json PATH            results, image_filter_micro_bench.json\n"
+  "  --baseline PATH        results to compare with, exit 2 on regression\n"
+  "  --threshold F          relative slow down of a regression, 0.05\n";
+
+struct MicroOptions {
+  std::string image;
+  std::vector<std::string> kernels;
+  std::vector<std::string> types;
+  std::vector<int> radii;
+  std::vector<CpuTarget> targets;
+  int warmup;
+  int runs;
+  double min_run_seconds;
+  bool perf;
+  // Open when perf is set and the host has the counters.
+  PerfCounters* counters;
+  std::string json;
+  std::string baseline;
+  double threshold;
+};
+
+// Keeps the results of the kernels alive.
+static volatile double g_sink = 0;
+
+// Return false on a bad option, printing the usage.
+static bool ParseOptions(int argc, char** argv, MicroOptions* options) {
+  options->image = "test_image1.bmp";
+  options->kernels = SplitList("add_sub_hist,get_sums_of_hist,"
+    "get_hist_medium_value,update_hist,quick_sort,binary_find,"
+    "replace_sorted_buffer,update_sum,border_pixel,transpose");
+  options->types = SplitList("uchar,float,double");
+  options->radii = SplitIntList("1,4,16");
+  for (int t = CPU_TARGET_BASELINE; t < CPU_TARGET_NUM; t++) {
+    if (IsCpuTargetSupported(static_cast<CpuTarget>(t))) {
+      options->targets.push_back(static_cast<CpuTarget>(t));
+    }
+  }
+  options->warmup = 3;
+  options->runs = 21;
+  options->min_run_seconds = 0.002;
+  options->perf = false;
+  options->counters = nullptr;
+  options->json = "image_filter_micro_bench.json";
+  options->threshold = 0.05;
+  for (int k = 1; k < argc; k++) {
+    std::string key = argv[k];
+    if ("--perf" == key) {
+      options->perf = true;
+      continue;
+    }
+    if ("--help" == key || "-h" == key || k + 1 >= argc) {
+      fputs(kUsage, "--help" == key || "-h" == key ? stdout : stderr);
+      return false;
+    }
+    std::string value = argv[++k];
+    if ("--image" == key) {
+      options->image = value;
+    } else if ("--kernels" == key) {
+      options->kernels = SplitList(value);
+    } else if ("--types" == key) {
+      options->types = SplitList(value);
+    } else if ("--radii" == key) {
+      options->radii = SplitIntList(value);
+    } else if ("--targets" == key) {
+      std::vector<std::string> names = SplitList(value);
+      options->targets.clear();
+      for (size_t n = 0; n < names.size(); n++) {
+        CpuTarget target;
+        if (!ParseCpuTarget(names[n].c_str(), &target) ||
+          !IsCpuTargetSupported(target)) {
+          fprintf(stderr, "Cpu target %s not supported\n", names[n].c_str());
+          return false;
+        }
+        options->targets.push_back(target);
+      }
+    } else if ("--warmup" == key) {
+      options->warmup = atoi(value.c_str());
+    } else if ("--runs" == key) {
+      options->runs = atoi(value.c_str());
+    } else if ("--min-run-seconds" == key) {
+      options->min_run_seconds = atof(value.c_str());
+    } else if ("--json" == key) {
+      options->json = value;
+    } else if ("--baseline" == key) {
+      options->baseline = value;
+    } else if ("--threshold" == key) {
+      options->threshold = atof(value.c_str());
+    } else {
+      fprintf(stderr, "Unknown option %s\n%s", key.c_str(), kUsage);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool HasKernel(const MicroOptions& options, const char* kernel) {
+  return options.kernels.end() !=
+    std::find(options.kernels.begin(), options.kernels.end(), kernel);
+}
+
+/**
+* Time a kernel case and keep its result. run processes elements values
+* and bytes bytes, it is repeated within a timed run for at least
+* min_run_seconds so the clock resolution does not matter. target is empty
+* for the kernels that are not dispatched.
+*/
+static void RunMicroCase(const char* kernel, const char* type, int radius,
+  const char* target, const BenchImage& image, double elements,
+  double bytes, const std::function<void()>& run,
+  const MicroOptions& options, std::vector<BenchResult>* results) {
+  double start = GetMonotonicSeconds();
+  run();
+  double once = GetMonotonicSeconds() - start;
+  int repeats = once > 0 ? static_cast<int>(
+    ceil(options.min_run_seconds / once)) : 1000;
+  repeats = std::max(repeats, 1);
+  std::function<void()> repeated = [&]() {
+    for (int k = 0; k < repeats; k++) {
+      run();
+    }
+  };
+  BenchResult result;
+  char name[128];
+  sprintf(name, "%s/%s/r%d%s%s", kernel, type, radius, *target ? "/" : "",
+    target);
+  result.name = name;
+  result.algorithm = kernel;
+  result.type = type;
+  result.image = image.name;
+  result.cache = "warm";
+  result.target = target;
+  result.radius = radius;
+  result.width = image.width;
+  result.height = image.height;
+  result.elements = elements;
+  result.bytes = bytes;
+  // Times of one pass of the kernel, comparable whatever the repeats.
+  BenchStats& stats = result.stats;
+  stats = MeasureRuns(repeated, std::function<void()>(), options.warmup,
+    options.runs, 1e9, options.counters);
+  ClearPerfCounts(&result.counts);
+  if (nullptr != options.counters) {
+    result.counts = options.counters->GetMeanCounts();
+    for (int k = 0; k < PERF_EVENT_NUM; k++) {
+      if (result.counts.values[k] >= 0) {
+        result.counts.values[k] /= repeats;
+      }
+    }
+  }
+  stats.median /= repeats;
+  stats.p95 /= repeats;
+  stats.mad /= repeats;
+  stats.min /= repeats;
+  stats.max /= repeats;
+  double nanoseconds = stats.median * 1e9;
+  printf("%-44s %11.3f us  %8.3f elements/ns  %8.3f bytes/ns  mad %5.1f%%\n",
+    name, nanoseconds * 1e-3, elements / nanoseconds, bytes / nanoseconds,
+    stats.median > 0 ? stats.mad / stats.median * 100 : 0.0);
+  double cycles = result.counts.values[PERF_EVENT_CYCLES];
+  if (nullptr != options.counters) {
+    printf("%-44s%s", "", FormatPerfCounts(result.counts, elements,
+      "element", stats.median).c_str());
+    if (cycles > 0) {
+      printf("  %.3g bytes/cycle", bytes / cycles);
+    }
+    printf("\n");
+  }
+  fflush(stdout);
+  results->push_back(result);
+}
+
+// Row y of the image as GetWindowRows takes it, the default border.
+static int GetBorderRow(int y, int height) {
+  return BorderInterpolate(y, height, BORDER_REFLECT_101);
+}
+
+/**
+* The histogram kernels of the unsigned char median filter, on the col
+* histograms of the window rows around the middle row of the image, for
+* each cpu target.
+*/
+static void RunHistogramCases(const BenchImage& image, int radius,
+  const MicroOptions& options, std::vector<BenchResult>* results) {
+  int width = image.width;
+  int height = image.height;
+  int core_size = radius * 2 + 1;
+  int y = height / 2;
+  std::vector<int> col_data(static_cast<size_t>(width) * GRAY_LEVEL_MAX);
+  for (int m = -radius; m <= radius; m++) {
+    const unsigned char* row =
+      &image.pixels[static_cast<size_t>(GetBorderRow(y + m, height)) * width];
+    for (int x = 0; x < width; x++) {
+      col_data[static_cast<size_t>(x) * GRAY_LEVEL_MAX + row[x]]++;
+    }
+  }
+  // Col histograms from x = -radius to width + radius, as GetColHist takes
+  // them.
+  std::vector<int*> cols(width + 2 * radius);
+  for (int x = -radius; x < width + radius; x++) {
+    cols[x + radius] = &col_data[static_cast<size_t>(
+      BorderInterpolate(x, width, BORDER_REFLECT_101)) * GRAY_LEVEL_MAX];
+  }
+  // Window histograms of every x of the row, the inputs of the rank search.
+  std::vector<int> windows(static_cast<size_t>(width) * GRAY_LEVEL_MAX, 0);
+  for (int x = 0; x < width; x++) {
+    int* his = &windows[static_cast<size_t>(x) * GRAY_LEVEL_MAX];
+    for (int k = 0; k < core_size; k++) {
+      for (int v = 0; v < GRAY_LEVEL_MAX; v++) {
+        his[v] += cols[x + k][v];
+      }
+    }
+  }
+  int stop_point = static_cast<int>(core_size * core_size * 0.5f);
+  double bins_scanned = 0;
+  for (int x = 0; x < width; x++) {
+    const int* his = &windows[static_cast<size_t>(x) * GRAY_LEVEL_MAX];
+    int sum = 0;
+    int v = 0;
+    while (v < GRAY_LEVEL_MAX && (sum += his[v]) <= stop_point) {
+      v++;
+    }
+    bins_scanned += v + 1;
+  }
+  std::vector<int> his(GRAY_LEVEL_MAX);
+  double hist_bytes = sizeof(int) * GRAY_LEVEL_MAX;
+  for (size_t t = 0; t < options.targets.size(); t++) {
+    SetCpuTarget(options.targets[t]);
+    const FilterKernels& kernels = GetFilterKernels();
+    const char* target = GetCpuTargetName(options.targets[t]);
+    if (HasKernel(options, "add_sub_hist")) {
+      RunMicroCase("add_sub_hist", "int", radius, target, image,
+        static_cast<double>(width - 1) * GRAY_LEVEL_MAX,
+        (width - 1) * hist_bytes * 4, [&]() {
+        memcpy(&his[0], &windows[0], sizeof(int) * GRAY_LEVEL_MAX);
+        for (int x = 1; x < width; x++) {
+          kernels.add_sub_hist(&his[0], cols[x + 2 * radius], cols[x - 1],
+            GRAY_LEVEL_MAX);
+        }
+        g_sink = g_sink + his[GRAY_LEVEL_MAX / 2];
+      }, options, results);
+    }
+    if (HasKernel(options, "get_sums_of_hist")) {
+      RunMicroCase("get_sums_of_hist", "int", radius, target, image,
+        static_cast<double>(width) * core_size * GRAY_LEVEL_MAX,
+        width * (core_size + 2) * hist_bytes, [&]() {
+        for (int x = 0; x < width; x++) {
+          memset(&his[0], 0, sizeof(int) * GRAY_LEVEL_MAX);
+          GetSumsOfHist(kernels, &his[0], &cols[0], x, core_size);
+        }
+        g_sink = g_sink + his[GRAY_LEVEL_MAX / 2];
+      }, options, results);
+    }
+    if (HasKernel(options, "get_hist_medium_value")) {
+      RunMicroCase("get_hist_medium_value", "int", radius, target, image,
+        bins_scanned, bins_scanned * sizeof(int), [&]() {
+        int sum = 0;
+        for (int x = 0; x < width; x++) {
+          sum += GetHistMediumValue(kernels,
+            &windows[static_cast<size_t>(x) * GRAY_LEVEL_MAX],
+            GRAY_LEVEL_MAX, radius, 0.5f);
+        }
+        g_sink = g_sink + sum;
+      }, options, results);
+    }
+  }
+  SetCpuTarget(options.targets.back());
+  if (!HasKernel(options, "update_hist")) {
+    return;
+  }
+  // The ordinal image of MedianFilter::FilterByHistogram, the ranks of the
+  // values among the distinct ones.
+  int ranks[GRAY_LEVEL_MAX];
+  int unique_size = 0;
+  for (int v = 0; v < GRAY_LEVEL_MAX; v++) {
+    ranks[v] = unique_size;
+    if (image.pixels.end() !=
+      std::find(image.pixels.begin(), image.pixels.end(), v)) {
+      unique_size++;
+    }
+  }
+  std::vector<int> ordinal(static_cast<size_t>(width) * core_size);
+  std::vector<const int*> rows(core_size);
+  for (int m = 0; m < core_size; m++) {
+    const unsigned char* row = &image.pixels[static_cast<size_t>(
+      GetBorderRow(y - radius + m, height)) * width];
+    for (int x = 0; x < width; x++) {
+      ordinal[m * width + x] = ranks[row[x]];
+    }
+    rows[m] = &ordinal[m * width];
+  }
+  std::vector<int> init_his(unique_size, 0);
+  for (int m = 0; m < core_size; m++) {
+    for (int x = -radius; x <= radius; x++) {
+      init_his[rows[m][BorderInterpolate(x, width, BORDER_REFLECT_101)]]++;
+    }
+  }
+  std::vector<int> ordinal_his(unique_size);
+  double updates = 2.0 * core_size * (width - 1);
+  RunMicroCase("update_hist", "int", radius, "", image, updates,
+    updates * 2 * sizeof(int), [&]() {
+    memcpy(&ordinal_his[0], &init_his[0], sizeof(int) * unique_size);
+    for (int x = 1; x < width; x++) {
+      UpdateHist<int>(&rows[0], &ordinal_his[0], radius, x, width, 0, 1,
+        BORDER_REFLECT_101, 0);
+    }
+    g_sink = g_sink + ordinal_his[unique_size / 2];
+  }, options, results);
+}
+
+/**
+* The kernels of MedianFilter::FilterByLocalSort on the windows of the
+* middle row of the image.
+*/
+template<typename Dtype>
+static void RunSortCases(const BenchImage& image, const char* type,
+  int radius, const MicroOptions& options,
+  std::vector<BenchResult>* results) {
+  int width = image.width;
+  int height = image.height;
+  int core_size = radius * 2 + 1;
+  int wnd_size = core_size * core_size;
+  int y = height / 2;
+  std::vector<std::vector<Dtype> > rows(core_size);
+  for (int m = 0; m < core_size; m++) {
+    const unsigned char* row = &image.pixels[static_cast<size_t>(
+      GetBorderRow(y - radius + m, height)) * width];
+    rows[m].assign(row, row + width);
+  }
+  // The first window of every 16 cols, as GetRowMedianByLocalSort fills it.
+  int window_num = (width - 1) / 16 + 1;
+  std::vector<Dtype> windows(static_cast<size_t>(window_num) * wnd_size);
+  for (int w = 0; w < window_num; w++) {
+    for (int m = 0; m < core_size; m++) {
+      for (int k = 0; k < core_size; k++) {
+        windows[w * wnd_size + m * core_size + k] = rows[m][
+          BorderInterpolate(w * 16 + k - radius, width, BORDER_REFLECT_101)];
+      }
+    }
+  }
+  std::vector<Dtype> sorted(windows);
+  for (int w = 0; w < window_num; w++) {
+    QuickSort(&sorted[w * wnd_size], 0, wnd_size - 1);
+  }
+  std::vector<Dtype> buffer(wnd_size);
+  double values = static_cast<double>(window_num) * wnd_size;
+  if (HasKernel(options, "quick_sort")) {
+    RunMicroCase("quick_sort", type, radius, "", image, values,
+      values * sizeof(Dtype), [&]() {
+      for (int w = 0; w < window_num; w++) {
+        memcpy(&buffer[0], &windows[w * wnd_size], sizeof(Dtype) * wnd_size);
+        QuickSort(&buffer[0], 0, wnd_size - 1);
+      }
+      g_sink = g_sink + buffer[wnd_size / 2];
+    }, options, results);
+  }
+  if (HasKernel(options, "binary_find")) {
+    RunMicroCase("binary_find", type, radius, "", image, values,
+      values * sizeof(Dtype), [&]() {
+      int sum = 0;
+      for (int w = 0; w < window_num; w++) {
+        Dtype* window = &sorted[w * wnd_size];
+        for (int k = 0; k < wnd_size; k++) {
+          sum += BinaryFind(window, 0, wnd_size, windows[w * wnd_size + k]);
+        }
+      }
+      g_sink = g_sink + sum;
+    }, options, results);
+  }
+  if (!HasKernel(options, "replace_sorted_buffer") || width <= core_size) {
+    return;
+  }
+  // Slide the window of the first col along the row once, keeping where
+  // each value left, then time the replacements alone.
+  std::vector<int> positions;
+  std::vector<Dtype> added;
+  memcpy(&buffer[0], &sorted[0], sizeof(Dtype) * wnd_size);
+  for (int x = 1; x < width; x++) {
+    int x_sub = BorderInterpolate(x - radius - 1, width, BORDER_REFLECT_101);
+    int x_add = BorderInterpolate(x + radius, width, BORDER_REFLECT_101);
+    for (int m = 0; m < core_size; m++) {
+      int pos = BinaryFind(&buffer[0], 0, wnd_size, rows[m][x_sub]);
+      ReplaceSortedBuffer(&buffer[0], pos, radius, rows[m][x_add]);
+      positions.push_back(pos);
+      added.push_back(rows[m][x_add]);
+    }
+  }
+  int replace_num = static_cast<int>(positions.size());
+  RunMicroCase("replace_sorted_buffer", type, radius, "", image,
+    replace_num, replace_num * sizeof(Dtype), [&]() {
+    memcpy(&buffer[0], &sorted[0], sizeof(Dtype) * wnd_size);
+    for (int k = 0; k < replace_num; k++) {
+      ReplaceSortedBuffer(&buffer[0], positions[k], radius, added[k]);
+    }
+    g_sink = g_sink + buffer[wnd_size / 2];
+  }, options, results);
+}
+
+// UpdateSum of mean_filter.cpp for each type.
+inline void UpdateSum(const FilterKernels& kernels,
+  const unsigned char* row_sub, const unsigned char* row_add,
+  double* sum_cols, int width) {
+  kernels.update_sum_uchar(row_sub, row_add, sum_cols, width);
+}
+
+inline void UpdateSum(const FilterKernels& kernels, const float* row_sub,
+  const float* row_add, double* sum_cols, int width) {
+  kernels.update_sum_float(row_sub, row_add, sum_cols, width);
+}
+
+inline void UpdateSum(const FilterKernels& kernels, const double* row_sub,
+  const double* row_add, double* sum_cols, int width) {
+  kernels.update_sum_double(row_sub, row_add, sum_cols, width);
+}
+
+/**
+* The column sums of the mean filter moving down the whole image, for each
+* cpu target, and the pixels BorderPixel takes outside the image cols.
+*/
+template<typename Dtype>
+static void RunRowCases(const BenchImage& image, const char* type,
+  int radius, const MicroOptions& options,
+  std::vector<BenchResult>* results) {
+  int width = image.width;
+  int height = image.height;
+  int core_size = radius * 2 + 1;
+  std::vector<Dtype> pixels(image.pixels.begin(), image.pixels.end());
+  std::vector<double> sum_cols(width, 0);
+  if (HasKernel(options, "update_sum") && height > core_size) {
+    double values = static_cast<double>(width) * (height - core_size);
+    for (size_t t = 0; t < options.targets.size(); t++) {
+      SetCpuTarget(options.targets[t]);
+      const FilterKernels& kernels = GetFilterKernels();
+      RunMicroCase("update_sum", type, radius,
+        GetCpuTargetName(options.targets[t]), image, values,
+        values * (2 * sizeof(Dtype) + 2 * sizeof(double)), [&]() {
+        for (int i = core_size; i < height; i++) {
+          UpdateSum(kernels, &pixels[static_cast<size_t>(i - core_size) *
+            width], &pixels[static_cast<size_t>(i) * width], &sum_cols[0],
+            width);
+        }
+        g_sink = g_sink + sum_cols[width / 2];
+      }, options, results);
+    }
+    SetCpuTarget(options.targets.back());
+  }
+  if (!HasKernel(options, "border_pixel")) {
+    return;
+  }
+  static const BorderType kBorders[] = {
+    BORDER_REFLECT_101, BORDER_REPLICATE, BORDER_CONSTANT};
+  static const char* kBorderNames[] = {
+    "border_pixel_reflect_101", "border_pixel_replicate",
+    "border_pixel_constant"};
+  double values = 2.0 * radius * height;
+  for (int b = 0; b < 3; b++) {
+    BorderType border = kBorders[b];
+    RunMicroCase(kBorderNames[b], type, radius, "", image, values,
+      values * sizeof(Dtype), [&]() {
+      double sum = 0;
+      for (int i = 0; i < height; i++) {
+        const Dtype* row = &pixels[static_cast<size_t>(i) * width];
+        for (int x = -radius; x < 0; x++) {
+          sum += BorderPixel(row, x, width, 1, border, Dtype());
+        }
+        for (int x = width; x < width + radius; x++) {
+          sum += BorderPixel(row, x, width, 1, border, Dtype());
+        }
+      }
+      g_sink = g_sink + sum;
+    }, options, results);
+  }
+}
+
+/**
+* TransposeImage of the whole image against the pixel by pixel transpose
+* it replaces, transpose_naive. The radius of the cases is 0.
+*/
+template<typename Dtype>
+static void RunTransposeCases(const BenchImage& image, const char* type,
+  const MicroOptions& options, std::vector<BenchResult>* results) {
+  if (!HasKernel(options, "transpose")) {
+    return;
+  }
+  int width = image.width;
+  int height = image.height;
+  std::vector<Dtype> pixels(image.pixels.begin(), image.pixels.end());
+  std::vector<Dtype> transposed(pixels.size());
+  double values = static_cast<double>(width) * height;
+  RunMicroCase("transpose_naive", type, 0, "", image, values,
+    values * 2 * sizeof(Dtype), [&]() {
+    for (int i = 0; i < width; i++) {
+      Dtype* dst_row = &transposed[static_cast<size_t>(i) * height];
+      for (int j = 0; j < height; j++) {
+        dst_row[j] = pixels[static_cast<size_t>(j) * width + i];
+      }
+    }
+    g_sink = g_sink + transposed[transposed.size() / 2];
+  }, options, results);
+  RunMicroCase("transpose", type, 0, "", image, values,
+    values * 2 * sizeof(Dtype), [&]() {
+    TransposeImage(&pixels[0], width, &transposed[0], height, width, height,
+      1);
+    g_sink = g_sink + transposed[transposed.size() / 2];
+  }, options, results);
+}
+
+template<typename Dtype>
+static void RunTypeCases(const BenchImage& image, const char* type,
+  int radius, const MicroOptions& options,
+  std::vector<BenchResult>* results) {
+  RunSortCases<Dtype>(image, type, radius, options, results);
+  RunRowCases<Dtype>(image, type, radius, options, results);
+}
+
+int main(int argc, char** argv) {
+  MicroOptions options;
+  if (!ParseOptions(argc, argv, &options)) {
+    return argc > 1 && (0 == strcmp(argv[1], "--help") ||
+      0 == strcmp(argv[1], "-h")) ? 0 : 1;
+  }
+  PerfCounters perf_counters;
+  if (options.perf) {
+    if (perf_counters.Open()) {
+      options.counters = &perf_counters;
+    } else {
+      fprintf(stderr, "No hardware counter can be opened, see "
+        "/proc/sys/kernel/perf_event_paranoid, timing only\n");
+    }
+  }
+  if (options.targets.empty()) {
+    fprintf(stderr, "No cpu target\n");
+    return 1;
+  }
+  BenchImage image;
+  if (!LoadBenchImage(options.image, &image)) {
+    fprintf(stderr, "Can not read %s\n", options.image.c_str());
+    return 1;
+  }
+  std::vector<BenchResult> results;
+  for (size_t r = 0; r < options.radii.size(); r++) {
+    int radius = options.radii[r];
+    if (radius < 1 || radius >= std::min(image.width, image.height)) {
+      continue;
+    }
+    RunHistogramCases(image, radius, options, &results);
+    for (size_t t = 0; t < options.types.size(); t++) {
+      const std::string& type = options.types[t];
+      if ("uchar" == type) {
+        RunTypeCases<unsigned char>(image, "uchar", radius, options,
+          &results);
+      } else if ("float" == type) {
+        RunTypeCases<float>(image, "float", radius, options, &results);
+      } else if ("double" == type) {
+        RunTypeCases<double>(image, "double", radius, options, &results);
+      } else {
+        fprintf(stderr, "Unknown type %s\n", type.c_str());
+        return 1;
+      }
+    }
+  }
+
+  for (size_t t = 0; t < options.types.size(); t++) {
+    const std::string& type = options.types[t];
+    if ("uchar" == type) {
+      RunTransposeCases<unsigned char>(image, "uchar", options, &results);
+    } else if ("float" == type) {
+      RunTransposeCases<float>(image, "float", options, &results);
+    } else {
+      RunTransposeCases<double>(image, "double", options, &results);
+    }
+  }
+
+  std::map<std::string, std::string> host;
+  char number[32];
+  host["cpu_target"] = GetCpuTargetName(GetSupportedCpuTarget());
+  sprintf(number, "%lld", static_cast<long long>(time(nullptr)));
+  host["timestamp"] = number;
+  if (!options.json.empty() &&
+    !WriteBenchJson(options.json, host, results)) {
+    fprintf(stderr, "Can not write %s\n", options.json.c_str());
+    return 1;
+  }
+  if (!options.baseline.empty()) {
+    std::map<std::string, BenchStats> baseline;
+    if (!LoadBenchBaseline(options.baseline, &baseline)) {
+      fprintf(stderr, "Can not read %s\n", options.baseline.c_str());
+      return 1;
+    }
+    int regressions = CompareWithBaseline(results, baseline,
+      options.threshold);
+    printf("%d regressions over %g%%\n", regressions,
+      options.threshold * 100);
+    if (regressions > 0) {
+      return 2;
+    }
+  }
+  return 0;
+}
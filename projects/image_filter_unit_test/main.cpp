@@ -0,0 +1,1850 @@
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <future>
+#include <set>
+#include <string>
+#include <vector>
+#include "image_filter/auto_median_filter.h"
+#include "image_filter/cpu_dispatch.h"
+#include "image_filter/filter_graph.h"
+#include "image_filter/frame_batch.h"
+#include "image_filter/frame_pipeline.h"
+#include "image_filter/mapped_image.h"
+#include "image_filter/mean_filter.h"
+#include "image_filter/median_filter.h"
+#include "image_filter/packed_row.h"
+#include "image_filter/patch_batch.h"
+#include "image_filter/temporal_filter.h"
+#include "image_filter/tiled_file_filter.h"
+#include "image_filter/trace_recorder.h"
+#include "image_filter/transpose.h"
+#include "image_filter/volume_filter.h"
+
+// Unit tests of the filters, run by ctest without OpenCV. Every failed
+// check is printed and main returns 1 if any failed.
+// The filters are checked against a brute-force reference, which gathers
+// the whole window of every output pixel with BorderInterpolate and sorts
+// or sums it. The medians and the unsigned char means must be identical,
+// the float and double means equal up to rounding.
+
+// Engines of the 2D filters.
+enum Engine {
+  ENGINE_MEAN = 0,
+  ENGINE_MEDIAN_HISTOGRAM = 1,
+  ENGINE_MEDIAN_LOCAL_SORT = 2,
+  // UcharMedianFilter, only for unsigned char.
+  ENGINE_UCHAR_MEDIAN = 3
+};
+
+static const char* kEngineNames[] = {"mean", "median_histogram",
+  "median_local_sort", "uchar_median"};
+static const char* kBorderNames[] = {"reflect_101", "replicate",
+  "constant"};
+static const BorderType kBorders[] = {BORDER_REFLECT_101, BORDER_REPLICATE,
+  BORDER_CONSTANT};
+
+static int g_checks = 0;
+static int g_failures = 0;
+// Cpu target the engine checks run with, printed with their failures.
+static const char* g_target_name = nullptr;
+
+static void Check(bool ok, const std::string& name) {
+  g_checks++;
+  if (!ok) {
+    g_failures++;
+    if (nullptr != g_target_name) {
+      printf("FAILED: %s %s\n", g_target_name, name.c_str());
+    } else {
+      printf("FAILED: %s\n", name.c_str());
+    }
+  }
+}
+
+static const char* TypeName(unsigned char) { return "uchar"; }
+static const char* TypeName(float) { return "float"; }
+static const char* TypeName(double) { return "double"; }
+
+static int GetEngineNum(unsigned char) { return 4; }
+template<typename Dtype>
+static int GetEngineNum(Dtype) { return 3; }
+
+// Random values, a few of them repeated so the medians have ties.
+template<typename Dtype>
+static void FillRandom(Dtype* data, size_t size) {
+  for (size_t k = 0; k < size; k++) {
+    data[k] = static_cast<Dtype>(rand() % 256);
+  }
+}
+
+static void FillRandom(float* data, size_t size) {
+  for (size_t k = 0; k < size; k++) {
+    data[k] = static_cast<float>(rand() % 1000) / 7.0f;
+  }
+}
+
+static void FillRandom(double* data, size_t size) {
+  for (size_t k = 0; k < size; k++) {
+    data[k] = static_cast<double>(rand() % 1000) / 7.0;
+  }
+}
+
+// The mean as the filters convert it.
+static unsigned char GetMean(double sum, int count, unsigned char) {
+  return static_cast<unsigned char>(round(sum / count));
+}
+
+template<typename Dtype>
+static Dtype GetMean(double sum, int count, Dtype) {
+  return static_cast<Dtype>(sum / count);
+}
+
+// Median of the values of a window, the value of rank count * gate.
+template<typename Dtype>
+static Dtype GetMedian(std::vector<Dtype>* values, float gate) {
+  std::sort(values->begin(), values->end());
+  int count = static_cast<int>(values->size());
+  return (*values)[static_cast<int>(count * gate)];
+}
+
+template<typename Dtype>
+static Dtype Reduce(bool median, std::vector<Dtype>* values, float gate) {
+  if (median) {
+    return GetMedian(values, gate);
+  }
+  double sum = 0;
+  for (size_t k = 0; k < values->size(); k++) {
+    sum += (*values)[k];
+  }
+  return GetMean(sum, static_cast<int>(values->size()), Dtype());
+}
+
+/**
+* Brute-force 2D filter of a whole image with channels interleaved values
+* per pixel and row pitch src_pitch. host_dst is packed.
+*/
+template<typename Dtype>
+static void ReferenceFilter(bool median, const Dtype* host_src,
+  int src_pitch, Dtype* host_dst, int width, int height, int channels,
+  int radius, BorderType border, Dtype border_value, float gate) {
+  std::vector<Dtype> values;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      for (int c = 0; c < channels; c++) {
+        values.clear();
+        for (int m = y - radius; m <= y + radius; m++) {
+          for (int n = x - radius; n <= x + radius; n++) {
+            int i = BorderInterpolate(m, height, border);
+            int j = BorderInterpolate(n, width, border);
+            values.push_back(i < 0 || j < 0 ? border_value :
+              host_src[i * src_pitch + j * channels + c]);
+          }
+        }
+        host_dst[(y * width + x) * channels + c] =
+          Reduce(median, &values, gate);
+      }
+    }
+  }
+}
+
+// Brute-force 3D filter of a width by height by depth volume.
+template<typename Dtype>
+static void ReferenceFilter3D(bool median, const Dtype* host_src,
+  Dtype* host_dst, int width, int height, int depth, int radius,
+  BorderType border, Dtype border_value, float gate) {
+  std::vector<Dtype> values;
+  for (int z = 0; z < depth; z++) {
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        values.clear();
+        for (int l = z - radius; l <= z + radius; l++) {
+          for (int m = y - radius; m <= y + radius; m++) {
+            for (int n = x - radius; n <= x + radius; n++) {
+              int k = BorderInterpolate(l, depth, border);
+              int i = BorderInterpolate(m, height, border);
+              int j = BorderInterpolate(n, width, border);
+              values.push_back(k < 0 || i < 0 || j < 0 ? border_value :
+                host_src[(k * height + i) * width + j]);
+            }
+          }
+        }
+        host_dst[(z * height + y) * width + x] =
+          Reduce(median, &values, gate);
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+static bool IsNear(Dtype value, Dtype expected, bool exact) {
+  if (exact) {
+    return value == expected;
+  }
+  double diff = fabs(static_cast<double>(value) - expected);
+  return diff <= 1e-4 * (1 + fabs(static_cast<double>(expected)));
+}
+
+// Compare rows of row_size values of two images with pitches.
+template<typename Dtype>
+static bool IsSame(const Dtype* image, int pitch, const Dtype* expected,
+  int expected_pitch, int row_size, int rows, bool exact) {
+  for (int i = 0; i < rows; i++) {
+    for (int k = 0; k < row_size; k++) {
+      if (!IsNear(image[i * pitch + k], expected[i * expected_pitch + k],
+        exact)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// The means of float and double are only equal up to rounding.
+template<typename Dtype>
+static bool IsExact(bool median, Dtype) { return median; }
+static bool IsExact(bool, unsigned char) { return true; }
+
+// Settings shared by the engines of a check.
+template<typename Dtype>
+struct FilterSettings {
+  FilterSettings() : radius(1), channels(1), layout(LAYOUT_ROW_MAJOR),
+    border(BORDER_REFLECT_101), border_value(Dtype()), gate(0.5f),
+    stats(nullptr) {}
+  int radius;
+  int channels;
+  ImageLayout layout;
+  BorderType border;
+  Dtype border_value;
+  float gate;
+  FilterStats* stats;
+};
+
+template<typename Dtype>
+static void Apply(const FilterSettings<Dtype>& settings,
+  MeanFilter<Dtype>* filter) {
+  filter->set_radius(settings.radius);
+  filter->set_channel_num(settings.channels);
+  filter->set_layout(settings.layout);
+  filter->set_border(settings.border, settings.border_value);
+  filter->set_stats(settings.stats);
+}
+
+template<typename Dtype>
+static void Apply(const FilterSettings<Dtype>& settings,
+  MedianFilter<Dtype>* filter) {
+  filter->set_radius(settings.radius);
+  filter->set_channel_num(settings.channels);
+  filter->set_layout(settings.layout);
+  filter->set_border(settings.border, settings.border_value);
+  filter->set_gate(settings.gate);
+  filter->set_stats(settings.stats);
+}
+
+static void Apply(const FilterSettings<unsigned char>& settings,
+  UcharMedianFilter* filter) {
+  filter->set_radius(settings.radius);
+  filter->set_channel_num(settings.channels);
+  filter->set_layout(settings.layout);
+  filter->set_border(settings.border, settings.border_value);
+  filter->set_gate(settings.gate);
+  filter->set_stats(settings.stats);
+}
+
+// UcharMedianFilter only takes unsigned char.
+template<typename Dtype>
+static bool RunUcharMedian(const FilterSettings<Dtype>&, const Dtype*, int,
+  Dtype*, int, int, int, const ImageRect&, FilterWorkspace*) {
+  return false;
+}
+
+static bool RunUcharMedian(const FilterSettings<unsigned char>& settings,
+  const unsigned char* host_src, int src_pitch, unsigned char* host_dst,
+  int dst_pitch, int width, int height, const ImageRect& roi,
+  FilterWorkspace* workspace) {
+  UcharMedianFilter filter;
+  Apply(settings, &filter);
+  if (nullptr == workspace) {
+    return filter.FilterByHistogram(host_src, src_pitch, host_dst,
+      dst_pitch, width, height, roi);
+  }
+  return workspace->Reserve(filter.GetWorkspaceSize(width, height)) &&
+    filter.FilterByHistogram(host_src, src_pitch, host_dst, dst_pitch,
+    width, height, roi, workspace);
+}
+
+/**
+* Filter the roi of an image with an engine, through the roi overloads.
+* With a workspace, it is reserved first and the filter takes its buffers
+* from it.
+*/
+template<typename Dtype>
+static bool RunEngine(int engine, const FilterSettings<Dtype>& settings,
+  const Dtype* host_src, int src_pitch, Dtype* host_dst, int dst_pitch,
+  int width, int height, const ImageRect& roi,
+  FilterWorkspace* workspace = nullptr) {
+  if (ENGINE_UCHAR_MEDIAN == engine) {
+    return RunUcharMedian(settings, host_src, src_pitch, host_dst, dst_pitch,
+      width, height, roi, workspace);
+  }
+  if (ENGINE_MEAN == engine) {
+    MeanFilter<Dtype> filter;
+    Apply(settings, &filter);
+    if (nullptr == workspace) {
+      return filter.Filter(host_src, src_pitch, host_dst, dst_pitch, width,
+        height, roi);
+    }
+    return workspace->Reserve(filter.GetWorkspaceSize(width, height)) &&
+      filter.Filter(host_src, src_pitch, host_dst, dst_pitch, width, height,
+      roi, workspace);
+  }
+  MedianFilter<Dtype> filter;
+  Apply(settings, &filter);
+  if (nullptr != workspace &&
+    !workspace->Reserve(filter.GetWorkspaceSize(width, height))) {
+    return false;
+  }
+  if (ENGINE_MEDIAN_HISTOGRAM == engine) {
+    return nullptr == workspace ?
+      filter.FilterByHistogram(host_src, src_pitch, host_dst, dst_pitch,
+      width, height, roi) :
+      filter.FilterByHistogram(host_src, src_pitch, host_dst, dst_pitch,
+      width, height, roi, workspace);
+  }
+  return nullptr == workspace ?
+    filter.FilterByLocalSort(host_src, src_pitch, host_dst, dst_pitch,
+    width, height, roi) :
+    filter.FilterByLocalSort(host_src, src_pitch, host_dst, dst_pitch,
+    width, height, roi, workspace);
+}
+
+template<typename Dtype>
+static std::string GetCaseName(const char* test, int engine,
+  const FilterSettings<Dtype>& settings) {
+  return std::string(test) + " " + TypeName(Dtype()) + " " +
+    kEngineNames[engine] + " r" + std::to_string(settings.radius) + " c" +
+    std::to_string(settings.channels) + " " + kBorderNames[settings.border];
+}
+
+// Filter a roi of an image with pitches and compare it to the reference of
+// the whole image.
+template<typename Dtype>
+static bool CheckRoi(int engine, const FilterSettings<Dtype>& settings,
+  int width, int height, int pitch_pad, const ImageRect& roi) {
+  int channels = settings.channels;
+  int src_pitch = width * channels + pitch_pad;
+  int dst_pitch = roi.width * channels + pitch_pad;
+  std::vector<Dtype> src(static_cast<size_t>(src_pitch) * height);
+  std::vector<Dtype> dst(static_cast<size_t>(dst_pitch) * roi.height);
+  std::vector<Dtype> expected(static_cast<size_t>(width) * height * channels);
+  FillRandom(src.data(), src.size());
+  bool median = ENGINE_MEAN != engine;
+  ReferenceFilter(median, src.data(), src_pitch, expected.data(), width,
+    height, channels, settings.radius, settings.border,
+    settings.border_value, settings.gate);
+  if (!RunEngine(engine, settings, src.data(), src_pitch, dst.data(),
+    dst_pitch, width, height, roi)) {
+    return false;
+  }
+  int expected_pitch = width * channels;
+  return IsSame(dst.data(), dst_pitch,
+    expected.data() + roi.y * expected_pitch + roi.x * channels,
+    expected_pitch, roi.width * channels, roi.height,
+    IsExact(median, Dtype()));
+}
+
+// The stripes of the threads give the output of one thread, bit for bit
+// for unsigned char, in every border mode, with more threads than the
+// radius and stripes of a single row.
+static void TestThreads() {
+  const int sizes[][2] = {{61, 43}, {17, 5}};
+  const int thread_nums[] = {2, 3, 4, 7};
+  for (int b = 0; b < 3; b++) {
+    for (int s = 0; s < 2; s++) {
+      for (int radius = 1; radius <= 3; radius++) {
+        int width = sizes[s][0];
+        int height = sizes[s][1];
+        int channels = 3;
+        size_t size = static_cast<size_t>(width) * height * channels;
+        std::vector<unsigned char> src(size), dst(size), expected(size);
+        FillRandom(src.data(), size);
+        MeanFilter<unsigned char> filter(radius);
+        filter.set_channel_num(channels);
+        filter.set_border(kBorders[b], 90);
+        bool ok = filter.Filter(src.data(), expected.data(), width, height);
+        for (int t = 0; t < 4 && ok; t++) {
+          filter.set_thread_num(thread_nums[t]);
+          ok = filter.Filter(src.data(), dst.data(), width, height) &&
+            dst == expected;
+        }
+        Check(ok, "threads uchar mean r" + std::to_string(radius) + " " +
+          kBorderNames[b] + " " + std::to_string(width) + "x" +
+          std::to_string(height));
+      }
+    }
+  }
+}
+
+// The border modes at every radius, on a wide image and on one smaller
+// than the window, reflected several times.
+template<typename Dtype>
+static void TestBorders() {
+  const int sizes[][2] = {{23, 17}, {5, 4}};
+  for (int engine = 0; engine < GetEngineNum(Dtype()); engine++) {
+    for (int b = 0; b < 3; b++) {
+      for (int s = 0; s < 2; s++) {
+        for (int radius = 1; radius <= 3; radius++) {
+          FilterSettings<Dtype> settings;
+          settings.radius = radius;
+          settings.border = kBorders[b];
+          settings.border_value = static_cast<Dtype>(37);
+          int width = sizes[s][0];
+          int height = sizes[s][1];
+          Check(CheckRoi(engine, settings, width, height, 0,
+            ImageRect(0, 0, width, height)),
+            GetCaseName("border", engine, settings) + " " +
+            std::to_string(width) + "x" + std::to_string(height));
+        }
+      }
+    }
+  }
+}
+
+// Rois inside, at the edges and at the corners of an image with padded
+// rows, the pixels around the roi are read as context.
+template<typename Dtype>
+static void TestRoi() {
+  const ImageRect rois[] = {ImageRect(5, 4, 11, 9), ImageRect(0, 0, 7, 6),
+    ImageRect(20, 3, 9, 14), ImageRect(0, 15, 29, 6), ImageRect(14, 20, 1, 1)};
+  for (int engine = 0; engine < GetEngineNum(Dtype()); engine++) {
+    for (int b = 0; b < 3; b++) {
+      for (size_t r = 0; r < sizeof(rois) / sizeof(rois[0]); r++) {
+        FilterSettings<Dtype> settings;
+        settings.radius = 2;
+        settings.border = kBorders[b];
+        settings.border_value = static_cast<Dtype>(200);
+        Check(CheckRoi(engine, settings, 29, 21, 7, rois[r]),
+          GetCaseName("roi", engine, settings) + " roi " +
+          std::to_string(r));
+      }
+    }
+  }
+}
+
+// Interleaved channels, each one filtered on its own.
+template<typename Dtype>
+static void TestChannels() {
+  for (int engine = 0; engine < GetEngineNum(Dtype()); engine++) {
+    for (int channels = 1; channels <= CHANNEL_NUM_MAX; channels++) {
+      for (int b = 0; b < 3; b++) {
+        FilterSettings<Dtype> settings;
+        settings.radius = 2;
+        settings.channels = channels;
+        settings.border = kBorders[b];
+        settings.border_value = static_cast<Dtype>(9);
+        Check(CheckRoi(engine, settings, 19, 13, 3, ImageRect(0, 0, 19, 13)),
+          GetCaseName("channels", engine, settings));
+        Check(CheckRoi(engine, settings, 19, 13, 3, ImageRect(4, 2, 8, 7)),
+          GetCaseName("channels roi", engine, settings));
+      }
+    }
+  }
+}
+
+// A column-major image is the transposed row-major one, the output too.
+template<typename Dtype>
+static void TestColumnMajor() {
+  int width = 17;
+  int height = 11;
+  for (int engine = 0; engine < GetEngineNum(Dtype()); engine++) {
+    FilterSettings<Dtype> settings;
+    settings.radius = 2;
+    settings.channels = 2;
+    settings.layout = LAYOUT_COLUMN_MAJOR;
+    int channels = settings.channels;
+    size_t size = static_cast<size_t>(width) * height * channels;
+    std::vector<Dtype> src(size), dst(size), expected(size);
+    FillRandom(src.data(), size);
+    // The rows of the column-major image are its columns.
+    bool median = ENGINE_MEAN != engine;
+    ReferenceFilter(median, src.data(), height * channels, expected.data(),
+      height, width, channels, settings.radius, settings.border,
+      settings.border_value, settings.gate);
+    Check(RunEngine(engine, settings, src.data(), height * channels,
+      dst.data(), height * channels, width, height,
+      ImageRect(0, 0, width, height)) &&
+      IsSame(dst.data(), height * channels, expected.data(),
+      height * channels, height * channels, width, IsExact(median, Dtype())),
+      GetCaseName("column_major", engine, settings));
+  }
+}
+
+/**
+* The blocked transpose against a pixel by pixel one, on sizes below, at and
+* above the kernel and block sides, with padded rows. The padding of the
+* destination must be left as it is.
+*/
+template<typename Dtype>
+static void TestTranspose() {
+  const int sizes[][2] = {{1, 1}, {7, 3}, {8, 8}, {13, 9}, {32, 32},
+    {33, 70}, {100, 37}, {257, 5}};
+  const Dtype pad_value = static_cast<Dtype>(255);
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    for (int channels = 1; channels <= CHANNEL_NUM_MAX; channels++) {
+      for (int pitch_pad = 0; pitch_pad <= 5; pitch_pad += 5) {
+        int width = sizes[s][0];
+        int height = sizes[s][1];
+        int src_pitch = width * channels + pitch_pad;
+        int dst_pitch = height * channels + pitch_pad;
+        std::vector<Dtype> src(static_cast<size_t>(src_pitch) * height);
+        std::vector<Dtype> dst(static_cast<size_t>(dst_pitch) * width,
+          pad_value);
+        std::vector<Dtype> expected(dst.size(), pad_value);
+        FillRandom(src.data(), src.size());
+        for (int y = 0; y < height; y++) {
+          for (int x = 0; x < width; x++) {
+            for (int c = 0; c < channels; c++) {
+              expected[x * dst_pitch + y * channels + c] =
+                src[y * src_pitch + x * channels + c];
+            }
+          }
+        }
+        TransposeImage(src.data(), src_pitch, dst.data(), dst_pitch, width,
+          height, channels);
+        Check(dst == expected, std::string("transpose ") +
+          TypeName(Dtype()) + " " + std::to_string(width) + "x" +
+          std::to_string(height) + " c" + std::to_string(channels) +
+          " pad " + std::to_string(pitch_pad));
+      }
+    }
+  }
+}
+
+// A workspace reserved once serves the next calls, the second call
+// allocates nothing.
+template<typename Dtype>
+static void TestWorkspace() {
+  int width = 31;
+  int height = 19;
+  for (int engine = 0; engine < GetEngineNum(Dtype()); engine++) {
+    FilterSettings<Dtype> settings;
+    settings.radius = 3;
+    settings.channels = 3;
+    int channels = settings.channels;
+    size_t size = static_cast<size_t>(width) * height * channels;
+    std::vector<Dtype> src(size), dst(size), expected(size);
+    FillRandom(src.data(), size);
+    bool median = ENGINE_MEAN != engine;
+    ReferenceFilter(median, src.data(), width * channels, expected.data(),
+      width, height, channels, settings.radius, settings.border,
+      settings.border_value, settings.gate);
+    FilterWorkspace workspace;
+    size_t bytes = 0;
+    bool ok = true;
+    for (int call = 0; call < 2; call++) {
+      ok = ok && RunEngine(engine, settings, src.data(), width * channels,
+        dst.data(), width * channels, width, height,
+        ImageRect(0, 0, width, height), &workspace) &&
+        IsSame(dst.data(), width * channels, expected.data(),
+        width * channels, width * channels, height,
+        IsExact(median, Dtype()));
+      int allocations = workspace.TakeAllocations(&bytes);
+      ok = ok && (0 == call ? 1 == allocations : 0 == allocations);
+    }
+    Check(ok, GetCaseName("workspace", engine, settings));
+  }
+}
+
+/**
+* The stats of a call without a workspace and of two calls with one. The
+* filters count the workspace blocks on a mark of their own, the owner still
+* takes them with TakeAllocations. Without IMAGE_FILTER_STATS the stats are
+* left cleared.
+*/
+template<typename Dtype>
+static void TestStats() {
+  int width = 23;
+  int height = 17;
+  long long enabled = IsFilterStatsEnabled() ? 1 : 0;
+  for (int engine = 0; engine < GetEngineNum(Dtype()); engine++) {
+    FilterStats stats;
+    ClearFilterStats(&stats);
+    FilterSettings<Dtype> settings;
+    settings.radius = 2;
+    settings.stats = &stats;
+    size_t size = static_cast<size_t>(width) * height;
+    std::vector<Dtype> src(size), dst(size), expected(size);
+    FillRandom(src.data(), size);
+    bool median = ENGINE_MEAN != engine;
+    ReferenceFilter(median, src.data(), width, expected.data(), width,
+      height, 1, settings.radius, settings.border, settings.border_value,
+      settings.gate);
+    ImageRect roi(0, 0, width, height);
+    bool ok = RunEngine(engine, settings, src.data(), width, dst.data(),
+      width, width, height, roi) && IsSame(dst.data(), width,
+      expected.data(), width, width, height, IsExact(median, Dtype())) &&
+      enabled * width * height == stats.pixels &&
+      enabled == stats.allocations;
+    FilterWorkspace workspace;
+    for (int call = 0; call < 2; call++) {
+      ok = ok && RunEngine(engine, settings, src.data(), width, dst.data(),
+        width, width, height, roi, &workspace) && IsSame(dst.data(), width,
+        expected.data(), width, width, height, IsExact(median, Dtype()));
+      size_t bytes = 0;
+      int allocations = workspace.TakeAllocations(&bytes);
+      ok = ok && (0 == call ? 1 : 0) == allocations &&
+        enabled * allocations == stats.allocations &&
+        static_cast<long long>(enabled * bytes) == stats.allocated_bytes;
+    }
+    Check(ok, GetCaseName("stats", engine, settings));
+  }
+}
+
+// Every buffer of the arena starts on a cache line, with huge pages or
+// without pre-faulting too.
+static void TestArena() {
+  const char* names[] = {"default", "huge_page", "no_prefault"};
+  for (int mode = 0; mode < 3; mode++) {
+    FilterWorkspace workspace;
+    workspace.set_huge_page(1 == mode);
+    workspace.set_prefault(2 != mode);
+    size_t size = 1 == mode ? HUGE_PAGE_SIZE + 100 : 1000;
+    bool ok = workspace.Reserve(size) && size <= workspace.capacity();
+    for (int k = 1; k <= 4 && ok; k++) {
+      char* buffer = workspace.Acquire<char>(k * 3);
+      ok = 0 == reinterpret_cast<size_t>(buffer) % CACHE_LINE_SIZE;
+    }
+    Check(ok, std::string("arena ") + names[mode]);
+  }
+}
+
+// Push the rows of an image into a stream and collect the output rows.
+template<typename Stream, typename Dtype>
+static bool RunRowStream(Stream* stream, const Dtype* host_src,
+  Dtype* host_dst, int width, int height) {
+  if (!stream->ok()) {
+    return false;
+  }
+  int rows_out = 0;
+  for (int i = 0; i < height; i++) {
+    if (stream->PushRow(host_src + i * width,
+      host_dst + rows_out * width)) {
+      rows_out++;
+    }
+  }
+  while (rows_out < height && stream->Flush(host_dst + rows_out * width)) {
+    rows_out++;
+  }
+  return height == rows_out && !stream->Flush(host_dst);
+}
+
+template<typename Stream, typename Dtype>
+static bool CheckRowStream(Stream* stream, bool median, BorderType border,
+  Dtype border_value, int radius, int width, int height) {
+  size_t size = static_cast<size_t>(width) * height;
+  std::vector<Dtype> src(size), dst(size), expected(size);
+  FillRandom(src.data(), size);
+  ReferenceFilter(median, src.data(), width, expected.data(), width, height,
+    1, radius, border, border_value, 0.5f);
+  stream->set_border(border, border_value);
+  return RunRowStream(stream, src.data(), dst.data(), width, height) &&
+    IsSame(dst.data(), width, expected.data(), width, width, height,
+    IsExact(median, Dtype()));
+}
+
+static void TestUcharRowStream(int radius, int b, int width, int height) {
+  UcharMedianRowStream stream(radius, width);
+  Check(CheckRowStream(&stream, true, kBorders[b],
+    static_cast<unsigned char>(77), radius, width, height),
+    std::string("row_stream uchar uchar_median r") +
+    std::to_string(radius) + " " + kBorderNames[b]);
+}
+
+// Row streams, the second image of a stream after Reset too.
+template<typename Dtype>
+static void TestRowStreams() {
+  int width = 21;
+  int height = 15;
+  for (int b = 0; b < 3; b++) {
+    for (int radius = 1; radius <= 3; radius++) {
+      std::string name = std::string(TypeName(Dtype())) + " r" +
+        std::to_string(radius) + " " + kBorderNames[b];
+      Dtype border_value = static_cast<Dtype>(77);
+      MeanRowStream<Dtype> mean_stream(radius, width);
+      Check(CheckRowStream(&mean_stream, false, kBorders[b], border_value,
+        radius, width, height), "row_stream " + name + " mean");
+      MedianRowStream<Dtype> median_stream(radius, width);
+      Check(CheckRowStream(&median_stream, true, kBorders[b], border_value,
+        radius, width, height), "row_stream " + name + " median");
+      median_stream.Reset();
+      Check(CheckRowStream(&median_stream, true, kBorders[b], border_value,
+        radius, width, height), "row_stream " + name + " median reset");
+    }
+  }
+}
+
+// Push the columns of a row-major image, every column is copied out.
+template<typename Stream, typename Dtype>
+static bool CheckColumnStream(Stream* stream, BorderType border,
+  Dtype border_value, int radius, int width, int height) {
+  if (!stream->ok()) {
+    return false;
+  }
+  size_t size = static_cast<size_t>(width) * height;
+  std::vector<Dtype> src(size), dst(size), expected(size);
+  std::vector<Dtype> column(height), column_out(height);
+  FillRandom(src.data(), size);
+  ReferenceFilter(true, src.data(), width, expected.data(), width, height,
+    1, radius, border, border_value, 0.5f);
+  stream->set_border(border, border_value);
+  int columns_out = 0;
+  for (int x = 0; x <= width + radius; x++) {
+    bool out;
+    if (x < width) {
+      for (int y = 0; y < height; y++) {
+        column[y] = src[y * width + x];
+      }
+      out = stream->PushColumn(column.data(), column_out.data());
+    } else {
+      out = stream->Flush(column_out.data());
+    }
+    if (out) {
+      for (int y = 0; y < height; y++) {
+        dst[y * width + columns_out] = column_out[y];
+      }
+      columns_out++;
+    }
+  }
+  return width == columns_out &&
+    IsSame(dst.data(), width, expected.data(), width, width, height, true);
+}
+
+static void TestUcharColumnStream(int radius, int b) {
+  UcharMedianColumnStream stream(radius, 12);
+  Check(CheckColumnStream(&stream, kBorders[b],
+    static_cast<unsigned char>(5), radius, 25, 12),
+    std::string("column_stream uchar uchar_median r") +
+    std::to_string(radius) + " " + kBorderNames[b]);
+}
+
+template<typename Dtype>
+static void TestColumnStreams() {
+  for (int b = 0; b < 3; b++) {
+    for (int radius = 1; radius <= 3; radius++) {
+      MedianColumnStream<Dtype> stream(radius, 12);
+      Check(CheckColumnStream(&stream, kBorders[b], static_cast<Dtype>(5),
+        radius, 25, 12), std::string("column_stream ") + TypeName(Dtype()) +
+        " median r" + std::to_string(radius) + " " + kBorderNames[b]);
+    }
+  }
+}
+
+// Push the slices of a volume into a stream and collect the output slices.
+template<typename Stream, typename Dtype>
+static bool RunSliceStream(Stream* stream, const Dtype* host_src,
+  Dtype* host_dst, int slice_size, int depth) {
+  if (!stream->ok()) {
+    return false;
+  }
+  stream->Reset();
+  int slices_out = 0;
+  for (int z = 0; z < depth; z++) {
+    if (stream->PushSlice(host_src + z * slice_size,
+      host_dst + slices_out * slice_size)) {
+      slices_out++;
+    }
+  }
+  while (slices_out < depth &&
+    stream->Flush(host_dst + slices_out * slice_size)) {
+    slices_out++;
+  }
+  return depth == slices_out;
+}
+
+// The cube filters of volumes, whole and slice by slice.
+template<typename Dtype>
+static void TestVolume() {
+  int width = 11;
+  int height = 9;
+  int depth = 8;
+  size_t size = static_cast<size_t>(width) * height * depth;
+  for (int b = 0; b < 3; b++) {
+    for (int radius = 1; radius <= 2; radius++) {
+      std::vector<Dtype> src(size), dst(size), expected(size);
+      FillRandom(src.data(), size);
+      Dtype border_value = static_cast<Dtype>(50);
+      ReferenceFilter3D(false, src.data(), expected.data(), width, height,
+        depth, radius, kBorders[b], border_value, 0.5f);
+      MeanSliceStream<Dtype> stream(radius, width, height);
+      stream.set_border(kBorders[b], border_value);
+      bool ok = stream.FilterVolume(src.data(), dst.data(), depth) &&
+        IsSame(dst.data(), 0, expected.data(), 0,
+        static_cast<int>(size), 1, IsExact(false, Dtype()));
+      std::fill(dst.begin(), dst.end(), Dtype());
+      ok = ok && RunSliceStream(&stream, src.data(), dst.data(),
+        width * height, depth) && IsSame(dst.data(), 0, expected.data(), 0,
+        static_cast<int>(size), 1, IsExact(false, Dtype()));
+      Check(ok, std::string("volume ") + TypeName(Dtype()) + " mean r" +
+        std::to_string(radius) + " " + kBorderNames[b]);
+    }
+  }
+}
+
+static void TestUcharVolume() {
+  int width = 11;
+  int height = 9;
+  int depth = 8;
+  size_t size = static_cast<size_t>(width) * height * depth;
+  for (int b = 0; b < 3; b++) {
+    for (int radius = 1; radius <= 2; radius++) {
+      std::vector<unsigned char> src(size), dst(size), expected(size);
+      FillRandom(src.data(), size);
+      ReferenceFilter3D(true, src.data(), expected.data(), width, height,
+        depth, radius, kBorders[b], static_cast<unsigned char>(50), 0.5f);
+      UcharMedianSliceStream stream(radius, width, height);
+      stream.set_border(kBorders[b], 50);
+      bool ok = stream.FilterVolume(src.data(), dst.data(), depth) &&
+        IsSame(dst.data(), 0, expected.data(), 0,
+        static_cast<int>(size), 1, true);
+      std::fill(dst.begin(), dst.end(), 0);
+      ok = ok && RunSliceStream(&stream, src.data(), dst.data(),
+        width * height, depth) && IsSame(dst.data(), 0, expected.data(), 0,
+        static_cast<int>(size), 1, true);
+      Check(ok, std::string("volume uchar uchar_median r") +
+        std::to_string(radius) + " " + kBorderNames[b]);
+    }
+  }
+}
+
+// Frames pushed one by one, the window is the last frame_num frames, or
+// the frames pushed so far.
+template<typename Dtype>
+static void TestTemporalMean() {
+  int size = 37;
+  int frame_num = 4;
+  int frames = 11;
+  std::vector<Dtype> src(static_cast<size_t>(size) * frames), dst(size);
+  FillRandom(src.data(), src.size());
+  TemporalMeanFilter<Dtype> filter(frame_num, size, 1);
+  bool ok = filter.ok();
+  for (int f = 0; f < frames && ok; f++) {
+    ok = filter.PushFrame(src.data() + f * size, dst.data());
+    int first = f - frame_num + 1 > 0 ? f - frame_num + 1 : 0;
+    for (int k = 0; k < size && ok; k++) {
+      std::vector<Dtype> values;
+      for (int g = first; g <= f; g++) {
+        values.push_back(src[g * size + k]);
+      }
+      ok = IsNear(dst[k], Reduce(false, &values, 0.5f),
+        IsExact(false, Dtype()));
+    }
+  }
+  Check(ok, std::string("temporal ") + TypeName(Dtype()) + " mean");
+}
+
+static void TestTemporalMedian(float gate) {
+  int size = 37;
+  int frame_num = 5;
+  int frames = 13;
+  std::vector<unsigned char> src(static_cast<size_t>(size) * frames);
+  std::vector<unsigned char> dst(size);
+  FillRandom(src.data(), src.size());
+  UcharTemporalMedianFilter filter(frame_num, size, 1);
+  filter.set_gate(gate);
+  bool ok = filter.ok();
+  for (int f = 0; f < frames && ok; f++) {
+    ok = filter.PushFrame(src.data() + f * size, dst.data());
+    int first = f - frame_num + 1 > 0 ? f - frame_num + 1 : 0;
+    for (int k = 0; k < size && ok; k++) {
+      std::vector<unsigned char> values;
+      for (int g = first; g <= f; g++) {
+        values.push_back(src[g * size + k]);
+      }
+      ok = dst[k] == GetMedian(&values, gate);
+    }
+  }
+  Check(ok, "temporal uchar median gate " + std::to_string(gate));
+}
+
+static bool RunBatchUcharMedian(FrameBatchFilter* batch,
+  const FilterSettings<unsigned char>& settings,
+  const unsigned char* const* srcs, unsigned char* const* dsts,
+  int frame_num, int width, int height) {
+  UcharMedianFilter filter;
+  Apply(settings, &filter);
+  return batch->FilterByHistogram(filter, srcs, dsts, frame_num, width,
+    height);
+}
+
+template<typename Dtype>
+static bool RunBatchUcharMedian(FrameBatchFilter*,
+  const FilterSettings<Dtype>&, const Dtype* const*, Dtype* const*, int,
+  int, int) {
+  return false;
+}
+
+// A batch of frames spread over the workers, more frames than workers.
+template<typename Dtype>
+static void TestFrameBatch() {
+  int width = 23;
+  int height = 14;
+  int frame_num = 9;
+  size_t size = static_cast<size_t>(width) * height;
+  FrameBatchFilter batch(3);
+  for (int engine = 0; engine < GetEngineNum(Dtype()); engine++) {
+    FilterSettings<Dtype> settings;
+    settings.radius = 2;
+    settings.border = BORDER_REPLICATE;
+    std::vector<Dtype> src(size * frame_num), dst(size * frame_num);
+    std::vector<Dtype> expected(size * frame_num);
+    std::vector<const Dtype*> srcs(frame_num);
+    std::vector<Dtype*> dsts(frame_num);
+    FillRandom(src.data(), src.size());
+    bool median = ENGINE_MEAN != engine;
+    for (int f = 0; f < frame_num; f++) {
+      srcs[f] = src.data() + f * size;
+      dsts[f] = dst.data() + f * size;
+      ReferenceFilter(median, srcs[f], width, expected.data() + f * size,
+        width, height, 1, settings.radius, settings.border, Dtype(), 0.5f);
+    }
+    bool ok;
+    if (ENGINE_MEAN == engine) {
+      MeanFilter<Dtype> filter;
+      Apply(settings, &filter);
+      ok = batch.Filter(filter, srcs.data(), dsts.data(), frame_num, width,
+        height);
+    } else if (ENGINE_UCHAR_MEDIAN == engine) {
+      ok = RunBatchUcharMedian(&batch, settings, srcs.data(), dsts.data(),
+        frame_num, width, height);
+    } else {
+      MedianFilter<Dtype> filter;
+      Apply(settings, &filter);
+      ok = ENGINE_MEDIAN_HISTOGRAM == engine ?
+        batch.FilterByHistogram(filter, srcs.data(), dsts.data(), frame_num,
+        width, height) :
+        batch.FilterByLocalSort(filter, srcs.data(), dsts.data(), frame_num,
+        width, height);
+    }
+    Check(ok && IsSame(dst.data(), 0, expected.data(), 0,
+      static_cast<int>(dst.size()), 1, IsExact(median, Dtype())),
+      GetCaseName("frame_batch", engine, settings));
+  }
+}
+
+// Patches of a batch, more patches than lanes, each one filtered as an
+// image of its own.
+template<typename Dtype>
+static void TestPatchBatch() {
+  int width = 7;
+  int height = 6;
+  int patch_num = PATCH_LANE_NUM + 9;
+  size_t size = static_cast<size_t>(width) * height;
+  for (int b = 0; b < 3; b++) {
+    for (int radius = 1; radius <= PATCH_RADIUS_MAX; radius++) {
+      for (int median = 0; median < 2; median++) {
+        std::vector<Dtype> src(size * patch_num), dst(size * patch_num);
+        std::vector<Dtype> expected(size * patch_num);
+        std::vector<Dtype> packed(size * patch_num);
+        std::vector<Dtype> packed_dst(size * patch_num);
+        std::vector<const Dtype*> srcs(patch_num);
+        std::vector<Dtype*> dsts(patch_num);
+        FillRandom(src.data(), src.size());
+        Dtype border_value = static_cast<Dtype>(3);
+        for (int p = 0; p < patch_num; p++) {
+          srcs[p] = src.data() + p * size;
+          dsts[p] = dst.data() + p * size;
+          ReferenceFilter(0 != median, srcs[p], width,
+            expected.data() + p * size, width, height, 1, radius,
+            kBorders[b], border_value, 0.5f);
+        }
+        PatchBatchFilter<Dtype> filter(radius);
+        filter.set_border(kBorders[b], border_value);
+        PackPatches(srcs.data(), patch_num, width, height, packed.data());
+        bool ok = 0 != median ?
+          filter.Median(packed.data(), packed_dst.data(), patch_num, width,
+          height) :
+          filter.Mean(packed.data(), packed_dst.data(), patch_num, width,
+          height);
+        UnpackPatches(packed_dst.data(), patch_num, width, height,
+          dsts.data());
+        Check(ok && IsSame(dst.data(), 0, expected.data(), 0,
+          static_cast<int>(dst.size()), 1, IsExact(0 != median, Dtype())),
+          std::string("patch_batch ") + TypeName(Dtype()) +
+          (median ? " median r" : " mean r") + std::to_string(radius) +
+          " " + kBorderNames[b]);
+      }
+    }
+  }
+}
+
+static bool WriteFile(const char* path, const void* data, size_t size) {
+  FILE* file = fopen(path, "wb");
+  if (nullptr == file) {
+    return false;
+  }
+  bool ok = size == fwrite(data, 1, size, file);
+  return 0 == fclose(file) && ok;
+}
+
+static bool ReadFile(const char* path, void* data, size_t size) {
+  FILE* file = fopen(path, "rb");
+  if (nullptr == file) {
+    return false;
+  }
+  bool ok = size == fread(data, 1, size, file);
+  fclose(file);
+  return ok;
+}
+
+static bool RunTiledUcharMedian(TiledFileFilter* tiled,
+  const FilterSettings<unsigned char>& settings, const char* src_path,
+  const char* dst_path, int width, int height) {
+  UcharMedianFilter filter;
+  Apply(settings, &filter);
+  return tiled->FilterByHistogram(filter, src_path, dst_path, width, height);
+}
+
+template<typename Dtype>
+static bool RunTiledUcharMedian(TiledFileFilter*,
+  const FilterSettings<Dtype>&, const char*, const char*, int, int) {
+  return false;
+}
+
+// Tiles of the files smaller than the image, the last ones cut.
+template<typename Dtype>
+static void TestTiledFile() {
+  const char* src_path = "image_filter_unit_test_src.raw";
+  const char* dst_path = "image_filter_unit_test_dst.raw";
+  int width = 45;
+  int height = 37;
+  TiledFileFilter tiled;
+  tiled.set_tile_size(16, 8);
+  for (int engine = 0; engine < GetEngineNum(Dtype()); engine++) {
+    FilterSettings<Dtype> settings;
+    settings.radius = 3;
+    settings.channels = 2;
+    settings.border = BORDER_CONSTANT;
+    settings.border_value = static_cast<Dtype>(11);
+    size_t size = static_cast<size_t>(width) * height * settings.channels;
+    std::vector<Dtype> src(size), dst(size), expected(size);
+    FillRandom(src.data(), size);
+    bool median = ENGINE_MEAN != engine;
+    ReferenceFilter(median, src.data(), width * settings.channels,
+      expected.data(), width, height, settings.channels, settings.radius,
+      settings.border, settings.border_value, settings.gate);
+    bool ok = WriteFile(src_path, src.data(), size * sizeof(Dtype));
+    if (ENGINE_MEAN == engine) {
+      MeanFilter<Dtype> filter;
+      Apply(settings, &filter);
+      ok = ok && tiled.Filter(filter, src_path, dst_path, width, height);
+    } else if (ENGINE_UCHAR_MEDIAN == engine) {
+      ok = ok && RunTiledUcharMedian(&tiled, settings, src_path, dst_path,
+        width, height);
+    } else {
+      MedianFilter<Dtype> filter;
+      Apply(settings, &filter);
+      ok = ok && (ENGINE_MEDIAN_HISTOGRAM == engine ?
+        tiled.FilterByHistogram(filter, src_path, dst_path, width, height) :
+        tiled.FilterByLocalSort(filter, src_path, dst_path, width, height));
+    }
+    ok = ok && ReadFile(dst_path, dst.data(), size * sizeof(Dtype));
+    Check(ok && IsSame(dst.data(), 0, expected.data(), 0,
+      static_cast<int>(size), 1, IsExact(median, Dtype())),
+      GetCaseName("tiled_file", engine, settings));
+    remove(src_path);
+    remove(dst_path);
+  }
+}
+
+// Frames loaded, filtered by the workers and stored, out of order.
+template<typename Dtype>
+static void TestPipeline() {
+  int width = 19;
+  int height = 12;
+  int frame_num = 10;
+  size_t size = static_cast<size_t>(width) * height;
+  std::vector<Dtype> src(size * frame_num), dst(size * frame_num);
+  std::vector<Dtype> expected(size * frame_num);
+  FillRandom(src.data(), src.size());
+  MedianFilter<Dtype> filter(2);
+  for (int f = 0; f < frame_num; f++) {
+    ReferenceFilter(true, src.data() + f * size, width,
+      expected.data() + f * size, width, height, 1, 2, BORDER_REFLECT_101,
+      Dtype(), 0.5f);
+  }
+  FramePipeline<Dtype> pipeline(size, 3, 2);
+  bool ok = pipeline.Start(
+    [&](int index, Dtype* host_src) {
+      std::copy(src.begin() + index * size, src.begin() + (index + 1) * size,
+        host_src);
+      return true;
+    },
+    [&](const Dtype* host_src, Dtype* host_dst, FilterWorkspace* workspace) {
+      return filter.FilterByHistogram(host_src, host_dst, width, height,
+        workspace);
+    },
+    [&](int index, const Dtype* host_dst) {
+      std::copy(host_dst, host_dst + size, dst.begin() + index * size);
+      return true;
+    }, filter.GetWorkspaceSize(width, height));
+  std::vector<std::future<bool> > done;
+  for (int f = 0; f < frame_num && ok; f++) {
+    done.push_back(pipeline.Submit(f));
+  }
+  for (size_t f = 0; f < done.size(); f++) {
+    ok = done[f].get() && ok;
+  }
+  pipeline.Finish();
+  Check(ok && IsSame(dst.data(), 0, expected.data(), 0,
+    static_cast<int>(dst.size()), 1, true),
+    std::string("pipeline ") + TypeName(Dtype()) + " median_histogram");
+}
+
+static void AddUcharMedian(FilterGraph<unsigned char>* graph,
+  const UcharMedianFilter* filter) {
+  graph->AddMedianByHistogram(filter);
+}
+
+template<typename Dtype>
+static void AddUcharMedian(FilterGraph<Dtype>*, const UcharMedianFilter*) {}
+
+/**
+* A mean, a median by histogram and a median by local sort chained tile by
+* tile, and the unsigned char median for unsigned char, against the
+* references run one after the other.
+*/
+template<typename Dtype>
+static void TestFilterGraph() {
+  int width = 37;
+  int height = 29;
+  int channels = 2;
+  size_t size = static_cast<size_t>(width) * height * channels;
+  for (int b = 0; b < 3; b++) {
+    for (int thread_num = 1; thread_num <= 3; thread_num += 2) {
+      std::vector<Dtype> src(size), dst(size), expected(size), temp(size);
+      FillRandom(src.data(), size);
+      Dtype border_value = static_cast<Dtype>(100);
+      MeanFilter<Dtype> mean(1);
+      MedianFilter<Dtype> histogram(2);
+      MedianFilter<Dtype> local_sort(1);
+      UcharMedianFilter uchar_median(2);
+      mean.set_channel_num(channels);
+      histogram.set_channel_num(channels);
+      local_sort.set_channel_num(channels);
+      uchar_median.set_channel_num(channels);
+      mean.set_border(kBorders[b], border_value);
+      histogram.set_border(kBorders[b], border_value);
+      local_sort.set_border(kBorders[b], border_value);
+      uchar_median.set_border(kBorders[b],
+        static_cast<unsigned char>(border_value));
+      FilterGraph<Dtype> graph;
+      graph.set_tile_size(8, 6);
+      graph.set_thread_num(thread_num);
+      graph.set_channel_num(channels);
+      graph.AddMean(&mean);
+      graph.AddMedianByHistogram(&histogram);
+      graph.AddMedianByLocalSort(&local_sort);
+      AddUcharMedian(&graph, &uchar_median);
+      ReferenceFilter(false, src.data(), width * channels, expected.data(),
+        width, height, channels, 1, kBorders[b], border_value, 0.5f);
+      ReferenceFilter(true, expected.data(), width * channels, temp.data(),
+        width, height, channels, 2, kBorders[b], border_value, 0.5f);
+      ReferenceFilter(true, temp.data(), width * channels, expected.data(),
+        width, height, channels, 1, kBorders[b], border_value, 0.5f);
+      if (4 == graph.stage_num()) {
+        temp = expected;
+        ReferenceFilter(true, temp.data(), width * channels,
+          expected.data(), width, height, channels, 2, kBorders[b],
+          border_value, 0.5f);
+      }
+      Check(graph.Filter(src.data(), dst.data(), width, height) &&
+        IsSame(dst.data(), 0, expected.data(), 0, static_cast<int>(size), 1,
+        IsExact(false, Dtype())), std::string("filter_graph ") +
+        TypeName(Dtype()) + " threads " + std::to_string(thread_num) + " " +
+        kBorderNames[b]);
+    }
+  }
+}
+
+// Pack a row of values of the bits of format, the inverse of UnpackRow.
+static void PackRow(const int* values, int width, PackedFormat format,
+  unsigned char* packed_row) {
+  size_t size = GetPackedRowSize(format, width);
+  std::fill(packed_row, packed_row + size, 0);
+  int bits = GetPackedBits(format);
+  for (int x = 0; x < width; x++) {
+    int v = values[x];
+    if (PACKED_10BIT_MIPI == format) {
+      unsigned char* group = packed_row + x / 4 * 5;
+      group[x % 4] = static_cast<unsigned char>(v >> 2);
+      group[4] |= static_cast<unsigned char>((v & 0x03) << (x % 4 * 2));
+    } else if (PACKED_12BIT_MIPI == format) {
+      unsigned char* group = packed_row + x / 2 * 3;
+      group[x % 2] = static_cast<unsigned char>(v >> 4);
+      group[2] |= static_cast<unsigned char>((v & 0x0F) << (x % 2 * 4));
+    } else {
+      for (int k = 0; k < bits; k++) {
+        size_t pos = static_cast<size_t>(x) * bits + k;
+        packed_row[pos / 8] |=
+          static_cast<unsigned char>(((v >> k) & 1) << (pos % 8));
+      }
+    }
+  }
+}
+
+// The value a packed value is unpacked to.
+static unsigned char GetUnpacked(int value, int bits, unsigned char) {
+  return static_cast<unsigned char>(value >> (bits - 8));
+}
+
+template<typename Dtype>
+static Dtype GetUnpacked(int value, int, Dtype) {
+  return static_cast<Dtype>(value);
+}
+
+template<typename Stream, typename Dtype>
+static bool CheckPackedStream(Stream* stream, bool median,
+  PackedFormat format, int radius, int width, int height, Dtype) {
+  if (!stream->ok()) {
+    return false;
+  }
+  int bits = GetPackedBits(format);
+  size_t size = static_cast<size_t>(width) * height;
+  std::vector<int> values(size);
+  std::vector<Dtype> unpacked(size), dst(size), expected(size);
+  std::vector<unsigned char> packed(GetPackedRowSize(format, width));
+  for (size_t k = 0; k < size; k++) {
+    values[k] = rand() % (1 << bits);
+    unpacked[k] = GetUnpacked(values[k], bits, Dtype());
+  }
+  ReferenceFilter(median, unpacked.data(), width, expected.data(), width,
+    height, 1, radius, BORDER_REFLECT_101, Dtype(), 0.5f);
+  int rows_out = 0;
+  for (int i = 0; i < height; i++) {
+    PackRow(values.data() + i * width, width, format, packed.data());
+    if (stream->PushPackedRow(packed.data(), format,
+      dst.data() + rows_out * width)) {
+      rows_out++;
+    }
+  }
+  while (stream->Flush(dst.data() + rows_out * width)) {
+    rows_out++;
+  }
+  return height == rows_out && IsSame(dst.data(), width, expected.data(),
+    width, width, height, IsExact(median, Dtype()));
+}
+
+static void TestUcharPackedStream(PackedFormat format, int width) {
+  UcharMedianRowStream stream(2, width);
+  Check(CheckPackedStream(&stream, true, format, 2, width, 9,
+    static_cast<unsigned char>(0)), "packed_row uchar uchar_median format " +
+    std::to_string(format) + " width " + std::to_string(width));
+}
+
+template<typename Dtype>
+static void TestUcharPackedStream(PackedFormat, int) {}
+
+// Packed rows of every format, the widths end with partial groups.
+template<typename Dtype>
+static void TestPackedRows() {
+  const PackedFormat formats[] = {PACKED_10BIT, PACKED_12BIT,
+    PACKED_10BIT_MIPI, PACKED_12BIT_MIPI};
+  const int widths[] = {16, 13, 15};
+  for (int f = 0; f < 4; f++) {
+    for (int w = 0; w < 3; w++) {
+      std::string name = std::string(TypeName(Dtype())) + " format " +
+        std::to_string(formats[f]) + " width " + std::to_string(widths[w]);
+      MeanRowStream<Dtype> mean_stream(2, widths[w]);
+      Check(CheckPackedStream(&mean_stream, false, formats[f], 2, widths[w],
+        9, Dtype()), "packed_row " + name + " mean");
+      MedianRowStream<Dtype> median_stream(2, widths[w]);
+      Check(CheckPackedStream(&median_stream, true, formats[f], 2, widths[w],
+        9, Dtype()), "packed_row " + name + " median");
+      TestUcharPackedStream<Dtype>(formats[f], widths[w]);
+    }
+  }
+  for (int f = 0; f < 4; f++) {
+    TestUcharPackedStream(formats[f], 13);
+  }
+}
+
+// The whole text of a file, empty if it can not be read.
+static std::string ReadTextFile(const char* path) {
+  FILE* file = fopen(path, "rb");
+  std::string text;
+  if (nullptr == file) {
+    return text;
+  }
+  char buffer[256];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    text.append(buffer, size);
+  }
+  fclose(file);
+  return text;
+}
+
+// Lines of a tuning cache for the current cpu target, coefficients of the
+// histogram and of the local sort, the unsigned char histogram is slow.
+static std::string GetTuneCacheLines(const char* type,
+  const char* histogram, const char* local_sort) {
+  std::string prefix = std::string(GetCpuTargetName(GetCpuTarget())) + " " +
+    type;
+  return prefix + " uchar_histogram 1000000 0 0\n" +
+    prefix + " histogram " + histogram + "\n" +
+    prefix + " local_sort " + local_sort + "\n";
+}
+
+// The engine of the tests running a method of a plan.
+static int GetPlanEngine(MedianEngine engine) {
+  switch (engine) {
+  case MEDIAN_ENGINE_UCHAR_HISTOGRAM: return ENGINE_UCHAR_MEDIAN;
+  case MEDIAN_ENGINE_HISTOGRAM: return ENGINE_MEDIAN_HISTOGRAM;
+  default: return ENGINE_MEDIAN_LOCAL_SORT;
+  }
+}
+
+/**
+* AutoMedianFilter against the method of its plan run on the whole image,
+* on the plans of a cache of made-up coefficients: the local sort on the
+* whole image, and the histogram, whose cost grows with the distinct values
+* of its context, which float and double run on tiles.
+*/
+template<typename Dtype>
+static void TestAutoMedianFilter() {
+  const char* path = "image_filter_unit_test_tune.txt";
+  int width = 150;
+  int height = 130;
+  size_t size = static_cast<size_t>(width) * height;
+  for (int tiled = 0; tiled < 2; tiled++) {
+    FilterSettings<Dtype> settings;
+    settings.radius = 2;
+    std::vector<Dtype> src(size), dst(size), expected(size);
+    FillRandom(src.data(), size);
+    std::string lines = tiled ?
+      GetTuneCacheLines(TypeName(Dtype()), "0 0 1", "1000000 0 0") :
+      GetTuneCacheLines(TypeName(Dtype()), "1000000 0 0", "1 0 0");
+    MedianAutoTuner tuner;
+    tuner.set_cache_path(path);
+    AutoMedianFilter<Dtype> filter(settings.radius);
+    filter.set_tuner(&tuner);
+    bool ok = WriteFile(path, lines.data(), lines.size());
+    MedianPlan plan = filter.GetPlan(width, height);
+    ok = ok && (tiled ? MEDIAN_ENGINE_HISTOGRAM : MEDIAN_ENGINE_LOCAL_SORT) ==
+      plan.engine;
+    // The distinct values of unsigned char are too few to cut the image.
+    ok = ok && (tiled && 1 != sizeof(Dtype) ? 0 != plan.tile_size :
+      !tiled ? 0 == plan.tile_size : true);
+    ok = ok && RunEngine(GetPlanEngine(plan.engine), settings, src.data(),
+      width, expected.data(), width, width, height,
+      ImageRect(0, 0, width, height));
+    ok = ok && filter.Filter(src.data(), dst.data(), width, height) &&
+      dst == expected;
+    Check(ok, std::string("auto_median ") + TypeName(Dtype()) +
+      (tiled ? " tiles" : " whole"));
+    remove(path);
+  }
+}
+
+/**
+* The unsigned char coefficients calibrated and saved, then loaded by a
+* plan after Clear without calibrating again, which would rewrite the file.
+* A cache of made-up coefficients gives their plan, and a plan for another
+* cpu target calibrates again and adds the lines of that target.
+*/
+static void TestTuneCache() {
+  const char* path = "image_filter_unit_test_tune.txt";
+  int width = 640;
+  int height = 480;
+  remove(path);
+  MedianAutoTuner tuner;
+  tuner.set_cache_path(path);
+  tuner.Calibrate<unsigned char>();
+  std::string saved = ReadTextFile(path);
+  MedianPlan plan = tuner.Plan<unsigned char>(width, height, 1, 3);
+  tuner.Clear();
+  MedianPlan loaded = tuner.Plan<unsigned char>(width, height, 1, 3);
+  Check(!saved.empty() && saved == ReadTextFile(path) &&
+    plan.engine == loaded.engine && plan.tile_size == loaded.tile_size &&
+    plan.thread_num == loaded.thread_num &&
+    fabs(plan.seconds - loaded.seconds) <= 1e-6 * plan.seconds,
+    "tune_cache round trip");
+  std::string lines = GetTuneCacheLines("uchar", "1000000 0 0", "1 0 0");
+  bool ok = WriteFile(path, lines.data(), lines.size());
+  tuner.Clear();
+  loaded = tuner.Plan<unsigned char>(width, height, 1, 3);
+  Check(ok && MEDIAN_ENGINE_LOCAL_SORT == loaded.engine &&
+    0 == loaded.tile_size &&
+    fabs(loaded.seconds - width * height * 1e-9) <= 1e-15,
+    "tune_cache made-up coefficients");
+  CpuTarget target = GetCpuTarget();
+  for (int t = 0; t < CPU_TARGET_NUM; t++) {
+    CpuTarget other = static_cast<CpuTarget>(t);
+    if (other == target || !SetCpuTarget(other)) {
+      continue;
+    }
+    tuner.Plan<unsigned char>(width, height, 1, 3);
+    std::string retuned = ReadTextFile(path);
+    Check(std::string::npos != retuned.find(lines) && std::string::npos !=
+      retuned.find(std::string(GetCpuTargetName(other)) + " uchar "),
+      std::string("tune_cache target ") + GetCpuTargetName(other));
+    SetCpuTarget(target);
+    break;
+  }
+  remove(path);
+}
+
+static void PutLittleEndian(unsigned int value, int bytes,
+  unsigned char* data) {
+  for (int k = 0; k < bytes; k++) {
+    data[k] = static_cast<unsigned char>(value >> (8 * k));
+  }
+}
+
+/**
+* A BMP of 8 bits with a gray palette or of 24 bits, rows of width *
+* channels values from the top one, padded to 4 bytes and stored
+* bottom-up unless top_down. height is written as it is.
+*/
+static std::vector<unsigned char> MakeBmp(const unsigned char* rows,
+  int width, int height, int channels, bool top_down) {
+  int pitch = (width * channels + 3) / 4 * 4;
+  int palette = 1 == channels ? 256 * 4 : 0;
+  int offset = 14 + 40 + palette;
+  int row_num = height < 0 ? -height : height;
+  std::vector<unsigned char> file(offset + pitch * row_num, 0xCD);
+  file[0] = 'B';
+  file[1] = 'M';
+  PutLittleEndian(static_cast<unsigned int>(file.size()), 4, &file[2]);
+  PutLittleEndian(0, 4, &file[6]);
+  PutLittleEndian(offset, 4, &file[10]);
+  std::fill(file.begin() + 14, file.begin() + offset, 0);
+  PutLittleEndian(40, 4, &file[14]);
+  PutLittleEndian(width, 4, &file[18]);
+  PutLittleEndian(static_cast<unsigned int>(top_down ? -height : height), 4,
+    &file[22]);
+  PutLittleEndian(1, 2, &file[26]);
+  PutLittleEndian(channels * 8, 2, &file[28]);
+  for (int c = 0; c < palette / 4; c++) {
+    std::fill(file.begin() + 54 + c * 4, file.begin() + 54 + c * 4 + 3,
+      static_cast<unsigned char>(c));
+  }
+  for (int i = 0; i < row_num; i++) {
+    int row = top_down ? i : row_num - 1 - i;
+    std::copy(rows + row * width * channels,
+      rows + (row + 1) * width * channels, &file[offset + i * pitch]);
+  }
+  return file;
+}
+
+static bool WriteFile(const char* path,
+  const std::vector<unsigned char>& data) {
+  return WriteFile(path, data.data(), data.size());
+}
+
+// The rows of image in file order, from the top one unless bottom_up.
+static bool IsFileOrder(const MappedImage& image, const unsigned char* rows,
+  bool bottom_up) {
+  int row_size = image.width() * image.channels();
+  for (int i = 0; i < image.height(); i++) {
+    int row = bottom_up ? image.height() - 1 - i : i;
+    if (!std::equal(rows + row * row_size, rows + (row + 1) * row_size,
+      image.pixels<unsigned char>() + i * image.pitch())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+* Filter a mapped image in place into a file made by CreateLike, close it
+* and map it again: its layout is the one of the source and its pixels the
+* reference filter of the rows in file order.
+*/
+static bool CheckCreateLike(bool bmp, const char* src_path,
+  const char* dst_path) {
+  MappedImage src;
+  MappedImage dst;
+  bool opened = bmp ? src.OpenBmp(src_path) : src.OpenPgm(src_path);
+  if (!opened || !dst.CreateLike(dst_path, src)) {
+    return false;
+  }
+  int width = src.width();
+  int height = src.height();
+  int channels = src.channels();
+  std::vector<unsigned char> expected(
+    static_cast<size_t>(src.pitch()) * height);
+  ReferenceFilter(true, src.pixels<unsigned char>(), src.pitch(),
+    expected.data(), width, height, channels, 2, BORDER_REFLECT_101,
+    static_cast<unsigned char>(0), 0.5f);
+  UcharMedianFilter filter(2);
+  filter.set_channel_num(channels);
+  if (!filter.FilterByHistogram(src.pixels<unsigned char>(), src.pitch(),
+    dst.mutable_pixels<unsigned char>(), dst.pitch(), width, height,
+    ImageRect(0, 0, width, height))) {
+    return false;
+  }
+  dst.Close();
+  MappedImage result;
+  opened = bmp ? result.OpenBmp(dst_path) : result.OpenPgm(dst_path);
+  return opened && src.format() == result.format() &&
+    width == result.width() && height == result.height() &&
+    channels == result.channels() && src.pitch() == result.pitch() &&
+    src.bottom_up() == result.bottom_up() &&
+    src.max_value() == result.max_value() &&
+    IsSame(result.pixels<unsigned char>(), result.pitch(), expected.data(),
+    width * channels, width * channels, height, true);
+}
+
+/**
+* PGM headers with comments and whitespace, BMP of 8 and 24 bits stored
+* bottom-up or top-down with padded rows, the files refused, and images
+* filtered in place into files made by CreateLike.
+*/
+static void TestMappedImage() {
+  const char* src_path = "image_filter_unit_test_src.bmp";
+  const char* pgm_path = "image_filter_unit_test_src.pgm";
+  const char* dst_path = "image_filter_unit_test_dst";
+  MappedImage image;
+  std::vector<unsigned char> pixels(7 * 5 * 3);
+  FillRandom(pixels.data(), pixels.size());
+  std::string header = "P5\n# made by\n#  a test\n 7\t# width\n\n5\r\n255 ";
+  std::vector<unsigned char> pgm(header.begin(), header.end());
+  pgm.insert(pgm.end(), pixels.begin(), pixels.begin() + 35);
+  Check(WriteFile(pgm_path, pgm) && image.OpenPgm(pgm_path) &&
+    IMAGE_FILE_PGM == image.format() && 7 == image.width() &&
+    5 == image.height() && 1 == image.channels() && 7 == image.pitch() &&
+    255 == image.max_value() && IsFileOrder(image, pixels.data(), false),
+    "mapped_image pgm comments");
+  const char* refused_pgms[] = {"P5\n7 5\n65535\n", "P5\n7 5\n0\n",
+    "P5\n7 5 255", "P2\n7 5\n255\n", "P5\n7 # 5\n255\n"};
+  for (int k = 0; k < 5; k++) {
+    std::vector<unsigned char> file(refused_pgms[k],
+      refused_pgms[k] + strlen(refused_pgms[k]));
+    file.resize(file.size() + 70, 0);
+    Check(WriteFile(pgm_path, file) && !image.OpenPgm(pgm_path) &&
+      !image.is_open(), "mapped_image pgm refused " + std::to_string(k));
+  }
+  for (int channels = 1; channels <= 3; channels += 2) {
+    for (int top_down = 0; top_down < 2; top_down++) {
+      std::string name = "mapped_image bmp " + std::to_string(channels * 8) +
+        (top_down ? " top-down" : " bottom-up");
+      int pitch = (7 * channels + 3) / 4 * 4;
+      Check(WriteFile(src_path, MakeBmp(pixels.data(), 7, 5, channels,
+        0 != top_down)) && image.OpenBmp(src_path) &&
+        IMAGE_FILE_BMP == image.format() && 7 == image.width() &&
+        5 == image.height() && channels == image.channels() &&
+        pitch == image.pitch() && (0 == top_down) == image.bottom_up() &&
+        IsFileOrder(image, pixels.data(), 0 == top_down), name);
+    }
+  }
+  // Heights out of range, INT_MIN has no positive value.
+  const int heights[] = {0, INT_MIN, (1 << 30) + 1, -(1 << 30) - 1};
+  for (int k = 0; k < 4; k++) {
+    std::vector<unsigned char> file = MakeBmp(pixels.data(), 7, 5, 1, false);
+    PutLittleEndian(static_cast<unsigned int>(heights[k]), 4, &file[22]);
+    Check(WriteFile(src_path, file) && !image.OpenBmp(src_path),
+      "mapped_image bmp height " + std::to_string(heights[k]));
+  }
+  std::vector<unsigned char> colored = MakeBmp(pixels.data(), 7, 5, 1,
+    false);
+  colored[54 + 10 * 4] = 11;
+  Check(WriteFile(src_path, colored) && !image.OpenBmp(src_path),
+    "mapped_image bmp palette not gray");
+  image.Close();
+  std::vector<unsigned char> big(23 * 17 * 3);
+  FillRandom(big.data(), big.size());
+  for (int channels = 1; channels <= 3; channels += 2) {
+    for (int top_down = 0; top_down < 2; top_down++) {
+      Check(WriteFile(src_path, MakeBmp(big.data(), 23, 17, channels,
+        0 != top_down)) && CheckCreateLike(true, src_path, dst_path),
+        "mapped_image create_like bmp " + std::to_string(channels * 8) +
+        (top_down ? " top-down" : " bottom-up"));
+    }
+  }
+  header = "P5 23 17 200\n";
+  pgm.assign(header.begin(), header.end());
+  pgm.insert(pgm.end(), big.begin(), big.begin() + 23 * 17);
+  Check(WriteFile(pgm_path, pgm) && CheckCreateLike(false, pgm_path, dst_path),
+    "mapped_image create_like pgm");
+  remove(src_path);
+  remove(pgm_path);
+  remove(dst_path);
+}
+
+static void SkipJsonSpace(const std::string& text, size_t* pos) {
+  while (*pos < text.size() && isspace(static_cast<unsigned char>(
+    text[*pos]))) {
+    ++*pos;
+  }
+}
+
+// Parse a JSON value from pos, only its syntax is checked.
+static bool ParseJsonValue(const std::string& text, size_t* pos) {
+  SkipJsonSpace(text, pos);
+  if (*pos >= text.size()) {
+    return false;
+  }
+  char c = text[*pos];
+  if ('{' == c || '[' == c) {
+    char close = '{' == c ? '}' : ']';
+    ++*pos;
+    SkipJsonSpace(text, pos);
+    if (*pos < text.size() && close == text[*pos]) {
+      ++*pos;
+      return true;
+    }
+    while (true) {
+      if ('{' == c) {
+        SkipJsonSpace(text, pos);
+        if (*pos >= text.size() || '"' != text[*pos] ||
+          !ParseJsonValue(text, pos)) {
+          return false;
+        }
+        SkipJsonSpace(text, pos);
+        if (*pos >= text.size() || ':' != text[(*pos)++]) {
+          return false;
+        }
+      }
+      if (!ParseJsonValue(text, pos)) {
+        return false;
+      }
+      SkipJsonSpace(text, pos);
+      if (*pos >= text.size()) {
+        return false;
+      }
+      char next = text[(*pos)++];
+      if (close == next) {
+        return true;
+      }
+      if (',' != next) {
+        return false;
+      }
+    }
+  }
+  if ('"' == c) {
+    for (++*pos; *pos < text.size(); ++*pos) {
+      if ('\\' == text[*pos]) {
+        ++*pos;
+      } else if ('"' == text[*pos]) {
+        ++*pos;
+        return true;
+      } else if (static_cast<unsigned char>(text[*pos]) < 0x20) {
+        return false;
+      }
+    }
+    return false;
+  }
+  const char* literals[] = {"true", "false", "null"};
+  for (int k = 0; k < 3; k++) {
+    if (0 == text.compare(*pos, strlen(literals[k]), literals[k])) {
+      *pos += strlen(literals[k]);
+      return true;
+    }
+  }
+  const char* start = text.c_str() + *pos;
+  char* end = nullptr;
+  strtod(start, &end);
+  *pos += end - start;
+  return end != start;
+}
+
+// A whole JSON document.
+static bool IsJson(const std::string& text) {
+  size_t pos = 0;
+  if (!ParseJsonValue(text, &pos)) {
+    return false;
+  }
+  SkipJsonSpace(text, &pos);
+  return text.size() == pos;
+}
+
+// The number after key in line, -1 if there is none.
+static long long GetJsonNumber(const std::string& line, const char* key) {
+  size_t pos = line.find(std::string("\"") + key + "\": ");
+  return std::string::npos == pos ? -1 :
+    atoll(line.c_str() + pos + strlen(key) + 4);
+}
+
+/**
+* Leases of the rings: nested leases of a thread share one ring, a ring
+* given back is reused by the next thread, a thread recording while
+* another holds a ring gets a new one, and the spans past the capacity of
+* a ring are dropped, oldest first.
+*/
+static void TestTraceLeases() {
+  TraceRecorder recorder(4);
+  TraceBuffer* outer = recorder.AcquireThreadBuffer("outer");
+  TraceBuffer* inner = recorder.AcquireThreadBuffer("inner");
+  recorder.ReleaseThreadBuffer();
+  TraceBuffer* again = recorder.AcquireThreadBuffer(nullptr);
+  recorder.ReleaseThreadBuffer();
+  recorder.ReleaseThreadBuffer();
+  Check(outer == inner && outer == again &&
+    "outer, inner" == outer->thread_name(), "trace nested leases");
+  TraceBuffer* reused = nullptr;
+  std::thread worker([&]() {
+    reused = recorder.AcquireThreadBuffer("worker");
+    recorder.ReleaseThreadBuffer();
+  });
+  worker.join();
+  Check(outer == reused && "outer, inner, worker" == outer->thread_name(),
+    "trace released ring reused");
+  TraceBuffer* held = recorder.AcquireThreadBuffer(nullptr);
+  TraceBuffer* other = nullptr;
+  std::thread second([&]() {
+    other = recorder.AcquireThreadBuffer(nullptr);
+    recorder.ReleaseThreadBuffer();
+  });
+  second.join();
+  recorder.ReleaseThreadBuffer();
+  Check(outer == held && nullptr != other && outer != other &&
+    outer->tid() != other->tid(), "trace ring per thread at once");
+  TraceBuffer* buffer = recorder.AcquireThreadBuffer(nullptr);
+  for (int k = 0; k < 6; k++) {
+    buffer->Record("span", k, k + 1, k);
+  }
+  std::vector<TraceEvent> events = buffer->GetEvents();
+  recorder.ReleaseThreadBuffer();
+  bool ok = 2 == recorder.dropped() && 4 == events.size();
+  for (size_t k = 0; k < events.size() && ok; k++) {
+    ok = static_cast<long long>(k) + 2 == events[k].index;
+  }
+  recorder.Clear();
+  Check(ok && 0 == recorder.dropped(), "trace ring overflow");
+}
+
+/**
+* The Chrome trace of a filter graph on three threads: a valid JSON
+* document, one thread_name event per ring and a complete event with its
+* index for every tile.
+*/
+static void TestChromeTrace() {
+  const char* path = "image_filter_unit_test_trace.json";
+  int width = 37;
+  int height = 29;
+  size_t size = static_cast<size_t>(width) * height;
+  std::vector<float> src(size), dst(size);
+  FillRandom(src.data(), size);
+  MedianFilter<float> median(2);
+  FilterGraph<float> graph;
+  graph.set_tile_size(8, 6);
+  graph.set_thread_num(3);
+  graph.AddMedianByHistogram(&median);
+  TraceRecorder recorder;
+  SetTraceRecorder(&recorder);
+  bool ok = graph.Filter(src.data(), dst.data(), width, height);
+  SetTraceRecorder(nullptr);
+  ok = ok && recorder.WriteChromeTrace(path);
+  std::string text = ReadTextFile(path);
+  remove(path);
+  ok = ok && IsJson(text);
+  // Every event is on a line of its own.
+  int tile_num = ((width + 7) / 8) * ((height + 5) / 6);
+  std::vector<int> tiles(tile_num, 0);
+  std::set<long long> span_tids;
+  std::multiset<long long> name_tids;
+  size_t begin = 0;
+  while (ok && begin < text.size()) {
+    size_t end = text.find('\n', begin);
+    end = std::string::npos == end ? text.size() : end;
+    std::string line = text.substr(begin, end - begin);
+    begin = end + 1;
+    long long tid = GetJsonNumber(line, "tid");
+    if (std::string::npos != line.find("\"ph\": \"M\"")) {
+      ok = std::string::npos != line.find("\"name\": \"thread_name\"") &&
+        std::string::npos != line.find("filter graph");
+      name_tids.insert(tid);
+    } else if (std::string::npos != line.find("\"ph\": \"X\"")) {
+      span_tids.insert(tid);
+      long long index = GetJsonNumber(line, "index");
+      if (std::string::npos != line.find("\"name\": \"graph_tile\"")) {
+        ok = 0 <= index && index < tile_num;
+        tiles[ok ? index : 0]++;
+      }
+    }
+  }
+  for (int t = 0; t < tile_num && ok; t++) {
+    ok = 1 == tiles[t];
+  }
+  // A worker may lease a ring and find no tile left, so it is named but
+  // has no span.
+  ok = ok && !span_tids.empty() &&
+    std::set<long long>(name_tids.begin(), name_tids.end()).size() ==
+    name_tids.size();
+  for (std::set<long long>::iterator it = span_tids.begin();
+    it != span_tids.end() && ok; ++it) {
+    ok = 1 == name_tids.count(*it);
+  }
+  Check(ok, "trace chrome json");
+}
+
+template<typename Dtype>
+static void TestType() {
+  TestRowStreams<Dtype>();
+  TestBorders<Dtype>();
+  TestWorkspace<Dtype>();
+  TestStats<Dtype>();
+  TestRoi<Dtype>();
+  TestChannels<Dtype>();
+  TestColumnMajor<Dtype>();
+  TestTranspose<Dtype>();
+  TestVolume<Dtype>();
+  TestTemporalMean<Dtype>();
+  TestColumnStreams<Dtype>();
+  TestFrameBatch<Dtype>();
+  TestPatchBatch<Dtype>();
+  TestTiledFile<Dtype>();
+  TestPipeline<Dtype>();
+  TestFilterGraph<Dtype>();
+  TestPackedRows<Dtype>();
+  TestAutoMedianFilter<Dtype>();
+}
+
+// The checks running the filter kernels, for the current cpu target.
+static void TestEngines() {
+  TestThreads();
+  TestType<unsigned char>();
+  TestType<float>();
+  TestType<double>();
+  TestUcharVolume();
+  TestTemporalMedian(0.5f);
+  TestTemporalMedian(0.3f);
+  for (int b = 0; b < 3; b++) {
+    for (int radius = 1; radius <= 3; radius++) {
+      TestUcharColumnStream(radius, b);
+    }
+  }
+  for (int b = 0; b < 3; b++) {
+    for (int radius = 1; radius <= 3; radius++) {
+      TestUcharRowStream(radius, b, 21, 15);
+    }
+  }
+}
+
+int main() {
+  srand(1);
+  TestArena();
+  // Every target the cpu supports, not only the one picked at startup.
+  CpuTarget target = GetCpuTarget();
+  for (int t = 0; t < CPU_TARGET_NUM; t++) {
+    CpuTarget current = static_cast<CpuTarget>(t);
+    if (!SetCpuTarget(current)) {
+      printf("skipped cpu target %s\n", GetCpuTargetName(current));
+      continue;
+    }
+    g_target_name = GetCpuTargetName(current);
+    TestEngines();
+  }
+  g_target_name = nullptr;
+  SetCpuTarget(target);
+  TestTuneCache();
+  TestMappedImage();
+  TestTraceLeases();
+  TestChromeTrace();
+  printf("%d checks, %d failed\n", g_checks, g_failures);
+  return 0 == g_failures ? 0 : 1;
+}